@@ -0,0 +1,380 @@
+//! Compilation benchmarks for the DXC shim.
+//!
+//! Run with `cargo bench -p vislum-dxc`. `libdxcompiler.so` must be loadable.
+//!
+//! The results are written as JSON to the file named by `VISLUM_DXC_BENCH_OUTPUT`, or to
+//! stdout if it is not set, and a human-readable summary is printed to stderr.
+//! `VISLUM_DXC_BENCH_ITERATIONS` overrides the number of iterations of the latency benchmarks.
+
+use std::{
+    collections::HashMap,
+    fmt::Write as _,
+    sync::Arc,
+    time::{Duration, Instant},
+};
+
+use vislum_dxc::{
+    DxcCache, DxcCompileJob, DxcCompileOptions, DxcCompiler, DxcCompilerPool,
+    DxcCompilerPoolCreateInfo, DxcDefine, DxcIncludeCache, DxcIncludeHandler, DxcIncludeSource,
+    DxcLoader,
+};
+
+const QUAD_VERT: &str = include_str!("../../vislum-test/shaders/quad.vert.hlsl");
+const QUAD_FRAG: &str = include_str!("../../vislum-test/shaders/quad.frag.hlsl");
+const COMMON: &str = include_str!("../../vislum-test/shaders/common.hlsl");
+const BINDLESS: &str = include_str!("../../assets/shaders/bindless.hlsl");
+
+/// The number of generated headers included by the include-heavy shader.
+const GENERATED_HEADER_COUNT: usize = 64;
+
+/// The thread counts the batch benchmark is run with. 0 uses one thread per core.
+const BATCH_THREAD_COUNTS: &[usize] = &[1, 2, 4, 8, 0];
+
+const DEFAULT_ITERATIONS: usize = 50;
+
+/// Serves includes from memory, so the benchmarks do not measure file system access.
+struct MemoryIncludeHandler {
+    files: HashMap<String, Arc<[u8]>>,
+}
+
+impl MemoryIncludeHandler {
+    fn new() -> Self {
+        let mut files = HashMap::new();
+        files.insert("common.hlsl".to_string(), Arc::from(COMMON.as_bytes()));
+        files.insert("bindless.hlsl".to_string(), Arc::from(BINDLESS.as_bytes()));
+
+        for i in 0..GENERATED_HEADER_COUNT {
+            files.insert(
+                format!("generated/lib_{i}.hlsl"),
+                Arc::from(generated_header(i).into_bytes()),
+            );
+        }
+
+        Self { files }
+    }
+}
+
+impl DxcIncludeHandler for MemoryIncludeHandler {
+    fn load_source(&self, filename: &str) -> Option<DxcIncludeSource> {
+        let filename = filename.trim_start_matches("./");
+        self.files
+            .get(filename)
+            .cloned()
+            .map(DxcIncludeSource::from)
+    }
+}
+
+fn generated_header(index: usize) -> String {
+    format!(
+        "#ifndef LIB_{index}_HLSL\n\
+         #define LIB_{index}_HLSL\n\
+         \n\
+         float3 Lib{index}(float3 x) {{\n\
+         \x20   float3 y = x * {scale}.0 + float3({index}.0, 0.5, 0.25);\n\
+         \x20   y = HsvToRgb(frac(y));\n\
+         \x20   return lerp(x, y, 0.{index});\n\
+         }}\n\
+         \n\
+         #endif\n",
+        scale = index + 1,
+    )
+}
+
+/// A pixel shader including the common headers and every generated header.
+fn include_heavy_source() -> String {
+    let mut source = String::from("#include \"common.hlsl\"\n#include \"bindless.hlsl\"\n");
+    for i in 0..GENERATED_HEADER_COUNT {
+        writeln!(source, "#include \"generated/lib_{i}.hlsl\"").unwrap();
+    }
+
+    source.push_str("\nfloat4 main(VertexOutput input) : SV_Target {\n");
+    source.push_str("    float3 color = input.color;\n");
+    for i in 0..GENERATED_HEADER_COUNT {
+        writeln!(source, "    color = Lib{i}(color);").unwrap();
+    }
+    source.push_str("    return float4(color, 1.0) * SampleBindlessTexture(0, 0, color.xy);\n}\n");
+    source
+}
+
+/// A pixel shader with several define axes, expanded into every permutation.
+const PERMUTATION_SOURCE: &str = r#"#include "common.hlsl"
+#include "bindless.hlsl"
+
+struct Light {
+    float3 direction;
+    float3 color;
+};
+
+[[vk::binding(0, 0)]]
+StructuredBuffer<Light> lights;
+
+float4 main(VertexOutput input) : SV_Target {
+    float3 normal = normalize(input.color * 2.0 - 1.0);
+    float3 color = 0.0;
+
+    [unroll]
+    for (uint i = 0; i < LIGHT_COUNT; i++) {
+        float ndotl = saturate(dot(normal, -lights[i].direction));
+#if QUALITY >= 1
+        ndotl = ndotl * ndotl * (3.0 - 2.0 * ndotl);
+#endif
+#if QUALITY >= 2
+        color += HsvToRgb(float3(frac(ndotl), 0.5, 1.0)) * 0.1;
+#endif
+#if USE_SHADOWS
+        ndotl *= LoadBindlessTexture(i, int2(input.position.xy)).r;
+#endif
+        color += lights[i].color * ndotl;
+    }
+
+#if USE_TEXTURE
+    color *= SampleBindlessTexture(0, 0, input.position.xy).rgb;
+#endif
+
+    return float4(color, 1.0);
+}
+"#;
+
+/// The define values of a single permutation of [`PERMUTATION_SOURCE`].
+struct Permutation {
+    values: [(&'static str, String); 4],
+}
+
+fn permutations() -> Vec<Permutation> {
+    let mut permutations = Vec::new();
+    for use_texture in 0..2 {
+        for light_count in [1, 2, 4, 8] {
+            for quality in 0..3 {
+                for use_shadows in 0..2 {
+                    permutations.push(Permutation {
+                        values: [
+                            ("USE_TEXTURE", use_texture.to_string()),
+                            ("LIGHT_COUNT", light_count.to_string()),
+                            ("QUALITY", quality.to_string()),
+                            ("USE_SHADOWS", use_shadows.to_string()),
+                        ],
+                    });
+                }
+            }
+        }
+    }
+    permutations
+}
+
+/// The latencies of a benchmark, in nanoseconds.
+struct Latencies {
+    min: u128,
+    median: u128,
+    mean: u128,
+    p95: u128,
+    max: u128,
+}
+
+impl Latencies {
+    fn new(mut samples: Vec<Duration>) -> Self {
+        samples.sort();
+        let nanos = |duration: &Duration| duration.as_nanos();
+        let percentile = |p: usize| nanos(&samples[(samples.len() - 1) * p / 100]);
+
+        Self {
+            min: nanos(&samples[0]),
+            median: percentile(50),
+            mean: samples.iter().map(nanos).sum::<u128>() / samples.len() as u128,
+            p95: percentile(95),
+            max: nanos(&samples[samples.len() - 1]),
+        }
+    }
+}
+
+/// Collects the results of all benchmarks as a JSON document.
+struct Report {
+    entries: Vec<String>,
+}
+
+impl Report {
+    fn latency(&mut self, name: &str, iterations: usize, latencies: Latencies) {
+        eprintln!(
+            "{name}: median {:.3} ms, p95 {:.3} ms",
+            latencies.median as f64 / 1e6,
+            latencies.p95 as f64 / 1e6,
+        );
+
+        self.entries.push(format!(
+            "{{\"name\":\"{name}\",\"kind\":\"latency\",\"iterations\":{iterations},\
+             \"min_ns\":{},\"median_ns\":{},\"mean_ns\":{},\"p95_ns\":{},\"max_ns\":{}}}",
+            latencies.min, latencies.median, latencies.mean, latencies.p95, latencies.max,
+        ));
+    }
+
+    fn throughput(&mut self, name: &str, thread_count: usize, job_count: usize, elapsed: Duration) {
+        let jobs_per_second = job_count as f64 / elapsed.as_secs_f64();
+        eprintln!("{name} (threads: {thread_count}): {jobs_per_second:.1} jobs/s");
+
+        self.entries.push(format!(
+            "{{\"name\":\"{name}\",\"kind\":\"throughput\",\"thread_count\":{thread_count},\
+             \"job_count\":{job_count},\"elapsed_ns\":{},\"jobs_per_second\":{jobs_per_second:.3}}}",
+            elapsed.as_nanos(),
+        ));
+    }
+
+    fn to_json(&self) -> String {
+        let timestamp = std::time::SystemTime::now()
+            .duration_since(std::time::UNIX_EPOCH)
+            .map_or(0, |duration| duration.as_secs());
+
+        format!(
+            "{{\"timestamp\":{timestamp},\"benchmarks\":[\n  {}\n]}}\n",
+            self.entries.join(",\n  ")
+        )
+    }
+}
+
+fn measure(iterations: usize, mut f: impl FnMut()) -> Latencies {
+    // Warm up, so lazily initialized DXC state is not part of the first sample.
+    f();
+
+    let samples = (0..iterations)
+        .map(|_| {
+            let start = Instant::now();
+            f();
+            start.elapsed()
+        })
+        .collect();
+
+    Latencies::new(samples)
+}
+
+fn main() {
+    let iterations = std::env::var("VISLUM_DXC_BENCH_ITERATIONS")
+        .ok()
+        .and_then(|iterations| iterations.parse().ok())
+        .unwrap_or(DEFAULT_ITERATIONS);
+
+    let loader = match DxcLoader::new() {
+        Ok(loader) => loader,
+        Err(err) => {
+            eprintln!("skipping benchmarks: {err}");
+            return;
+        }
+    };
+
+    let include_handler = MemoryIncludeHandler::new();
+    let mut report = Report {
+        entries: Vec::new(),
+    };
+
+    let mut compiler = DxcCompiler::new(loader.clone()).unwrap();
+
+    // Single-compile latency of the test shaders.
+    let vert_options = DxcCompileOptions::new("main", "vs_6_5");
+    report.latency(
+        "single/quad.vert",
+        iterations,
+        measure(iterations, || {
+            compiler
+                .compile(QUAD_VERT, &vert_options, &include_handler)
+                .unwrap();
+        }),
+    );
+
+    let frag_options = DxcCompileOptions::new("main", "ps_6_5");
+    report.latency(
+        "single/quad.frag",
+        iterations,
+        measure(iterations, || {
+            compiler
+                .compile(QUAD_FRAG, &frag_options, &include_handler)
+                .unwrap();
+        }),
+    );
+
+    // Include-heavy compiles, with includes loaded through the handler every time and served
+    // from an include cache.
+    let include_heavy = include_heavy_source();
+    report.latency(
+        "include_heavy/uncached",
+        iterations,
+        measure(iterations, || {
+            compiler
+                .compile(&include_heavy, &frag_options, &include_handler)
+                .unwrap();
+        }),
+    );
+
+    compiler.set_include_cache(Some(DxcIncludeCache::new()));
+    report.latency(
+        "include_heavy/include_cache",
+        iterations,
+        measure(iterations, || {
+            compiler
+                .compile(&include_heavy, &frag_options, &include_handler)
+                .unwrap();
+        }),
+    );
+
+    // Cache-hit latency. The warm-up iteration populates the cache.
+    let cache_directory =
+        std::env::temp_dir().join(format!("vislum-dxc-bench-{}", std::process::id()));
+    compiler.set_cache(Some(DxcCache::open(&cache_directory).unwrap()));
+    report.latency(
+        "cache_hit/include_heavy",
+        iterations,
+        measure(iterations, || {
+            compiler
+                .compile(&include_heavy, &frag_options, &include_handler)
+                .unwrap();
+        }),
+    );
+    compiler.set_cache(None);
+
+    // Batch throughput of the permutation corpus across thread counts.
+    let permutations = permutations();
+    let defines: Vec<Vec<DxcDefine<'_>>> = permutations
+        .iter()
+        .map(|permutation| {
+            permutation
+                .values
+                .iter()
+                .map(|(name, value)| DxcDefine {
+                    name,
+                    value: Some(value),
+                })
+                .collect()
+        })
+        .collect();
+
+    let jobs: Vec<_> = defines
+        .iter()
+        .map(|defines| DxcCompileJob {
+            source: PERMUTATION_SOURCE,
+            options: DxcCompileOptions {
+                defines,
+                ..DxcCompileOptions::new("main", "ps_6_5")
+            },
+        })
+        .collect();
+
+    let pool = DxcCompilerPool::new(loader, DxcCompilerPoolCreateInfo::default()).unwrap();
+    for &thread_count in BATCH_THREAD_COUNTS {
+        // Warm up, so every compiler the batch needs has been created.
+        pool.compile_batch(&jobs, thread_count, &include_handler)
+            .unwrap();
+
+        let start = Instant::now();
+        let results = pool
+            .compile_batch(&jobs, thread_count, &include_handler)
+            .unwrap();
+        let elapsed = start.elapsed();
+
+        assert!(results.iter().all(|result| result.is_ok()));
+        report.throughput("batch/permutations", thread_count, jobs.len(), elapsed);
+    }
+
+    let _ = std::fs::remove_dir_all(&cache_directory);
+
+    let json = report.to_json();
+    match std::env::var_os("VISLUM_DXC_BENCH_OUTPUT") {
+        Some(path) => std::fs::write(path, json).unwrap(),
+        None => print!("{json}"),
+    }
+}
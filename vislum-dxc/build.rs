@@ -5,7 +5,7 @@ fn main() {
 
     cc::Build::new()
         .cpp(true)
-        .flag_if_supported("-std=c++11")
+        .flag_if_supported("-std=c++17")
         .file("cpp/shim.cpp")
         .compile("vislum-dxc-shim");
 }
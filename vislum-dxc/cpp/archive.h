@@ -0,0 +1,501 @@
+#pragma once
+
+#include "cache.h"
+#include "common.h"
+#include "dependency.h"
+#include "hash.h"
+#include "reflection.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+// The layout of a shader archive.
+//
+// An archive is a single file holding many compiled modules, found by a caller-chosen key such
+// as the hash of a permutation. The file starts with a header, followed by the entries sorted
+// by key, the tables they index into, and the bytecode. Every section is 8-byte aligned, so an
+// archive can be mapped and used in place.
+struct DxcShimArchiveHeader {
+  static const uint32_t Magic = 0x41584456; // "VDXA"
+  static const uint32_t Version = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  uint64_t entryCount;
+  uint64_t entriesOffset;
+  uint64_t bindingsOffset;
+  uint64_t bindingCount;
+  uint64_t inputsOffset;
+  uint64_t inputCount;
+  uint64_t dependenciesOffset;
+  uint64_t dependencyCount;
+
+  // NUL-terminated strings, referred to by their offset in the section.
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+};
+
+struct DxcShimArchiveEntry {
+  DxcShimHash key;
+  uint64_t bytecodeOffset;
+  uint64_t bytecodeSize;
+
+  // Whether the bytecode could be reflected. The reflection fields are zero otherwise.
+  uint32_t isReflected;
+  uint32_t stage;
+  uint32_t pushConstantSize;
+  uint32_t localSize[3];
+  uint32_t firstBinding;
+  uint32_t bindingCount;
+  uint32_t firstInput;
+  uint32_t inputCount;
+  uint32_t firstDependency;
+  uint32_t dependencyCount;
+};
+
+struct DxcShimArchiveBinding {
+  uint32_t set;
+  uint32_t binding;
+  uint32_t descriptorType;
+  uint32_t count;
+  uint32_t name;
+  uint32_t reserved;
+};
+
+struct DxcShimArchiveInput {
+  uint32_t location;
+  uint32_t componentType;
+  uint32_t componentCount;
+  uint32_t name;
+};
+
+struct DxcShimArchiveDependency {
+  DxcShimHash hash;
+  uint32_t filename;
+  uint32_t reserved;
+};
+
+// Orders archive keys, as the entries are sorted.
+inline bool isArchiveKeyLess(DxcShimHash const& a, DxcShimHash const& b) {
+  return a.high != b.high ? a.high < b.high : a.low < b.low;
+}
+
+// Aligns an offset in an archive to a section boundary.
+inline uint64_t alignArchiveOffset(uint64_t offset) {
+  return (offset + 7) & ~uint64_t(7);
+}
+
+// Builds a shader archive from compilation results.
+//
+// All methods are thread-safe, so results can be added from the threads compiling them.
+class DxcShimArchiveWriter {
+public:
+  // Adds a module with its reflection and dependencies. The bytecode is copied.
+  //
+  // Returns false if an entry with the same key was already added.
+  inline bool add(
+    DxcShimHash const& key,
+    const void* bytecode,
+    size_t bytecodeSize,
+    const DxcShimReflection* reflection,
+    std::vector<DxcShimResolvedInclude> const& dependencies) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_keys.insert(key).second) {
+      return false;
+    }
+
+    PendingEntry entry = {};
+    entry.key = key;
+    entry.bytecode.assign(static_cast<const uint8_t*>(bytecode), static_cast<const uint8_t*>(bytecode) + bytecodeSize);
+    if (reflection != nullptr) {
+      entry.isReflected = true;
+      entry.reflection = *reflection;
+
+      // The names are copied into the string table, so only the flat tables are kept.
+      for (size_t i = 0; i < reflection->bindingCount; i++) {
+        entry.bindings.push_back(reflection->bindings[i]);
+        entry.bindingNames.push_back(addString(reflection->bindings[i].name));
+      }
+      for (size_t i = 0; i < reflection->inputCount; i++) {
+        entry.inputs.push_back(reflection->inputs[i]);
+        entry.inputNames.push_back(addString(reflection->inputs[i].name));
+      }
+    }
+    for (DxcShimResolvedInclude const& dependency : dependencies) {
+      entry.dependencies.push_back(dependency.hash);
+      entry.dependencyNames.push_back(addString(dependency.filename.c_str()));
+    }
+
+    m_entries.push_back(std::move(entry));
+    return true;
+  }
+
+  // Writes the archive to a file, replacing it atomically. Returns false if it failed.
+  inline bool write(std::string const& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<PendingEntry const*> entries;
+    entries.reserve(m_entries.size());
+    for (PendingEntry const& entry : m_entries) {
+      entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](PendingEntry const* a, PendingEntry const* b) {
+      return isArchiveKeyLess(a->key, b->key);
+    });
+
+    std::vector<DxcShimArchiveEntry> flatEntries;
+    std::vector<DxcShimArchiveBinding> bindings;
+    std::vector<DxcShimArchiveInput> inputs;
+    std::vector<DxcShimArchiveDependency> dependencies;
+    flatEntries.reserve(entries.size());
+
+    for (PendingEntry const* entry : entries) {
+      DxcShimArchiveEntry flat = {};
+      flat.key = entry->key;
+      flat.bytecodeSize = entry->bytecode.size();
+      flat.isReflected = entry->isReflected;
+      flat.stage = static_cast<uint32_t>(entry->reflection.stage);
+      flat.pushConstantSize = entry->reflection.pushConstantSize;
+      std::memcpy(flat.localSize, entry->reflection.localSize, sizeof(flat.localSize));
+
+      flat.firstBinding = static_cast<uint32_t>(bindings.size());
+      flat.bindingCount = static_cast<uint32_t>(entry->bindings.size());
+      for (size_t i = 0; i < entry->bindings.size(); i++) {
+        DxcShimReflectionBinding const& binding = entry->bindings[i];
+        DxcShimArchiveBinding flatBinding = {};
+        flatBinding.set = binding.set;
+        flatBinding.binding = binding.binding;
+        flatBinding.descriptorType = static_cast<uint32_t>(binding.descriptorType);
+        flatBinding.count = binding.count;
+        flatBinding.name = entry->bindingNames[i];
+        bindings.push_back(flatBinding);
+      }
+
+      flat.firstInput = static_cast<uint32_t>(inputs.size());
+      flat.inputCount = static_cast<uint32_t>(entry->inputs.size());
+      for (size_t i = 0; i < entry->inputs.size(); i++) {
+        DxcShimReflectionInput const& input = entry->inputs[i];
+        DxcShimArchiveInput flatInput = {};
+        flatInput.location = input.location;
+        flatInput.componentType = static_cast<uint32_t>(input.componentType);
+        flatInput.componentCount = input.componentCount;
+        flatInput.name = entry->inputNames[i];
+        inputs.push_back(flatInput);
+      }
+
+      flat.firstDependency = static_cast<uint32_t>(dependencies.size());
+      flat.dependencyCount = static_cast<uint32_t>(entry->dependencies.size());
+      for (size_t i = 0; i < entry->dependencies.size(); i++) {
+        DxcShimArchiveDependency flatDependency = {};
+        flatDependency.hash = entry->dependencies[i];
+        flatDependency.filename = entry->dependencyNames[i];
+        dependencies.push_back(flatDependency);
+      }
+
+      flatEntries.push_back(flat);
+    }
+
+    DxcShimArchiveHeader header = {};
+    header.magic = DxcShimArchiveHeader::Magic;
+    header.version = DxcShimArchiveHeader::Version;
+    header.entryCount = flatEntries.size();
+    header.entriesOffset = alignArchiveOffset(sizeof(header));
+    header.bindingsOffset = alignArchiveOffset(header.entriesOffset + flatEntries.size() * sizeof(DxcShimArchiveEntry));
+    header.bindingCount = bindings.size();
+    header.inputsOffset = alignArchiveOffset(header.bindingsOffset + bindings.size() * sizeof(DxcShimArchiveBinding));
+    header.inputCount = inputs.size();
+    header.dependenciesOffset = alignArchiveOffset(header.inputsOffset + inputs.size() * sizeof(DxcShimArchiveInput));
+    header.dependencyCount = dependencies.size();
+    header.stringsOffset = alignArchiveOffset(header.dependenciesOffset + dependencies.size() * sizeof(DxcShimArchiveDependency));
+    header.stringsSize = m_strings.size();
+
+    uint64_t offset = alignArchiveOffset(header.stringsOffset + header.stringsSize);
+    for (size_t i = 0; i < flatEntries.size(); i++) {
+      flatEntries[i].bytecodeOffset = offset;
+      offset = alignArchiveOffset(offset + entries[i]->bytecode.size());
+    }
+
+    std::vector<uint8_t> file(offset, 0);
+    std::memcpy(file.data(), &header, sizeof(header));
+    copyTable(file, header.entriesOffset, flatEntries);
+    copyTable(file, header.bindingsOffset, bindings);
+    copyTable(file, header.inputsOffset, inputs);
+    copyTable(file, header.dependenciesOffset, dependencies);
+    copyTable(file, header.stringsOffset, m_strings);
+    for (size_t i = 0; i < flatEntries.size(); i++) {
+      copyTable(file, flatEntries[i].bytecodeOffset, entries[i]->bytecode);
+    }
+
+    return writeFileAtomically(path, file.data(), file.size());
+  }
+
+private:
+  struct PendingEntry {
+    DxcShimHash key;
+    std::vector<uint8_t> bytecode;
+
+    bool isReflected;
+    DxcShimReflection reflection;
+    std::vector<DxcShimReflectionBinding> bindings;
+    std::vector<uint32_t> bindingNames;
+    std::vector<DxcShimReflectionInput> inputs;
+    std::vector<uint32_t> inputNames;
+
+    std::vector<DxcShimHash> dependencies;
+    std::vector<uint32_t> dependencyNames;
+  };
+
+  // Adds a string to the string table, and returns its offset.
+  inline uint32_t addString(const char* string) {
+    uint32_t offset = static_cast<uint32_t>(m_strings.size());
+    m_strings.insert(m_strings.end(), string, string + std::strlen(string) + 1);
+    return offset;
+  }
+
+  template <typename T>
+  inline static void copyTable(std::vector<uint8_t>& file, uint64_t offset, std::vector<T> const& table) {
+    if (!table.empty()) {
+      std::memcpy(file.data() + offset, table.data(), table.size() * sizeof(T));
+    }
+  }
+
+  std::mutex m_mutex;
+  std::vector<PendingEntry> m_entries;
+  std::unordered_set<DxcShimHash, DxcShimHashHasher> m_keys;
+  std::vector<char> m_strings;
+};
+
+// A shader archive mapped into memory.
+//
+// Opening maps the file and validates its index. Lookups are binary searches over the mapped
+// index, and bytecode, names and hashes are handed out as pointers into the mapping, without
+// copying. The archive is immutable once opened, and safe to use from many threads.
+class DxcShimArchive {
+public:
+  // Maps the archive at the given path.
+  //
+  // Throws a DxcShimException if the file cannot be mapped or is not a valid archive.
+  inline explicit DxcShimArchive(std::string const& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw DxcShimException(DxcShimStatus::ArchiveOpenError);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      m_size = static_cast<size_t>(st.st_size);
+      void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      m_data = data != MAP_FAILED ? static_cast<const uint8_t*>(data) : nullptr;
+    }
+    close(fd);
+
+    if (m_data == nullptr || !validate()) {
+      unmap();
+      throw DxcShimException(DxcShimStatus::ArchiveOpenError);
+    }
+  }
+
+  DxcShimArchive(DxcShimArchive const&) = delete;
+  DxcShimArchive& operator=(DxcShimArchive const&) = delete;
+
+  ~DxcShimArchive() {
+    unmap();
+  }
+
+  inline size_t getEntryCount() const {
+    return static_cast<size_t>(m_header->entryCount);
+  }
+
+  // Finds the entry with the given key. Returns false if there is none.
+  inline bool find(DxcShimHash const& key, size_t& index) const {
+    const DxcShimArchiveEntry* begin = m_entries;
+    const DxcShimArchiveEntry* end = m_entries + getEntryCount();
+    const DxcShimArchiveEntry* entry = std::lower_bound(begin, end, key,
+      [](DxcShimArchiveEntry const& entry, DxcShimHash const& key) {
+        return isArchiveKeyLess(entry.key, key);
+      });
+
+    if (entry == end || entry->key != key) {
+      return false;
+    }
+    index = static_cast<size_t>(entry - begin);
+    return true;
+  }
+
+  inline DxcShimHash const& getKey(size_t index) const {
+    return m_entries[index].key;
+  }
+
+  inline const void* getBytecodePointer(size_t index) const {
+    return m_data + m_entries[index].bytecodeOffset;
+  }
+
+  inline size_t getBytecodeSize(size_t index) const {
+    return static_cast<size_t>(m_entries[index].bytecodeSize);
+  }
+
+  // Returns the reflection of an entry, or NULL if its bytecode could not be reflected.
+  //
+  // The flat tables are built for all entries on the first call, with names pointing into the
+  // mapping, so archives that are never reflected do not pay for it.
+  inline const DxcShimReflection* getReflection(size_t index) const {
+    std::call_once(m_reflectOnce, [this]() { buildReflections(); });
+    return m_entries[index].isReflected ? &m_reflections[index] : nullptr;
+  }
+
+  inline size_t getDependencyCount(size_t index) const {
+    return m_entries[index].dependencyCount;
+  }
+
+  // Returns a dependency of an entry, with its NUL-terminated filename.
+  inline void getDependency(size_t index, size_t dependencyIndex, const char*& filename, DxcShimHash& hash) const {
+    DxcShimArchiveDependency const& dependency = m_dependencies[m_entries[index].firstDependency + dependencyIndex];
+    filename = getString(dependency.filename);
+    hash = dependency.hash;
+  }
+
+private:
+  // Checks that every table, string and bytecode lies within the file, and that every enum
+  // value is valid, so lookups need no further checks.
+  inline bool validate() {
+    if (m_size < sizeof(DxcShimArchiveHeader)) {
+      return false;
+    }
+    m_header = reinterpret_cast<const DxcShimArchiveHeader*>(m_data);
+    if (m_header->magic != DxcShimArchiveHeader::Magic || m_header->version != DxcShimArchiveHeader::Version) {
+      return false;
+    }
+
+    if (!isTableInFile(m_header->entriesOffset, m_header->entryCount, sizeof(DxcShimArchiveEntry))
+      || !isTableInFile(m_header->bindingsOffset, m_header->bindingCount, sizeof(DxcShimArchiveBinding))
+      || !isTableInFile(m_header->inputsOffset, m_header->inputCount, sizeof(DxcShimArchiveInput))
+      || !isTableInFile(m_header->dependenciesOffset, m_header->dependencyCount, sizeof(DxcShimArchiveDependency))
+      || !isTableInFile(m_header->stringsOffset, m_header->stringsSize, 1)) {
+      return false;
+    }
+
+    // The string table must end with a terminator, so no string runs past it.
+    if (m_header->stringsSize > 0 && m_data[m_header->stringsOffset + m_header->stringsSize - 1] != '\0') {
+      return false;
+    }
+
+    m_entries = reinterpret_cast<const DxcShimArchiveEntry*>(m_data + m_header->entriesOffset);
+    m_bindings = reinterpret_cast<const DxcShimArchiveBinding*>(m_data + m_header->bindingsOffset);
+    m_inputs = reinterpret_cast<const DxcShimArchiveInput*>(m_data + m_header->inputsOffset);
+    m_dependencies = reinterpret_cast<const DxcShimArchiveDependency*>(m_data + m_header->dependenciesOffset);
+
+    for (size_t i = 0; i < getEntryCount(); i++) {
+      DxcShimArchiveEntry const& entry = m_entries[i];
+      if (!isTableInFile(entry.bytecodeOffset, entry.bytecodeSize, 1)
+        || !isRangeInTable(entry.firstBinding, entry.bindingCount, m_header->bindingCount)
+        || !isRangeInTable(entry.firstInput, entry.inputCount, m_header->inputCount)
+        || !isRangeInTable(entry.firstDependency, entry.dependencyCount, m_header->dependencyCount)
+        || !isShaderStage(entry.stage)) {
+        return false;
+      }
+
+      // Binary search needs strictly sorted keys.
+      if (i > 0 && !isArchiveKeyLess(m_entries[i - 1].key, entry.key)) {
+        return false;
+      }
+    }
+
+    for (size_t i = 0; i < m_header->bindingCount; i++) {
+      if (m_bindings[i].name >= m_header->stringsSize || !isDescriptorType(m_bindings[i].descriptorType)) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < m_header->inputCount; i++) {
+      if (m_inputs[i].name >= m_header->stringsSize || !isComponentType(m_inputs[i].componentType)) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < m_header->dependencyCount; i++) {
+      if (m_dependencies[i].filename >= m_header->stringsSize) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  inline bool isTableInFile(uint64_t offset, uint64_t count, uint64_t elementSize) const {
+    if (offset % 8 != 0 || offset > m_size) {
+      return false;
+    }
+    return count <= (m_size - offset) / elementSize;
+  }
+
+  inline static bool isRangeInTable(uint64_t first, uint64_t count, uint64_t tableSize) {
+    return first <= tableSize && count <= tableSize - first;
+  }
+
+  inline const char* getString(uint32_t offset) const {
+    return reinterpret_cast<const char*>(m_data + m_header->stringsOffset + offset);
+  }
+
+  inline void buildReflections() const {
+    m_reflectionBindings.reserve(m_header->bindingCount);
+    for (size_t i = 0; i < m_header->bindingCount; i++) {
+      DxcShimReflectionBinding binding;
+      binding.set = m_bindings[i].set;
+      binding.binding = m_bindings[i].binding;
+      binding.descriptorType = static_cast<DxcShimDescriptorType>(m_bindings[i].descriptorType);
+      binding.count = m_bindings[i].count;
+      binding.name = getString(m_bindings[i].name);
+      m_reflectionBindings.push_back(binding);
+    }
+
+    m_reflectionInputs.reserve(m_header->inputCount);
+    for (size_t i = 0; i < m_header->inputCount; i++) {
+      DxcShimReflectionInput input;
+      input.location = m_inputs[i].location;
+      input.componentType = static_cast<DxcShimComponentType>(m_inputs[i].componentType);
+      input.componentCount = m_inputs[i].componentCount;
+      input.name = getString(m_inputs[i].name);
+      m_reflectionInputs.push_back(input);
+    }
+
+    m_reflections.resize(getEntryCount());
+    for (size_t i = 0; i < getEntryCount(); i++) {
+      DxcShimArchiveEntry const& entry = m_entries[i];
+      DxcShimReflection& reflection = m_reflections[i];
+      reflection.stage = static_cast<DxcShimShaderStage>(entry.stage);
+      reflection.pushConstantSize = entry.pushConstantSize;
+      std::memcpy(reflection.localSize, entry.localSize, sizeof(reflection.localSize));
+      reflection.bindings = m_reflectionBindings.data() + entry.firstBinding;
+      reflection.bindingCount = entry.bindingCount;
+      reflection.inputs = m_reflectionInputs.data() + entry.firstInput;
+      reflection.inputCount = entry.inputCount;
+    }
+  }
+
+  inline void unmap() {
+    if (m_data != nullptr) {
+      munmap(const_cast<uint8_t*>(m_data), m_size);
+      m_data = nullptr;
+    }
+  }
+
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+
+  const DxcShimArchiveHeader* m_header = nullptr;
+  const DxcShimArchiveEntry* m_entries = nullptr;
+  const DxcShimArchiveBinding* m_bindings = nullptr;
+  const DxcShimArchiveInput* m_inputs = nullptr;
+  const DxcShimArchiveDependency* m_dependencies = nullptr;
+
+  // The flat reflection tables, built on first use.
+  mutable std::once_flag m_reflectOnce;
+  mutable std::vector<DxcShimReflection> m_reflections;
+  mutable std::vector<DxcShimReflectionBinding> m_reflectionBindings;
+  mutable std::vector<DxcShimReflectionInput> m_reflectionInputs;
+};
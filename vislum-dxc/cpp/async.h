@@ -0,0 +1,262 @@
+#pragma once
+
+#include "wrapper.h"
+#include "pool.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+class DxcShimCompileTask;
+
+// Called once a task has completed or been cancelled, with the task and the completion user
+// data it was submitted with.
+//
+// Completed tasks, and tasks cancelled while running, are reported on the worker thread that
+// ran them. Tasks cancelled while pending are reported on the thread that cancelled them.
+typedef void (*DxcShimCompletionCallback)(DxcShimCompileTask* task, void* userData);
+
+enum class DxcShimTaskStatus: uint8_t {
+  // Queued, waiting for a worker.
+  Pending = 0,
+  Running = 1,
+  Completed = 2,
+  Cancelled = 3,
+};
+
+// A compilation submitted to an async compiler.
+//
+// The source and arguments are copied on creation, so the caller's buffers can be released
+// as soon as the task is submitted. The include callback user data and the cancellation token
+// of the options must stay valid until the task has completed or been cancelled.
+//
+// Tasks are reference counted, as they are shared by the caller's handle and the queue of
+// the async compiler.
+class DxcShimCompileTask {
+public:
+  inline DxcShimCompileTask(
+    const char* data,
+    size_t size,
+    DxcShimCompileOptions const& options,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompletionCallback onComplete,
+    void* completionUserData)
+    : m_source(data, size)
+    , m_userCallback(userCallback)
+    , m_userData(userData)
+    , m_onComplete(onComplete)
+    , m_completionUserData(completionUserData)
+    , m_priority(options.priority)
+    , m_cancellation(DxcShimCompiler::buildCancellation(options)) {
+    DxcShimCompiler::buildArguments(options, m_args);
+    m_cancellation.linkedToken = &m_cancellationToken;
+  }
+
+  DxcShimCompileTask(DxcShimCompileTask const&) = delete;
+  DxcShimCompileTask& operator=(DxcShimCompileTask const&) = delete;
+
+  ~DxcShimCompileTask() {
+    delete m_result;
+  }
+
+  inline void addRef() {
+    m_refCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  inline void release() {
+    if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  inline DxcShimPriority getPriority() const {
+    return m_priority;
+  }
+
+  inline DxcShimTaskStatus getStatus() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_status;
+  }
+
+  // Cancels the task. A pending task is cancelled immediately. A running one is stopped at the
+  // next point DXC can be stopped, and becomes Cancelled then, unless it completes first.
+  //
+  // Returns whether the call cancelled the task, which only a pending task is right away.
+  inline bool cancel() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_status == DxcShimTaskStatus::Running) {
+        m_cancellationToken.cancel();
+        return false;
+      }
+
+      if (m_status != DxcShimTaskStatus::Pending) {
+        return false;
+      }
+      m_status = DxcShimTaskStatus::Cancelled;
+    }
+
+    finish();
+    return true;
+  }
+
+  // Compiles the task with the given compiler, unless it has been cancelled.
+  inline void run(DxcShimCompiler& compiler) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_status != DxcShimTaskStatus::Pending) {
+        return;
+      }
+      m_status = DxcShimTaskStatus::Running;
+    }
+
+    DxcShimCompilationResult* result = compiler.compile(m_source.data(), m_source.size(), m_args, m_cancellation, m_userCallback, m_userData);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (result->isCancelled()) {
+        delete result;
+        m_status = DxcShimTaskStatus::Cancelled;
+      } else {
+        m_result = result;
+        m_status = DxcShimTaskStatus::Completed;
+      }
+    }
+
+    finish();
+  }
+
+  // Blocks until the task has completed or been cancelled.
+  inline void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this]() {
+      return m_status == DxcShimTaskStatus::Completed || m_status == DxcShimTaskStatus::Cancelled;
+    });
+  }
+
+  // Takes ownership of the result. Returns NULL if the task has not completed, or the result
+  // has already been taken.
+  inline DxcShimCompilationResult* takeResult() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    DxcShimCompilationResult* result = m_result;
+    m_result = nullptr;
+    return result;
+  }
+
+private:
+  inline void finish() {
+    m_condition.notify_all();
+    if (m_onComplete != nullptr) {
+      m_onComplete(this, m_completionUserData);
+    }
+  }
+
+  std::string m_source;
+  DxcShimArguments m_args;
+  DxcShimUserCallback m_userCallback;
+  void* m_userData;
+  DxcShimCompletionCallback m_onComplete;
+  void* m_completionUserData;
+  DxcShimPriority m_priority;
+
+  // Cancelled by cancel while the task is running. Linked into m_cancellation.
+  DxcShimCancellationToken m_cancellationToken;
+  DxcShimCancellation m_cancellation;
+
+  // Guards the status and the result.
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  DxcShimTaskStatus m_status = DxcShimTaskStatus::Pending;
+  DxcShimCompilationResult* m_result = nullptr;
+
+  // Held by the caller's handle until it is released.
+  std::atomic<int> m_refCount {1};
+};
+
+// Compiles tasks in the background on a fixed set of worker threads.
+//
+// Each worker owns a compiler acquired from the pool for the lifetime of the async compiler,
+// so the pool must outlive it. Tasks are picked up by priority, then roughly in submission
+// order. Interactive tasks run before any queued task of lower priority, and make room for
+// themselves among the other work of the pool, such as batches, at its next job boundary.
+class DxcShimAsyncCompiler {
+public:
+  // Starts threadCount workers. A threadCount of 0 uses one thread per core.
+  //
+  // Throws a DxcShimException if a compiler cannot be created, or no worker can be started.
+  inline explicit DxcShimAsyncCompiler(DxcShimCompilerPool& pool, size_t threadCount)
+    : m_queue(getWorkerCount(threadCount)) {
+    threadCount = getWorkerCount(threadCount);
+
+    // Compilers are acquired up front so that creation failures are reported here rather
+    // than on a worker thread.
+    m_compilers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+      m_compilers.emplace_back(new DxcShimPooledCompiler(pool));
+    }
+
+    m_threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+      try {
+        m_threads.emplace_back(&DxcShimAsyncCompiler::work, this, std::ref(*m_compilers[i]), i);
+      } catch (std::system_error const&) {
+        // Out of threads. Run with the workers that could be started.
+        break;
+      }
+    }
+
+    if (m_threads.empty()) {
+      throw DxcShimException(DxcShimStatus::SpawnThreadError);
+    }
+  }
+
+  DxcShimAsyncCompiler(DxcShimAsyncCompiler const&) = delete;
+  DxcShimAsyncCompiler& operator=(DxcShimAsyncCompiler const&) = delete;
+
+  // Cancels all pending tasks and waits for the running ones to complete.
+  ~DxcShimAsyncCompiler() {
+    for (DxcShimCompileTask* task : m_queue.stop()) {
+      task->cancel();
+      task->release();
+    }
+
+    for (std::thread& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  // Queues a task. The async compiler holds its own reference until the task has run.
+  inline void submit(DxcShimCompileTask* task) {
+    task->addRef();
+    m_queue.push(task, task->getPriority());
+  }
+
+private:
+  inline static size_t getWorkerCount(size_t threadCount) {
+    return threadCount != 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  inline void work(DxcShimPooledCompiler& compiler, size_t workerIndex) {
+    DxcShimCompileTask* task;
+    while (m_queue.pop(workerIndex, task)) {
+      // Cancelled tasks are skipped by run, and only dropped from the queue here.
+      {
+        DxcShimPriorityScope priorityScope(compiler->getPriorityGate(), task->getPriority());
+        task->run(*compiler);
+      }
+      task->release();
+    }
+  }
+
+  // One deque per worker, including the workers that could not be started, whose tasks are
+  // stolen by the others.
+  DxcShimWorkQueue<DxcShimCompileTask*> m_queue;
+
+  std::vector<std::unique_ptr<DxcShimPooledCompiler>> m_compilers;
+  std::vector<std::thread> m_threads;
+};
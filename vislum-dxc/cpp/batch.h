@@ -0,0 +1,306 @@
+#pragma once
+
+#include "wrapper.h"
+#include "pool.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <system_error>
+#include <thread>
+
+// A single compilation of a batch.
+struct DxcShimCompileJob {
+  const char* source;
+  size_t sourceSize;
+  DxcShimCompileOptions options;
+
+  // Passed to the include callback of the batch for the includes of this job.
+  void* userData;
+};
+
+// Returns the number of threads of a batch. A threadCount of 0 uses one thread per core.
+inline size_t getBatchThreadCount(size_t threadCount) {
+  if (threadCount == 0) {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+  return threadCount;
+}
+
+// Runs taskCount tasks in parallel over compilers acquired from a pool, as
+// task(compiler, args, index). A threadCount of 0 uses one thread per core.
+//
+// args is cleared before every task, and reused across the tasks of a worker to save
+// allocations. Tasks are started in increasing index order, and the calling thread takes part
+// in the work.
+template <typename Task>
+inline void runOnPool(DxcShimCompilerPool& pool, size_t taskCount, size_t threadCount, Task const& task) {
+  if (taskCount == 0) {
+    return;
+  }
+
+  threadCount = std::min(getBatchThreadCount(threadCount), taskCount);
+
+  // Compilers are acquired up front so that creation failures are reported before any work
+  // is started.
+  std::vector<std::unique_ptr<DxcShimPooledCompiler>> compilers;
+  compilers.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; i++) {
+    compilers.emplace_back(new DxcShimPooledCompiler(pool));
+  }
+
+  std::atomic<size_t> next {0};
+  auto worker = [&](DxcShimPooledCompiler& compiler) {
+    DxcShimArguments args;
+    for (;;) {
+      size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= taskCount) {
+        break;
+      }
+
+      args.clear();
+      task(*compiler, args, i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount - 1);
+  for (size_t i = 1; i < threadCount; i++) {
+    try {
+      threads.emplace_back(worker, std::ref(*compilers[i]));
+    } catch (std::system_error const&) {
+      // Out of threads. The remaining work is picked up by the threads already running.
+      break;
+    }
+  }
+
+  worker(*compilers[0]);
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+// Returns how long a job is expected to take, in bytes of source it has to parse: its own
+// source, and an average include for every #include directive in it.
+//
+// Includes dominate the compile time of most shaders, so a short source pulling in many of
+// them is scheduled ahead of a long one that includes little.
+inline uint64_t estimateJobCost(DxcShimCompileJob const& job, uint64_t averageIncludeSize) {
+  uint64_t includeCount = 0;
+  const char* it = job.source;
+  const char* end = job.source + job.sourceSize;
+  while (it < end) {
+    while (it < end && (*it == ' ' || *it == '\t')) {
+      it++;
+    }
+    if (it < end && *it == '#') {
+      it++;
+      while (it < end && (*it == ' ' || *it == '\t')) {
+        it++;
+      }
+      if (static_cast<size_t>(end - it) >= 7 && std::memcmp(it, "include", 7) == 0) {
+        includeCount++;
+      }
+    }
+
+    const char* newline = static_cast<const char*>(std::memchr(it, '\n', end - it));
+    it = newline != nullptr ? newline + 1 : end;
+  }
+
+  return job.sourceSize + includeCount * averageIncludeSize;
+}
+
+// Returns the order to start the jobs of a batch in: by priority, then in order of decreasing
+// cost, so the longest compilations start first and do not straggle at the end of the batch.
+// Fills in the estimated cost of every job.
+inline std::vector<size_t> orderJobs(
+  DxcShimCompilerPool& pool,
+  const DxcShimCompileJob* jobs,
+  size_t jobCount,
+  std::vector<uint64_t>& costs) {
+  // The includes seen by the pool so far tell how large an include is. Until there are any,
+  // a guess is used.
+  DxcShimCompilerStats stats = pool.getStats().snapshot();
+  uint64_t averageIncludeSize = stats.includeCount != 0 ? stats.includeBytes / stats.includeCount : 4096;
+
+  costs.resize(jobCount);
+  for (size_t i = 0; i < jobCount; i++) {
+    costs[i] = estimateJobCost(jobs[i], averageIncludeSize);
+  }
+
+  std::vector<size_t> order(jobCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    size_t rankA = getPriorityRank(jobs[a].options.priority);
+    size_t rankB = getPriorityRank(jobs[b].options.priority);
+    if (rankA != rankB) {
+      return rankA < rankB;
+    }
+    return costs[a] > costs[b];
+  });
+  return order;
+}
+
+// Compiles a batch of jobs in parallel over compilers acquired from a pool.
+//
+// results must point to jobCount entries. Each entry receives the result of the job at the
+// same index, which must be freed by the caller. Entries that are not NULL are reset and
+// compiled into instead of allocating a new result, so the results of one batch can be reused
+// for the next. A threadCount of 0 uses one thread per core.
+//
+// The include callback is invoked from several threads at once, but never concurrently for
+// the same job.
+inline void compileBatch(
+  DxcShimCompilerPool& pool,
+  const DxcShimCompileJob* jobs,
+  size_t jobCount,
+  size_t threadCount,
+  DxcShimUserCallback userCallback,
+  DxcShimCompilationResult** results) {
+  std::vector<uint64_t> costs;
+  std::vector<size_t> order = orderJobs(pool, jobs, jobCount, costs);
+
+  runOnPool(pool, jobCount, threadCount, [&](DxcShimCompiler& compiler, DxcShimArguments& args, size_t i) {
+    DxcShimCompileJob const& job = jobs[order[i]];
+
+    DxcShimCompiler::buildArguments(job.options, args);
+    DxcShimCancellation cancellation = DxcShimCompiler::buildCancellation(job.options);
+
+    // Jobs of lower priority make room for interactive compilations here, between jobs.
+    DxcShimPriorityScope priorityScope(compiler.getPriorityGate(), job.options.priority);
+
+    DxcShimCompilationResult*& result = results[order[i]];
+    if (result == nullptr) {
+      result = compiler.compile(job.source, job.sourceSize, args, cancellation, userCallback, job.userData);
+    } else {
+      compiler.compile(job.source, job.sourceSize, args, cancellation, userCallback, job.userData, *result);
+    }
+  });
+}
+
+// Called with the result of a job of a streaming batch as soon as the job finishes, on the
+// worker thread that compiled it. The result is only valid until the callback returns, after
+// which its bytecode and messages are released.
+typedef void (*DxcShimBatchResultCallback)(void* userData, size_t jobIndex, DxcShimCompilationResult* result);
+
+// Bounds the memory held by the jobs of a streaming batch that are in flight.
+class DxcShimMemoryBudget {
+public:
+  // A budget of 0 is unlimited.
+  inline explicit DxcShimMemoryBudget(uint64_t budget)
+    : m_budget(budget) {}
+
+  // Waits until a job of the given size fits in the budget. A job larger than the whole
+  // budget is admitted once nothing else is in flight, so every job eventually runs.
+  inline void acquire(uint64_t size) {
+    if (m_budget == 0) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_released.wait(lock, [&]() { return m_used == 0 || m_used + size <= m_budget; });
+    m_used += size;
+  }
+
+  inline void release(uint64_t size) {
+    if (m_budget == 0) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_used -= size;
+    }
+    m_released.notify_all();
+  }
+
+  // Returns how many jobs of the given sizes can be in flight at once at most, which is at
+  // least one. That many of the smallest jobs fit in the budget, and no more of any jobs do.
+  inline size_t getMaxInFlight(std::vector<uint64_t> sizes) const {
+    if (m_budget == 0 || sizes.empty()) {
+      return std::max<size_t>(sizes.size(), 1);
+    }
+
+    std::sort(sizes.begin(), sizes.end());
+    size_t count = 0;
+    uint64_t used = 0;
+    while (count < sizes.size() && sizes[count] <= m_budget - used) {
+      used += sizes[count];
+      count++;
+    }
+    return std::max<size_t>(count, 1);
+  }
+
+private:
+  uint64_t m_budget;
+
+  std::mutex m_mutex;
+  std::condition_variable m_released;
+  uint64_t m_used = 0;
+};
+
+// Returns the memory a job is expected to hold while in flight, from its estimated cost.
+//
+// The AST and IR of DXC dominate, and grow with the source it parses. This is a rough rule of
+// thumb rather than a measurement, which the budget of a batch is meant to be tuned against.
+inline uint64_t estimateJobMemory(uint64_t cost) {
+  static const uint64_t baseMemory = 4u << 20;
+  static const uint64_t memoryPerSourceByte = 64;
+  return baseMemory + cost * memoryPerSourceByte;
+}
+
+// Compiles a batch of jobs in parallel over compilers acquired from a pool, handing every
+// result to a callback as soon as its job finishes, then releasing it.
+//
+// Only the jobs in flight hold memory. A job is only started while the estimated memory of the
+// jobs in flight, including its own, fits in memoryBudget bytes. A memoryBudget of 0 only
+// bounds the jobs in flight by threadCount. Jobs start in the same order as in compileBatch.
+//
+// No more threads, and so compilers, are used than the budget can keep busy at once.
+//
+// The include and result callbacks are invoked from several threads at once, but never
+// concurrently for the same job.
+inline void compileBatchStreaming(
+  DxcShimCompilerPool& pool,
+  const DxcShimCompileJob* jobs,
+  size_t jobCount,
+  size_t threadCount,
+  uint64_t memoryBudget,
+  DxcShimUserCallback userCallback,
+  DxcShimBatchResultCallback onResult,
+  void* resultUserData) {
+  std::vector<uint64_t> costs;
+  std::vector<size_t> order = orderJobs(pool, jobs, jobCount, costs);
+  DxcShimMemoryBudget budget(memoryBudget);
+
+  std::vector<uint64_t> memories(jobCount);
+  for (size_t i = 0; i < jobCount; i++) {
+    memories[i] = estimateJobMemory(costs[i]);
+  }
+  threadCount = std::min(getBatchThreadCount(threadCount), budget.getMaxInFlight(memories));
+
+  runOnPool(pool, jobCount, threadCount, [&](DxcShimCompiler& compiler, DxcShimArguments& args, size_t i) {
+    size_t index = order[i];
+    DxcShimCompileJob const& job = jobs[index];
+
+    DxcShimCompiler::buildArguments(job.options, args);
+    DxcShimCancellation cancellation = DxcShimCompiler::buildCancellation(job.options);
+
+    // Jobs yield to interactive compilations before waiting for memory, so a job waiting for
+    // an interactive compilation holds none.
+    DxcShimPriorityScope priorityScope(compiler.getPriorityGate(), job.options.priority);
+
+    uint64_t memory = memories[index];
+    budget.acquire(memory);
+    {
+      DxcShimCompilationResult result;
+      compiler.compile(job.source, job.sourceSize, args, cancellation, userCallback, job.userData, result);
+      onResult(resultUserData, index, &result);
+    }
+    budget.release(memory);
+  });
+}
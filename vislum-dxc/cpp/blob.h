@@ -0,0 +1,173 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <sys/mman.h>
+
+// A blob backed by a read-only memory mapping, unmapped when the last reference is released.
+class DxcShimMappedBlob : public IDxcBlob {
+public:
+  inline DxcShimMappedBlob(void* data, size_t size)
+    : m_data(data)
+    , m_size(size) {}
+
+  // IUnknown methods
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) override {
+    if (riid == __uuidof(IUnknown) || riid == __uuidof(IDxcBlob)) {
+      *ppvObject = this;
+      AddRef();
+      return S_OK;
+    }
+    *ppvObject = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  ULONG STDMETHODCALLTYPE AddRef() override {
+    return ++m_refCount;
+  }
+
+  ULONG STDMETHODCALLTYPE Release() override {
+    ULONG refCount = --m_refCount;
+    if (refCount == 0) {
+      delete this;
+    }
+    return refCount;
+  }
+
+  // IDxcBlob methods
+  LPVOID STDMETHODCALLTYPE GetBufferPointer() override {
+    return m_data;
+  }
+
+  SIZE_T STDMETHODCALLTYPE GetBufferSize() override {
+    return m_size;
+  }
+
+private:
+  ~DxcShimMappedBlob() {
+    munmap(m_data, m_size);
+  }
+
+  void* m_data;
+  size_t m_size;
+  std::atomic<ULONG> m_refCount {0u};
+};
+
+// A blob exposing the start of another blob, which it keeps alive.
+//
+// Lets the contents of a blob be shrunk in place, without copying them into a new blob.
+class DxcShimSliceBlob : public IDxcBlob {
+public:
+  inline DxcShimSliceBlob(IDxcBlob* parent, size_t size)
+    : m_parent(parent)
+    , m_size(size) {}
+
+  // IUnknown methods
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) override {
+    if (riid == __uuidof(IUnknown) || riid == __uuidof(IDxcBlob)) {
+      *ppvObject = this;
+      AddRef();
+      return S_OK;
+    }
+    *ppvObject = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  ULONG STDMETHODCALLTYPE AddRef() override {
+    return ++m_refCount;
+  }
+
+  ULONG STDMETHODCALLTYPE Release() override {
+    ULONG refCount = --m_refCount;
+    if (refCount == 0) {
+      delete this;
+    }
+    return refCount;
+  }
+
+  // IDxcBlob methods
+  LPVOID STDMETHODCALLTYPE GetBufferPointer() override {
+    return m_parent->GetBufferPointer();
+  }
+
+  SIZE_T STDMETHODCALLTYPE GetBufferSize() override {
+    return m_size;
+  }
+
+private:
+  CComPtr<IDxcBlob> m_parent;
+  size_t m_size;
+  std::atomic<ULONG> m_refCount {0u};
+};
+
+// Called when a borrowed blob is released, to give the memory back to its owner.
+typedef void (*DxcShimReleaseCallback)(void* context);
+
+// A UTF-8 text blob borrowing memory owned by the caller.
+//
+// The memory is not copied. The release callback is invoked with its context once the last
+// reference to the blob is released, possibly from another thread.
+class DxcShimBorrowedBlob : public IDxcBlobEncoding {
+public:
+  inline DxcShimBorrowedBlob(
+    const void* data,
+    size_t size,
+    DxcShimReleaseCallback release,
+    void* releaseContext)
+    : m_data(data)
+    , m_size(size)
+    , m_release(release)
+    , m_releaseContext(releaseContext) {}
+
+  // IUnknown methods
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) override {
+    if (riid == __uuidof(IUnknown) || riid == __uuidof(IDxcBlob) || riid == __uuidof(IDxcBlobEncoding)) {
+      *ppvObject = this;
+      AddRef();
+      return S_OK;
+    }
+    *ppvObject = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  ULONG STDMETHODCALLTYPE AddRef() override {
+    return ++m_refCount;
+  }
+
+  ULONG STDMETHODCALLTYPE Release() override {
+    ULONG refCount = --m_refCount;
+    if (refCount == 0) {
+      delete this;
+    }
+    return refCount;
+  }
+
+  // IDxcBlob methods
+  LPVOID STDMETHODCALLTYPE GetBufferPointer() override {
+    return const_cast<void*>(m_data);
+  }
+
+  SIZE_T STDMETHODCALLTYPE GetBufferSize() override {
+    return m_size;
+  }
+
+  // IDxcBlobEncoding methods
+  HRESULT STDMETHODCALLTYPE GetEncoding(BOOL *pKnown, UINT32 *pCodePage) override {
+    *pKnown = TRUE;
+    *pCodePage = CP_UTF8;
+    return S_OK;
+  }
+
+private:
+  ~DxcShimBorrowedBlob() {
+    if (m_release != nullptr) {
+      m_release(m_releaseContext);
+    }
+  }
+
+  const void* m_data;
+  size_t m_size;
+  DxcShimReleaseCallback m_release;
+  void* m_releaseContext;
+  std::atomic<ULONG> m_refCount {0u};
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "blob.h"
+#include "common.h"
+#include "hash.h"
+#include "trace.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Writes a file to a temporary file next to it, then renames it into place, so concurrent
+// readers never observe a partial file. Returns false if the file could not be written.
+inline bool writeFileAtomically(std::string const& path, const void* data, size_t size) {
+  std::string temporaryPath = path + ".XXXXXX";
+
+  int fd = mkstemp(&temporaryPath[0]);
+  if (fd < 0) {
+    return false;
+  }
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  bool written = true;
+  while (written && size > 0) {
+    ssize_t count = write(fd, bytes, size);
+    if (count < 0) {
+      written = errno == EINTR;
+      continue;
+    }
+
+    bytes += count;
+    size -= static_cast<size_t>(count);
+  }
+  written = close(fd) == 0 && written;
+
+  if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+    unlink(temporaryPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+// A persistent, content-addressed cache of compiled bytecode.
+//
+// Each entry is a file named after the hex digest of its key, sharded into subdirectories by the
+// first two digits. A hit maps the file into memory and hands the mapping out as the bytecode
+// blob, so it is never copied. Entries are written to a temporary file and renamed into place,
+// so concurrent compilers, and processes sharing the directory, never observe a partial entry.
+//
+// The cache holds no mutable state besides the directory, and is safe to use from many threads.
+class DxcShimCache {
+public:
+  // Opens the cache at the given directory, creating it if needed.
+  //
+  // Throws a DxcShimException if the directory cannot be created.
+  inline explicit DxcShimCache(std::string directory)
+    : m_directory(std::move(directory)) {
+    while (m_directory.size() > 1 && m_directory.back() == '/') {
+      m_directory.pop_back();
+    }
+
+    if (m_directory.empty() || !createDirectories(m_directory)) {
+      throw DxcShimException(DxcShimStatus::CacheOpenError);
+    }
+  }
+
+  inline std::string const& getDirectory() const {
+    return m_directory;
+  }
+
+  // Loads the entry for the given key. Returns NULL on a miss.
+  inline CComPtr<IDxcBlob> load(DxcShimHash const& key) const {
+    DXC_SHIM_TRACE_SCOPE("load from cache");
+    CComPtr<IDxcBlob> blob;
+
+    int fd = open(entryPath(key).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return blob;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_t size = static_cast<size_t>(st.st_size);
+      void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        blob = new DxcShimMappedBlob(data, size);
+      }
+    }
+
+    close(fd);
+    return blob;
+  }
+
+  // Stores an entry for the given key.
+  //
+  // Storing is best effort: failures only mean the next lookup misses.
+  inline void store(DxcShimHash const& key, const void* data, size_t size) const {
+    DXC_SHIM_TRACE_SCOPE("store to cache");
+    std::string hex = key.toHex();
+    std::string shard = m_directory + "/" + hex.substr(0, 2);
+    if (mkdir(shard.c_str(), 0755) != 0 && errno != EEXIST) {
+      return;
+    }
+
+    writeFileAtomically(shard + "/" + hex.substr(2), data, size);
+  }
+
+private:
+  inline std::string entryPath(DxcShimHash const& key) const {
+    std::string hex = key.toHex();
+    return m_directory + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+  }
+
+  // Creates the directory and all of its missing parents.
+  inline static bool createDirectories(std::string const& path) {
+    for (size_t i = 1; i <= path.size(); i++) {
+      if (i != path.size() && path[i] != '/') {
+        continue;
+      }
+
+      std::string prefix = path.substr(0, i);
+      if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+        return false;
+      }
+    }
+
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  }
+
+  std::string m_directory;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Returns the current time of the clock that deadlines are measured on, in nanoseconds.
+inline uint64_t dxcShimClockNow() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+// Cancels the compilations it is passed to, from any thread.
+class DxcShimCancellationToken {
+public:
+  inline void cancel() {
+    m_isCancelled.store(true, std::memory_order_relaxed);
+  }
+
+  inline bool isCancelled() const {
+    return m_isCancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> m_isCancelled {false};
+};
+
+// When a compilation is to be abandoned.
+//
+// Checked between the phases of a compilation and before every include, as DXC itself cannot
+// be interrupted.
+struct DxcShimCancellation {
+  const DxcShimCancellationToken* token = nullptr;
+
+  // A second token, such as the one of the async task the compilation runs in.
+  const DxcShimCancellationToken* linkedToken = nullptr;
+
+  // The time after which the compilation is abandoned, as returned by dxcShimClockNow. 0 is
+  // no deadline.
+  uint64_t deadline = 0;
+
+  inline bool isCancelled() const {
+    if (token != nullptr && token->isCancelled()) {
+      return true;
+    }
+
+    if (linkedToken != nullptr && linkedToken->isCancelled()) {
+      return true;
+    }
+
+    return deadline != 0 && dxcShimClockNow() >= deadline;
+  }
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#define __EMULATE_UUID
+
+#include <cstdint>
+#include <dxc/WinAdapter.h>
+#include <dxc/dxcapi.h>
+#include <exception>
+
+enum class DxcShimStatus: uint8_t {
+  Ok = 0,
+  OpenLibraryError = 1,
+  GetCreateInstance2SymbolError = 2,
+  GetDxcCompilerInstanceError = 3,
+  GetDxcUtilsInstanceError = 4,
+  CacheOpenError = 5,
+  SpawnThreadError = 6,
+  ArchiveOpenError = 7,
+  ArchiveWriteError = 8,
+  ServerAddressError = 9,
+  ServerListenError = 10,
+  ServerSpawnError = 11,
+  TraceOpenError = 12,
+};
+
+class DxcShimException : public std::exception {
+public:
+  DxcShimException(DxcShimStatus status) : m_status(status) {}
+
+  inline DxcShimStatus getStatus() const {
+    return m_status;
+  }
+
+private:
+  DxcShimStatus m_status;
+};
@@ -1,16 +1,223 @@
 #pragma once
 
-#include <codecvt>
-#include <locale>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
 #include <string>
 
-// Converts a UTF-8 string to a UTF-16 string.
-inline std::wstring utf8_to_utf16(const char* s) {
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
-    return conv.from_bytes(s);
+// Conversions between UTF-8 and the wide strings used by DXC.
+//
+// wchar_t is UTF-16 on Windows, and UTF-32 on Linux, where DXC uses the native wchar_t. The
+// conversions handle both, by the size of the character type they are instantiated with, so
+// the UTF-16 conversions can also be used through char16_t. Invalid input is replaced by
+// U+FFFD instead of failing.
+//
+// Filenames, arguments and most diagnostics are ASCII, so runs of ASCII are found eight bytes
+// at a time and copied in a plain loop the compiler vectorizes, without decoding. The output
+// is written in place into a string sized for the worst case, so reusing the output string
+// across calls avoids allocating.
+
+const uint32_t dxcShimReplacementCharacter = 0xfffd;
+
+// Returns the length of the run of ASCII at the start of a UTF-8 string.
+inline size_t dxcShimAsciiPrefix(const char* s, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, s + i, sizeof(word));
+    if ((word & UINT64_C(0x8080808080808080)) != 0) {
+      break;
+    }
+  }
+  while (i < size && static_cast<unsigned char>(s[i]) < 0x80) {
+    i++;
+  }
+  return i;
+}
+
+// Returns the length of the run of ASCII at the start of a wide string.
+template <typename WideChar>
+inline size_t dxcShimAsciiPrefix(const WideChar* s, size_t size) {
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    uint32_t any = static_cast<uint32_t>(s[i]) | static_cast<uint32_t>(s[i + 1])
+      | static_cast<uint32_t>(s[i + 2]) | static_cast<uint32_t>(s[i + 3]);
+    if (any >= 0x80) {
+      break;
+    }
+  }
+  while (i < size && static_cast<uint32_t>(s[i]) < 0x80) {
+    i++;
+  }
+  return i;
+}
+
+// Decodes the UTF-8 code point starting at s[i], and advances i past it.
+inline uint32_t dxcShimDecodeUtf8(const char* s, size_t size, size_t& i) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(s);
+  uint32_t lead = bytes[i++];
+
+  size_t length;
+  uint32_t codePoint;
+  uint32_t minimum;
+  if (lead < 0x80) {
+    return lead;
+  } else if ((lead & 0xe0) == 0xc0) {
+    length = 1;
+    codePoint = lead & 0x1f;
+    minimum = 0x80;
+  } else if ((lead & 0xf0) == 0xe0) {
+    length = 2;
+    codePoint = lead & 0x0f;
+    minimum = 0x800;
+  } else if ((lead & 0xf8) == 0xf0) {
+    length = 3;
+    codePoint = lead & 0x07;
+    minimum = 0x10000;
+  } else {
+    return dxcShimReplacementCharacter;
+  }
+
+  for (size_t j = 0; j < length; j++) {
+    if (i >= size || (bytes[i] & 0xc0) != 0x80) {
+      return dxcShimReplacementCharacter;
+    }
+    codePoint = (codePoint << 6) | (bytes[i++] & 0x3f);
+  }
+
+  // Reject overlong encodings, surrogates and values past the last code point.
+  if (codePoint < minimum || codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint <= 0xdfff)) {
+    return dxcShimReplacementCharacter;
+  }
+  return codePoint;
+}
+
+// Decodes the wide code point starting at s[i], and advances i past it.
+template <typename WideChar>
+inline uint32_t dxcShimDecodeWide(const WideChar* s, size_t size, size_t& i) {
+  uint32_t unit = static_cast<uint32_t>(s[i++]);
+  if (sizeof(WideChar) == 4) {
+    bool isValid = unit <= 0x10ffff && (unit < 0xd800 || unit > 0xdfff);
+    return isValid ? unit : dxcShimReplacementCharacter;
+  }
+
+  unit &= 0xffff;
+  if (unit < 0xd800 || unit > 0xdfff) {
+    return unit;
+  }
+
+  // A high surrogate must be followed by a low one.
+  if (unit >= 0xdc00 || i >= size) {
+    return dxcShimReplacementCharacter;
+  }
+  uint32_t low = static_cast<uint32_t>(s[i]) & 0xffff;
+  if (low < 0xdc00 || low > 0xdfff) {
+    return dxcShimReplacementCharacter;
+  }
+  i++;
+  return 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+}
+
+// Encodes a code point as UTF-8 at out, and returns the number of bytes written.
+inline size_t dxcShimEncodeUtf8(uint32_t codePoint, char* out) {
+  if (codePoint < 0x80) {
+    out[0] = static_cast<char>(codePoint);
+    return 1;
+  } else if (codePoint < 0x800) {
+    out[0] = static_cast<char>(0xc0 | (codePoint >> 6));
+    out[1] = static_cast<char>(0x80 | (codePoint & 0x3f));
+    return 2;
+  } else if (codePoint < 0x10000) {
+    out[0] = static_cast<char>(0xe0 | (codePoint >> 12));
+    out[1] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+    out[2] = static_cast<char>(0x80 | (codePoint & 0x3f));
+    return 3;
+  }
+
+  out[0] = static_cast<char>(0xf0 | (codePoint >> 18));
+  out[1] = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+  out[2] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+  out[3] = static_cast<char>(0x80 | (codePoint & 0x3f));
+  return 4;
 }
 
-inline std::string utf16_to_utf8(const wchar_t* s) {
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
-    return conv.to_bytes(s);
-}
\ No newline at end of file
+// Encodes a code point as wide characters at out, and returns the number written.
+template <typename WideChar>
+inline size_t dxcShimEncodeWide(uint32_t codePoint, WideChar* out) {
+  if (sizeof(WideChar) == 4 || codePoint < 0x10000) {
+    out[0] = static_cast<WideChar>(codePoint);
+    return 1;
+  }
+
+  codePoint -= 0x10000;
+  out[0] = static_cast<WideChar>(0xd800 + (codePoint >> 10));
+  out[1] = static_cast<WideChar>(0xdc00 + (codePoint & 0x3ff));
+  return 2;
+}
+
+// Appends a UTF-8 string to a wide string.
+template <typename WideChar>
+inline void utf8_to_wide(const char* s, size_t size, std::basic_string<WideChar>& out) {
+  // Every byte produces at most one wide character, as do surrogate pairs from 4 bytes.
+  size_t start = out.size();
+  out.resize(start + size);
+  WideChar* dst = &out[0] + start;
+
+  size_t i = 0;
+  size_t written = 0;
+  while (i < size) {
+    size_t ascii = dxcShimAsciiPrefix(s + i, size - i);
+    for (size_t j = 0; j < ascii; j++) {
+      dst[written + j] = static_cast<WideChar>(s[i + j]);
+    }
+    i += ascii;
+    written += ascii;
+
+    if (i < size) {
+      written += dxcShimEncodeWide(dxcShimDecodeUtf8(s, size, i), dst + written);
+    }
+  }
+
+  out.resize(start + written);
+}
+
+// Appends a wide string to a UTF-8 string.
+template <typename WideChar>
+inline void wide_to_utf8(const WideChar* s, size_t size, std::string& out) {
+  // A UTF-32 unit produces at most 4 bytes, and a UTF-16 unit at most 3.
+  size_t start = out.size();
+  out.resize(start + size * (sizeof(WideChar) == 4 ? 4 : 3));
+  char* dst = &out[0] + start;
+
+  size_t i = 0;
+  size_t written = 0;
+  while (i < size) {
+    size_t ascii = dxcShimAsciiPrefix(s + i, size - i);
+    for (size_t j = 0; j < ascii; j++) {
+      dst[written + j] = static_cast<char>(s[i + j]);
+    }
+    i += ascii;
+    written += ascii;
+
+    if (i < size) {
+      written += dxcShimEncodeUtf8(dxcShimDecodeWide(s, size, i), dst + written);
+    }
+  }
+
+  out.resize(start + written);
+}
+
+// Converts a NUL-terminated UTF-8 string to a wide string.
+inline std::wstring utf8_to_wide(const char* s) {
+  std::wstring out;
+  utf8_to_wide(s, std::strlen(s), out);
+  return out;
+}
+
+// Converts a NUL-terminated wide string to a UTF-8 string.
+inline std::string wide_to_utf8(const wchar_t* s) {
+  std::string out;
+  wide_to_utf8(s, std::wcslen(s), out);
+  return out;
+}
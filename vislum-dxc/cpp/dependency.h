@@ -0,0 +1,120 @@
+#pragma once
+
+#include "hash.h"
+#include "include_cache.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// An include resolved by a compilation.
+struct DxcShimResolvedInclude {
+  // The normalized filename, as by DxcShimIncludeCache::normalize.
+  std::string filename;
+
+  // The hash of the contents of the include.
+  DxcShimHash hash;
+};
+
+// Returns the hash of the contents of an include.
+inline DxcShimHash hashIncludeContents(const void* data, size_t size) {
+  DxcShimHasher hasher;
+  hasher.update(data, size);
+  return hasher.finish();
+}
+
+// Called with the NUL-terminated name of every compilation found in a dependency index.
+typedef void (*DxcShimDependentCallback)(const char* name, void* userData);
+
+// Maps included files to the compilations that depend on them.
+//
+// Compilations are identified by a caller-chosen name, such as the path of the shader asset,
+// and recorded with the includes of their result. When a file changes, the index returns the
+// names of the compilations that resolved it, directly or through other includes.
+//
+// All methods are thread-safe.
+class DxcShimDependencyIndex {
+public:
+  // Records the includes of a compilation, replacing those previously recorded for the name.
+  inline void record(std::string const& name, std::vector<DxcShimResolvedInclude> const& includes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    removeLocked(name);
+
+    std::vector<DxcShimResolvedInclude>& recorded = m_includes[name];
+    recorded = includes;
+    for (DxcShimResolvedInclude const& include : recorded) {
+      m_dependents[include.filename].insert(name);
+    }
+  }
+
+  // Removes a compilation from the index, e.g. when its shader is deleted.
+  inline void remove(std::string const& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    removeLocked(name);
+  }
+
+  // Returns the names of the compilations that depend on a file.
+  //
+  // If hash is set, compilations that resolved the file with the same contents are skipped,
+  // so touching a file without changing it does not trigger recompilations.
+  inline std::vector<std::string> findDependents(std::string const& filename, const DxcShimHash* hash) {
+    std::string normalized = DxcShimIncludeCache::normalize(filename);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<std::string> dependents;
+    auto it = m_dependents.find(normalized);
+    if (it == m_dependents.end()) {
+      return dependents;
+    }
+
+    for (std::string const& name : it->second) {
+      if (hash != nullptr && getHashLocked(name, normalized) == *hash) {
+        continue;
+      }
+      dependents.push_back(name);
+    }
+    return dependents;
+  }
+
+private:
+  inline void removeLocked(std::string const& name) {
+    auto it = m_includes.find(name);
+    if (it == m_includes.end()) {
+      return;
+    }
+
+    for (DxcShimResolvedInclude const& include : it->second) {
+      auto dependents = m_dependents.find(include.filename);
+      if (dependents == m_dependents.end()) {
+        continue;
+      }
+
+      dependents->second.erase(name);
+      if (dependents->second.empty()) {
+        m_dependents.erase(dependents);
+      }
+    }
+    m_includes.erase(it);
+  }
+
+  // Returns the hash a compilation recorded for a file. The compilation must depend on it.
+  inline DxcShimHash getHashLocked(std::string const& name, std::string const& filename) const {
+    for (DxcShimResolvedInclude const& include : m_includes.at(name)) {
+      if (include.filename == filename) {
+        return include.hash;
+      }
+    }
+    return DxcShimHash {};
+  }
+
+  std::mutex m_mutex;
+
+  // The includes of every compilation, by name.
+  std::unordered_map<std::string, std::vector<DxcShimResolvedInclude>> m_includes;
+
+  // The names of the compilations depending on every file, by normalized filename.
+  std::unordered_map<std::string, std::unordered_set<std::string>> m_dependents;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum class DxcShimDiagnosticSeverity: uint8_t {
+  Error = 0,
+  Warning = 1,
+  // Additional information attached to the preceding error or warning.
+  Note = 2,
+  Remark = 3,
+};
+
+// A single message reported by DXC, such as an error or a warning.
+//
+// The strings point into the messages of the compilation result, and are not NUL-terminated.
+struct DxcShimDiagnostic {
+  DxcShimDiagnosticSeverity severity;
+
+  // The file the diagnostic refers to. Empty if it has no location, like command line errors.
+  const char* file;
+  size_t fileSize;
+
+  // The 1-based line and column. Zero if unknown.
+  uint32_t line;
+  uint32_t column;
+
+  const char* message;
+  size_t messageSize;
+};
+
+// Parses the severity at the start of s, followed by ": ". Returns its length, or 0.
+inline size_t parseDiagnosticSeverity(const char* s, size_t size, DxcShimDiagnosticSeverity& severity) {
+  static const struct {
+    const char* prefix;
+    DxcShimDiagnosticSeverity severity;
+  } severities[] = {
+    { "fatal error: ", DxcShimDiagnosticSeverity::Error },
+    { "error: ", DxcShimDiagnosticSeverity::Error },
+    { "warning: ", DxcShimDiagnosticSeverity::Warning },
+    { "note: ", DxcShimDiagnosticSeverity::Note },
+    { "remark: ", DxcShimDiagnosticSeverity::Remark },
+  };
+
+  for (auto const& entry : severities) {
+    size_t length = std::strlen(entry.prefix);
+    if (size >= length && std::memcmp(s, entry.prefix, length) == 0) {
+      severity = entry.severity;
+      return length;
+    }
+  }
+  return 0;
+}
+
+// Parses the decimal number at s[i], and advances i past it. Returns false if there is none.
+inline bool parseDiagnosticNumber(const char* s, size_t size, size_t& i, uint32_t& value) {
+  size_t start = i;
+  value = 0;
+  while (i < size && s[i] >= '0' && s[i] <= '9') {
+    value = value * 10 + static_cast<uint32_t>(s[i] - '0');
+    i++;
+  }
+  return i > start;
+}
+
+// Parses a single line of DXC output as a diagnostic. Returns false if it is not one, like
+// the source excerpts and carets following a diagnostic.
+//
+// Diagnostics are "file:line:column: severity: message", or "severity: message" if they have
+// no location. The filename may itself contain colons, as in Windows drive letters, so every
+// colon is tried as the start of the location.
+inline bool parseDiagnosticLine(const char* s, size_t size, DxcShimDiagnostic& diagnostic) {
+  diagnostic = DxcShimDiagnostic {};
+
+  size_t severityLength = parseDiagnosticSeverity(s, size, diagnostic.severity);
+  if (severityLength != 0) {
+    diagnostic.file = s;
+    diagnostic.message = s + severityLength;
+    diagnostic.messageSize = size - severityLength;
+    return true;
+  }
+
+  for (size_t colon = 1; colon < size; colon++) {
+    if (s[colon] != ':') {
+      continue;
+    }
+
+    size_t i = colon + 1;
+    uint32_t line, column = 0;
+    if (!parseDiagnosticNumber(s, size, i, line) || i >= size || s[i] != ':') {
+      continue;
+    }
+    i++;
+
+    // The column is optional.
+    if (parseDiagnosticNumber(s, size, i, column)) {
+      if (i >= size || s[i] != ':') {
+        continue;
+      }
+      i++;
+    }
+
+    if (i >= size || s[i] != ' ') {
+      continue;
+    }
+    i++;
+
+    severityLength = parseDiagnosticSeverity(s + i, size - i, diagnostic.severity);
+    if (severityLength == 0) {
+      continue;
+    }
+    i += severityLength;
+
+    diagnostic.file = s;
+    diagnostic.fileSize = colon;
+    diagnostic.line = line;
+    diagnostic.column = column;
+    diagnostic.message = s + i;
+    diagnostic.messageSize = size - i;
+    return true;
+  }
+  return false;
+}
+
+// Appends the diagnostics found in the output of DXC to diagnostics.
+//
+// The diagnostics point into text, which must outlive them.
+inline void parseDiagnostics(const char* text, size_t size, std::vector<DxcShimDiagnostic>& diagnostics) {
+  size_t start = 0;
+  while (start < size) {
+    const char* newline = static_cast<const char*>(std::memchr(text + start, '\n', size - start));
+    size_t end = newline != nullptr ? static_cast<size_t>(newline - text) : size;
+
+    size_t lineSize = end - start;
+    if (lineSize > 0 && text[start + lineSize - 1] == '\r') {
+      lineSize--;
+    }
+
+    DxcShimDiagnostic diagnostic;
+    if (parseDiagnosticLine(text + start, lineSize, diagnostic)) {
+      diagnostics.push_back(diagnostic);
+    }
+
+    start = end + 1;
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A 128-bit content hash.
+struct DxcShimHash {
+  uint64_t high;
+  uint64_t low;
+
+  inline bool operator==(DxcShimHash const& other) const {
+    return high == other.high && low == other.low;
+  }
+
+  inline bool operator!=(DxcShimHash const& other) const {
+    return !(*this == other);
+  }
+
+  // Returns the hash as 32 lowercase hexadecimal digits.
+  inline std::string toHex() const {
+    static const char digits[] = "0123456789abcdef";
+
+    std::string hex(32, '0');
+    for (size_t i = 0; i < 16; i++) {
+      hex[15 - i] = digits[(high >> (i * 4)) & 0xf];
+      hex[31 - i] = digits[(low >> (i * 4)) & 0xf];
+    }
+    return hex;
+  }
+};
+
+// Hashes a DxcShimHash for unordered containers. The hash is already uniform, so its low bits
+// are used as is.
+struct DxcShimHashHasher {
+  inline size_t operator()(DxcShimHash const& hash) const {
+    return static_cast<size_t>(hash.low);
+  }
+};
+
+// An incremental 128-bit FNV-1a hasher.
+//
+// Not cryptographic, but wide enough that accidental collisions between cache keys are not a
+// concern.
+class DxcShimHasher {
+public:
+  inline void update(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+      m_state ^= bytes[i];
+      m_state *= prime();
+    }
+  }
+
+  inline void update(uint64_t value) {
+    uint8_t bytes[8];
+    for (size_t i = 0; i < 8; i++) {
+      bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+    update(bytes, sizeof(bytes));
+  }
+
+  // Hashes a length-prefixed field, so that the boundaries between consecutive fields are part
+  // of the hash.
+  inline void updateField(const void* data, size_t size) {
+    update(static_cast<uint64_t>(size));
+    update(data, size);
+  }
+
+  inline void updateField(std::string const& value) {
+    updateField(value.data(), value.size());
+  }
+
+  inline DxcShimHash finish() const {
+    return DxcShimHash {
+      static_cast<uint64_t>(m_state >> 64),
+      static_cast<uint64_t>(m_state),
+    };
+  }
+
+private:
+  inline static unsigned __int128 prime() {
+    return (static_cast<unsigned __int128>(0x0000000001000000ull) << 64) | 0x000000000000013bull;
+  }
+
+  unsigned __int128 m_state {
+    (static_cast<unsigned __int128>(0x6c62272e07bb0142ull) << 64) | 0x62b821756295c58dull
+  };
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "common.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A cache of include blobs, shared by any number of compilers.
+//
+// Serves repeated includes from already created blobs instead of calling back into the user and
+// creating a new blob every time. Entries are keyed by normalized filename, so "./a/../b.hlsl"
+// and "b.hlsl" share an entry. The cache assumes a filename resolves to the same contents until
+// it is invalidated.
+class DxcShimIncludeCache {
+public:
+  // Returns the blob cached for the normalized filename, or NULL.
+  inline CComPtr<IDxcBlobEncoding> find(std::string const& filename) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    CComPtr<IDxcBlobEncoding> blob;
+    auto it = m_blobs.find(filename);
+    if (it != m_blobs.end()) {
+      blob = it->second;
+    }
+    return blob;
+  }
+
+  inline void insert(std::string const& filename, IDxcBlobEncoding* blob) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blobs[filename] = blob;
+  }
+
+  // Removes the entry of a file, e.g. after the file changed on disk.
+  inline void invalidate(std::string const& filename) {
+    std::string normalized = normalize(filename);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blobs.erase(normalized);
+  }
+
+  inline void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blobs.clear();
+  }
+
+  // Normalizes a filename as passed to the include handler.
+  //
+  // Backslashes become forward slashes, and empty, "." and ".." components are resolved.
+  // Leading ".." components of relative paths are kept. The normalized filename is never
+  // longer than the filename.
+  inline static std::string normalize(std::string const& filename) {
+    bool absolute = !filename.empty() && (filename[0] == '/' || filename[0] == '\\');
+
+    std::vector<std::string> components;
+    std::string component;
+    for (size_t i = 0; i <= filename.size(); i++) {
+      char c = i < filename.size() ? filename[i] : '/';
+      if (c != '/' && c != '\\') {
+        component += c;
+        continue;
+      }
+
+      if (component == "..") {
+        if (!components.empty() && components.back() != "..") {
+          components.pop_back();
+        } else if (!absolute) {
+          components.push_back(component);
+        }
+      } else if (!component.empty() && component != ".") {
+        components.push_back(component);
+      }
+      component.clear();
+    }
+
+    std::string normalized = absolute ? "/" : "";
+    for (size_t i = 0; i < components.size(); i++) {
+      if (i != 0) {
+        normalized += '/';
+      }
+      normalized += components[i];
+    }
+    return normalized;
+  }
+
+private:
+  std::mutex m_mutex;
+  std::unordered_map<std::string, CComPtr<IDxcBlobEncoding>> m_blobs;
+};
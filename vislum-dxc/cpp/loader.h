@@ -0,0 +1,149 @@
+#pragma once
+
+#include "common.h"
+#include "trace.h"
+#include <atomic>
+#include <dlfcn.h>
+#include <mutex>
+#include <string>
+
+// The options of the loader.
+struct DxcShimLoaderOptions {
+  // The path or soname of the DXC library. NULL uses "libdxcompiler.so".
+  const char* libraryPath;
+
+  // Whether to open the library only when the first compiler is created, instead of right away.
+  // A process that loads all its shaders from an archive then never loads DXC. Cache lookups
+  // still load it, as cache keys are computed from the preprocessed source.
+  bool deferOpen;
+
+  // Whether to resolve the symbols of the library when first called (RTLD_LAZY), instead of
+  // all of them when it is opened (RTLD_NOW).
+  bool lazyBinding;
+};
+
+// Loads the DXC library and resolves DxcCreateInstance2.
+//
+// The loader is a reference-counted, process-wide singleton: the library is opened at most once
+// however many loaders are acquired, and closed when the last one is released. The options of the
+// first acquisition apply until then.
+class DxcShimLoader {
+public:
+  // Acquires the loader, creating it with the given options if none is alive.
+  //
+  // Unless the open is deferred, throws a DxcShimException if the library cannot be loaded.
+  inline static DxcShimLoader* acquire(DxcShimLoaderOptions const& options) {
+    std::lock_guard<std::mutex> lock(getInstanceMutex());
+
+    DxcShimLoader*& instance = getInstance();
+    bool isCreated = instance == nullptr;
+    if (isCreated) {
+      instance = new DxcShimLoader(options);
+    }
+
+    if (!options.deferOpen) {
+      try {
+        instance->open();
+      } catch (DxcShimException const&) {
+        if (isCreated) {
+          delete instance;
+          instance = nullptr;
+        }
+        throw;
+      }
+    }
+
+    instance->m_refCount++;
+    return instance;
+  }
+
+  // Acquires the loader with the default options, opening the library right away.
+  inline static DxcShimLoader* acquire() {
+    DxcShimLoaderOptions options = {};
+    return acquire(options);
+  }
+
+  // Releases a reference to the loader, closing the library if it was the last.
+  inline void release() {
+    std::lock_guard<std::mutex> lock(getInstanceMutex());
+
+    if (--m_refCount == 0) {
+      getInstance() = nullptr;
+      delete this;
+    }
+  }
+
+  // Returns DxcCreateInstance2, opening the library if it is not yet.
+  //
+  // Throws a DxcShimException if the library cannot be loaded. Safe to call from many threads.
+  inline DxcCreateInstance2Proc getCreateInstance2Proc() const {
+    DxcCreateInstance2Proc createInstance2 = m_createInstance2.load(std::memory_order_acquire);
+    if (createInstance2 == nullptr) {
+      createInstance2 = open();
+    }
+    return createInstance2;
+  }
+
+  // Returns whether the library has been opened.
+  inline bool isLoaded() const {
+    return m_createInstance2.load(std::memory_order_acquire) != nullptr;
+  }
+
+private:
+  inline explicit DxcShimLoader(DxcShimLoaderOptions const& options)
+    : m_libraryPath(options.libraryPath != nullptr ? options.libraryPath : "libdxcompiler.so")
+    , m_flags(options.lazyBinding ? RTLD_LAZY : RTLD_NOW) {}
+
+  ~DxcShimLoader() {
+    if (m_handle != nullptr) {
+      dlclose(m_handle);
+    }
+  }
+
+  // Opens the library, unless it is already. A failed open is retried on the next call.
+  inline DxcCreateInstance2Proc open() const {
+    std::lock_guard<std::mutex> lock(m_openMutex);
+
+    DxcCreateInstance2Proc createInstance2 = m_createInstance2.load(std::memory_order_relaxed);
+    if (createInstance2 != nullptr) {
+      return createInstance2;
+    }
+
+    DXC_SHIM_TRACE_SCOPE("open library");
+    void* handle = dlopen(m_libraryPath.c_str(), m_flags);
+    if (handle == nullptr) {
+      throw DxcShimException(DxcShimStatus::OpenLibraryError);
+    }
+
+    createInstance2 = (DxcCreateInstance2Proc)dlsym(handle, "DxcCreateInstance2");
+    if (createInstance2 == nullptr) {
+      dlclose(handle);
+      throw DxcShimException(DxcShimStatus::GetCreateInstance2SymbolError);
+    }
+
+    m_handle = handle;
+    m_createInstance2.store(createInstance2, std::memory_order_release);
+    return createInstance2;
+  }
+
+  inline static std::mutex& getInstanceMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  inline static DxcShimLoader*& getInstance() {
+    static DxcShimLoader* instance = nullptr;
+    return instance;
+  }
+
+  std::string m_libraryPath;
+  int m_flags;
+
+  // Guarded by the instance mutex.
+  size_t m_refCount = 0;
+
+  // The library is opened on first use, so these are set by a const method.
+  mutable std::mutex m_openMutex;
+  mutable void* m_handle = nullptr;
+  mutable std::atomic<DxcCreateInstance2Proc> m_createInstance2 {nullptr};
+};
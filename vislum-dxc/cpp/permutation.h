@@ -0,0 +1,127 @@
+#pragma once
+
+#include "batch.h"
+#include "wrapper.h"
+#include "pool.h"
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// An axis of a permutation: a define and the values it takes across the variants.
+struct DxcShimPermutationAxis {
+  const char* name;
+
+  // The values of the define. A NULL value leaves the define out of the variant, so a feature
+  // toggle is { NULL, "1" }.
+  const char* const* values;
+  size_t valueCount;
+};
+
+// Returns the number of variants of a permutation, the product of the value counts of its
+// axes. A permutation without axes has a single variant.
+inline size_t countPermutations(const DxcShimPermutationAxis* axes, size_t axisCount) {
+  size_t count = 1;
+  for (size_t i = 0; i < axisCount; i++) {
+    count *= axes[i].valueCount;
+  }
+  return count;
+}
+
+// Compiles every variant of a source over the combinations of values of the axes.
+//
+// Variants are numbered with the last axis varying fastest, as nested loops over the axes
+// would. The defines of a variant follow those of the base options.
+//
+// All variants are first preprocessed in parallel, and variants whose preprocessed source is
+// identical to that of an earlier variant are not compiled: for those, representatives
+// receives the index of the earlier variant and results a NULL entry. The remaining variants
+// are then compiled in parallel, with representatives set to their own index. results and
+// representatives must point to countPermutations entries, and the results must be freed by
+// the caller.
+//
+// The include callback is invoked from several threads at once, with the same userData for
+// every variant.
+inline void compilePermutations(
+  DxcShimCompilerPool& pool,
+  const char* source,
+  size_t sourceSize,
+  DxcShimCompileOptions const& options,
+  const DxcShimPermutationAxis* axes,
+  size_t axisCount,
+  size_t threadCount,
+  DxcShimUserCallback userCallback,
+  void* userData,
+  DxcShimCompilationResult** results,
+  size_t* representatives) {
+  size_t variantCount = countPermutations(axes, axisCount);
+
+  std::vector<std::vector<DxcShimDefine>> defines(variantCount);
+  for (size_t variant = 0; variant < variantCount; variant++) {
+    std::vector<DxcShimDefine>& variantDefines = defines[variant];
+    variantDefines.reserve(options.defineCount + axisCount);
+    variantDefines.assign(options.defines, options.defines + options.defineCount);
+
+    size_t remainder = variant;
+    size_t first = variantDefines.size();
+    for (size_t axis = axisCount; axis-- > 0;) {
+      const char* value = axes[axis].values[remainder % axes[axis].valueCount];
+      remainder /= axes[axis].valueCount;
+
+      if (value != nullptr) {
+        variantDefines.push_back(DxcShimDefine { axes[axis].name, value });
+      }
+    }
+
+    // Keep the defines in axis order, so the arguments read like the declaration.
+    std::reverse(variantDefines.begin() + first, variantDefines.end());
+  }
+
+  auto buildArguments = [&](size_t variant, DxcShimArguments& args) {
+    DxcShimCompileOptions variantOptions = options;
+    variantOptions.defines = defines[variant].data();
+    variantOptions.defineCount = defines[variant].size();
+    DxcShimCompiler::buildArguments(variantOptions, args);
+  };
+
+  DxcShimCancellation cancellation = DxcShimCompiler::buildCancellation(options);
+
+  // Variants that fail to preprocess have no hash, and are compiled to report their errors.
+  std::vector<DxcShimHash> hashes(variantCount);
+  std::vector<char> hasHash(variantCount, false);
+  runOnPool(pool, variantCount, threadCount, [&](DxcShimCompiler& compiler, DxcShimArguments& args, size_t variant) {
+    buildArguments(variant, args);
+
+    DxcShimPriorityScope priorityScope(compiler.getPriorityGate(), options.priority);
+    DxcShimCompilationResult result;
+    compiler.preprocess(source, sourceSize, args, cancellation, userCallback, userData, result);
+    const DxcShimHash* hash = result.getPreprocessedHash();
+    if (hash != nullptr) {
+      hashes[variant] = *hash;
+      hasHash[variant] = true;
+    }
+  });
+
+  std::vector<size_t> unique;
+  std::unordered_map<DxcShimHash, size_t, DxcShimHashHasher> variantsByHash;
+  for (size_t variant = 0; variant < variantCount; variant++) {
+    results[variant] = nullptr;
+    representatives[variant] = variant;
+
+    if (hasHash[variant]) {
+      auto inserted = variantsByHash.insert(std::make_pair(hashes[variant], variant));
+      if (!inserted.second) {
+        representatives[variant] = inserted.first->second;
+        continue;
+      }
+    }
+    unique.push_back(variant);
+  }
+
+  runOnPool(pool, unique.size(), threadCount, [&](DxcShimCompiler& compiler, DxcShimArguments& args, size_t i) {
+    size_t variant = unique[i];
+    buildArguments(variant, args);
+
+    DxcShimPriorityScope priorityScope(compiler.getPriorityGate(), options.priority);
+    results[variant] = compiler.compile(source, sourceSize, args, cancellation, userCallback, userData);
+  });
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "wrapper.h"
+#include <mutex>
+#include <vector>
+
+// A pool of compilers sharing a single loader.
+//
+// A DXC compiler instance must not be used by more than one thread at a time, so each worker
+// acquires a compiler for the duration of its compilations and releases it afterwards. Released
+// compilers are kept and handed out again, so the IDxcCompiler3/IDxcUtils pair is only created
+// when the pool needs to grow. The lock only guards the idle list and the settings new compilers
+// are created with, and is never held while compiling.
+class DxcShimCompilerPool {
+public:
+  // Throws a DxcShimException if creating a compiler fails, after destroying the ones created.
+  inline explicit DxcShimCompilerPool(DxcShimLoader const& loader, size_t initialSize)
+    : m_loader(loader) {
+    m_idle.reserve(initialSize);
+    try {
+      for (size_t i = 0; i < initialSize; i++) {
+        DxcShimCompiler* compiler = new DxcShimCompiler(m_loader);
+        compiler->setParentStats(&m_stats);
+        compiler->setPriorityGate(&m_priorityGate);
+        m_idle.push_back(compiler);
+      }
+    } catch (...) {
+      // The destructor does not run for a constructor that throws.
+      for (DxcShimCompiler* compiler : m_idle) {
+        delete compiler;
+      }
+      throw;
+    }
+  }
+
+  DxcShimCompilerPool(DxcShimCompilerPool const&) = delete;
+  DxcShimCompilerPool& operator=(DxcShimCompilerPool const&) = delete;
+
+  ~DxcShimCompilerPool() {
+    for (DxcShimCompiler* compiler : m_idle) {
+      delete compiler;
+    }
+  }
+
+  // Acquires an idle compiler, creating a new one if none is available.
+  //
+  // Throws a DxcShimException if a new compiler has to be created and creation fails.
+  inline DxcShimCompiler* acquire() {
+    DXC_SHIM_TRACE_SCOPE("acquire compiler");
+    DxcShimCache* cache;
+    DxcShimIncludeCache* includeCache;
+    DxcShimRemoteCache* remoteCache;
+    DxcShimPrelude* prelude;
+    DxcShimCompileServerClient const* compileServer;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_idle.empty()) {
+        DxcShimCompiler* compiler = m_idle.back();
+        m_idle.pop_back();
+        return compiler;
+      }
+
+      // Read under the lock, as they may be set concurrently with acquiring a compiler for
+      // another thread.
+      cache = m_cache;
+      includeCache = m_includeCache;
+      remoteCache = m_remoteCache;
+      prelude = m_prelude;
+      compileServer = m_compileServer;
+    }
+
+    // Created outside of the lock, as instance creation is comparatively slow.
+    DxcShimCompiler* compiler = new DxcShimCompiler(m_loader);
+    compiler->setCache(cache);
+    compiler->setIncludeCache(includeCache);
+    compiler->setRemoteCache(remoteCache);
+    compiler->setPrelude(prelude);
+    compiler->setCompileServer(compileServer);
+    compiler->setParentStats(&m_stats);
+    compiler->setPriorityGate(&m_priorityGate);
+    return compiler;
+  }
+
+  // Returns a compiler to the pool. The compiler must have been acquired from this pool.
+  inline void release(DxcShimCompiler* compiler) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.push_back(compiler);
+  }
+
+  // Sets the cache used by all compilers of the pool. NULL disables caching.
+  //
+  // Must not be called while compilers are acquired. The cache must outlive the pool, or be
+  // replaced before it is closed.
+  inline void setCache(DxcShimCache* cache) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache = cache;
+    for (DxcShimCompiler* compiler : m_idle) {
+      compiler->setCache(cache);
+    }
+  }
+
+  // Sets the include cache used by all compilers of the pool. NULL disables include caching.
+  //
+  // Must not be called while compilers are acquired. The include cache must outlive the pool,
+  // or be replaced before it is destroyed.
+  inline void setIncludeCache(DxcShimIncludeCache* includeCache) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_includeCache = includeCache;
+    for (DxcShimCompiler* compiler : m_idle) {
+      compiler->setIncludeCache(includeCache);
+    }
+  }
+
+  // Sets the remote cache used by all compilers of the pool. NULL disables it.
+  //
+  // Must not be called while compilers are acquired. The remote cache must outlive the pool, or
+  // be replaced before it is destroyed.
+  inline void setRemoteCache(DxcShimRemoteCache* remoteCache) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_remoteCache = remoteCache;
+    for (DxcShimCompiler* compiler : m_idle) {
+      compiler->setRemoteCache(remoteCache);
+    }
+  }
+
+  // Sets the prelude of all compilers of the pool. NULL disables it.
+  //
+  // Must not be called while compilers are acquired. The prelude must outlive the pool, or be
+  // replaced before it is destroyed.
+  inline void setPrelude(DxcShimPrelude* prelude) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_prelude = prelude;
+    for (DxcShimCompiler* compiler : m_idle) {
+      compiler->setPrelude(prelude);
+    }
+  }
+
+  // Sets the compile server used by all compilers of the pool. NULL compiles in process.
+  //
+  // Must not be called while compilers are acquired. The client must outlive the pool, or be
+  // replaced before it is destroyed.
+  inline void setCompileServer(DxcShimCompileServerClient const* compileServer) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_compileServer = compileServer;
+    for (DxcShimCompiler* compiler : m_idle) {
+      compiler->setCompileServer(compileServer);
+    }
+  }
+
+  // Returns the statistics accumulated over all compilations of the compilers of this pool.
+  inline DxcShimStatsCounters& getStats() {
+    return m_stats;
+  }
+
+  // Returns the gate the compilations of the compilers of this pool are scheduled against.
+  inline DxcShimPriorityGate& getPriorityGate() {
+    return m_priorityGate;
+  }
+
+  inline DxcShimLoader const& getLoader() const {
+    return m_loader;
+  }
+
+private:
+  DxcShimLoader const& m_loader;
+  std::mutex m_mutex;
+  std::vector<DxcShimCompiler*> m_idle;
+  DxcShimCache* m_cache = nullptr;
+  DxcShimIncludeCache* m_includeCache = nullptr;
+  DxcShimRemoteCache* m_remoteCache = nullptr;
+  DxcShimPrelude* m_prelude = nullptr;
+  DxcShimCompileServerClient const* m_compileServer = nullptr;
+  DxcShimStatsCounters m_stats;
+  DxcShimPriorityGate m_priorityGate;
+};
+
+// A compiler acquired from a pool, released back to it when destroyed.
+class DxcShimPooledCompiler {
+public:
+  inline explicit DxcShimPooledCompiler(DxcShimCompilerPool& pool)
+    : m_pool(pool)
+    , m_compiler(pool.acquire()) {}
+
+  DxcShimPooledCompiler(DxcShimPooledCompiler const&) = delete;
+  DxcShimPooledCompiler& operator=(DxcShimPooledCompiler const&) = delete;
+
+  ~DxcShimPooledCompiler() {
+    m_pool.release(m_compiler);
+  }
+
+  inline DxcShimCompiler* operator->() const {
+    return m_compiler;
+  }
+
+  inline DxcShimCompiler& operator*() const {
+    return *m_compiler;
+  }
+
+private:
+  DxcShimCompilerPool& m_pool;
+  DxcShimCompiler* m_compiler;
+};
@@ -0,0 +1,350 @@
+#pragma once
+
+#include "dependency.h"
+#include "hash.h"
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The expansion of a prelude for one set of arguments.
+struct DxcShimPreludeExpansion {
+  // False if the prelude failed to expand, in which case sources are compiled as they are.
+  bool isUsable;
+
+  // The preprocessed prelude, with the macros it defines restored as directives.
+  std::string source;
+
+  // The includes resolved by the prelude.
+  std::vector<DxcShimResolvedInclude> includes;
+
+  // The normalized filenames of the includes of the prelude marked with #pragma once, which
+  // the preprocessor would not include again.
+  std::vector<std::string> onceIncludes;
+};
+
+// A prelude shared by many shaders, such as the chain of includes every shader starts with.
+//
+// Sources that start with the prelude are compiled from its expansion: the prelude run through
+// the preprocessor once per set of arguments, with its includes resolved and inlined, its
+// conditionals evaluated, and its macros expanded. The macros it defines are kept as directives,
+// so the rest of the source sees them as it would have. DXC cannot serialize its AST, so the
+// expansion is still parsed by every compilation, but no longer preprocessed.
+//
+// The expansion does not carry the include-once state of the preprocessor. Includes guarded by
+// #ifndef are skipped by their guard macros, which the expansion keeps. Includes of the prelude
+// marked with #pragma once are recorded instead, and served empty when included again.
+//
+// Expansions are cached by the arguments of the compilation, as defines may change what the
+// prelude expands to. The cache assumes the includes of the prelude do not change until it is
+// cleared. Diagnostics within the prelude point into its expansion.
+class DxcShimPrelude {
+public:
+  inline DxcShimPrelude(const char* data, size_t size)
+    : m_source(data, size) {}
+
+  // Returns the size of the prelude at the start of the source, or 0 if the source does not
+  // start with it. The prelude must end at the end of a line of the source.
+  inline size_t match(const char* data, size_t size) const {
+    if (m_source.empty() || size < m_source.size() || std::memcmp(data, m_source.data(), m_source.size()) != 0) {
+      return 0;
+    }
+
+    size_t end = m_source.size();
+    if (m_source.back() == '\n' || end == size) {
+      return end;
+    }
+    if (data[end] == '\n') {
+      return end + 1;
+    }
+    return 0;
+  }
+
+  // Returns the source the prelude is expanded from, with directives echoing its macros.
+  inline std::string buildExpansionSource() const {
+    return buildExpansionSource(m_source.data(), m_source.size());
+  }
+
+  // Returns the expansion cached for the hash of the arguments, or NULL if there is none.
+  inline std::shared_ptr<const DxcShimPreludeExpansion> find(DxcShimHash const& argsHash) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_expansions.find(argsHash);
+    return it != m_expansions.end() ? it->second : nullptr;
+  }
+
+  // Caches an expansion. The oldest expansion is evicted once too many are cached.
+  inline void insert(DxcShimHash const& argsHash, std::shared_ptr<const DxcShimPreludeExpansion> expansion) {
+    static const size_t maxExpansionCount = 64;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_expansions.emplace(argsHash, std::move(expansion)).second) {
+      return;
+    }
+
+    m_order.push_back(argsHash);
+    if (m_order.size() > maxExpansionCount) {
+      m_expansions.erase(m_order.front());
+      m_order.pop_front();
+    }
+  }
+
+  // Removes all expansions, e.g. after an include of the prelude changed on disk.
+  inline void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_expansions.clear();
+    m_order.clear();
+  }
+
+  // Returns whether a source has a #pragma once directive, wherever it appears.
+  inline static bool hasPragmaOnce(const char* data, size_t size) {
+    size_t start = 0;
+    while (start < size) {
+      const char* newline = static_cast<const char*>(std::memchr(data + start, '\n', size - start));
+      size_t end = newline != nullptr ? static_cast<size_t>(newline - data) : size;
+
+      const char* it = matchPragma(data + start, data + end);
+      if (it != nullptr && matchWord(it, data + end, "once")) {
+        return true;
+      }
+      start = end + 1;
+    }
+    return false;
+  }
+
+  // Returns the source a prelude is expanded from: the prelude with its macro directives
+  // echoed, and a last pragma marking its end.
+  inline static std::string buildExpansionSource(const char* data, size_t size) {
+    // Every line of the echoed source ends with a newline.
+    std::string source = echoMacroDirectives(data, size);
+    source += "#pragma ";
+    source += endPragma;
+    source += "\n";
+    return source;
+  }
+
+  // Adds a pragma after every #define and #undef directive of a source, echoing the directive.
+  //
+  // The preprocessor drops directives from its output, but prints unknown pragmas, so the
+  // echoes of the directives in the branches taken end up in the preprocessed output, in order.
+  // The directive is echoed as a string literal, as the preprocessor may expand the macros in
+  // the operands of unknown pragmas, such as DXC does with Microsoft extensions. Line
+  // continuations are joined and comments dropped, as the echo spans a single line.
+  inline static std::string echoMacroDirectives(const char* data, size_t size) {
+    while (size > 0 && data[size - 1] == '\0') {
+      size--;
+    }
+
+    std::string echoed;
+    echoed.reserve(size);
+
+    size_t start = 0;
+    while (start < size) {
+      // A logical line, up to the first newline that is not escaped.
+      size_t end = start;
+      while (end < size && (data[end] != '\n' || isEscaped(data + start, data + end))) {
+        end++;
+      }
+      echoed.append(data + start, end - start);
+      echoed += '\n';
+
+      const char* directive = matchMacroDirective(data + start, data + end);
+      if (directive != nullptr) {
+        echoed += "#pragma ";
+        echoed += echoPragma;
+        echoed += ' ';
+        appendDirective(directive, data + end, echoed);
+        echoed += '\n';
+      }
+      start = end + 1;
+    }
+    return echoed;
+  }
+
+  // Turns the echoed directives of a preprocessed expansion back into directives. Returns false
+  // if the pragmas did not survive preprocessing, or an echo was changed by it.
+  inline static bool restoreMacroDirectives(const char* data, size_t size, std::string& source) {
+    source.clear();
+    source.reserve(size);
+
+    size_t start = 0;
+    while (start < size) {
+      size_t end = start;
+      while (end < size && data[end] != '\n') {
+        end++;
+      }
+
+      const char* pragma = matchPragma(data + start, data + end);
+      if (pragma != nullptr && matchWord(pragma, data + end, endPragma)) {
+        return true;
+      }
+      if (pragma != nullptr && matchWord(pragma, data + end, echoPragma)) {
+        const char* literal = skipSpaces(pragma + std::strlen(echoPragma), data + end);
+        if (!restoreDirective(literal, data + end, source)) {
+          return false;
+        }
+      } else {
+        source.append(data + start, end - start);
+      }
+      source += '\n';
+      start = end + 1;
+    }
+
+    // The end of the prelude was never reached, so the echoes may be missing as well.
+    return false;
+  }
+
+private:
+  // The pragmas the macro directives are echoed with. Unknown to DXC, which ignores them.
+  static constexpr const char* echoPragma = "vislum_prelude_directive";
+  static constexpr const char* endPragma = "vislum_prelude_end";
+
+  inline static const char* skipSpaces(const char* it, const char* end) {
+    while (it < end && (*it == ' ' || *it == '\t')) {
+      it++;
+    }
+    return it;
+  }
+
+  // Returns the start of the pragma name if a line is a #pragma directive.
+  inline static const char* matchPragma(const char* it, const char* end) {
+    it = skipSpaces(it, end);
+    if (it == end || *it != '#') {
+      return nullptr;
+    }
+
+    it = skipSpaces(it + 1, end);
+    if (!matchWord(it, end, "pragma")) {
+      return nullptr;
+    }
+    return skipSpaces(it + 6, end);
+  }
+
+  // Returns whether a line continues with the given word, followed by a space or its end.
+  inline static bool matchWord(const char* it, const char* end, const char* word) {
+    size_t length = std::strlen(word);
+    if (static_cast<size_t>(end - it) < length || std::memcmp(it, word, length) != 0) {
+      return false;
+    }
+    return it + length == end || it[length] == ' ' || it[length] == '\t' || it[length] == '\r';
+  }
+
+  // Returns whether the newline at the end of a line is escaped by a line continuation.
+  inline static bool isEscaped(const char* start, const char* newline) {
+    if (newline > start && newline[-1] == '\r') {
+      newline--;
+    }
+    return newline > start && newline[-1] == '\\';
+  }
+
+  // Returns the start of the directive name if a line is a #define or #undef directive.
+  inline static const char* matchMacroDirective(const char* it, const char* end) {
+    while (it < end && (*it == ' ' || *it == '\t')) {
+      it++;
+    }
+    if (it == end || *it != '#') {
+      return nullptr;
+    }
+    it++;
+    while (it < end && (*it == ' ' || *it == '\t')) {
+      it++;
+    }
+
+    static const char* const names[] = { "define", "undef" };
+    for (const char* name : names) {
+      size_t length = std::strlen(name);
+      if (static_cast<size_t>(end - it) > length
+        && std::memcmp(it, name, length) == 0
+        && (it[length] == ' ' || it[length] == '\t')) {
+        return it;
+      }
+    }
+    return nullptr;
+  }
+
+  // Appends a directive as a string literal on a single line, without line continuations or
+  // comments.
+  inline static void appendDirective(const char* it, const char* end, std::string& echoed) {
+    echoed += '"';
+    char quote = '\0';
+    while (it < end) {
+      if (*it == '\\' && it + 1 < end && (it[1] == '\n' || (it[1] == '\r' && it + 2 < end && it[2] == '\n'))) {
+        echoed += ' ';
+        it += it[1] == '\n' ? 2 : 3;
+      } else if (*it == '\r') {
+        it++;
+      } else if (quote != '\0') {
+        // Comments do not start within string and character literals.
+        if (*it == quote) {
+          quote = '\0';
+        } else if (*it == '\\' && it + 1 < end) {
+          appendEscaped(*it++, echoed);
+        }
+        appendEscaped(*it++, echoed);
+      } else if (*it == '/' && it + 1 < end && it[1] == '/') {
+        break;
+      } else if (*it == '/' && it + 1 < end && it[1] == '*') {
+        const char* close = it + 2;
+        while (close + 1 < end && !(close[0] == '*' && close[1] == '/')) {
+          close++;
+        }
+        if (close + 1 >= end) {
+          break;
+        }
+        echoed += ' ';
+        it = close + 2;
+      } else {
+        if (*it == '"' || *it == '\'') {
+          quote = *it;
+        }
+        appendEscaped(*it++, echoed);
+      }
+    }
+    echoed += '"';
+  }
+
+  inline static void appendEscaped(char c, std::string& echoed) {
+    if (c == '"' || c == '\\') {
+      echoed += '\\';
+    }
+    echoed += c;
+  }
+
+  // Appends the directive echoed by a string literal, which must end the line. Returns false if
+  // the literal is malformed or does not hold a #define or #undef directive.
+  inline static bool restoreDirective(const char* it, const char* end, std::string& source) {
+    if (it == end || *it != '"') {
+      return false;
+    }
+
+    size_t directive = source.size();
+    source += '#';
+    for (it++; it < end && *it != '"'; it++) {
+      if (*it == '\\') {
+        it++;
+        if (it == end || (*it != '"' && *it != '\\')) {
+          return false;
+        }
+      }
+      source += *it;
+    }
+    if (it == end) {
+      return false;
+    }
+
+    it = skipSpaces(it + 1, end);
+    if (it < end && *it == '\r') {
+      it++;
+    }
+    return it == end && matchMacroDirective(source.data() + directive, source.data() + source.size()) != nullptr;
+  }
+
+  std::string m_source;
+
+  std::mutex m_mutex;
+  std::unordered_map<DxcShimHash, std::shared_ptr<const DxcShimPreludeExpansion>, DxcShimHashHasher> m_expansions;
+  std::deque<DxcShimHash> m_order;
+};
@@ -0,0 +1,753 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// The type of a descriptor binding. Values match VkDescriptorType.
+enum class DxcShimDescriptorType: uint32_t {
+  Sampler = 0,
+  CombinedImageSampler = 1,
+  SampledImage = 2,
+  StorageImage = 3,
+  UniformTexelBuffer = 4,
+  StorageTexelBuffer = 5,
+  UniformBuffer = 6,
+  StorageBuffer = 7,
+  InputAttachment = 10,
+  AccelerationStructure = 1000150000,
+};
+
+// The stage of an entry point. Values match VkShaderStageFlagBits.
+enum class DxcShimShaderStage: uint32_t {
+  Unknown = 0,
+  Vertex = 0x1,
+  TessellationControl = 0x2,
+  TessellationEvaluation = 0x4,
+  Geometry = 0x8,
+  Fragment = 0x10,
+  Compute = 0x20,
+  Task = 0x40,
+  Mesh = 0x80,
+  RayGeneration = 0x100,
+  AnyHit = 0x200,
+  ClosestHit = 0x400,
+  Miss = 0x800,
+  Intersection = 0x1000,
+  Callable = 0x2000,
+};
+
+// The scalar type of the components of a stage input.
+enum class DxcShimComponentType: uint32_t {
+  Unknown = 0,
+  Float16 = 1,
+  Float32 = 2,
+  Float64 = 3,
+  Sint16 = 4,
+  Sint32 = 5,
+  Sint64 = 6,
+  Uint16 = 7,
+  Uint32 = 8,
+  Uint64 = 9,
+};
+
+// Returns whether a value read from outside the shim, such as from an archive, is one of the
+// descriptor types.
+inline bool isDescriptorType(uint32_t value) {
+  return value <= static_cast<uint32_t>(DxcShimDescriptorType::StorageBuffer)
+    || value == static_cast<uint32_t>(DxcShimDescriptorType::InputAttachment)
+    || value == static_cast<uint32_t>(DxcShimDescriptorType::AccelerationStructure);
+}
+
+// Returns whether a value is one of the shader stages: 0 or a single stage bit.
+inline bool isShaderStage(uint32_t value) {
+  return value <= static_cast<uint32_t>(DxcShimShaderStage::Callable) && (value & (value - 1)) == 0;
+}
+
+// Returns whether a value is one of the component types.
+inline bool isComponentType(uint32_t value) {
+  return value <= static_cast<uint32_t>(DxcShimComponentType::Uint64);
+}
+
+struct DxcShimReflectionBinding {
+  uint32_t set;
+  uint32_t binding;
+  DxcShimDescriptorType descriptorType;
+
+  // The number of descriptors. 0 for runtime arrays, whose size is set by the pipeline layout.
+  uint32_t count;
+
+  // The NUL-terminated name of the resource, empty if DXC emitted none.
+  const char* name;
+};
+
+// An input of the entry point, such as a vertex attribute. Built-ins are not included.
+struct DxcShimReflectionInput {
+  uint32_t location;
+  DxcShimComponentType componentType;
+  uint32_t componentCount;
+
+  // The NUL-terminated name of the input, empty if DXC emitted none.
+  const char* name;
+};
+
+// The interface of a SPIR-V module, as a flat table.
+//
+// All pointers are owned by the reflection and stay valid for its lifetime.
+struct DxcShimReflection {
+  DxcShimShaderStage stage;
+
+  // The size in bytes of the push constant block. 0 if there is none.
+  uint32_t pushConstantSize;
+
+  // The workgroup size of compute, task and mesh shaders. 0 for other stages.
+  uint32_t localSize[3];
+
+  const DxcShimReflectionBinding* bindings;
+  size_t bindingCount;
+
+  const DxcShimReflectionInput* inputs;
+  size_t inputCount;
+};
+
+// Extracts the bindings, push constants and inputs of a SPIR-V module.
+//
+// DXC does not produce DXC_OUT_REFLECTION when targeting SPIR-V, so the decorations of the
+// module are read directly instead. This is a single pass over the instructions, which is
+// cheap next to a compilation.
+class DxcShimReflector {
+public:
+  // Reflects a SPIR-V module. Returns NULL if the module is not valid SPIR-V.
+  //
+  // The module may come from a cache, so it is not trusted: sizes read from it are bounded
+  // before anything is allocated for them.
+  inline static std::unique_ptr<DxcShimReflector> reflect(const void* data, size_t size) {
+    try {
+      std::unique_ptr<DxcShimReflector> reflector(new DxcShimReflector());
+      if (!reflector->parse(static_cast<const uint32_t*>(data), size / sizeof(uint32_t))) {
+        return nullptr;
+      }
+
+      reflector->build();
+      return reflector;
+    } catch (std::bad_alloc const&) {
+      return nullptr;
+    }
+  }
+
+  inline DxcShimReflection const& getReflection() const {
+    return m_reflection;
+  }
+
+private:
+  // SPIR-V opcodes, decorations and enumerants used by the reflector.
+  enum : uint32_t {
+    MagicNumber = 0x07230203,
+
+    // The universal limit of the SPIR-V specification on the members of a struct.
+    MaxStructMemberCount = 16383,
+
+    OpName = 5,
+    OpEntryPoint = 15,
+    OpExecutionMode = 16,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+    OpTypeAccelerationStructureKHR = 5341,
+
+    DecorationBufferBlock = 3,
+    DecorationRowMajor = 4,
+    DecorationArrayStride = 6,
+    DecorationMatrixStride = 7,
+    DecorationBuiltIn = 11,
+    DecorationLocation = 30,
+    DecorationBinding = 33,
+    DecorationDescriptorSet = 34,
+    DecorationOffset = 35,
+
+    StorageClassUniformConstant = 0,
+    StorageClassInput = 1,
+    StorageClassUniform = 2,
+    StorageClassPushConstant = 9,
+    StorageClassStorageBuffer = 12,
+
+    DimBuffer = 5,
+    DimSubpassData = 6,
+
+    ExecutionModeLocalSize = 17,
+  };
+
+  struct Member {
+    uint32_t offset = 0;
+    uint32_t matrixStride = 0;
+    bool isRowMajor = false;
+  };
+
+  // What is known about an id.
+  struct Id {
+    // The opcode and operands following the result id, for types.
+    uint32_t opcode = 0;
+    std::vector<uint32_t> operands;
+
+    std::string name;
+
+    // OpConstant value, or OpVariable storage class.
+    uint32_t value = 0;
+
+    // OpVariable pointer type.
+    uint32_t type = 0;
+
+    bool hasBinding = false;
+    bool hasLocation = false;
+    bool isBuiltIn = false;
+    bool isBufferBlock = false;
+    uint32_t set = 0;
+    uint32_t binding = 0;
+    uint32_t location = 0;
+    uint32_t arrayStride = 0;
+
+    std::vector<Member> members;
+
+    // The size of the type without a member layout, once it is known.
+    bool hasSize = false;
+    uint32_t size = 0;
+  };
+
+  struct Binding {
+    uint32_t set;
+    uint32_t binding;
+    DxcShimDescriptorType descriptorType;
+    uint32_t count;
+    std::string name;
+  };
+
+  struct Input {
+    uint32_t location;
+    DxcShimComponentType componentType;
+    uint32_t componentCount;
+    std::string name;
+  };
+
+  inline DxcShimReflector() {
+    std::memset(&m_reflection, 0, sizeof(m_reflection));
+  }
+
+  inline bool parse(const uint32_t* words, size_t wordCount) {
+    if (wordCount < 5 || words[0] != MagicNumber) {
+      return false;
+    }
+
+    // Stripped modules keep the ids of their debug information, so ids may outnumber words,
+    // but not by this much. The bound sizes an index of 4 bytes per id, and only ids used by
+    // the module get an entry of their own.
+    static const size_t maxIdsPerWord = 8;
+    uint32_t bound = words[3];
+    if (bound > wordCount * maxIdsPerWord) {
+      return false;
+    }
+    m_idIndices.assign(bound, 0);
+
+    uint32_t entryPoint = 0;
+    size_t offset = 5;
+    while (offset < wordCount) {
+      uint32_t opcode = words[offset] & 0xffff;
+      uint32_t length = words[offset] >> 16;
+      if (length == 0 || offset + length > wordCount) {
+        return false;
+      }
+
+      const uint32_t* operands = words + offset + 1;
+      uint32_t operandCount = length - 1;
+      offset += length;
+
+      switch (opcode) {
+      case OpName:
+        if (operandCount >= 2 && isValid(operands[0])) {
+          addId(operands[0]).name = readString(operands + 1, operandCount - 1);
+        }
+        break;
+
+      case OpEntryPoint:
+        // Only the first entry point is reflected, which is the only one DXC emits.
+        if (operandCount >= 2 && entryPoint == 0) {
+          entryPoint = operands[1];
+          m_reflection.stage = toShaderStage(operands[0]);
+        }
+        break;
+
+      case OpExecutionMode:
+        if (operandCount >= 5 && operands[0] == entryPoint && operands[1] == ExecutionModeLocalSize) {
+          m_reflection.localSize[0] = operands[2];
+          m_reflection.localSize[1] = operands[3];
+          m_reflection.localSize[2] = operands[4];
+        }
+        break;
+
+      case OpTypeInt:
+      case OpTypeFloat:
+      case OpTypeVector:
+      case OpTypeMatrix:
+      case OpTypeImage:
+      case OpTypeSampler:
+      case OpTypeSampledImage:
+      case OpTypeArray:
+      case OpTypeRuntimeArray:
+      case OpTypeStruct:
+      case OpTypePointer:
+      case OpTypeAccelerationStructureKHR:
+        if (operandCount >= 1 && isValid(operands[0])) {
+          Id& id = addId(operands[0]);
+          id.opcode = opcode;
+          id.operands.assign(operands + 1, operands + operandCount);
+        }
+        break;
+
+      case OpConstant:
+        if (operandCount >= 3 && isValid(operands[1])) {
+          addId(operands[1]).value = operands[2];
+        }
+        break;
+
+      case OpVariable:
+        if (operandCount >= 3 && isValid(operands[1])) {
+          Id& id = addId(operands[1]);
+          id.opcode = opcode;
+          id.type = operands[0];
+          id.value = operands[2];
+          m_variables.push_back(operands[1]);
+        }
+        break;
+
+      case OpDecorate:
+        if (operandCount >= 2 && isValid(operands[0])) {
+          decorate(addId(operands[0]), operands[1], operandCount >= 3 ? operands[2] : 0);
+        }
+        break;
+
+      case OpMemberDecorate:
+        if (operandCount >= 3 && isValid(operands[0])) {
+          if (operands[1] >= MaxStructMemberCount) {
+            return false;
+          }
+
+          Id& id = addId(operands[0]);
+          if (id.members.size() <= operands[1]) {
+            id.members.resize(operands[1] + 1);
+          }
+          decorateMember(id.members[operands[1]], operands[2], operandCount >= 4 ? operands[3] : 0);
+        }
+        break;
+      }
+    }
+
+    for (uint32_t variable : m_variables) {
+      reflectVariable(*getId(variable));
+    }
+
+    return true;
+  }
+
+  inline void decorate(Id& id, uint32_t decoration, uint32_t value) {
+    switch (decoration) {
+    case DecorationBufferBlock:
+      id.isBufferBlock = true;
+      break;
+    case DecorationArrayStride:
+      id.arrayStride = value;
+      break;
+    case DecorationBuiltIn:
+      id.isBuiltIn = true;
+      break;
+    case DecorationLocation:
+      id.hasLocation = true;
+      id.location = value;
+      break;
+    case DecorationBinding:
+      id.hasBinding = true;
+      id.binding = value;
+      break;
+    case DecorationDescriptorSet:
+      id.set = value;
+      break;
+    }
+  }
+
+  inline static void decorateMember(Member& member, uint32_t decoration, uint32_t value) {
+    switch (decoration) {
+    case DecorationRowMajor:
+      member.isRowMajor = true;
+      break;
+    case DecorationMatrixStride:
+      member.matrixStride = value;
+      break;
+    case DecorationOffset:
+      member.offset = value;
+      break;
+    }
+  }
+
+  inline void reflectVariable(Id const& variable) {
+    Id const* pointer = getId(variable.type);
+    if (pointer == nullptr || pointer->opcode != OpTypePointer || pointer->operands.size() < 2) {
+      return;
+    }
+
+    uint32_t storageClass = variable.value;
+    uint32_t typeId = pointer->operands[1];
+
+    if (storageClass == StorageClassPushConstant) {
+      m_reflection.pushConstantSize = getSize(typeId);
+      return;
+    }
+
+    if (storageClass == StorageClassInput) {
+      if (variable.hasLocation && !variable.isBuiltIn) {
+        reflectInput(variable, typeId);
+      }
+      return;
+    }
+
+    if (!variable.hasBinding) {
+      return;
+    }
+
+    // Arrays of resources are a single binding with several descriptors.
+    uint32_t count = 1;
+    Id const* type = getId(typeId);
+    if (type != nullptr && type->opcode == OpTypeArray && type->operands.size() >= 2) {
+      Id const* length = getId(type->operands[1]);
+      count = length != nullptr ? length->value : 1;
+      type = getId(type->operands[0]);
+    } else if (type != nullptr && type->opcode == OpTypeRuntimeArray && type->operands.size() >= 1) {
+      count = 0;
+      type = getId(type->operands[0]);
+    }
+
+    if (type == nullptr) {
+      return;
+    }
+
+    DxcShimDescriptorType descriptorType;
+    if (!getDescriptorType(storageClass, *type, descriptorType)) {
+      return;
+    }
+
+    Binding binding;
+    binding.set = variable.set;
+    binding.binding = variable.binding;
+    binding.descriptorType = descriptorType;
+    binding.count = count;
+
+    // DXC names the variables of constant buffers after the buffer, and their types "type.*".
+    binding.name = !variable.name.empty() ? variable.name : type->name;
+    m_bindings.push_back(std::move(binding));
+  }
+
+  inline void reflectInput(Id const& variable, uint32_t typeId) {
+    Input input;
+    input.location = variable.location;
+    input.componentType = DxcShimComponentType::Unknown;
+    input.componentCount = 1;
+    input.name = variable.name;
+
+    Id const* type = getId(typeId);
+    if (type != nullptr && type->opcode == OpTypeVector && type->operands.size() >= 2) {
+      input.componentCount = type->operands[1];
+      type = getId(type->operands[0]);
+    }
+
+    if (type != nullptr) {
+      input.componentType = getComponentType(*type);
+    }
+
+    m_inputs.push_back(std::move(input));
+  }
+
+  inline static bool getDescriptorType(uint32_t storageClass, Id const& type, DxcShimDescriptorType& descriptorType) {
+    switch (storageClass) {
+    case StorageClassUniform:
+      descriptorType = type.isBufferBlock ? DxcShimDescriptorType::StorageBuffer : DxcShimDescriptorType::UniformBuffer;
+      return true;
+
+    case StorageClassStorageBuffer:
+      descriptorType = DxcShimDescriptorType::StorageBuffer;
+      return true;
+
+    case StorageClassUniformConstant:
+      break;
+
+    default:
+      return false;
+    }
+
+    switch (type.opcode) {
+    case OpTypeSampler:
+      descriptorType = DxcShimDescriptorType::Sampler;
+      return true;
+
+    case OpTypeSampledImage:
+      descriptorType = DxcShimDescriptorType::CombinedImageSampler;
+      return true;
+
+    case OpTypeAccelerationStructureKHR:
+      descriptorType = DxcShimDescriptorType::AccelerationStructure;
+      return true;
+
+    case OpTypeImage: {
+      if (type.operands.size() < 6) {
+        return false;
+      }
+
+      uint32_t dim = type.operands[1];
+      bool isStorage = type.operands[5] == 2;
+      if (dim == DimSubpassData) {
+        descriptorType = DxcShimDescriptorType::InputAttachment;
+      } else if (dim == DimBuffer) {
+        descriptorType = isStorage ? DxcShimDescriptorType::StorageTexelBuffer : DxcShimDescriptorType::UniformTexelBuffer;
+      } else {
+        descriptorType = isStorage ? DxcShimDescriptorType::StorageImage : DxcShimDescriptorType::SampledImage;
+      }
+      return true;
+    }
+
+    default:
+      return false;
+    }
+  }
+
+  inline static DxcShimComponentType getComponentType(Id const& type) {
+    if (type.operands.empty()) {
+      return DxcShimComponentType::Unknown;
+    }
+
+    uint32_t width = type.operands[0];
+    if (type.opcode == OpTypeFloat) {
+      switch (width) {
+      case 16: return DxcShimComponentType::Float16;
+      case 32: return DxcShimComponentType::Float32;
+      case 64: return DxcShimComponentType::Float64;
+      }
+    } else if (type.opcode == OpTypeInt && type.operands.size() >= 2) {
+      bool isSigned = type.operands[1] != 0;
+      switch (width) {
+      case 16: return isSigned ? DxcShimComponentType::Sint16 : DxcShimComponentType::Uint16;
+      case 32: return isSigned ? DxcShimComponentType::Sint32 : DxcShimComponentType::Uint32;
+      case 64: return isSigned ? DxcShimComponentType::Sint64 : DxcShimComponentType::Uint64;
+      }
+    }
+    return DxcShimComponentType::Unknown;
+  }
+
+  // Returns the size of a type in bytes, following its explicit layout decorations. Sizes that
+  // do not fit in 32 bits saturate.
+  inline uint32_t getSize(uint32_t typeId, Member const* member = nullptr, uint32_t depth = 0) {
+    Id* type = getId(typeId);
+    if (type == nullptr || depth > 32) {
+      return 0;
+    }
+
+    // Sizes are computed once per type, except within a member, whose layout changes the size of
+    // matrices and arrays of them. Structs lay out their own members, so they are always computed
+    // once. Otherwise structs sharing a member type would be walked once per path to them, which
+    // is exponential in their nesting.
+    bool isShared = member == nullptr || type->opcode == OpTypeStruct;
+    if (isShared) {
+      if (type->hasSize) {
+        return type->size;
+      }
+
+      // A type containing itself is malformed, and has no size where it is nested.
+      type->hasSize = true;
+    }
+
+    uint32_t size = computeSize(*type, member, depth);
+    if (isShared) {
+      type->size = size;
+    }
+    return size;
+  }
+
+  inline uint32_t computeSize(Id const& type, Member const* member, uint32_t depth) {
+    switch (type.opcode) {
+    case OpTypeInt:
+    case OpTypeFloat:
+      return type.operands.empty() ? 0 : type.operands[0] / 8;
+
+    case OpTypeVector:
+      return type.operands.size() < 2 ? 0 : multiplySaturated(type.operands[1], getSize(type.operands[0], nullptr, depth + 1));
+
+    case OpTypeMatrix: {
+      if (type.operands.size() < 2) {
+        return 0;
+      }
+
+      // The stride separates columns, or rows for row-major matrices.
+      uint32_t columnCount = type.operands[1];
+      Id const* column = getId(type.operands[0]);
+      uint32_t rowCount = column != nullptr && column->operands.size() >= 2 ? column->operands[1] : 0;
+      uint32_t stride = member != nullptr ? member->matrixStride : 0;
+      if (stride == 0) {
+        return multiplySaturated(columnCount, getSize(type.operands[0], nullptr, depth + 1));
+      }
+      return multiplySaturated(stride, member->isRowMajor ? rowCount : columnCount);
+    }
+
+    case OpTypeArray: {
+      if (type.operands.size() < 2) {
+        return 0;
+      }
+
+      Id const* length = getId(type.operands[1]);
+      uint32_t count = length != nullptr ? length->value : 0;
+      uint32_t stride = type.arrayStride != 0 ? type.arrayStride : getSize(type.operands[0], member, depth + 1);
+      return multiplySaturated(count, stride);
+    }
+
+    case OpTypeStruct: {
+      uint32_t size = 0;
+      for (size_t i = 0; i < type.operands.size(); i++) {
+        Member const* memberLayout = i < type.members.size() ? &type.members[i] : nullptr;
+        uint32_t offset = memberLayout != nullptr ? memberLayout->offset : size;
+        uint32_t end = addSaturated(offset, getSize(type.operands[i], memberLayout, depth + 1));
+        if (end > size) {
+          size = end;
+        }
+      }
+      return size;
+    }
+
+    default:
+      return 0;
+    }
+  }
+
+  inline static uint32_t multiplySaturated(uint32_t a, uint32_t b) {
+    uint64_t product = static_cast<uint64_t>(a) * b;
+    return product > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(product);
+  }
+
+  inline static uint32_t addSaturated(uint32_t a, uint32_t b) {
+    return a > UINT32_MAX - b ? UINT32_MAX : a + b;
+  }
+
+  inline static DxcShimShaderStage toShaderStage(uint32_t executionModel) {
+    switch (executionModel) {
+    case 0: return DxcShimShaderStage::Vertex;
+    case 1: return DxcShimShaderStage::TessellationControl;
+    case 2: return DxcShimShaderStage::TessellationEvaluation;
+    case 3: return DxcShimShaderStage::Geometry;
+    case 4: return DxcShimShaderStage::Fragment;
+    case 5: return DxcShimShaderStage::Compute;
+    case 5267:
+    case 5364: return DxcShimShaderStage::Task;
+    case 5268:
+    case 5365: return DxcShimShaderStage::Mesh;
+    case 5313: return DxcShimShaderStage::RayGeneration;
+    case 5314: return DxcShimShaderStage::Intersection;
+    case 5315: return DxcShimShaderStage::AnyHit;
+    case 5316: return DxcShimShaderStage::ClosestHit;
+    case 5317: return DxcShimShaderStage::Miss;
+    case 5318: return DxcShimShaderStage::Callable;
+    default: return DxcShimShaderStage::Unknown;
+    }
+  }
+
+  // Reads a literal string, which is NUL-terminated and padded to a whole number of words.
+  inline static std::string readString(const uint32_t* words, size_t wordCount) {
+    const char* chars = reinterpret_cast<const char*>(words);
+    size_t maxLength = wordCount * sizeof(uint32_t);
+    size_t length = 0;
+    while (length < maxLength && chars[length] != '\0') {
+      length++;
+    }
+    return std::string(chars, length);
+  }
+
+  inline bool isValid(uint32_t id) const {
+    return id < m_idIndices.size();
+  }
+
+  // Returns the entry of a valid id, adding it the first time the id is used.
+  inline Id& addId(uint32_t id) {
+    uint32_t& index = m_idIndices[id];
+    if (index == 0) {
+      m_ids.emplace_back();
+      index = static_cast<uint32_t>(m_ids.size());
+    }
+    return m_ids[index - 1];
+  }
+
+  // Returns the entry of an id, or NULL if the module does not use it.
+  inline Id* getId(uint32_t id) {
+    return isValid(id) && m_idIndices[id] != 0 ? &m_ids[m_idIndices[id] - 1] : nullptr;
+  }
+
+  inline Id const* getId(uint32_t id) const {
+    return isValid(id) && m_idIndices[id] != 0 ? &m_ids[m_idIndices[id] - 1] : nullptr;
+  }
+
+  // Builds the flat tables once all strings are in place, as their pointers must not move.
+  inline void build() {
+    m_flatBindings.reserve(m_bindings.size());
+    for (Binding const& binding : m_bindings) {
+      DxcShimReflectionBinding flat;
+      flat.set = binding.set;
+      flat.binding = binding.binding;
+      flat.descriptorType = binding.descriptorType;
+      flat.count = binding.count;
+      flat.name = binding.name.c_str();
+      m_flatBindings.push_back(flat);
+    }
+
+    m_flatInputs.reserve(m_inputs.size());
+    for (Input const& input : m_inputs) {
+      DxcShimReflectionInput flat;
+      flat.location = input.location;
+      flat.componentType = input.componentType;
+      flat.componentCount = input.componentCount;
+      flat.name = input.name.c_str();
+      m_flatInputs.push_back(flat);
+    }
+
+    m_reflection.bindings = m_flatBindings.data();
+    m_reflection.bindingCount = m_flatBindings.size();
+    m_reflection.inputs = m_flatInputs.data();
+    m_reflection.inputCount = m_flatInputs.size();
+
+    // The ids are only needed while parsing.
+    m_ids.clear();
+    m_ids.shrink_to_fit();
+    m_idIndices.clear();
+    m_idIndices.shrink_to_fit();
+    m_variables.clear();
+    m_variables.shrink_to_fit();
+  }
+
+  // The index of the entry of every id plus one, or 0 if the id is not used.
+  std::vector<uint32_t> m_idIndices;
+  std::vector<Id> m_ids;
+  std::vector<uint32_t> m_variables;
+
+  std::vector<Binding> m_bindings;
+  std::vector<Input> m_inputs;
+
+  std::vector<DxcShimReflectionBinding> m_flatBindings;
+  std::vector<DxcShimReflectionInput> m_flatInputs;
+  DxcShimReflection m_reflection;
+};
@@ -0,0 +1,457 @@
+#pragma once
+
+#include "blob.h"
+#include "cancellation.h"
+#include "common.h"
+#include "conv.h"
+#include "strip.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The messages exchanged with a compile or cache server over its socket.
+//
+// A compile server client connects for a single compilation: it sends a Compile message,
+// answers every Include message with an IncludeResult, and receives a Result. The bytecode of a
+// Result is not part of the message, but written to a memfd whose descriptor is passed along
+// with it, so it is mapped by the client instead of copied through the socket.
+//
+// A cache server client keeps its connection open, and sends any number of CacheLookup
+// messages, each answered by a CacheLookupResult, and CacheStore messages, which are not
+// answered.
+enum class DxcShimServerMessageType: uint32_t {
+  Compile = 1,
+  Include = 2,
+  IncludeResult = 3,
+  Result = 4,
+  CacheLookup = 5,
+  CacheLookupResult = 6,
+  CacheStore = 7,
+};
+
+struct DxcShimServerMessageHeader {
+  DxcShimServerMessageType type;
+
+  // The size of the payload following the header.
+  uint32_t size;
+};
+
+// The largest payload received by default. Larger messages drop the connection, as they come
+// from a peer that does not speak the protocol, such as an HTTP client.
+static const size_t dxcShimMaxServerMessageSize = 256u << 20;
+
+// Appends a 32-bit integer to a message payload.
+inline void appendServerU32(std::string& payload, uint32_t value) {
+  payload.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Appends a plain value, such as a hash, to a message payload.
+template <typename T>
+inline void appendServerValue(std::string& payload, T const& value) {
+  payload.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Appends a string to a message payload, prefixed by its size and followed by a NUL, so the
+// receiver can use it in place as a C string.
+inline void appendServerString(std::string& payload, const char* data, size_t size) {
+  appendServerU32(payload, static_cast<uint32_t>(size));
+  payload.append(data, size);
+  payload.push_back('\0');
+}
+
+// Appends a wide string to a message payload, converted to UTF-8.
+inline void appendServerString(std::string& payload, const wchar_t* data, size_t size) {
+  size_t sizeOffset = payload.size();
+  appendServerU32(payload, 0);
+  wide_to_utf8(data, size, payload);
+
+  uint32_t stringSize = static_cast<uint32_t>(payload.size() - sizeOffset - sizeof(uint32_t));
+  std::memcpy(&payload[sizeOffset], &stringSize, sizeof(stringSize));
+  payload.push_back('\0');
+}
+
+// Reads the fields of a message payload, checking they are in bounds.
+class DxcShimServerMessageReader {
+public:
+  inline DxcShimServerMessageReader(const char* data, size_t size)
+    : m_data(data)
+    , m_size(size) {}
+
+  inline bool readU32(uint32_t& value) {
+    return readValue(value);
+  }
+
+  // Reads a value written by appendServerValue.
+  template <typename T>
+  inline bool readValue(T& value) {
+    if (m_size - m_offset < sizeof(value)) {
+      return false;
+    }
+    std::memcpy(&value, m_data + m_offset, sizeof(value));
+    m_offset += sizeof(value);
+    return true;
+  }
+
+  // Reads a string written by appendServerString. The string is NUL-terminated in place.
+  inline bool readString(const char*& data, size_t& size) {
+    uint32_t stringSize;
+    if (!readU32(stringSize) || m_size - m_offset <= stringSize || m_data[m_offset + stringSize] != '\0') {
+      return false;
+    }
+    data = m_data + m_offset;
+    size = stringSize;
+    m_offset += stringSize + 1;
+    return true;
+  }
+
+private:
+  const char* m_data;
+  size_t m_size;
+  size_t m_offset = 0;
+};
+
+// Fills in the socket address of a compile server. Returns false if the path is too long.
+inline bool buildServerAddress(std::string const& socketPath, sockaddr_un& address) {
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::memcpy(address.sun_path, socketPath.data(), socketPath.size());
+  return true;
+}
+
+// Sends all of the given bytes, along with a descriptor if fd is not -1.
+//
+// Closed connections fail the send rather than raising SIGPIPE.
+inline bool sendAll(int socket, const void* data, size_t size, int fd = -1) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    iovec io = { const_cast<char*>(bytes), size };
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+
+    // The descriptor goes with the first byte sent.
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd != -1) {
+      std::memset(control, 0, sizeof(control));
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+
+      cmsghdr* header = CMSG_FIRSTHDR(&message);
+      header->cmsg_level = SOL_SOCKET;
+      header->cmsg_type = SCM_RIGHTS;
+      header->cmsg_len = CMSG_LEN(sizeof(int));
+      std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+
+    ssize_t count = sendmsg(socket, &message, MSG_NOSIGNAL);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+
+    bytes += count;
+    size -= static_cast<size_t>(count);
+    fd = -1;
+  }
+  return true;
+}
+
+// Receives exactly the given number of bytes. If fd is not NULL, it receives a descriptor passed
+// along with them, or -1 if there is none.
+inline bool receiveAll(int socket, void* data, size_t size, int* fd = nullptr) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    iovec io = { bytes, size };
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd != nullptr) {
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+    }
+
+    ssize_t count = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+
+    if (fd != nullptr) {
+      for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+          std::memcpy(fd, CMSG_DATA(header), sizeof(int));
+        }
+      }
+    }
+
+    bytes += count;
+    size -= static_cast<size_t>(count);
+  }
+  return true;
+}
+
+inline bool sendServerMessage(int socket, DxcShimServerMessageType type, std::string const& payload, int fd = -1) {
+  DxcShimServerMessageHeader header = { type, static_cast<uint32_t>(payload.size()) };
+  return sendAll(socket, &header, sizeof(header), fd) && sendAll(socket, payload.data(), payload.size());
+}
+
+// Receives a message into the payload buffer, reusing its capacity. If fd is not NULL, it
+// receives the descriptor passed with the message, or -1 if there is none.
+//
+// Fails on payloads larger than maxSize. The buffer grows as the payload arrives, so a peer
+// announcing a large payload it never sends does not make it allocate one.
+inline bool receiveServerMessage(
+  int socket,
+  DxcShimServerMessageType& type,
+  std::string& payload,
+  int* fd = nullptr,
+  size_t maxSize = dxcShimMaxServerMessageSize) {
+  static const size_t chunkSize = 1u << 20;
+
+  if (fd != nullptr) {
+    *fd = -1;
+  }
+
+  DxcShimServerMessageHeader header;
+  if (!receiveAll(socket, &header, sizeof(header), fd)) {
+    return false;
+  }
+
+  type = header.type;
+  if (header.size > maxSize) {
+    return false;
+  }
+
+  payload.clear();
+  while (payload.size() < header.size) {
+    size_t offset = payload.size();
+    size_t count = std::min<size_t>(header.size - offset, chunkSize);
+    payload.resize(offset + count);
+    if (!receiveAll(socket, &payload[offset], count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// How a compilation forwarded to a compile server ended.
+enum class DxcShimCompileServerStatus: uint8_t {
+  // The server compiled the shader, successfully or not.
+  Completed = 0,
+
+  // The compilation was cancelled while the server was compiling it.
+  Cancelled = 1,
+
+  // No server is listening on the socket. Nothing was sent, so the shader can be compiled in
+  // process instead.
+  Unavailable = 2,
+
+  // The connection was lost during the compilation, such as when DXC crashed the worker.
+  Disconnected = 3,
+};
+
+// The outcome of a compilation completed by a compile server.
+struct DxcShimCompileServerResponse {
+  bool isSuccessful = false;
+
+  // The messages reported by DXC, pointing into the buffer passed to the compilation.
+  const char* messages = nullptr;
+  size_t messageSize = 0;
+
+  // The bytecode, mapped from the memfd written by the server. NULL if the compilation failed.
+  CComPtr<IDxcBlob> bytecode;
+};
+
+// Forwards compilations to a compile server listening on a local socket.
+//
+// Every compilation opens its own connection, which the server hands to an idle worker process,
+// so compilations from many threads run in as many processes and a crashing worker only fails
+// the compilation it was running. Includes are still resolved by the client, through the
+// include handler of the compilation, as the server has no access to the callbacks of the
+// client.
+//
+// The client only holds the socket address, and is safe to use from many threads.
+class DxcShimCompileServerClient {
+public:
+  // Throws a DxcShimException if the path is too long for a socket address.
+  inline explicit DxcShimCompileServerClient(std::string socketPath) {
+    if (!buildServerAddress(socketPath, m_address)) {
+      throw DxcShimException(DxcShimStatus::ServerAddressError);
+    }
+  }
+
+  // Compiles a shader on the server with the given DXC arguments.
+  //
+  // The buffer receives the messages of the server, and keeps its capacity across calls. The
+  // response points into it.
+  inline DxcShimCompileServerStatus compile(
+    const char* data,
+    size_t size,
+    LPCWSTR const* args,
+    UINT32 argCount,
+    DxcShimStripOptions const& strip,
+    IDxcIncludeHandler* includeHandler,
+    DxcShimCancellation const& cancellation,
+    std::string& buffer,
+    DxcShimCompileServerResponse& response) const {
+    int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket < 0) {
+      return DxcShimCompileServerStatus::Unavailable;
+    }
+
+    if (connect(socket, reinterpret_cast<const sockaddr*>(&m_address), sizeof(m_address)) != 0) {
+      close(socket);
+      return DxcShimCompileServerStatus::Unavailable;
+    }
+
+    DxcShimCompileServerStatus status = exchange(socket, data, size, args, argCount, strip, includeHandler, cancellation, buffer, response);
+    close(socket);
+    return status;
+  }
+
+private:
+  inline DxcShimCompileServerStatus exchange(
+    int socket,
+    const char* data,
+    size_t size,
+    LPCWSTR const* args,
+    UINT32 argCount,
+    DxcShimStripOptions const& strip,
+    IDxcIncludeHandler* includeHandler,
+    DxcShimCancellation const& cancellation,
+    std::string& buffer,
+    DxcShimCompileServerResponse& response) const {
+    buffer.clear();
+    appendServerU32(buffer, argCount);
+    for (UINT32 i = 0; i < argCount; i++) {
+      appendServerString(buffer, args[i], std::wcslen(args[i]));
+    }
+    appendServerU32(buffer, static_cast<uint32_t>(strip.stripDebugInfo) | static_cast<uint32_t>(strip.stripNames) << 1);
+    appendServerString(buffer, data, size);
+
+    if (!sendServerMessage(socket, DxcShimServerMessageType::Compile, buffer)) {
+      return DxcShimCompileServerStatus::Disconnected;
+    }
+
+    std::wstring filename;
+    std::string reply;
+    for (;;) {
+      if (!waitForMessage(socket, cancellation)) {
+        return DxcShimCompileServerStatus::Cancelled;
+      }
+
+      int fd;
+      DxcShimServerMessageType type;
+      if (!receiveServerMessage(socket, type, buffer, &fd)) {
+        return DxcShimCompileServerStatus::Disconnected;
+      }
+
+      if (type == DxcShimServerMessageType::Result) {
+        bool isReceived = receiveResult(buffer, fd, response);
+        if (fd != -1) {
+          close(fd);
+        }
+        return isReceived ? DxcShimCompileServerStatus::Completed : DxcShimCompileServerStatus::Disconnected;
+      }
+
+      if (fd != -1) {
+        close(fd);
+      }
+
+      if (type != DxcShimServerMessageType::Include) {
+        return DxcShimCompileServerStatus::Disconnected;
+      }
+
+      // The include handler checks for cancellation, and records the include as if DXC had
+      // loaded it in process.
+      filename.clear();
+      utf8_to_wide(buffer.data(), buffer.size(), filename);
+
+      CComPtr<IDxcBlob> source;
+      HRESULT hr = includeHandler != nullptr ? includeHandler->LoadSource(filename.c_str(), &source) : E_FAIL;
+      if (cancellation.isCancelled()) {
+        return DxcShimCompileServerStatus::Cancelled;
+      }
+
+      reply.clear();
+      if (SUCCEEDED(hr) && source != nullptr) {
+        appendServerU32(reply, 1);
+        appendServerString(reply, static_cast<const char*>(source->GetBufferPointer()), source->GetBufferSize());
+      } else {
+        appendServerU32(reply, 0);
+      }
+
+      if (!sendServerMessage(socket, DxcShimServerMessageType::IncludeResult, reply)) {
+        return DxcShimCompileServerStatus::Disconnected;
+      }
+    }
+  }
+
+  // Waits until the server sends a message. Returns false if the compilation is cancelled
+  // first, which abandons the connection and leaves the worker to finish on its own.
+  inline static bool waitForMessage(int socket, DxcShimCancellation const& cancellation) {
+    static const int pollInterval = 10;
+
+    pollfd fd = { socket, POLLIN, 0 };
+    for (;;) {
+      if (cancellation.isCancelled()) {
+        return false;
+      }
+
+      int count = poll(&fd, 1, pollInterval);
+      if (count > 0 || (count < 0 && errno != EINTR)) {
+        return true;
+      }
+    }
+  }
+
+  // Reads a Result message, whose bytecode is in the passed descriptor.
+  inline static bool receiveResult(std::string const& payload, int fd, DxcShimCompileServerResponse& response) {
+    DxcShimServerMessageReader reader(payload.data(), payload.size());
+
+    uint32_t isSuccessful;
+    uint32_t bytecodeSize;
+    if (!reader.readU32(isSuccessful)
+      || !reader.readString(response.messages, response.messageSize)
+      || !reader.readU32(bytecodeSize)) {
+      return false;
+    }
+
+    response.isSuccessful = isSuccessful != 0;
+    if (!response.isSuccessful || bytecodeSize == 0) {
+      return true;
+    }
+
+    // Mapping past the end of the file would fault once the bytecode is read.
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(bytecodeSize)) {
+      return false;
+    }
+
+    void* bytecode = mmap(nullptr, bytecodeSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (bytecode == MAP_FAILED) {
+      return false;
+    }
+
+    response.bytecode = new DxcShimMappedBlob(bytecode, bytecodeSize);
+    return true;
+  }
+
+  sockaddr_un m_address;
+};
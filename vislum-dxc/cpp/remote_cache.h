@@ -0,0 +1,259 @@
+#pragma once
+
+#include "blob.h"
+#include "common.h"
+#include "hash.h"
+#include "trace.h"
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// The bytecode of a remote cache entry, as returned by a backend.
+struct DxcShimRemoteCacheEntry {
+  // NULL if the key was not found.
+  const void* data;
+  size_t size;
+
+  // If set, the data is borrowed rather than copied, and must stay valid until release is
+  // called with releaseContext, possibly on another thread.
+  //
+  // If NULL, the data is copied and only has to stay valid until the lookup returns.
+  DxcShimReleaseCallback release;
+  void* releaseContext;
+};
+
+// Looks up the entries of count keys at once, filling in the entry at the same index for every
+// key found. The entries are zeroed before the call.
+typedef void (*DxcShimRemoteCacheLookupCallback)(void* userData, const DxcShimHash* keys, size_t count, DxcShimRemoteCacheEntry* entries);
+
+// Stores an entry. The data only has to stay valid until the callback returns.
+typedef void (*DxcShimRemoteCacheStoreCallback)(void* userData, const DxcShimHash* key, const void* data, size_t size);
+
+// A remote cache backend, such as a client of a cache server shared by a build farm.
+//
+// Lookups are called from the compiling threads, one at a time, and stores from the upload
+// thread of the cache, so a backend may use one connection for each.
+struct DxcShimRemoteCacheBackend {
+  DxcShimRemoteCacheLookupCallback lookup;
+  DxcShimRemoteCacheStoreCallback store;
+
+  // Called with the user data once the cache is destroyed, after the last store. May be NULL.
+  DxcShimReleaseCallback release;
+  void* userData;
+};
+
+// A cache of compiled bytecode shared between machines, in front of a remote cache backend.
+//
+// Consulted by compilers after a miss in their local cache, and never while holding anything
+// of it. Concurrent lookups are batched: while a lookup is in flight, the keys of every compiler
+// that misses queue up, and go to the backend in a single lookup once it returns. Stores are
+// queued and uploaded by a thread of the cache, so a compilation never waits on an upload.
+class DxcShimRemoteCache {
+public:
+  // Throws a DxcShimException if the upload thread cannot be started.
+  inline explicit DxcShimRemoteCache(DxcShimRemoteCacheBackend const& backend)
+    : m_backend(backend) {
+    try {
+      m_uploadThread = std::thread(&DxcShimRemoteCache::upload, this);
+    } catch (std::system_error const&) {
+      throw DxcShimException(DxcShimStatus::SpawnThreadError);
+    }
+  }
+
+  DxcShimRemoteCache(DxcShimRemoteCache const&) = delete;
+  DxcShimRemoteCache& operator=(DxcShimRemoteCache const&) = delete;
+
+  // Finishes the queued uploads, then releases the backend.
+  ~DxcShimRemoteCache() {
+    {
+      std::lock_guard<std::mutex> lock(m_uploadMutex);
+      m_isStopping = true;
+    }
+    m_uploadReady.notify_one();
+    m_uploadThread.join();
+
+    if (m_backend.release != nullptr) {
+      m_backend.release(m_backend.userData);
+    }
+  }
+
+  // Looks up the bytecode cached under the given key. Returns NULL on a miss.
+  //
+  // Safe to call from many threads, whose lookups are batched together.
+  inline CComPtr<IDxcBlob> load(DxcShimHash const& key) {
+    DXC_SHIM_TRACE_SCOPE("load from remote cache");
+    Lookup lookup;
+    lookup.key = key;
+
+    std::unique_lock<std::mutex> lock(m_lookupMutex);
+    m_pendingLookups.push_back(&lookup);
+    while (!lookup.isDone) {
+      // The first thread to find no lookup in flight sends all the pending keys, including
+      // those of other threads.
+      if (!m_isLookingUp) {
+        lookUpPending(lock);
+      } else {
+        m_lookupDone.wait(lock);
+      }
+    }
+    return std::move(lookup.bytecode);
+  }
+
+  // Queues an upload of bytecode under the given key. The blob is kept alive until it is
+  // uploaded.
+  //
+  // If too many uploads are queued, such as when the backend is unreachable, the upload is
+  // dropped, as it only saves other machines from compiling the shader.
+  inline void store(DxcShimHash const& key, IDxcBlob* bytecode) {
+    static const size_t maxQueuedUploads = 1024;
+
+    {
+      std::lock_guard<std::mutex> lock(m_uploadMutex);
+      if (m_uploads.size() >= maxQueuedUploads) {
+        return;
+      }
+
+      Upload upload;
+      upload.key = key;
+      upload.bytecode = bytecode;
+      m_uploads.push_back(std::move(upload));
+    }
+    m_uploadReady.notify_one();
+  }
+
+  // Waits until every queued upload has been handed to the backend.
+  inline void flush() {
+    std::unique_lock<std::mutex> lock(m_uploadMutex);
+    m_uploadIdle.wait(lock, [&] {
+      return m_uploads.empty() && !m_isUploading;
+    });
+  }
+
+private:
+  struct Lookup {
+    DxcShimHash key;
+    CComPtr<IDxcBlob> bytecode;
+    bool isDone = false;
+  };
+
+  struct Upload {
+    DxcShimHash key;
+    CComPtr<IDxcBlob> bytecode;
+  };
+
+  // Sends the pending lookups to the backend as one batch. The lock is released during the
+  // lookup, so more keys can queue up for the next batch.
+  inline void lookUpPending(std::unique_lock<std::mutex>& lock) {
+    m_isLookingUp = true;
+    m_batch.swap(m_pendingLookups);
+    m_pendingLookups.clear();
+    lock.unlock();
+
+    size_t count = m_batch.size();
+    m_batchKeys.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      m_batchKeys[i] = m_batch[i]->key;
+    }
+    m_batchEntries.assign(count, DxcShimRemoteCacheEntry {});
+
+    {
+      DXC_SHIM_TRACE_SCOPE("look up remote cache batch");
+      m_backend.lookup(m_backend.userData, m_batchKeys.data(), count, m_batchEntries.data());
+    }
+
+    // The blobs are created before publishing the results, as a lookup is freed once done.
+    std::vector<CComPtr<IDxcBlob>> bytecodes(count);
+    for (size_t i = 0; i < count; i++) {
+      bytecodes[i] = createBlob(m_batchEntries[i]);
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < count; i++) {
+      m_batch[i]->bytecode = std::move(bytecodes[i]);
+      m_batch[i]->isDone = true;
+    }
+    m_batch.clear();
+    m_isLookingUp = false;
+    m_lookupDone.notify_all();
+  }
+
+  // Wraps the bytecode returned by the backend in a blob. Returns NULL for a miss.
+  inline static CComPtr<IDxcBlob> createBlob(DxcShimRemoteCacheEntry const& entry) {
+    CComPtr<IDxcBlob> blob;
+    if (entry.data == nullptr) {
+      return blob;
+    }
+
+    if (entry.release != nullptr) {
+      blob = new DxcShimBorrowedBlob(entry.data, entry.size, entry.release, entry.releaseContext);
+      return blob;
+    }
+
+    // Copied entries are kept in an anonymous mapping, so they can share the mapped blob.
+    if (entry.size == 0) {
+      return blob;
+    }
+
+    void* data = mmap(nullptr, entry.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      return blob;
+    }
+    std::memcpy(data, entry.data, entry.size);
+    blob = new DxcShimMappedBlob(data, entry.size);
+    return blob;
+  }
+
+  // The main loop of the upload thread.
+  inline void upload() {
+    std::unique_lock<std::mutex> lock(m_uploadMutex);
+    for (;;) {
+      m_uploadReady.wait(lock, [&] {
+        return !m_uploads.empty() || m_isStopping;
+      });
+      if (m_uploads.empty()) {
+        return;
+      }
+
+      Upload upload = std::move(m_uploads.front());
+      m_uploads.pop_front();
+      m_isUploading = true;
+      lock.unlock();
+
+      {
+        DXC_SHIM_TRACE_SCOPE("upload to remote cache");
+        m_backend.store(m_backend.userData, &upload.key, upload.bytecode->GetBufferPointer(), upload.bytecode->GetBufferSize());
+        upload.bytecode.Release();
+      }
+
+      lock.lock();
+      m_isUploading = false;
+      if (m_uploads.empty()) {
+        m_uploadIdle.notify_all();
+      }
+    }
+  }
+
+  DxcShimRemoteCacheBackend m_backend;
+
+  std::mutex m_lookupMutex;
+  std::condition_variable m_lookupDone;
+  std::vector<Lookup*> m_pendingLookups;
+  bool m_isLookingUp = false;
+
+  // The batch in flight, only used by the thread looking it up.
+  std::vector<Lookup*> m_batch;
+  std::vector<DxcShimHash> m_batchKeys;
+  std::vector<DxcShimRemoteCacheEntry> m_batchEntries;
+
+  std::mutex m_uploadMutex;
+  std::condition_variable m_uploadReady;
+  std::condition_variable m_uploadIdle;
+  std::deque<Upload> m_uploads;
+  bool m_isUploading = false;
+  bool m_isStopping = false;
+  std::thread m_uploadThread;
+};
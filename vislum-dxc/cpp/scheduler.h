@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// The priority class of a compilation.
+enum class DxcShimPriority: uint8_t {
+  // Work that is waited on but not looked at, such as the shaders of a level being loaded.
+  Normal = 0,
+
+  // Work someone is looking at right now, such as the shader open in an editor. Runs before
+  // any queued work of lower priority, which pauses at job boundaries to make room for it.
+  Interactive = 1,
+
+  // Work nobody is waiting on, such as permutations warming the cache.
+  Background = 2,
+};
+
+static const size_t dxcShimPriorityCount = 3;
+
+// Returns the rank of a priority class, 0 being the most urgent.
+inline size_t getPriorityRank(DxcShimPriority priority) {
+  switch (priority) {
+    case DxcShimPriority::Interactive:
+      return 0;
+    case DxcShimPriority::Normal:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+// Makes room for interactive compilations among the other work of a pool.
+//
+// Every running interactive compilation claims the core of one worker running lower priority
+// work: the first such worker to reach a job boundary waits there until an interactive
+// compilation ends. Running work is never interrupted, as DXC cannot be paused.
+class DxcShimPriorityGate {
+public:
+  inline void enterInteractive() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_interactiveCount++;
+  }
+
+  inline void leaveInteractive() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_interactiveCount--;
+    }
+    m_condition.notify_all();
+  }
+
+  // Called by lower priority work between jobs. Waits while the running interactive
+  // compilations outnumber the workers already waiting.
+  inline void yieldToInteractive() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_yieldingCount < m_interactiveCount) {
+      m_yieldingCount++;
+      m_condition.wait(lock, [this]() { return m_yieldingCount > m_interactiveCount; });
+      m_yieldingCount--;
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  size_t m_interactiveCount = 0;
+  size_t m_yieldingCount = 0;
+};
+
+// Schedules a single job of the given priority against a gate, for the lifetime of the scope.
+//
+// Interactive jobs are counted by the gate while they run, and other jobs first yield to the
+// interactive ones. A NULL gate schedules nothing.
+class DxcShimPriorityScope {
+public:
+  inline DxcShimPriorityScope(DxcShimPriorityGate* gate, DxcShimPriority priority)
+    : m_gate(priority == DxcShimPriority::Interactive ? gate : nullptr) {
+    if (m_gate != nullptr) {
+      m_gate->enterInteractive();
+    } else if (gate != nullptr) {
+      gate->yieldToInteractive();
+    }
+  }
+
+  DxcShimPriorityScope(DxcShimPriorityScope const&) = delete;
+  DxcShimPriorityScope& operator=(DxcShimPriorityScope const&) = delete;
+
+  ~DxcShimPriorityScope() {
+    if (m_gate != nullptr) {
+      m_gate->leaveInteractive();
+    }
+  }
+
+private:
+  // The gate the job is counted by, if it is interactive.
+  DxcShimPriorityGate* m_gate;
+};
+
+// The queue of a fixed set of workers, with a work-stealing deque per worker and priority.
+//
+// Items are pushed onto the deques of the workers in turn. A worker takes the most urgent item
+// it can find, from the front of its own deque first, then from the back of the deques of the
+// other workers, so a burst of work submitted from one thread spreads out over all of them.
+// Jobs are long compared to a lock, so the deques are locked rather than lock-free.
+template <typename T>
+class DxcShimWorkQueue {
+public:
+  inline explicit DxcShimWorkQueue(size_t workerCount)
+    : m_workers(workerCount) {
+    for (std::unique_ptr<Worker>& worker : m_workers) {
+      worker.reset(new Worker());
+    }
+  }
+
+  DxcShimWorkQueue(DxcShimWorkQueue const&) = delete;
+  DxcShimWorkQueue& operator=(DxcShimWorkQueue const&) = delete;
+
+  inline void push(T item, DxcShimPriority priority) {
+    size_t index = m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    {
+      // Counted under the lock of the queue, so the count never falls behind the items.
+      std::lock_guard<std::mutex> lock(m_mutex);
+      Worker& worker = *m_workers[index];
+      std::lock_guard<std::mutex> workerLock(worker.mutex);
+      worker.items[getPriorityRank(priority)].push_back(std::move(item));
+      m_itemCount++;
+    }
+    m_condition.notify_one();
+  }
+
+  // Takes the most urgent item for a worker, waiting until there is one. Returns false once the
+  // queue is stopped and empty.
+  inline bool pop(size_t workerIndex, T& item) {
+    for (;;) {
+      if (tryPop(workerIndex, item)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_itemCount--;
+        return true;
+      }
+
+      // An item counted but not found is being taken by another worker.
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this]() { return m_itemCount > 0 || m_isStopping; });
+      if (m_itemCount == 0) {
+        return false;
+      }
+    }
+  }
+
+  // Takes the items still queued, and makes pop return false from then on.
+  inline std::vector<T> stop() {
+    std::vector<T> items;
+    for (std::unique_ptr<Worker>& worker : m_workers) {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      for (std::deque<T>& deque : worker->items) {
+        for (T& item : deque) {
+          items.push_back(std::move(item));
+        }
+        deque.clear();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_itemCount -= items.size();
+      m_isStopping = true;
+    }
+    m_condition.notify_all();
+    return items;
+  }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+
+    // The items of the worker, by priority rank.
+    std::deque<T> items[dxcShimPriorityCount];
+  };
+
+  inline bool tryPop(size_t workerIndex, T& item) {
+    size_t workerCount = m_workers.size();
+    for (size_t rank = 0; rank < dxcShimPriorityCount; rank++) {
+      for (size_t i = 0; i < workerCount; i++) {
+        Worker& worker = *m_workers[(workerIndex + i) % workerCount];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+
+        std::deque<T>& items = worker.items[rank];
+        if (items.empty()) {
+          continue;
+        }
+
+        // Own items are taken in the order they were pushed, and stolen ones from the back,
+        // away from where the owner takes them.
+        if (i == 0) {
+          item = std::move(items.front());
+          items.pop_front();
+        } else {
+          item = std::move(items.back());
+          items.pop_back();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<size_t> m_nextWorker {0u};
+
+  // Guards the item count and the stopping flag, which idle workers wait on.
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  size_t m_itemCount = 0;
+  bool m_isStopping = false;
+};
@@ -0,0 +1,365 @@
+#pragma once
+
+#include "remote.h"
+#include "wrapper.h"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// The options of a compile server.
+struct DxcShimCompileServerOptions {
+  // The path of the socket to listen on. An existing socket at the path is replaced.
+  const char* socketPath;
+
+  // The number of worker processes, and so of compilations run at once.
+  size_t workerCount;
+
+  // The options each worker loads DXC with. Workers always open the library right away.
+  DxcShimLoaderOptions loaderOptions;
+};
+
+// A compile server, running compilations sent by DxcShimCompileServerClient in a pool of worker
+// processes.
+//
+// Every worker is forked from the server, loads DXC on its own, and accepts connections from the
+// shared listening socket one at a time, so the kernel hands each compilation to an idle worker.
+// Workers that exit, such as when DXC crashes, are replaced. Workers never outlive the server.
+//
+// As the workers are forked, the server should run in a process of its own, before it starts
+// other threads.
+class DxcShimCompileServer {
+public:
+  // Throws a DxcShimException if the path is too long for a socket address.
+  inline explicit DxcShimCompileServer(DxcShimCompileServerOptions const& options)
+    : m_workers(options.workerCount > 0 ? options.workerCount : 1, -1)
+    , m_loaderOptions(options.loaderOptions) {
+    if (!buildServerAddress(options.socketPath, m_address)) {
+      throw DxcShimException(DxcShimStatus::ServerAddressError);
+    }
+
+    if (options.loaderOptions.libraryPath != nullptr) {
+      m_libraryPath = options.loaderOptions.libraryPath;
+      m_loaderOptions.libraryPath = m_libraryPath.c_str();
+    }
+    m_loaderOptions.deferOpen = false;
+
+    if (pipe2(m_stopPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+      throw DxcShimException(DxcShimStatus::ServerListenError);
+    }
+  }
+
+  DxcShimCompileServer(DxcShimCompileServer const&) = delete;
+  DxcShimCompileServer& operator=(DxcShimCompileServer const&) = delete;
+
+  ~DxcShimCompileServer() {
+    close(m_stopPipe[0]);
+    close(m_stopPipe[1]);
+  }
+
+  // Listens on the socket and serves compilations until the server is stopped.
+  //
+  // Throws a DxcShimException if the socket cannot be listened on, a worker cannot be forked, or
+  // a worker fails to load DXC. The workers are stopped before returning.
+  inline void run() {
+    int listener = listen();
+
+    DxcShimStatus failure = DxcShimStatus::Ok;
+    for (pid_t& worker : m_workers) {
+      worker = spawn(listener);
+      if (worker < 0) {
+        failure = DxcShimStatus::ServerSpawnError;
+        break;
+      }
+    }
+
+    pollfd stop = { m_stopPipe[0], POLLIN, 0 };
+    while (failure == DxcShimStatus::Ok) {
+      static const int reapInterval = 100;
+      if (poll(&stop, 1, reapInterval) > 0) {
+        break;
+      }
+      failure = reap(listener);
+    }
+
+    close(listener);
+    unlink(m_address.sun_path);
+    stopWorkers();
+
+    // Consume the stop request, so the server can run again.
+    char byte;
+    while (read(m_stopPipe[0], &byte, 1) > 0) {}
+
+    if (failure != DxcShimStatus::Ok) {
+      throw DxcShimException(failure);
+    }
+  }
+
+  // Makes run return. Safe to call from any thread, and from a signal handler.
+  inline void stop() {
+    char byte = 0;
+    ssize_t count = write(m_stopPipe[1], &byte, 1);
+    (void)count;
+  }
+
+private:
+  // Workers that fail to start exit with this code plus the status of the failure.
+  static const int startupFailureExitCode = 64;
+
+  inline int listen() {
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+      throw DxcShimException(DxcShimStatus::ServerListenError);
+    }
+
+    // Replace the socket of a server that did not shut down cleanly.
+    unlink(m_address.sun_path);
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&m_address), sizeof(m_address)) != 0
+      || ::listen(listener, SOMAXCONN) != 0) {
+      close(listener);
+      throw DxcShimException(DxcShimStatus::ServerListenError);
+    }
+    return listener;
+  }
+
+  // Forks a worker. Returns its pid, or -1 if it could not be forked.
+  inline pid_t spawn(int listener) {
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid != 0) {
+      return pid;
+    }
+
+    // The worker is killed with the server, even if the server crashes.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent) {
+      _exit(0);
+    }
+
+    _exit(work(listener));
+  }
+
+  // Replaces the workers that exited. Returns the status of a worker that failed to start, as
+  // replacing it would only fail again.
+  inline DxcShimStatus reap(int listener) {
+    for (pid_t& worker : m_workers) {
+      int status;
+      if (waitpid(worker, &status, WNOHANG) != worker) {
+        continue;
+      }
+
+      if (WIFEXITED(status) && WEXITSTATUS(status) > startupFailureExitCode) {
+        worker = -1;
+        return static_cast<DxcShimStatus>(WEXITSTATUS(status) - startupFailureExitCode);
+      }
+
+      worker = spawn(listener);
+      if (worker < 0) {
+        return DxcShimStatus::ServerSpawnError;
+      }
+    }
+    return DxcShimStatus::Ok;
+  }
+
+  inline void stopWorkers() {
+    for (pid_t worker : m_workers) {
+      if (worker > 0) {
+        kill(worker, SIGTERM);
+      }
+    }
+
+    for (pid_t& worker : m_workers) {
+      if (worker > 0) {
+        while (waitpid(worker, nullptr, 0) < 0 && errno == EINTR) {}
+      }
+      worker = -1;
+    }
+  }
+
+  // The state of the connection a worker is serving, for its include callback.
+  struct Connection {
+    int socket;
+    std::string payload;
+    bool isDisconnected;
+  };
+
+  // The main loop of a worker. Returns the exit code of the worker.
+  inline int work(int listener) {
+    close(m_stopPipe[0]);
+    close(m_stopPipe[1]);
+
+    DxcShimLoader* loader;
+    DxcShimCompiler* compiler;
+    try {
+      loader = DxcShimLoader::acquire(m_loaderOptions);
+      compiler = new DxcShimCompiler(*loader);
+    } catch (DxcShimException const& e) {
+      return startupFailureExitCode + static_cast<int>(e.getStatus());
+    }
+
+    // The arguments and result are reused for every compilation of the worker.
+    DxcShimArguments args;
+    DxcShimCompilationResult result;
+    Connection connection;
+    for (;;) {
+      connection.socket = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection.socket < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        return 0;
+      }
+
+      connection.isDisconnected = false;
+      serve(*compiler, connection, args, result);
+      close(connection.socket);
+    }
+  }
+
+  // Serves the single compilation of a connection.
+  inline static void serve(DxcShimCompiler& compiler, Connection& connection, DxcShimArguments& args, DxcShimCompilationResult& result) {
+    DxcShimServerMessageType type;
+    std::string source;
+    if (!receiveServerMessage(connection.socket, type, connection.payload) || type != DxcShimServerMessageType::Compile) {
+      return;
+    }
+
+    // The payload is reused by the include callback, so the source is moved out of it.
+    DxcShimServerMessageReader reader(connection.payload.data(), connection.payload.size());
+    args.clear();
+    uint32_t argCount;
+    if (!reader.readU32(argCount)) {
+      return;
+    }
+    for (uint32_t i = 0; i < argCount; i++) {
+      const char* arg;
+      size_t argSize;
+      if (!reader.readString(arg, argSize)) {
+        return;
+      }
+      args.add(arg);
+    }
+
+    uint32_t strip;
+    const char* data;
+    size_t size;
+    if (!reader.readU32(strip) || !reader.readString(data, size)) {
+      return;
+    }
+    source.assign(data, size);
+
+    DxcShimStripOptions stripOptions = {};
+    stripOptions.stripDebugInfo = (strip & 1) != 0;
+    stripOptions.stripNames = (strip & 2) != 0;
+    args.setStrip(stripOptions);
+
+    // Cancellation is left to the client, which abandons the connection.
+    compiler.compile(source.data(), source.size(), args, DxcShimCancellation {}, loadInclude, &connection, result);
+    if (connection.isDisconnected) {
+      return;
+    }
+
+    int fd = -1;
+    size_t bytecodeSize = result.getBytecodeSize();
+    if (result.isSuccessful() && bytecodeSize > 0) {
+      fd = writeBytecode(result.getBytecodePointer(), bytecodeSize);
+      if (fd < 0) {
+        return;
+      }
+    }
+
+    std::string& payload = connection.payload;
+    payload.clear();
+    appendServerU32(payload, result.isSuccessful() ? 1 : 0);
+    appendServerString(payload, result.getMessagesPointer(), result.getMessagesSize());
+    appendServerU32(payload, static_cast<uint32_t>(bytecodeSize));
+    sendServerMessage(connection.socket, DxcShimServerMessageType::Result, payload, fd);
+
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  // Resolves an include of a worker compilation by asking the client for it.
+  inline static bool loadInclude(const char* filename, size_t filenameSize, void* userData, DxcShimIncludeSource* source) {
+    Connection& connection = *static_cast<Connection*>(userData);
+    if (connection.isDisconnected) {
+      return false;
+    }
+
+    std::string& payload = connection.payload;
+    DxcShimServerMessageType type;
+    payload.assign(filename, filenameSize);
+    if (!sendServerMessage(connection.socket, DxcShimServerMessageType::Include, payload)
+      || !receiveServerMessage(connection.socket, type, payload)
+      || type != DxcShimServerMessageType::IncludeResult) {
+      connection.isDisconnected = true;
+      return false;
+    }
+
+    DxcShimServerMessageReader reader(payload.data(), payload.size());
+    uint32_t isFound;
+    if (!reader.readU32(isFound)) {
+      connection.isDisconnected = true;
+      return false;
+    }
+    if (isFound == 0) {
+      return false;
+    }
+
+    // The contents are copied by the include handler before the payload is reused.
+    if (!reader.readString(source->data, source->size)) {
+      connection.isDisconnected = true;
+      return false;
+    }
+    source->release = nullptr;
+    source->releaseContext = nullptr;
+    return true;
+  }
+
+  // Writes bytecode to a new memfd, to be mapped by the client. Returns -1 on failure.
+  //
+  // The memfd is sealed against shrinking and writing, so the mapping of the client stays valid
+  // and unchanged for as long as it is used.
+  inline static int writeBytecode(const void* data, size_t size) {
+    int fd = memfd_create("vislum-dxc-bytecode", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+      return -1;
+    }
+
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      ssize_t count = write(fd, bytes, size);
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        close(fd);
+        return -1;
+      }
+
+      bytes += count;
+      size -= static_cast<size_t>(count);
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_WRITE) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  sockaddr_un m_address;
+  std::vector<pid_t> m_workers;
+  std::string m_libraryPath;
+  DxcShimLoaderOptions m_loaderOptions;
+  int m_stopPipe[2];
+};
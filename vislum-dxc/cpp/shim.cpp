@@ -1,10 +1,33 @@
 #include "wrapper.h"
+#include "pool.h"
+#include "batch.h"
+#include "async.h"
+#include "permutation.h"
+#include "archive.h"
+#include "server.h"
+#include "tcp_cache.h"
+
+// A work queue of integers, standing in for the jobs of a batch. Used by the tests of the crate.
+typedef DxcShimWorkQueue<uint64_t> DxcShimIntegerWorkQueue;
 
 extern "C" {
-  // Opens the loader.
+  // Opens the loader, loading "libdxcompiler.so" right away.
+  //
+  // The loader is shared by the whole process. Every open acquires a reference to it, and the
+  // library is closed when the last reference is closed.
   DxcShimStatus dxc_loader_open(DxcShimLoader **loader);
-  
-  // Closes the loader.
+
+  // Opens the loader with the given options, such as the library path or a deferred open.
+  //
+  // If a loader is already open, it is shared and keeps its library path and binding mode.
+  // With a deferred open, loading errors are returned when the first compiler is created. Only
+  // archives are read without a compiler: cache lookups preprocess the source, which loads DXC.
+  DxcShimStatus dxc_loader_open_with_options(const DxcShimLoaderOptions *options, DxcShimLoader **loader);
+
+  // Returns whether the loader has opened the DXC library.
+  bool dxc_loader_is_loaded(DxcShimLoader *loader);
+
+  // Closes the loader. Compilers and pools created from it must have been released.
   void dxc_loader_close(DxcShimLoader *loader);
 
   // Creates a compiler.
@@ -12,38 +35,674 @@ extern "C" {
 
   // Releases the compiler.
   void dxc_compiler_release(DxcShimCompiler *compiler);
+
+  // Opens the bytecode cache at the given directory, creating it if needed.
+  //
+  // The directory may be shared by several caches, compilers and processes.
+  DxcShimStatus dxc_cache_open(const char *directory, DxcShimCache **cache);
+
+  // Closes the cache. Compilers using it must have had their cache replaced or been released.
+  void dxc_cache_close(DxcShimCache *cache);
+
+  // Stores bytecode under a key. Used by the tests of the crate.
+  void dxc_cache_store(DxcShimCache *cache, const DxcShimHash *key, const void *data, size_t size);
+
+  // Copies the entry of a key into data, which has room for capacity bytes, and writes the size
+  // of the whole entry. Returns false on a miss. Used by the tests of the crate.
+  bool dxc_cache_load(DxcShimCache *cache, const DxcShimHash *key, void *data, size_t capacity, size_t *size);
+
+  // Sets the cache used by the compiler. NULL disables caching.
+  void dxc_compiler_set_cache(DxcShimCompiler *compiler, DxcShimCache *cache);
+
+  // Creates an include cache, which can be shared by any number of compilers.
+  void dxc_include_cache_create(DxcShimIncludeCache **includeCache);
+
+  // Destroys the include cache. Compilers using it must have had their include cache replaced
+  // or been released.
+  void dxc_include_cache_destroy(DxcShimIncludeCache *includeCache);
+
+  // Removes the cached include of the given file, so it is loaded again on its next use.
+  void dxc_include_cache_invalidate(DxcShimIncludeCache *includeCache, const char *filename);
+
+  // Removes all cached includes.
+  void dxc_include_cache_clear(DxcShimIncludeCache *includeCache);
+
+  // Writes the filename an include is cached under into normalized, which must have room for
+  // size bytes. Returns the size of the normalized filename, which is not NUL-terminated. Used
+  // by the tests of the crate.
+  size_t dxc_include_cache_normalize(const char *filename, size_t size, char *normalized);
+
+  // Sets the include cache used by the compiler. NULL disables include caching.
+  void dxc_compiler_set_include_cache(DxcShimCompiler *compiler, DxcShimIncludeCache *includeCache);
+
+  // Creates a prelude from its source, which sources it is set for may start with. Can be shared
+  // by any number of compilers. Includes of the prelude guarded by #ifndef stay guarded, and
+  // those marked with #pragma once are empty when the rest of the source includes them again.
+  void dxc_prelude_create(const char *data, size_t size, DxcShimPrelude **prelude);
+
+  // Destroys the prelude. Compilers and pools using it must have had their prelude replaced or
+  // been released.
+  void dxc_prelude_destroy(DxcShimPrelude *prelude);
+
+  // Removes all expansions of the prelude, so it is expanded again on its next use.
+  void dxc_prelude_clear(DxcShimPrelude *prelude);
+
+  // Writes the source a prelude is expanded from into source, which has room for capacity
+  // bytes. Returns the size of the whole source. Used by the tests of the crate.
+  size_t dxc_prelude_build_expansion_source(const char *data, size_t size, char *source, size_t capacity);
+
+  // Writes a preprocessed expansion with its macro directives restored into source, which has
+  // room for capacity bytes, and the size of the whole source into sourceSize. Returns false if
+  // the expansion is not usable. Used by the tests of the crate.
+  bool dxc_prelude_restore_expansion(const char *data, size_t size, char *source, size_t capacity, size_t *sourceSize);
+
+  // Returns whether a source has a #pragma once directive. Used by the tests of the crate.
+  bool dxc_prelude_has_pragma_once(const char *data, size_t size);
+
+  // Sets the prelude of the compiler. NULL disables it.
+  void dxc_compiler_set_prelude(DxcShimCompiler *compiler, DxcShimPrelude *prelude);
+
+  // Creates a compiler pool sharing the loader, with initialSize compilers created up front.
+  //
+  // The loader must outlive the pool.
+  DxcShimStatus dxc_compiler_pool_create(DxcShimLoader *loader, size_t initialSize, DxcShimCompilerPool **pool);
+
+  // Destroys the pool and all of its idle compilers.
+  //
+  // All acquired compilers must have been released back to the pool.
+  void dxc_compiler_pool_destroy(DxcShimCompilerPool *pool);
+
+  // Acquires a compiler from the pool for exclusive use by the calling thread.
+  DxcShimStatus dxc_compiler_pool_acquire(DxcShimCompilerPool *pool, DxcShimCompiler **compiler);
+
+  // Returns a compiler to the pool it was acquired from.
+  void dxc_compiler_pool_release(DxcShimCompilerPool *pool, DxcShimCompiler *compiler);
+
+  // Sets the cache used by all compilers of the pool. NULL disables caching.
+  //
+  // Must not be called while compilers are acquired from the pool.
+  void dxc_compiler_pool_set_cache(DxcShimCompilerPool *pool, DxcShimCache *cache);
+
+  // Sets the include cache used by all compilers of the pool. NULL disables include caching.
+  //
+  // Must not be called while compilers are acquired from the pool.
+  void dxc_compiler_pool_set_include_cache(DxcShimCompilerPool *pool, DxcShimIncludeCache *includeCache);
+
+  // Sets the prelude of all compilers of the pool. NULL disables it.
+  //
+  // Must not be called while compilers are acquired from the pool.
+  void dxc_compiler_pool_set_prelude(DxcShimCompilerPool *pool, DxcShimPrelude *prelude);
+
+  // Returns the statistics accumulated over all compilations of the compiler.
+  //
+  // May be called while the compiler is compiling on another thread.
+  void dxc_compiler_get_stats(DxcShimCompiler *compiler, DxcShimCompilerStats *stats);
+
+  // Resets the statistics of the compiler.
+  void dxc_compiler_reset_stats(DxcShimCompiler *compiler);
+
+  // Returns the statistics accumulated over all compilations of the compilers of the pool.
+  //
+  // May be called while compilers of the pool are compiling.
+  void dxc_compiler_pool_get_stats(DxcShimCompilerPool *pool, DxcShimCompilerStats *stats);
+
+  // Resets the statistics of the pool.
+  void dxc_compiler_pool_reset_stats(DxcShimCompilerPool *pool);
+
+  // Builds the arguments of the given options once, into a set that compilations refer to
+  // through the argumentSet of their options instead of building their own. The cancellation
+  // token, deadline and argument set of the options are ignored, and their strings are copied.
+  //
+  // A set can be used by many compilations at once, such as the jobs of a batch.
+  void dxc_argument_set_create(const DxcShimCompileOptions *options, DxcShimArgumentSet **argumentSet);
+
+  // Destroys the argument set. No compilation may still be using it.
+  void dxc_argument_set_destroy(DxcShimArgumentSet *argumentSet);
   
-  // Compiles a shader.
-  DxcShimCompilationResult* dxc_compile(DxcShimCompiler *compiler, const char *data, DxcShimUserCallback userCallback, void* userData);
+  // Compiles a shader with the given options.
+  //
+  // The source is size bytes long and does not need to be NUL-terminated.
+  DxcShimCompilationResult* dxc_compile(DxcShimCompiler *compiler, const char *data, size_t size, const DxcShimCompileOptions *options, DxcShimUserCallback userCallback, void* userData);
+
+  // Preprocesses a shader without running codegen.
+  //
+  // On success, the bytecode of the result is the preprocessed source, as a DXC UTF-8
+  // blob whose size includes the NUL terminator, and dxc_compilation_result_get_preprocessed_hash returns its hash. The
+  // result must be freed with dxc_compilation_result_free.
+  DxcShimCompilationResult* dxc_preprocess(DxcShimCompiler *compiler, const char *data, size_t size, const DxcShimCompileOptions *options, DxcShimUserCallback userCallback, void* userData);
   
+  // Compiles a shader into an existing result, which is reset first.
+  //
+  // The result keeps its allocations across compilations, so compiling many shaders into one
+  // result avoids allocating and freeing a result for each.
+  void dxc_compile_into(DxcShimCompiler *compiler, const char *data, size_t size, const DxcShimCompileOptions *options, DxcShimUserCallback userCallback, void* userData, DxcShimCompilationResult *result);
+
+  // Compiles a batch of jobs in parallel, using up to threadCount compilers from the pool.
+  //
+  // A threadCount of 0 uses one thread per core. results must point to jobCount entries, and
+  // receives the result of each job at the same index. Entries that are NULL receive a new
+  // result, and the others are reset and compiled into. Each result must be freed with
+  // dxc_compilation_result_free.
+  //
+  // Jobs start by priority, then the ones expected to take longest first, judging by their size
+  // and includes. Jobs of lower priority wait at job boundaries while interactive compilations
+  // of the pool need their thread.
+  //
+  // The include callback may be invoked from several threads at once, with the userData of
+  // the job that is being compiled.
+  DxcShimStatus dxc_compile_batch(
+    DxcShimCompilerPool *pool,
+    const DxcShimCompileJob *jobs,
+    size_t jobCount,
+    size_t threadCount,
+    DxcShimUserCallback userCallback,
+    DxcShimCompilationResult **results);
+
+  // Compiles a batch of jobs like dxc_compile_batch, but hands every result to onResult as soon
+  // as its job finishes, instead of keeping all of them until the batch completes.
+  //
+  // The result passed to onResult is owned by the batch, and released once the callback
+  // returns. Jobs are only started while the estimated memory of the jobs in flight fits in
+  // memoryBudget bytes, so the memory of a batch stays bounded however many jobs it has. A
+  // memoryBudget of 0 is unlimited. No more compilers are acquired than the budget lets run at
+  // once.
+  //
+  // The include and result callbacks may be invoked from several threads at once.
+  DxcShimStatus dxc_compile_batch_streaming(
+    DxcShimCompilerPool *pool,
+    const DxcShimCompileJob *jobs,
+    size_t jobCount,
+    size_t threadCount,
+    uint64_t memoryBudget,
+    DxcShimUserCallback userCallback,
+    DxcShimBatchResultCallback onResult,
+    void *resultUserData);
+
+  // Returns the number of variants of a permutation, the product of the value counts of its
+  // axes.
+  size_t dxc_permutation_count(const DxcShimPermutationAxis *axes, size_t axisCount);
+
+  // Compiles every variant of a source over the combinations of values of the axes, in
+  // parallel using up to threadCount compilers from the pool.
+  //
+  // Variants are numbered with the last axis varying fastest. Variants whose preprocessed
+  // source is identical to that of an earlier variant are not compiled: their entry in results
+  // is NULL, and their entry in representatives is the index of the variant whose result they
+  // share. results and representatives must point to dxc_permutation_count entries, and each
+  // non-NULL result must be freed with dxc_compilation_result_free.
+  //
+  // The include callback may be invoked from several threads at once.
+  DxcShimStatus dxc_compile_permutations(
+    DxcShimCompilerPool *pool,
+    const char *source,
+    size_t sourceSize,
+    const DxcShimCompileOptions *options,
+    const DxcShimPermutationAxis *axes,
+    size_t axisCount,
+    size_t threadCount,
+    DxcShimUserCallback userCallback,
+    void *userData,
+    DxcShimCompilationResult **results,
+    size_t *representatives);
+
+  // Creates an async compiler with threadCount workers, each using a compiler acquired from
+  // the pool. A threadCount of 0 uses one thread per core.
+  //
+  // The pool must outlive the async compiler.
+  DxcShimStatus dxc_async_compiler_create(DxcShimCompilerPool *pool, size_t threadCount, DxcShimAsyncCompiler **asyncCompiler);
+
+  // Destroys the async compiler. Pending tasks are cancelled, and running tasks are waited for.
+  void dxc_async_compiler_destroy(DxcShimAsyncCompiler *asyncCompiler);
+
+  // Queues a compilation on the async compiler and returns its task.
+  //
+  // The source and options are copied, and do not need to outlive the call. userData is passed
+  // to the include callback and must stay valid until the task has completed or been
+  // cancelled. onComplete may be NULL. Otherwise, it is called exactly once with
+  // completionUserData when the task completes or is cancelled, possibly before this returns.
+  //
+  // The task must be released with dxc_compile_task_release.
+  DxcShimCompileTask* dxc_compile_async(
+    DxcShimAsyncCompiler *asyncCompiler,
+    const char *data,
+    size_t size,
+    const DxcShimCompileOptions *options,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompletionCallback onComplete,
+    void* completionUserData);
+
+  // Returns the status of the task.
+  DxcShimTaskStatus dxc_compile_task_poll(DxcShimCompileTask *task);
+
+  // Cancels the task. A pending task is cancelled immediately. A running one is stopped before
+  // its next phase or include, and becomes cancelled then, unless it completes first.
+  //
+  // Returns whether the call cancelled the task, which only a pending task is right away.
+  bool dxc_compile_task_cancel(DxcShimCompileTask *task);
+
+  // Blocks until the task has completed or been cancelled.
+  void dxc_compile_task_wait(DxcShimCompileTask *task);
+
+  // Takes the result of a completed task, which must be freed with dxc_compilation_result_free.
+  //
+  // Returns NULL if the task has not completed, was cancelled, or its result was already taken.
+  DxcShimCompilationResult* dxc_compile_task_take_result(DxcShimCompileTask *task);
+
+  // Releases the task. A task that is still pending or running is not cancelled, and its
+  // result is freed once it completes.
+  void dxc_compile_task_release(DxcShimCompileTask *task);
+
+  // Creates a cancellation token, which can be passed to any number of compilations.
+  void dxc_cancellation_token_create(DxcShimCancellationToken **token);
+
+  // Destroys the token. Compilations using it must have completed.
+  void dxc_cancellation_token_destroy(DxcShimCancellationToken *token);
+
+  // Cancels all compilations using the token, from any thread.
+  //
+  // Compilations stop before their next phase or include, and return a cancelled result.
+  void dxc_cancellation_token_cancel(DxcShimCancellationToken *token);
+
+  // Returns whether the token has been cancelled.
+  bool dxc_cancellation_token_is_cancelled(DxcShimCancellationToken *token);
+
+  // Hashes the contents of an include the same way resolved includes are hashed.
+  void dxc_hash_include_contents(const void *data, size_t size, DxcShimHash *hash);
+
+  // Creates a dependency index, mapping included files to the compilations that depend on them.
+  void dxc_dependency_index_create(DxcShimDependencyIndex **index);
+
+  // Destroys the dependency index.
+  void dxc_dependency_index_destroy(DxcShimDependencyIndex *index);
+
+  // Records the includes of a compilation result under the given name, replacing the includes
+  // previously recorded for it.
+  void dxc_dependency_index_record(DxcShimDependencyIndex *index, const char *name, DxcShimCompilationResult *result);
+
+  // Records the given normalized filenames and hashes as the includes of a compilation. Used by
+  // the tests of the crate.
+  void dxc_dependency_index_record_includes(
+    DxcShimDependencyIndex *index,
+    const char *name,
+    const char *const *filenames,
+    const DxcShimHash *hashes,
+    size_t count);
+
+  // Removes the compilation with the given name from the index.
+  void dxc_dependency_index_remove(DxcShimDependencyIndex *index, const char *name);
+
+  // Calls callback with the name of every compilation that depends on the given file, directly
+  // or through other includes.
+  //
+  // If hash is not NULL, compilations that resolved the file with the same contents hash are
+  // skipped. The callback must not call back into the index.
+  void dxc_dependency_index_find_dependents(
+    DxcShimDependencyIndex *index,
+    const char *filename,
+    const DxcShimHash *hash,
+    DxcShimDependentCallback callback,
+    void* userData);
+
+  // Returns the current time of the clock compilation deadlines are measured on, in
+  // nanoseconds.
+  uint64_t dxc_clock_now();
+
   // Returns whether a compilation was successful.
   bool dxc_compilation_result_is_successful(DxcShimCompilationResult *result);
   
+  // Returns whether a compilation was cancelled by its token or deadline.
+  //
+  // Cancelled compilations are not successful.
+  bool dxc_compilation_result_is_cancelled(DxcShimCompilationResult *result);
+
   // Returns the error message of a compilation.
   //
-  // Returns NULL if the compilation was successful.
+  // For successful compilations, the message holds the warnings reported by DXC, if any.
   char* dxc_compilation_result_get_error_message(DxcShimCompilationResult *result);
 
+  // Returns the error message of a compilation, and its size in bytes without the NUL terminator.
+  //
+  // The message is not copied: the pointer refers to the UTF-8 blob reported by DXC, owned by the
+  // result, and remains valid until the result is freed.
+  void dxc_compilation_result_get_messages(DxcShimCompilationResult *result, const char **messages, size_t *size);
+
   // Returns the bytecode of a compilation.
   //
   // Size is the size of the bytecode in bytes. If the compilation failed, the size will be set to 0.
+  //
+  // The bytecode is not copied: the pointer refers to the DXC blob owned by the result and
+  // remains valid until the result is freed.
   void dxc_compilation_result_get_bytecode(DxcShimCompilationResult *result, void **bytecode, size_t *size);
 
+  // Returns the statistics of a compilation.
+  void dxc_compilation_result_get_stats(DxcShimCompilationResult *result, DxcShimCompilationStats *stats);
+
+  // Returns the number of includes resolved by a compilation, each counted once.
+  size_t dxc_compilation_result_get_include_count(DxcShimCompilationResult *result);
+
+  // Returns the include at the given index, in the order the includes were first loaded.
+  //
+  // The filename is normalized and NUL-terminated, and remains valid until the result is freed.
+  // The hash is the hash of the contents of the include, as by dxc_hash_include_contents.
+  void dxc_compilation_result_get_include(DxcShimCompilationResult *result, size_t index, const char **filename, DxcShimHash *hash);
+
+  // Returns the number of diagnostics reported by a compilation, including the warnings of a
+  // successful one. A failed compilation has at least one error.
+  //
+  // Results served from the cache report no warnings, as only the bytecode is cached.
+  size_t dxc_compilation_result_get_diagnostic_count(DxcShimCompilationResult *result);
+
+  // Gets the diagnostic at the given index, in the order DXC reported them.
+  //
+  // The strings point into the error message, are not NUL-terminated, and remain valid until
+  // the result is reset or freed.
+  void dxc_compilation_result_get_diagnostic(DxcShimCompilationResult *result, size_t index, DxcShimDiagnostic *diagnostic);
+
+  // Parses the diagnostics of messages in the format of DXC into up to capacity diagnostics.
+  // Returns the number of diagnostics found, which is at most the number of lines. Used by the
+  // tests of the crate.
+  //
+  // The strings point into text, which must outlive them.
+  size_t dxc_parse_diagnostics(const char *text, size_t size, DxcShimDiagnostic *diagnostics, size_t capacity);
+
+  // Gets the reflection of the SPIR-V bytecode: its stage, descriptor bindings, push constant
+  // size and stage inputs. Returns false if the compilation failed or produced no valid SPIR-V.
+  //
+  // The reflection is computed on the first call, including for results served from the
+  // cache, and remains valid until the result is freed.
+  bool dxc_compilation_result_get_reflection(DxcShimCompilationResult *result, const DxcShimReflection **reflection);
+
+  // Reflects SPIR-V bytecode without a compilation result. Returns false if it is not valid
+  // SPIR-V. Used by the tests of the crate.
+  //
+  // The reflection remains valid until the reflector is destroyed.
+  bool dxc_reflector_create(const uint32_t *words, size_t wordCount, DxcShimReflector **reflector);
+  const DxcShimReflection *dxc_reflector_get_reflection(DxcShimReflector *reflector);
+  void dxc_reflector_destroy(DxcShimReflector *reflector);
+
+  // Strips a SPIR-V module in place, as compilations do with the strip options. Returns the
+  // size of the stripped module in words, or 0 if it is not valid SPIR-V, in which case it is
+  // left untouched. Used by the tests of the crate.
+  size_t dxc_strip_spirv(uint32_t *words, size_t wordCount, const DxcShimStripOptions *options);
+
+  // Gets the hash of the source after preprocessing. Returns false if the source was not
+  // preprocessed, which is the case for failed preprocessing and compilations without a cache.
+  bool dxc_compilation_result_get_preprocessed_hash(DxcShimCompilationResult *result, DxcShimHash *hash);
+
+  // Creates an empty result, to be compiled into with dxc_compile_into or dxc_compile_batch.
+  // The result must be freed with dxc_compilation_result_free.
+  DxcShimCompilationResult* dxc_compilation_result_create();
+
+  // Releases the bytecode and clears the errors, includes and statistics of the result, but
+  // keeps its allocations for the next compilation into it. Pointers previously obtained from
+  // the result become invalid.
+  void dxc_compilation_result_reset(DxcShimCompilationResult *result);
+
   // Frees the result.
   void dxc_compilation_result_free(DxcShimCompilationResult *result);
+
+  // Creates an archive writer, collecting compiled modules to write into a shader archive.
+  void dxc_archive_writer_create(DxcShimArchiveWriter **writer);
+
+  // Destroys the archive writer.
+  void dxc_archive_writer_destroy(DxcShimArchiveWriter *writer);
+
+  // Adds the bytecode of a successful compilation to the archive under the given key, such as
+  // the hash of its permutation, with its reflection and resolved includes. The bytecode is
+  // copied, so the result can be freed right away.
+  //
+  // Returns false if the compilation failed or the key was already added.
+  bool dxc_archive_writer_add(DxcShimArchiveWriter *writer, const DxcShimHash *key, DxcShimCompilationResult *result);
+
+  // Adds bytecode to the archive under the given key, with an optional reflection and the
+  // filenames and hashes of its dependencies. Returns false if the key was already added. Used
+  // by the tests of the crate.
+  bool dxc_archive_writer_add_bytecode(
+    DxcShimArchiveWriter *writer,
+    const DxcShimHash *key,
+    const void *bytecode,
+    size_t bytecodeSize,
+    const DxcShimReflection *reflection,
+    const char *const *dependencyFilenames,
+    const DxcShimHash *dependencyHashes,
+    size_t dependencyCount);
+
+  // Writes the archive to the given path, replacing any existing file atomically. The writer
+  // can be written again after adding more modules.
+  DxcShimStatus dxc_archive_writer_write(DxcShimArchiveWriter *writer, const char *path);
+
+  // Maps the shader archive at the given path.
+  DxcShimStatus dxc_archive_open(const char *path, DxcShimArchive **archive);
+
+  // Unmaps the archive. Pointers obtained from it become invalid.
+  void dxc_archive_close(DxcShimArchive *archive);
+
+  // Returns the number of modules in the archive.
+  size_t dxc_archive_get_entry_count(DxcShimArchive *archive);
+
+  // Finds the module with the given key. Returns false if the archive has none.
+  bool dxc_archive_find(DxcShimArchive *archive, const DxcShimHash *key, size_t *index);
+
+  // Gets the key of the module at the given index. Modules are sorted by key.
+  void dxc_archive_get_key(DxcShimArchive *archive, size_t index, DxcShimHash *key);
+
+  // Gets the bytecode of a module. The bytecode points into the mapping, and remains valid
+  // until the archive is closed.
+  void dxc_archive_get_bytecode(DxcShimArchive *archive, size_t index, const void **bytecode, size_t *size);
+
+  // Gets the reflection of a module, as by dxc_compilation_result_get_reflection. Returns false
+  // if its bytecode could not be reflected when it was archived.
+  //
+  // The reflection remains valid until the archive is closed.
+  bool dxc_archive_get_reflection(DxcShimArchive *archive, size_t index, const DxcShimReflection **reflection);
+
+  // Returns the number of includes the module was compiled from.
+  size_t dxc_archive_get_dependency_count(DxcShimArchive *archive, size_t index);
+
+  // Gets an include of a module, as by dxc_compilation_result_get_include. The filename remains
+  // valid until the archive is closed.
+  void dxc_archive_get_dependency(DxcShimArchive *archive, size_t index, size_t dependencyIndex, const char **filename, DxcShimHash *hash);
+
+  // Creates a client of the compile server listening on the given socket path. Does not
+  // connect: every compilation connects on its own.
+  DxcShimStatus dxc_compile_server_client_create(const char *socketPath, DxcShimCompileServerClient **client);
+
+  // Destroys the client. Compilers and pools using it must have had their compile server
+  // replaced or been released.
+  void dxc_compile_server_client_destroy(DxcShimCompileServerClient *client);
+
+  // Sets the compile server the compiler forwards codegen to. NULL compiles in process.
+  //
+  // If no server is listening, shaders are compiled in process instead.
+  void dxc_compiler_set_compile_server(DxcShimCompiler *compiler, DxcShimCompileServerClient *client);
+
+  // Sets the compile server used by all compilers of the pool. NULL compiles in process.
+  //
+  // Must not be called while compilers are acquired from the pool.
+  void dxc_compiler_pool_set_compile_server(DxcShimCompilerPool *pool, DxcShimCompileServerClient *client);
+
+  // Creates a compile server with the given options. The server does not listen until run.
+  DxcShimStatus dxc_compile_server_create(const DxcShimCompileServerOptions *options, DxcShimCompileServer **server);
+
+  // Destroys the server, which must not be running.
+  void dxc_compile_server_destroy(DxcShimCompileServer *server);
+
+  // Forks the workers of the server and serves compilations until dxc_compile_server_stop is
+  // called. Returns an error if the socket cannot be listened on, or the workers fail to
+  // start.
+  //
+  // Should be called from a process of its own, before it starts other threads.
+  DxcShimStatus dxc_compile_server_run(DxcShimCompileServer *server);
+
+  // Makes dxc_compile_server_run return. May be called from any thread or a signal handler.
+  void dxc_compile_server_stop(DxcShimCompileServer *server);
+
+  // Creates a remote cache in front of the given backend, which is released with the cache.
+  DxcShimStatus dxc_remote_cache_create(const DxcShimRemoteCacheBackend *backend, DxcShimRemoteCache **remoteCache);
+
+  // Creates a remote cache talking to a cache server at the given host and port. Does not
+  // connect until the first lookup or upload. Connections and requests time out after
+  // timeoutMilliseconds, after which the server is skipped for a few seconds.
+  DxcShimStatus dxc_remote_cache_connect(const char *host, uint16_t port, uint32_t timeoutMilliseconds, DxcShimRemoteCache **remoteCache);
+
+  // Finishes the queued uploads, and destroys the remote cache. Compilers and pools using it
+  // must have had their remote cache replaced or been released.
+  void dxc_remote_cache_destroy(DxcShimRemoteCache *remoteCache);
+
+  // Waits until every queued upload has been handed to the backend.
+  void dxc_remote_cache_flush(DxcShimRemoteCache *remoteCache);
+
+  // Sets the remote cache used by the compiler after a local cache miss. NULL disables it.
+  void dxc_compiler_set_remote_cache(DxcShimCompiler *compiler, DxcShimRemoteCache *remoteCache);
+
+  // Sets the remote cache used by all compilers of the pool. NULL disables it.
+  //
+  // Must not be called while compilers are acquired from the pool.
+  void dxc_compiler_pool_set_remote_cache(DxcShimCompilerPool *pool, DxcShimRemoteCache *remoteCache);
+
+  // Creates a server sharing the cache over TCP, listening on the given host and port. A NULL
+  // host listens on all addresses, and a port of 0 picks a free port.
+  //
+  // The cache must outlive the server.
+  DxcShimStatus dxc_cache_server_create(DxcShimCache *cache, const char *host, uint16_t port, DxcShimCacheServer **server);
+
+  // Destroys the server, which must not be running.
+  void dxc_cache_server_destroy(DxcShimCacheServer *server);
+
+  // Returns the port the server listens on.
+  uint16_t dxc_cache_server_get_port(DxcShimCacheServer *server);
+
+  // Serves connections until dxc_cache_server_stop is called.
+  void dxc_cache_server_run(DxcShimCacheServer *server);
+
+  // Makes dxc_cache_server_run return. May be called from any thread or a signal handler.
+  void dxc_cache_server_stop(DxcShimCacheServer *server);
+
+  // Creates a sink writing zones to a file in the Chrome trace event format. The file is
+  // completed once the sink is destroyed.
+  DxcShimStatus dxc_trace_chrome_sink_create(const char *path, DxcShimTraceSink **sink);
+
+  // Creates a sink forwarding zones to user callbacks, such as ones emitting Tracy zones.
+  void dxc_trace_callback_sink_create(const DxcShimTraceCallbacks *callbacks, DxcShimTraceSink **sink);
+
+  // Destroys the sink, which must not be set.
+  void dxc_trace_sink_destroy(DxcShimTraceSink *sink);
+
+  // Writes out the zones buffered by the sink.
+  void dxc_trace_sink_flush(DxcShimTraceSink *sink);
+
+  // Sets the sink the zones of the process are traced to. NULL disables tracing, which then
+  // costs a single load per zone.
+  //
+  // Returns once no zone is traced by the previous sink, so it must not be called from a sink.
+  // Zones traced by the new sink do not delay it.
+  void dxc_trace_set_sink(DxcShimTraceSink *sink);
+
+  // Converts UTF-8 to UTF-16 or UTF-32, as wide strings are on Windows and Linux, writing up to
+  // capacity units. Returns the number of units of the whole conversion. Used by the tests of
+  // the crate.
+  size_t dxc_conv_utf8_to_utf16(const char *s, size_t size, char16_t *out, size_t capacity);
+  size_t dxc_conv_utf8_to_utf32(const char *s, size_t size, char32_t *out, size_t capacity);
+
+  // Converts UTF-16 or UTF-32 to UTF-8, writing up to capacity bytes. Returns the size of the
+  // whole conversion. Used by the tests of the crate.
+  size_t dxc_conv_utf16_to_utf8(const char16_t *s, size_t size, char *out, size_t capacity);
+  size_t dxc_conv_utf32_to_utf8(const char32_t *s, size_t size, char *out, size_t capacity);
+
+  // Creates a work queue of integers for the given number of workers. Used by the tests of the
+  // crate.
+  void dxc_work_queue_create(size_t workerCount, DxcShimIntegerWorkQueue **queue);
+
+  // Destroys the work queue. Used by the tests of the crate.
+  void dxc_work_queue_destroy(DxcShimIntegerWorkQueue *queue);
+
+  // Pushes an item of the given priority. Used by the tests of the crate.
+  void dxc_work_queue_push(DxcShimIntegerWorkQueue *queue, uint64_t item, DxcShimPriority priority);
+
+  // Takes the most urgent item for a worker, waiting until there is one. Returns false once the
+  // queue is stopped and empty. Used by the tests of the crate.
+  bool dxc_work_queue_pop(DxcShimIntegerWorkQueue *queue, size_t workerIndex, uint64_t *item);
+
+  // Stops the queue, writing up to capacity of the items still queued. Returns the number of
+  // items. Used by the tests of the crate.
+  size_t dxc_work_queue_stop(DxcShimIntegerWorkQueue *queue, uint64_t *items, size_t capacity);
+
+  // Creates a priority gate. Used by the tests of the crate.
+  void dxc_priority_gate_create(DxcShimPriorityGate **gate);
+
+  // Destroys the priority gate. No scope may be entered. Used by the tests of the crate.
+  void dxc_priority_gate_destroy(DxcShimPriorityGate *gate);
+
+  // Schedules a job of the given priority against the gate, waiting for it to make room if it
+  // is not interactive, until the scope is left. Used by the tests of the crate.
+  void dxc_priority_scope_enter(DxcShimPriorityGate *gate, DxcShimPriority priority, DxcShimPriorityScope **scope);
+
+  // Ends the job of the scope. Used by the tests of the crate.
+  void dxc_priority_scope_leave(DxcShimPriorityScope *scope);
+
+  // Creates the memory budget of a streaming batch. A budget of 0 is unlimited. Used by the
+  // tests of the crate.
+  void dxc_memory_budget_create(uint64_t budget, DxcShimMemoryBudget **memoryBudget);
+
+  // Destroys the memory budget. Used by the tests of the crate.
+  void dxc_memory_budget_destroy(DxcShimMemoryBudget *memoryBudget);
+
+  // Waits until a job of the given size fits in the budget. Used by the tests of the crate.
+  void dxc_memory_budget_acquire(DxcShimMemoryBudget *memoryBudget, uint64_t size);
+
+  // Releases the size of a job. Used by the tests of the crate.
+  void dxc_memory_budget_release(DxcShimMemoryBudget *memoryBudget, uint64_t size);
+
+  // Returns how many jobs of the given sizes can be in flight at once at most. Used by the tests
+  // of the crate.
+  size_t dxc_memory_budget_get_max_in_flight(DxcShimMemoryBudget *memoryBudget, const uint64_t *sizes, size_t count);
+
+  // Creates a TCP cache backend, skipping a failed server for retryDelayMilliseconds. Used by the
+  // tests of the crate.
+  void dxc_tcp_cache_backend_create(
+    const char *host,
+    uint16_t port,
+    uint32_t timeoutMilliseconds,
+    uint32_t retryDelayMilliseconds,
+    DxcShimTcpCacheBackend **backend);
+
+  // Destroys the TCP cache backend. Used by the tests of the crate.
+  void dxc_tcp_cache_backend_destroy(DxcShimTcpCacheBackend *backend);
+
+  // Looks up a batch of keys, clearing the entries of misses. The entries stay valid until the
+  // next lookup. Used by the tests of the crate.
+  void dxc_tcp_cache_backend_lookup(DxcShimTcpCacheBackend *backend, const DxcShimHash *keys, size_t count, DxcShimRemoteCacheEntry *entries);
+
+  // Sends bytecode to store under a key, without waiting for the server. Used by the tests of
+  // the crate.
+  void dxc_tcp_cache_backend_store(DxcShimTcpCacheBackend *backend, const DxcShimHash *key, const void *data, size_t size);
 } // extern "C"
 
 DxcShimStatus dxc_loader_open(DxcShimLoader **loader) {
   try {
-    *loader = new DxcShimLoader();
+    *loader = DxcShimLoader::acquire();
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+DxcShimStatus dxc_loader_open_with_options(const DxcShimLoaderOptions *options, DxcShimLoader **loader) {
+  try {
+    *loader = DxcShimLoader::acquire(*options);
     return DxcShimStatus::Ok;
   } catch (const DxcShimException &e) {
     return e.getStatus();
   }
 }
 
+bool dxc_loader_is_loaded(DxcShimLoader *loader) {
+  return loader->isLoaded();
+}
+
 void dxc_loader_close(DxcShimLoader *loader) {
-  delete loader;
+  loader->release();
 }
 
 DxcShimStatus dxc_create_compiler(DxcShimLoader *loader, DxcShimCompiler **compiler) {
@@ -59,23 +718,771 @@ void dxc_compiler_release(DxcShimCompiler *compiler) {
   delete compiler;
 }
 
-DxcShimCompilationResult* dxc_compile(DxcShimCompiler *compiler, const char *data, DxcShimUserCallback userCallback, void* userData) {
-  return compiler->compile(data, userCallback, userData);
+DxcShimStatus dxc_cache_open(const char *directory, DxcShimCache **cache) {
+  try {
+    *cache = new DxcShimCache(directory);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_cache_close(DxcShimCache *cache) {
+  delete cache;
 }
 
-bool dxc_compilation_result_is_successful(DxcShimCompilationResult *result) {
-    return result->isSuccessful();
+void dxc_cache_store(DxcShimCache *cache, const DxcShimHash *key, const void *data, size_t size) {
+  cache->store(*key, data, size);
 }
 
-char* dxc_compilation_result_get_error_message(DxcShimCompilationResult *result) {
-    return (char*)result->getErrorMessage().c_str();
+bool dxc_cache_load(DxcShimCache *cache, const DxcShimHash *key, void *data, size_t capacity, size_t *size) {
+  CComPtr<IDxcBlob> blob = cache->load(*key);
+  if (blob == nullptr) {
+    return false;
+  }
+
+  *size = blob->GetBufferSize();
+  std::memcpy(data, blob->GetBufferPointer(), std::min(*size, capacity));
+  return true;
 }
 
-void dxc_compilation_result_get_bytecode(DxcShimCompilationResult *result, void **bytecode, size_t *size) {
-    *bytecode = (void*)result->getBytecode().data();
-    *size = result->getBytecode().size();
+void dxc_compiler_set_cache(DxcShimCompiler *compiler, DxcShimCache *cache) {
+  compiler->setCache(cache);
 }
 
-void dxc_compilation_result_free(DxcShimCompilationResult *result) {
-    delete result;
+void dxc_include_cache_create(DxcShimIncludeCache **includeCache) {
+  *includeCache = new DxcShimIncludeCache();
+}
+
+void dxc_include_cache_destroy(DxcShimIncludeCache *includeCache) {
+  delete includeCache;
+}
+
+void dxc_include_cache_invalidate(DxcShimIncludeCache *includeCache, const char *filename) {
+  includeCache->invalidate(filename);
+}
+
+void dxc_include_cache_clear(DxcShimIncludeCache *includeCache) {
+  includeCache->clear();
+}
+
+size_t dxc_include_cache_normalize(const char *filename, size_t size, char *normalized) {
+  std::string result = DxcShimIncludeCache::normalize(std::string(filename, size));
+  std::memcpy(normalized, result.data(), result.size());
+  return result.size();
+}
+
+void dxc_compiler_set_include_cache(DxcShimCompiler *compiler, DxcShimIncludeCache *includeCache) {
+  compiler->setIncludeCache(includeCache);
+}
+
+void dxc_prelude_create(const char *data, size_t size, DxcShimPrelude **prelude) {
+  *prelude = new DxcShimPrelude(data, size);
+}
+
+void dxc_prelude_destroy(DxcShimPrelude *prelude) {
+  delete prelude;
+}
+
+void dxc_prelude_clear(DxcShimPrelude *prelude) {
+  prelude->clear();
+}
+
+size_t dxc_prelude_build_expansion_source(const char *data, size_t size, char *source, size_t capacity) {
+  std::string expansionSource = DxcShimPrelude::buildExpansionSource(data, size);
+  std::memcpy(source, expansionSource.data(), std::min(expansionSource.size(), capacity));
+  return expansionSource.size();
+}
+
+bool dxc_prelude_restore_expansion(const char *data, size_t size, char *source, size_t capacity, size_t *sourceSize) {
+  std::string restored;
+  bool isUsable = DxcShimPrelude::restoreMacroDirectives(data, size, restored);
+  std::memcpy(source, restored.data(), std::min(restored.size(), capacity));
+  *sourceSize = restored.size();
+  return isUsable;
+}
+
+bool dxc_prelude_has_pragma_once(const char *data, size_t size) {
+  return DxcShimPrelude::hasPragmaOnce(data, size);
+}
+
+void dxc_compiler_set_prelude(DxcShimCompiler *compiler, DxcShimPrelude *prelude) {
+  compiler->setPrelude(prelude);
+}
+
+DxcShimStatus dxc_compiler_pool_create(DxcShimLoader *loader, size_t initialSize, DxcShimCompilerPool **pool) {
+  try {
+    *pool = new DxcShimCompilerPool(*loader, initialSize);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_compiler_pool_destroy(DxcShimCompilerPool *pool) {
+  delete pool;
+}
+
+DxcShimStatus dxc_compiler_pool_acquire(DxcShimCompilerPool *pool, DxcShimCompiler **compiler) {
+  try {
+    *compiler = pool->acquire();
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_compiler_pool_release(DxcShimCompilerPool *pool, DxcShimCompiler *compiler) {
+  pool->release(compiler);
+}
+
+void dxc_compiler_pool_set_cache(DxcShimCompilerPool *pool, DxcShimCache *cache) {
+  pool->setCache(cache);
+}
+
+void dxc_compiler_pool_set_include_cache(DxcShimCompilerPool *pool, DxcShimIncludeCache *includeCache) {
+  pool->setIncludeCache(includeCache);
+}
+
+void dxc_compiler_pool_set_prelude(DxcShimCompilerPool *pool, DxcShimPrelude *prelude) {
+  pool->setPrelude(prelude);
+}
+
+void dxc_compiler_get_stats(DxcShimCompiler *compiler, DxcShimCompilerStats *stats) {
+  *stats = compiler->getStats().snapshot();
+}
+
+void dxc_compiler_reset_stats(DxcShimCompiler *compiler) {
+  compiler->getStats().reset();
+}
+
+void dxc_compiler_pool_get_stats(DxcShimCompilerPool *pool, DxcShimCompilerStats *stats) {
+  *stats = pool->getStats().snapshot();
+}
+
+void dxc_compiler_pool_reset_stats(DxcShimCompilerPool *pool) {
+  pool->getStats().reset();
+}
+
+void dxc_argument_set_create(const DxcShimCompileOptions *options, DxcShimArgumentSet **argumentSet) {
+  *argumentSet = DxcShimCompiler::createArgumentSet(*options);
+}
+
+void dxc_argument_set_destroy(DxcShimArgumentSet *argumentSet) {
+  delete argumentSet;
+}
+
+DxcShimCompilationResult* dxc_compile(DxcShimCompiler *compiler, const char *data, size_t size, const DxcShimCompileOptions *options, DxcShimUserCallback userCallback, void* userData) {
+  return compiler->compile(data, size, *options, userCallback, userData);
+}
+
+void dxc_compile_into(DxcShimCompiler *compiler, const char *data, size_t size, const DxcShimCompileOptions *options, DxcShimUserCallback userCallback, void* userData, DxcShimCompilationResult *result) {
+  compiler->compile(data, size, *options, userCallback, userData, *result);
+}
+
+DxcShimCompilationResult* dxc_preprocess(DxcShimCompiler *compiler, const char *data, size_t size, const DxcShimCompileOptions *options, DxcShimUserCallback userCallback, void* userData) {
+  return compiler->preprocess(data, size, *options, userCallback, userData);
+}
+
+DxcShimStatus dxc_compile_batch(
+  DxcShimCompilerPool *pool,
+  const DxcShimCompileJob *jobs,
+  size_t jobCount,
+  size_t threadCount,
+  DxcShimUserCallback userCallback,
+  DxcShimCompilationResult **results) {
+  try {
+    compileBatch(*pool, jobs, jobCount, threadCount, userCallback, results);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+DxcShimStatus dxc_compile_batch_streaming(
+  DxcShimCompilerPool *pool,
+  const DxcShimCompileJob *jobs,
+  size_t jobCount,
+  size_t threadCount,
+  uint64_t memoryBudget,
+  DxcShimUserCallback userCallback,
+  DxcShimBatchResultCallback onResult,
+  void *resultUserData) {
+  try {
+    compileBatchStreaming(*pool, jobs, jobCount, threadCount, memoryBudget, userCallback, onResult, resultUserData);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+size_t dxc_permutation_count(const DxcShimPermutationAxis *axes, size_t axisCount) {
+  return countPermutations(axes, axisCount);
+}
+
+DxcShimStatus dxc_compile_permutations(
+  DxcShimCompilerPool *pool,
+  const char *source,
+  size_t sourceSize,
+  const DxcShimCompileOptions *options,
+  const DxcShimPermutationAxis *axes,
+  size_t axisCount,
+  size_t threadCount,
+  DxcShimUserCallback userCallback,
+  void *userData,
+  DxcShimCompilationResult **results,
+  size_t *representatives) {
+  try {
+    compilePermutations(*pool, source, sourceSize, *options, axes, axisCount, threadCount, userCallback, userData, results, representatives);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+DxcShimStatus dxc_async_compiler_create(DxcShimCompilerPool *pool, size_t threadCount, DxcShimAsyncCompiler **asyncCompiler) {
+  try {
+    *asyncCompiler = new DxcShimAsyncCompiler(*pool, threadCount);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_async_compiler_destroy(DxcShimAsyncCompiler *asyncCompiler) {
+  delete asyncCompiler;
+}
+
+DxcShimCompileTask* dxc_compile_async(
+  DxcShimAsyncCompiler *asyncCompiler,
+  const char *data,
+  size_t size,
+  const DxcShimCompileOptions *options,
+  DxcShimUserCallback userCallback,
+  void* userData,
+  DxcShimCompletionCallback onComplete,
+  void* completionUserData) {
+  DxcShimCompileTask* task = new DxcShimCompileTask(data, size, *options, userCallback, userData, onComplete, completionUserData);
+  asyncCompiler->submit(task);
+  return task;
+}
+
+DxcShimTaskStatus dxc_compile_task_poll(DxcShimCompileTask *task) {
+  return task->getStatus();
+}
+
+bool dxc_compile_task_cancel(DxcShimCompileTask *task) {
+  return task->cancel();
+}
+
+void dxc_compile_task_wait(DxcShimCompileTask *task) {
+  task->wait();
+}
+
+DxcShimCompilationResult* dxc_compile_task_take_result(DxcShimCompileTask *task) {
+  return task->takeResult();
+}
+
+void dxc_compile_task_release(DxcShimCompileTask *task) {
+  task->release();
+}
+
+void dxc_cancellation_token_create(DxcShimCancellationToken **token) {
+  *token = new DxcShimCancellationToken();
+}
+
+void dxc_cancellation_token_destroy(DxcShimCancellationToken *token) {
+  delete token;
+}
+
+void dxc_cancellation_token_cancel(DxcShimCancellationToken *token) {
+  token->cancel();
+}
+
+bool dxc_cancellation_token_is_cancelled(DxcShimCancellationToken *token) {
+  return token->isCancelled();
+}
+
+void dxc_hash_include_contents(const void *data, size_t size, DxcShimHash *hash) {
+  *hash = hashIncludeContents(data, size);
+}
+
+void dxc_dependency_index_create(DxcShimDependencyIndex **index) {
+  *index = new DxcShimDependencyIndex();
+}
+
+void dxc_dependency_index_destroy(DxcShimDependencyIndex *index) {
+  delete index;
+}
+
+void dxc_dependency_index_record(DxcShimDependencyIndex *index, const char *name, DxcShimCompilationResult *result) {
+  index->record(name, result->getIncludes());
+}
+
+void dxc_dependency_index_record_includes(
+  DxcShimDependencyIndex *index,
+  const char *name,
+  const char *const *filenames,
+  const DxcShimHash *hashes,
+  size_t count) {
+  std::vector<DxcShimResolvedInclude> includes(count);
+  for (size_t i = 0; i < count; i++) {
+    includes[i].filename = filenames[i];
+    includes[i].hash = hashes[i];
+  }
+
+  index->record(name, includes);
+}
+
+void dxc_dependency_index_remove(DxcShimDependencyIndex *index, const char *name) {
+  index->remove(name);
+}
+
+void dxc_dependency_index_find_dependents(
+  DxcShimDependencyIndex *index,
+  const char *filename,
+  const DxcShimHash *hash,
+  DxcShimDependentCallback callback,
+  void* userData) {
+  // Collected first, so the callback is not invoked with the lock held.
+  std::vector<std::string> dependents = index->findDependents(filename, hash);
+  for (std::string const& name : dependents) {
+    callback(name.c_str(), userData);
+  }
+}
+
+uint64_t dxc_clock_now() {
+  return dxcShimClockNow();
+}
+
+bool dxc_compilation_result_is_successful(DxcShimCompilationResult *result) {
+    return result->isSuccessful();
+}
+
+bool dxc_compilation_result_is_cancelled(DxcShimCompilationResult *result) {
+    return result->isCancelled();
+}
+
+char* dxc_compilation_result_get_error_message(DxcShimCompilationResult *result) {
+    return const_cast<char*>(result->getMessagesPointer());
+}
+
+void dxc_compilation_result_get_messages(DxcShimCompilationResult *result, const char **messages, size_t *size) {
+    *messages = result->getMessagesPointer();
+    *size = result->getMessagesSize();
+}
+
+void dxc_compilation_result_get_bytecode(DxcShimCompilationResult *result, void **bytecode, size_t *size) {
+    *bytecode = const_cast<void*>(result->getBytecodePointer());
+    *size = result->getBytecodeSize();
+}
+
+void dxc_compilation_result_get_stats(DxcShimCompilationResult *result, DxcShimCompilationStats *stats) {
+    *stats = result->getStats();
+}
+
+size_t dxc_compilation_result_get_include_count(DxcShimCompilationResult *result) {
+    return result->getIncludes().size();
+}
+
+void dxc_compilation_result_get_include(DxcShimCompilationResult *result, size_t index, const char **filename, DxcShimHash *hash) {
+    DxcShimResolvedInclude const& include = result->getIncludes()[index];
+    *filename = include.filename.c_str();
+    *hash = include.hash;
+}
+
+size_t dxc_compilation_result_get_diagnostic_count(DxcShimCompilationResult *result) {
+    return result->getDiagnostics().size();
+}
+
+void dxc_compilation_result_get_diagnostic(DxcShimCompilationResult *result, size_t index, DxcShimDiagnostic *diagnostic) {
+    *diagnostic = result->getDiagnostics()[index];
+}
+
+size_t dxc_parse_diagnostics(const char *text, size_t size, DxcShimDiagnostic *diagnostics, size_t capacity) {
+    std::vector<DxcShimDiagnostic> parsed;
+    parseDiagnostics(text, size, parsed);
+    std::copy_n(parsed.begin(), std::min(parsed.size(), capacity), diagnostics);
+    return parsed.size();
+}
+
+bool dxc_compilation_result_get_reflection(DxcShimCompilationResult *result, const DxcShimReflection **reflection) {
+    const DxcShimReflection* resultReflection = result->getReflection();
+    if (resultReflection == nullptr) {
+      return false;
+    }
+
+    *reflection = resultReflection;
+    return true;
+}
+
+bool dxc_reflector_create(const uint32_t *words, size_t wordCount, DxcShimReflector **reflector) {
+    *reflector = DxcShimReflector::reflect(words, wordCount * sizeof(uint32_t)).release();
+    return *reflector != nullptr;
+}
+
+const DxcShimReflection *dxc_reflector_get_reflection(DxcShimReflector *reflector) {
+    return &reflector->getReflection();
+}
+
+void dxc_reflector_destroy(DxcShimReflector *reflector) {
+    delete reflector;
+}
+
+size_t dxc_strip_spirv(uint32_t *words, size_t wordCount, const DxcShimStripOptions *options) {
+    return stripSpirv(words, wordCount, *options);
+}
+
+bool dxc_compilation_result_get_preprocessed_hash(DxcShimCompilationResult *result, DxcShimHash *hash) {
+    const DxcShimHash* preprocessedHash = result->getPreprocessedHash();
+    if (preprocessedHash == nullptr) {
+      return false;
+    }
+
+    *hash = *preprocessedHash;
+    return true;
+}
+
+DxcShimCompilationResult* dxc_compilation_result_create() {
+    return new DxcShimCompilationResult();
+}
+
+void dxc_compilation_result_reset(DxcShimCompilationResult *result) {
+    result->reset();
+}
+
+void dxc_compilation_result_free(DxcShimCompilationResult *result) {
+    delete result;
+}
+
+void dxc_archive_writer_create(DxcShimArchiveWriter **writer) {
+  *writer = new DxcShimArchiveWriter();
+}
+
+void dxc_archive_writer_destroy(DxcShimArchiveWriter *writer) {
+  delete writer;
+}
+
+bool dxc_archive_writer_add(DxcShimArchiveWriter *writer, const DxcShimHash *key, DxcShimCompilationResult *result) {
+  if (!result->isSuccessful()) {
+    return false;
+  }
+
+  return writer->add(
+    *key,
+    result->getBytecodePointer(),
+    result->getBytecodeSize(),
+    result->getReflection(),
+    result->getIncludes());
+}
+
+bool dxc_archive_writer_add_bytecode(
+  DxcShimArchiveWriter *writer,
+  const DxcShimHash *key,
+  const void *bytecode,
+  size_t bytecodeSize,
+  const DxcShimReflection *reflection,
+  const char *const *dependencyFilenames,
+  const DxcShimHash *dependencyHashes,
+  size_t dependencyCount) {
+  std::vector<DxcShimResolvedInclude> dependencies(dependencyCount);
+  for (size_t i = 0; i < dependencyCount; i++) {
+    dependencies[i].filename = dependencyFilenames[i];
+    dependencies[i].hash = dependencyHashes[i];
+  }
+
+  return writer->add(*key, bytecode, bytecodeSize, reflection, dependencies);
+}
+
+DxcShimStatus dxc_archive_writer_write(DxcShimArchiveWriter *writer, const char *path) {
+  return writer->write(path) ? DxcShimStatus::Ok : DxcShimStatus::ArchiveWriteError;
+}
+
+DxcShimStatus dxc_archive_open(const char *path, DxcShimArchive **archive) {
+  try {
+    *archive = new DxcShimArchive(path);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_archive_close(DxcShimArchive *archive) {
+  delete archive;
+}
+
+size_t dxc_archive_get_entry_count(DxcShimArchive *archive) {
+  return archive->getEntryCount();
+}
+
+bool dxc_archive_find(DxcShimArchive *archive, const DxcShimHash *key, size_t *index) {
+  return archive->find(*key, *index);
+}
+
+void dxc_archive_get_key(DxcShimArchive *archive, size_t index, DxcShimHash *key) {
+  *key = archive->getKey(index);
+}
+
+void dxc_archive_get_bytecode(DxcShimArchive *archive, size_t index, const void **bytecode, size_t *size) {
+  *bytecode = archive->getBytecodePointer(index);
+  *size = archive->getBytecodeSize(index);
+}
+
+bool dxc_archive_get_reflection(DxcShimArchive *archive, size_t index, const DxcShimReflection **reflection) {
+  const DxcShimReflection* archiveReflection = archive->getReflection(index);
+  if (archiveReflection == nullptr) {
+    return false;
+  }
+
+  *reflection = archiveReflection;
+  return true;
+}
+
+size_t dxc_archive_get_dependency_count(DxcShimArchive *archive, size_t index) {
+  return archive->getDependencyCount(index);
+}
+
+void dxc_archive_get_dependency(DxcShimArchive *archive, size_t index, size_t dependencyIndex, const char **filename, DxcShimHash *hash) {
+  archive->getDependency(index, dependencyIndex, *filename, *hash);
+}
+
+DxcShimStatus dxc_compile_server_client_create(const char *socketPath, DxcShimCompileServerClient **client) {
+  try {
+    *client = new DxcShimCompileServerClient(socketPath);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_compile_server_client_destroy(DxcShimCompileServerClient *client) {
+  delete client;
+}
+
+void dxc_compiler_set_compile_server(DxcShimCompiler *compiler, DxcShimCompileServerClient *client) {
+  compiler->setCompileServer(client);
+}
+
+void dxc_compiler_pool_set_compile_server(DxcShimCompilerPool *pool, DxcShimCompileServerClient *client) {
+  pool->setCompileServer(client);
+}
+
+DxcShimStatus dxc_compile_server_create(const DxcShimCompileServerOptions *options, DxcShimCompileServer **server) {
+  try {
+    *server = new DxcShimCompileServer(*options);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_compile_server_destroy(DxcShimCompileServer *server) {
+  delete server;
+}
+
+DxcShimStatus dxc_compile_server_run(DxcShimCompileServer *server) {
+  try {
+    server->run();
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_compile_server_stop(DxcShimCompileServer *server) {
+  server->stop();
+}
+
+DxcShimStatus dxc_remote_cache_create(const DxcShimRemoteCacheBackend *backend, DxcShimRemoteCache **remoteCache) {
+  try {
+    *remoteCache = new DxcShimRemoteCache(*backend);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+DxcShimStatus dxc_remote_cache_connect(const char *host, uint16_t port, uint32_t timeoutMilliseconds, DxcShimRemoteCache **remoteCache) {
+  DxcShimRemoteCacheBackend backend = DxcShimTcpCacheBackend::create(host, port, timeoutMilliseconds);
+  try {
+    *remoteCache = new DxcShimRemoteCache(backend);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    backend.release(backend.userData);
+    return e.getStatus();
+  }
+}
+
+void dxc_remote_cache_destroy(DxcShimRemoteCache *remoteCache) {
+  delete remoteCache;
+}
+
+void dxc_remote_cache_flush(DxcShimRemoteCache *remoteCache) {
+  remoteCache->flush();
+}
+
+void dxc_compiler_set_remote_cache(DxcShimCompiler *compiler, DxcShimRemoteCache *remoteCache) {
+  compiler->setRemoteCache(remoteCache);
+}
+
+void dxc_compiler_pool_set_remote_cache(DxcShimCompilerPool *pool, DxcShimRemoteCache *remoteCache) {
+  pool->setRemoteCache(remoteCache);
+}
+
+DxcShimStatus dxc_cache_server_create(DxcShimCache *cache, const char *host, uint16_t port, DxcShimCacheServer **server) {
+  try {
+    *server = new DxcShimCacheServer(*cache, host, port);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_cache_server_destroy(DxcShimCacheServer *server) {
+  delete server;
+}
+
+uint16_t dxc_cache_server_get_port(DxcShimCacheServer *server) {
+  return server->getPort();
+}
+
+void dxc_cache_server_run(DxcShimCacheServer *server) {
+  server->run();
+}
+
+void dxc_cache_server_stop(DxcShimCacheServer *server) {
+  server->stop();
+}
+
+DxcShimStatus dxc_trace_chrome_sink_create(const char *path, DxcShimTraceSink **sink) {
+  try {
+    *sink = new DxcShimChromeTraceSink(path);
+    return DxcShimStatus::Ok;
+  } catch (const DxcShimException &e) {
+    return e.getStatus();
+  }
+}
+
+void dxc_trace_callback_sink_create(const DxcShimTraceCallbacks *callbacks, DxcShimTraceSink **sink) {
+  *sink = new DxcShimCallbackTraceSink(*callbacks);
+}
+
+void dxc_trace_sink_destroy(DxcShimTraceSink *sink) {
+  delete sink;
+}
+
+void dxc_trace_sink_flush(DxcShimTraceSink *sink) {
+  sink->flush();
+}
+
+void dxc_trace_set_sink(DxcShimTraceSink *sink) {
+  DxcShimTrace::setSink(sink);
+}
+
+size_t dxc_conv_utf8_to_utf16(const char *s, size_t size, char16_t *out, size_t capacity) {
+  std::u16string converted;
+  utf8_to_wide(s, size, converted);
+  std::memcpy(out, converted.data(), std::min(converted.size(), capacity) * sizeof(char16_t));
+  return converted.size();
+}
+
+size_t dxc_conv_utf8_to_utf32(const char *s, size_t size, char32_t *out, size_t capacity) {
+  std::u32string converted;
+  utf8_to_wide(s, size, converted);
+  std::memcpy(out, converted.data(), std::min(converted.size(), capacity) * sizeof(char32_t));
+  return converted.size();
+}
+
+size_t dxc_conv_utf16_to_utf8(const char16_t *s, size_t size, char *out, size_t capacity) {
+  std::string converted;
+  wide_to_utf8(s, size, converted);
+  std::memcpy(out, converted.data(), std::min(converted.size(), capacity));
+  return converted.size();
+}
+
+size_t dxc_conv_utf32_to_utf8(const char32_t *s, size_t size, char *out, size_t capacity) {
+  std::string converted;
+  wide_to_utf8(s, size, converted);
+  std::memcpy(out, converted.data(), std::min(converted.size(), capacity));
+  return converted.size();
+}
+
+void dxc_work_queue_create(size_t workerCount, DxcShimIntegerWorkQueue **queue) {
+  *queue = new DxcShimIntegerWorkQueue(workerCount);
+}
+
+void dxc_work_queue_destroy(DxcShimIntegerWorkQueue *queue) {
+  delete queue;
+}
+
+void dxc_work_queue_push(DxcShimIntegerWorkQueue *queue, uint64_t item, DxcShimPriority priority) {
+  queue->push(item, priority);
+}
+
+bool dxc_work_queue_pop(DxcShimIntegerWorkQueue *queue, size_t workerIndex, uint64_t *item) {
+  return queue->pop(workerIndex, *item);
+}
+
+size_t dxc_work_queue_stop(DxcShimIntegerWorkQueue *queue, uint64_t *items, size_t capacity) {
+  std::vector<uint64_t> remaining = queue->stop();
+  std::copy_n(remaining.begin(), std::min(remaining.size(), capacity), items);
+  return remaining.size();
+}
+
+void dxc_priority_gate_create(DxcShimPriorityGate **gate) {
+  *gate = new DxcShimPriorityGate();
+}
+
+void dxc_priority_gate_destroy(DxcShimPriorityGate *gate) {
+  delete gate;
+}
+
+void dxc_priority_scope_enter(DxcShimPriorityGate *gate, DxcShimPriority priority, DxcShimPriorityScope **scope) {
+  *scope = new DxcShimPriorityScope(gate, priority);
+}
+
+void dxc_priority_scope_leave(DxcShimPriorityScope *scope) {
+  delete scope;
+}
+
+void dxc_memory_budget_create(uint64_t budget, DxcShimMemoryBudget **memoryBudget) {
+  *memoryBudget = new DxcShimMemoryBudget(budget);
+}
+
+void dxc_memory_budget_destroy(DxcShimMemoryBudget *memoryBudget) {
+  delete memoryBudget;
+}
+
+void dxc_memory_budget_acquire(DxcShimMemoryBudget *memoryBudget, uint64_t size) {
+  memoryBudget->acquire(size);
+}
+
+void dxc_memory_budget_release(DxcShimMemoryBudget *memoryBudget, uint64_t size) {
+  memoryBudget->release(size);
+}
+
+size_t dxc_memory_budget_get_max_in_flight(DxcShimMemoryBudget *memoryBudget, const uint64_t *sizes, size_t count) {
+  return memoryBudget->getMaxInFlight(std::vector<uint64_t>(sizes, sizes + count));
+}
+
+void dxc_tcp_cache_backend_create(
+  const char *host,
+  uint16_t port,
+  uint32_t timeoutMilliseconds,
+  uint32_t retryDelayMilliseconds,
+  DxcShimTcpCacheBackend **backend) {
+  *backend = new DxcShimTcpCacheBackend(host, port, timeoutMilliseconds, retryDelayMilliseconds);
+}
+
+void dxc_tcp_cache_backend_destroy(DxcShimTcpCacheBackend *backend) {
+  delete backend;
+}
+
+void dxc_tcp_cache_backend_lookup(DxcShimTcpCacheBackend *backend, const DxcShimHash *keys, size_t count, DxcShimRemoteCacheEntry *entries) {
+  std::fill(entries, entries + count, DxcShimRemoteCacheEntry {});
+  backend->lookup(keys, count, entries);
+}
+
+void dxc_tcp_cache_backend_store(DxcShimTcpCacheBackend *backend, const DxcShimHash *key, const void *data, size_t size) {
+  backend->store(*key, data, size);
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Whether the result of a compilation was served from the bytecode cache.
+enum class DxcShimCacheStatus: uint8_t {
+  // No cache is set on the compiler.
+  Disabled = 0,
+  Hit = 1,
+  Miss = 2,
+
+  // Missed in the local cache, and served from the remote cache.
+  RemoteHit = 3,
+};
+
+// The statistics of a single compilation. Times are in nanoseconds.
+struct DxcShimCompilationStats {
+  // The time spent preprocessing the source to compute its cache key.
+  uint64_t preprocessTime;
+
+  // The time spent compiling the source. 0 if the result was served from the cache.
+  uint64_t compileTime;
+
+  // The time spent in the include callback. Part of the preprocess and compile times.
+  uint64_t includeTime;
+
+  // The number of includes resolved, and their total size in bytes.
+  uint64_t includeCount;
+  uint64_t includeBytes;
+
+  // The size of the bytecode in bytes. 0 if the compilation failed.
+  uint64_t outputSize;
+
+  DxcShimCacheStatus cacheStatus;
+};
+
+// The statistics accumulated over all compilations of a compiler or pool. Times are in
+// nanoseconds.
+struct DxcShimCompilerStats {
+  uint64_t compilationCount;
+
+  // The number of failed compilations, not counting cancelled ones.
+  uint64_t failureCount;
+  uint64_t cancellationCount;
+
+  uint64_t cacheHitCount;
+  uint64_t cacheMissCount;
+  uint64_t preprocessTime;
+  uint64_t compileTime;
+  uint64_t includeTime;
+  uint64_t includeCount;
+  uint64_t includeBytes;
+  uint64_t outputBytes;
+
+  // The number of cache hits served from the remote cache. Part of the cache hits.
+  uint64_t remoteCacheHitCount;
+};
+
+// Measures the time elapsed since its creation.
+class DxcShimStopwatch {
+public:
+  inline DxcShimStopwatch()
+    : m_start(std::chrono::steady_clock::now()) {}
+
+  // Returns the elapsed time in nanoseconds.
+  inline uint64_t elapsed() const {
+    auto elapsed = std::chrono::steady_clock::now() - m_start;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+private:
+  std::chrono::steady_clock::time_point m_start;
+};
+
+// Accumulates the statistics of compilations.
+//
+// Counters are updated with relaxed atomics, so they can be read while compilations are
+// running on other threads. A snapshot is not guaranteed to be consistent across counters.
+class DxcShimStatsCounters {
+public:
+  inline void record(DxcShimCompilationStats const& stats, bool isSuccessful, bool isCancelled) {
+    m_compilationCount.fetch_add(1, std::memory_order_relaxed);
+    if (isCancelled) {
+      m_cancellationCount.fetch_add(1, std::memory_order_relaxed);
+    } else if (!isSuccessful) {
+      m_failureCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (stats.cacheStatus == DxcShimCacheStatus::Hit) {
+      m_cacheHitCount.fetch_add(1, std::memory_order_relaxed);
+    } else if (stats.cacheStatus == DxcShimCacheStatus::RemoteHit) {
+      m_cacheHitCount.fetch_add(1, std::memory_order_relaxed);
+      m_remoteCacheHitCount.fetch_add(1, std::memory_order_relaxed);
+    } else if (stats.cacheStatus == DxcShimCacheStatus::Miss) {
+      m_cacheMissCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    m_preprocessTime.fetch_add(stats.preprocessTime, std::memory_order_relaxed);
+    m_compileTime.fetch_add(stats.compileTime, std::memory_order_relaxed);
+    m_includeTime.fetch_add(stats.includeTime, std::memory_order_relaxed);
+    m_includeCount.fetch_add(stats.includeCount, std::memory_order_relaxed);
+    m_includeBytes.fetch_add(stats.includeBytes, std::memory_order_relaxed);
+    m_outputBytes.fetch_add(stats.outputSize, std::memory_order_relaxed);
+  }
+
+  inline DxcShimCompilerStats snapshot() const {
+    DxcShimCompilerStats stats;
+    stats.compilationCount = m_compilationCount.load(std::memory_order_relaxed);
+    stats.failureCount = m_failureCount.load(std::memory_order_relaxed);
+    stats.cancellationCount = m_cancellationCount.load(std::memory_order_relaxed);
+    stats.cacheHitCount = m_cacheHitCount.load(std::memory_order_relaxed);
+    stats.cacheMissCount = m_cacheMissCount.load(std::memory_order_relaxed);
+    stats.preprocessTime = m_preprocessTime.load(std::memory_order_relaxed);
+    stats.compileTime = m_compileTime.load(std::memory_order_relaxed);
+    stats.includeTime = m_includeTime.load(std::memory_order_relaxed);
+    stats.includeCount = m_includeCount.load(std::memory_order_relaxed);
+    stats.includeBytes = m_includeBytes.load(std::memory_order_relaxed);
+    stats.outputBytes = m_outputBytes.load(std::memory_order_relaxed);
+    stats.remoteCacheHitCount = m_remoteCacheHitCount.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  inline void reset() {
+    m_compilationCount.store(0, std::memory_order_relaxed);
+    m_failureCount.store(0, std::memory_order_relaxed);
+    m_cancellationCount.store(0, std::memory_order_relaxed);
+    m_cacheHitCount.store(0, std::memory_order_relaxed);
+    m_cacheMissCount.store(0, std::memory_order_relaxed);
+    m_preprocessTime.store(0, std::memory_order_relaxed);
+    m_compileTime.store(0, std::memory_order_relaxed);
+    m_includeTime.store(0, std::memory_order_relaxed);
+    m_includeCount.store(0, std::memory_order_relaxed);
+    m_includeBytes.store(0, std::memory_order_relaxed);
+    m_outputBytes.store(0, std::memory_order_relaxed);
+    m_remoteCacheHitCount.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> m_compilationCount {0};
+  std::atomic<uint64_t> m_failureCount {0};
+  std::atomic<uint64_t> m_cancellationCount {0};
+  std::atomic<uint64_t> m_cacheHitCount {0};
+  std::atomic<uint64_t> m_cacheMissCount {0};
+  std::atomic<uint64_t> m_preprocessTime {0};
+  std::atomic<uint64_t> m_compileTime {0};
+  std::atomic<uint64_t> m_includeTime {0};
+  std::atomic<uint64_t> m_includeCount {0};
+  std::atomic<uint64_t> m_includeBytes {0};
+  std::atomic<uint64_t> m_outputBytes {0};
+  std::atomic<uint64_t> m_remoteCacheHitCount {0};
+};
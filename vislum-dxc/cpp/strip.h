@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// What to strip from the SPIR-V output of a compilation.
+//
+// Most of an unstripped module is debug information, which the driver ignores but still has to
+// parse in vkCreateShaderModule. Stripping it makes modules smaller to load, cache and ship.
+struct DxcShimStripOptions {
+  // Strips source text and line information: OpSource, OpSourceContinued, OpSourceExtension,
+  // OpString, OpLine, OpNoLine and OpModuleProcessed, and every non-semantic extended
+  // instruction set, such as the NonSemantic.Shader.DebugInfo.100 emitted by -fspv-debug.
+  bool stripDebugInfo;
+
+  // Strips OpName and OpMemberName. The reflection of stripped modules has no names.
+  bool stripNames;
+
+  inline bool isEnabled() const {
+    return stripDebugInfo || stripNames;
+  }
+};
+
+// Strips a SPIR-V module in place, moving the kept instructions to the front.
+//
+// Returns the size of the stripped module in words, or 0 if the module is not valid SPIR-V, in
+// which case it is left untouched.
+inline size_t stripSpirv(uint32_t* words, size_t wordCount, DxcShimStripOptions const& options) {
+  static const uint32_t magicNumber = 0x07230203;
+  static const size_t headerSize = 5;
+
+  enum : uint32_t {
+    OpSourceContinued = 2,
+    OpSource = 3,
+    OpSourceExtension = 4,
+    OpName = 5,
+    OpMemberName = 6,
+    OpString = 7,
+    OpLine = 8,
+    OpExtension = 10,
+    OpExtInstImport = 11,
+    OpExtInst = 12,
+    OpNoLine = 317,
+    OpModuleProcessed = 330,
+  };
+
+  if (wordCount < headerSize || words[0] != magicNumber) {
+    return 0;
+  }
+
+  // Check every instruction fits before moving any, so invalid modules stay untouched.
+  for (size_t i = headerSize; i < wordCount;) {
+    uint32_t instructionSize = words[i] >> 16;
+    if (instructionSize == 0 || instructionSize > wordCount - i) {
+      return 0;
+    }
+    i += instructionSize;
+  }
+
+  // The results of OpExtInstImport for non-semantic instruction sets, which come before any
+  // OpExtInst using them.
+  std::vector<uint32_t> nonSemanticSets;
+
+  // Returns whether the literal string at words[i], of up to operandCount words, starts with or
+  // is the given string.
+  auto isStringOperand = [&](size_t i, uint32_t operandCount, const char* prefix, bool isExact) {
+    const char* string = reinterpret_cast<const char*>(words + i);
+    size_t maxSize = operandCount * sizeof(uint32_t);
+    size_t prefixSize = std::strlen(prefix);
+    if (maxSize <= prefixSize || std::memcmp(string, prefix, prefixSize) != 0) {
+      return false;
+    }
+    return !isExact || string[prefixSize] == '\0';
+  };
+
+  size_t written = headerSize;
+  for (size_t i = headerSize; i < wordCount;) {
+    uint32_t instructionSize = words[i] >> 16;
+    uint32_t opcode = words[i] & 0xffff;
+
+    bool isStripped = false;
+    switch (opcode) {
+    case OpName:
+    case OpMemberName:
+      isStripped = options.stripNames;
+      break;
+    case OpSourceContinued:
+    case OpSource:
+    case OpSourceExtension:
+    case OpString:
+    case OpLine:
+    case OpNoLine:
+    case OpModuleProcessed:
+      isStripped = options.stripDebugInfo;
+      break;
+    case OpExtension:
+      isStripped = options.stripDebugInfo && instructionSize > 1
+        && isStringOperand(i + 1, instructionSize - 1, "SPV_KHR_non_semantic_info", true);
+      break;
+    case OpExtInstImport:
+      if (options.stripDebugInfo && instructionSize > 2
+        && isStringOperand(i + 2, instructionSize - 2, "NonSemantic.", false)) {
+        nonSemanticSets.push_back(words[i + 1]);
+        isStripped = true;
+      }
+      break;
+    case OpExtInst:
+      // Non-semantic results may only be used by other non-semantic instructions.
+      if (instructionSize > 3) {
+        for (uint32_t set : nonSemanticSets) {
+          if (words[i + 3] == set) {
+            isStripped = true;
+            break;
+          }
+        }
+      }
+      break;
+    }
+
+    if (!isStripped) {
+      if (written != i) {
+        std::memmove(words + written, words + i, instructionSize * sizeof(uint32_t));
+      }
+      written += instructionSize;
+    }
+    i += instructionSize;
+  }
+
+  return written;
+}
@@ -0,0 +1,432 @@
+#pragma once
+
+#include "cache.h"
+#include "remote.h"
+#include "remote_cache.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Opens a TCP connection, failing if it takes longer than the timeout. Sends and receives on the
+// connection time out after as long. Returns -1 on failure.
+inline int connectTcp(std::string const& host, uint16_t port, uint32_t timeoutMilliseconds) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* addresses;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+    return -1;
+  }
+
+  int socket = -1;
+  for (addrinfo* address = addresses; address != nullptr && socket < 0; address = address->ai_next) {
+    socket = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, address->ai_protocol);
+    if (socket < 0) {
+      continue;
+    }
+
+    // Connect without blocking, to bound the wait for unreachable hosts.
+    bool isConnected = connect(socket, address->ai_addr, address->ai_addrlen) == 0;
+    if (!isConnected && errno == EINPROGRESS) {
+      pollfd fd = { socket, POLLOUT, 0 };
+      int error = 0;
+      socklen_t errorSize = sizeof(error);
+      isConnected = poll(&fd, 1, static_cast<int>(timeoutMilliseconds)) > 0
+        && getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &errorSize) == 0
+        && error == 0;
+    }
+
+    if (!isConnected) {
+      close(socket);
+      socket = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+
+  if (socket < 0) {
+    return -1;
+  }
+
+  fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) & ~O_NONBLOCK);
+
+  timeval timeout = {};
+  timeout.tv_sec = timeoutMilliseconds / 1000;
+  timeout.tv_usec = (timeoutMilliseconds % 1000) * 1000;
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // Lookups are small request-response exchanges, which Nagle's algorithm would delay.
+  int noDelay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return socket;
+}
+
+// A remote cache backend talking to a DxcShimCacheServer over TCP.
+//
+// Lookups and uploads use a connection each, so lookups never queue up behind an upload. A
+// connection that fails is dropped and reopened on the next use, but no sooner than the retry
+// delay later, 5 seconds by default: until then, lookups miss and uploads are dropped right away, so an unreachable
+// server costs compilations nothing beyond the first timeout.
+class DxcShimTcpCacheBackend {
+public:
+  inline DxcShimTcpCacheBackend(
+    std::string host,
+    uint16_t port,
+    uint32_t timeoutMilliseconds,
+    uint32_t retryDelayMilliseconds = 5000)
+    : m_host(std::move(host))
+    , m_port(port)
+    , m_timeoutMilliseconds(timeoutMilliseconds)
+    , m_retryDelay(retryDelayMilliseconds) {}
+
+  DxcShimTcpCacheBackend(DxcShimTcpCacheBackend const&) = delete;
+  DxcShimTcpCacheBackend& operator=(DxcShimTcpCacheBackend const&) = delete;
+
+  // Creates a backend whose callbacks forward to a new TCP backend, which is deleted with it.
+  inline static DxcShimRemoteCacheBackend create(std::string host, uint16_t port, uint32_t timeoutMilliseconds) {
+    DxcShimRemoteCacheBackend backend = {};
+    backend.lookup = [](void* userData, const DxcShimHash* keys, size_t count, DxcShimRemoteCacheEntry* entries) {
+      static_cast<DxcShimTcpCacheBackend*>(userData)->lookup(keys, count, entries);
+    };
+    backend.store = [](void* userData, const DxcShimHash* key, const void* data, size_t size) {
+      static_cast<DxcShimTcpCacheBackend*>(userData)->store(*key, data, size);
+    };
+    backend.release = [](void* userData) {
+      delete static_cast<DxcShimTcpCacheBackend*>(userData);
+    };
+    backend.userData = new DxcShimTcpCacheBackend(std::move(host), port, timeoutMilliseconds);
+    return backend;
+  }
+
+  // Looks up a batch of keys. The entries point into a buffer of the backend, and stay valid
+  // until the next lookup.
+  inline void lookup(const DxcShimHash* keys, size_t count, DxcShimRemoteCacheEntry* entries) {
+    if (!m_lookupConnection.open(*this)) {
+      return;
+    }
+
+    std::string& payload = m_lookupPayload;
+    payload.clear();
+    appendServerU32(payload, static_cast<uint32_t>(count));
+    for (size_t i = 0; i < count; i++) {
+      appendServerValue(payload, keys[i]);
+    }
+
+    DxcShimServerMessageType type;
+    if (!sendServerMessage(m_lookupConnection.socket, DxcShimServerMessageType::CacheLookup, payload)
+      || !receiveServerMessage(m_lookupConnection.socket, type, payload)
+      || type != DxcShimServerMessageType::CacheLookupResult) {
+      m_lookupConnection.fail(*this);
+      return;
+    }
+
+    DxcShimServerMessageReader reader(payload.data(), payload.size());
+    for (size_t i = 0; i < count; i++) {
+      uint32_t isFound;
+      if (!reader.readU32(isFound)) {
+        break;
+      }
+      if (isFound == 0) {
+        continue;
+      }
+
+      const char* data;
+      size_t size;
+      if (!reader.readString(data, size)) {
+        break;
+      }
+      entries[i].data = data;
+      entries[i].size = size;
+    }
+  }
+
+  inline void store(DxcShimHash const& key, const void* data, size_t size) {
+    if (!m_storeConnection.open(*this)) {
+      return;
+    }
+
+    std::string& payload = m_storePayload;
+    payload.clear();
+    appendServerValue(payload, key);
+    appendServerString(payload, static_cast<const char*>(data), size);
+
+    if (!sendServerMessage(m_storeConnection.socket, DxcShimServerMessageType::CacheStore, payload)) {
+      m_storeConnection.fail(*this);
+    }
+  }
+
+private:
+  struct Connection {
+    int socket = -1;
+    std::chrono::steady_clock::time_point retryTime;
+
+    ~Connection() {
+      if (socket >= 0) {
+        close(socket);
+      }
+    }
+
+    // Opens the connection unless it is open, or failed too recently to retry.
+    inline bool open(DxcShimTcpCacheBackend const& backend) {
+      if (socket >= 0) {
+        return true;
+      }
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now < retryTime) {
+        return false;
+      }
+
+      socket = connectTcp(backend.m_host, backend.m_port, backend.m_timeoutMilliseconds);
+      if (socket < 0) {
+        fail(backend);
+        return false;
+      }
+      return true;
+    }
+
+    inline void fail(DxcShimTcpCacheBackend const& backend) {
+      if (socket >= 0) {
+        close(socket);
+        socket = -1;
+      }
+      retryTime = std::chrono::steady_clock::now() + backend.m_retryDelay;
+    }
+  };
+
+  std::string m_host;
+  uint16_t m_port;
+  uint32_t m_timeoutMilliseconds;
+  std::chrono::milliseconds m_retryDelay;
+
+  Connection m_lookupConnection;
+  std::string m_lookupPayload;
+  Connection m_storeConnection;
+  std::string m_storePayload;
+};
+
+// Serves a local cache over TCP to DxcShimTcpCacheBackend clients, so a cache directory of one
+// machine is shared by a whole build farm.
+//
+// Every connection is served by a thread of its own. The protocol has no authentication, so the
+// server should only be reachable from trusted machines.
+class DxcShimCacheServer {
+public:
+  // Listens on the given host and port. A NULL host listens on all addresses, and a port of 0
+  // picks a free port.
+  //
+  // Throws a DxcShimException if the address cannot be listened on.
+  inline DxcShimCacheServer(DxcShimCache& cache, const char* host, uint16_t port)
+    : m_cache(cache) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo* addresses;
+    if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &addresses) != 0) {
+      throw DxcShimException(DxcShimStatus::ServerListenError);
+    }
+
+    for (addrinfo* address = addresses; address != nullptr && m_listener < 0; address = address->ai_next) {
+      m_listener = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+      if (m_listener < 0) {
+        continue;
+      }
+
+      int reuseAddress = 1;
+      setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+      if (bind(m_listener, address->ai_addr, address->ai_addrlen) != 0 || listen(m_listener, SOMAXCONN) != 0) {
+        close(m_listener);
+        m_listener = -1;
+      }
+    }
+    freeaddrinfo(addresses);
+
+    if (m_listener < 0) {
+      throw DxcShimException(DxcShimStatus::ServerListenError);
+    }
+
+    if (pipe2(m_stopPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+      close(m_listener);
+      throw DxcShimException(DxcShimStatus::ServerListenError);
+    }
+  }
+
+  DxcShimCacheServer(DxcShimCacheServer const&) = delete;
+  DxcShimCacheServer& operator=(DxcShimCacheServer const&) = delete;
+
+  ~DxcShimCacheServer() {
+    close(m_listener);
+    close(m_stopPipe[0]);
+    close(m_stopPipe[1]);
+  }
+
+  // Returns the port listened on.
+  inline uint16_t getPort() const {
+    sockaddr_storage address = {};
+    socklen_t addressSize = sizeof(address);
+    if (getsockname(m_listener, reinterpret_cast<sockaddr*>(&address), &addressSize) != 0) {
+      return 0;
+    }
+
+    if (address.ss_family == AF_INET6) {
+      return ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+  }
+
+  // Serves connections until the server is stopped. Open connections are closed before
+  // returning.
+  inline void run() {
+    pollfd fds[] = {
+      { m_listener, POLLIN, 0 },
+      { m_stopPipe[0], POLLIN, 0 },
+    };
+
+    for (;;) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      if (fds[1].revents != 0) {
+        break;
+      }
+      if (fds[0].revents == 0) {
+        continue;
+      }
+
+      int connection = accept4(m_listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection < 0) {
+        continue;
+      }
+
+      int noDelay = 1;
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+      std::lock_guard<std::mutex> lock(m_connectionsMutex);
+      try {
+        std::thread(&DxcShimCacheServer::serve, this, connection).detach();
+        m_connections.push_back(connection);
+      } catch (std::system_error const&) {
+        close(connection);
+      }
+    }
+
+    // Wake up the connection threads, and wait for them to close their connections.
+    std::unique_lock<std::mutex> lock(m_connectionsMutex);
+    for (int connection : m_connections) {
+      shutdown(connection, SHUT_RDWR);
+    }
+    m_connectionsClosed.wait(lock, [&] {
+      return m_connections.empty();
+    });
+
+    // Consume the stop request, so the server can run again.
+    char byte;
+    while (read(m_stopPipe[0], &byte, 1) > 0) {}
+  }
+
+  // Makes run return. Safe to call from any thread, and from a signal handler.
+  inline void stop() {
+    char byte = 0;
+    ssize_t count = write(m_stopPipe[1], &byte, 1);
+    (void)count;
+  }
+
+private:
+  // Serves the messages of a connection until the client closes it, or sends a message that
+  // does not follow the protocol.
+  inline void serve(int connection) {
+    try {
+      serveMessages(connection);
+    } catch (std::bad_alloc const&) {
+      // Dropping the connection frees its buffers, and the thread must not end with an exception.
+    }
+
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    close(connection);
+    for (size_t i = 0; i < m_connections.size(); i++) {
+      if (m_connections[i] == connection) {
+        m_connections[i] = m_connections.back();
+        m_connections.pop_back();
+        break;
+      }
+    }
+    m_connectionsClosed.notify_all();
+  }
+
+  // Serves the messages of a connection. Returns once the connection should be closed.
+  inline void serveMessages(int connection) {
+    // Stores carry a single shader and lookups only keys, so larger requests are not the cache
+    // protocol.
+    static const size_t maxRequestSize = 64u << 20;
+
+    std::string payload;
+    std::string reply;
+    for (;;) {
+      DxcShimServerMessageType type;
+      if (!receiveServerMessage(connection, type, payload, nullptr, maxRequestSize)) {
+        return;
+      }
+
+      DxcShimServerMessageReader reader(payload.data(), payload.size());
+      if (type == DxcShimServerMessageType::CacheLookup) {
+        uint32_t count;
+        if (!reader.readU32(count)) {
+          return;
+        }
+
+        reply.clear();
+        bool isValid = true;
+        for (uint32_t i = 0; i < count && isValid; i++) {
+          DxcShimHash key;
+          isValid = reader.readValue(key);
+          CComPtr<IDxcBlob> bytecode = isValid ? m_cache.load(key) : nullptr;
+          if (bytecode != nullptr) {
+            appendServerU32(reply, 1);
+            appendServerString(reply, static_cast<const char*>(bytecode->GetBufferPointer()), bytecode->GetBufferSize());
+          } else {
+            appendServerU32(reply, 0);
+          }
+        }
+
+        if (!isValid || !sendServerMessage(connection, DxcShimServerMessageType::CacheLookupResult, reply)) {
+          return;
+        }
+      } else if (type == DxcShimServerMessageType::CacheStore) {
+        DxcShimHash key;
+        const char* data;
+        size_t size;
+        if (!reader.readValue(key) || !reader.readString(data, size)) {
+          return;
+        }
+        m_cache.store(key, data, size);
+      } else {
+        return;
+      }
+    }
+  }
+
+  DxcShimCache& m_cache;
+  int m_listener = -1;
+  int m_stopPipe[2];
+
+  // The connections being served, closed by their threads.
+  std::mutex m_connectionsMutex;
+  std::condition_variable m_connectionsClosed;
+  std::vector<int> m_connections;
+};
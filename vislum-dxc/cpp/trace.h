@@ -0,0 +1,261 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+// The static description of a traced zone, one per place it is traced from.
+//
+// Laid out as Tracy's ___tracy_source_location_data, so a callback sink can pass it to
+// ___tracy_emit_zone_begin as is. Locations live as long as the process.
+struct DxcShimTraceLocation {
+  const char* name;
+  const char* function;
+  const char* file;
+  uint32_t line;
+  uint32_t color;
+};
+
+// Called when a zone begins. Returns a context that is passed to the end callback of the zone,
+// such as a TracyCZoneCtx.
+typedef uint64_t (*DxcShimTraceBeginCallback)(void* userData, const DxcShimTraceLocation* location);
+
+// Called when a zone ends, on the thread it began on.
+typedef void (*DxcShimTraceEndCallback)(void* userData, const DxcShimTraceLocation* location, uint64_t context);
+
+// The callbacks of a callback sink, such as ones forwarding to a profiler.
+struct DxcShimTraceCallbacks {
+  DxcShimTraceBeginCallback begin;
+  DxcShimTraceEndCallback end;
+  void* userData;
+};
+
+// Receives the zones traced by the shim, from any thread.
+class DxcShimTraceSink {
+public:
+  virtual ~DxcShimTraceSink() = default;
+
+  virtual uint64_t begin(DxcShimTraceLocation const& location) = 0;
+  virtual void end(DxcShimTraceLocation const& location, uint64_t context) = 0;
+
+  // Writes out the zones buffered by the sink, if any.
+  virtual void flush() {}
+};
+
+// Forwards zones to user callbacks.
+class DxcShimCallbackTraceSink : public DxcShimTraceSink {
+public:
+  inline explicit DxcShimCallbackTraceSink(DxcShimTraceCallbacks const& callbacks)
+    : m_callbacks(callbacks) {}
+
+  inline uint64_t begin(DxcShimTraceLocation const& location) override {
+    return m_callbacks.begin(m_callbacks.userData, &location);
+  }
+
+  inline void end(DxcShimTraceLocation const& location, uint64_t context) override {
+    m_callbacks.end(m_callbacks.userData, &location, context);
+  }
+
+private:
+  DxcShimTraceCallbacks m_callbacks;
+};
+
+// Writes zones to a file in the Chrome trace event format, as read by chrome://tracing and
+// Perfetto.
+//
+// Every zone is written as a complete event once it ends, through the buffer of the file. The
+// file is only valid JSON once the sink is destroyed, although both viewers read it before.
+class DxcShimChromeTraceSink : public DxcShimTraceSink {
+public:
+  // Throws a DxcShimException if the file cannot be created.
+  inline explicit DxcShimChromeTraceSink(const char* path)
+    : m_file(std::fopen(path, "we"))
+    , m_pid(getpid()) {
+    if (m_file == nullptr) {
+      throw DxcShimException(DxcShimStatus::TraceOpenError);
+    }
+    std::fputs("{\"traceEvents\":[", m_file);
+  }
+
+  DxcShimChromeTraceSink(DxcShimChromeTraceSink const&) = delete;
+  DxcShimChromeTraceSink& operator=(DxcShimChromeTraceSink const&) = delete;
+
+  ~DxcShimChromeTraceSink() override {
+    std::fputs("\n]}\n", m_file);
+    std::fclose(m_file);
+  }
+
+  // Returns the start of the zone, in nanoseconds since the sink was created.
+  inline uint64_t begin(DxcShimTraceLocation const&) override {
+    return now();
+  }
+
+  inline void end(DxcShimTraceLocation const& location, uint64_t context) override {
+    uint64_t end = now();
+    long tid = getThreadId();
+
+    // Chrome expects microseconds, which are kept fractional.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::fprintf(
+      m_file,
+      "%s\n{\"name\":\"%s\",\"cat\":\"vislum-dxc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld}",
+      m_isEmpty ? "" : ",",
+      location.name,
+      static_cast<double>(context) / 1000.0,
+      static_cast<double>(end - context) / 1000.0,
+      static_cast<int>(m_pid),
+      tid);
+    m_isEmpty = false;
+  }
+
+  inline void flush() override {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::fflush(m_file);
+  }
+
+private:
+  inline uint64_t now() const {
+    auto elapsed = std::chrono::steady_clock::now() - m_start;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  // Returns the kernel id of the calling thread, as shown by other tools.
+  inline static long getThreadId() {
+    static thread_local long threadId = syscall(SYS_gettid);
+    return threadId;
+  }
+
+  std::FILE* m_file;
+  pid_t m_pid;
+  std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+
+  std::mutex m_mutex;
+  bool m_isEmpty = true;
+};
+
+// The trace sink of the process.
+//
+// While no sink is set, tracing a zone costs a single relaxed load. While one is set, every
+// traced zone is counted, so replacing the sink can wait until the previous one is unused.
+//
+// Each sink is set for an epoch, which alternates between two slots holding its sink and the
+// count of its zones. A zone counts itself in the slot of the epoch it entered in, so replacing
+// the sink only waits for the zones of the previous sink, not for those already entering the
+// new one.
+class DxcShimTrace {
+public:
+  inline static bool isEnabled() {
+    return getState().currentSink.load(std::memory_order_relaxed) != nullptr;
+  }
+
+  // Returns the sink to trace a zone with, or NULL if tracing is disabled. A returned sink must
+  // be released with leave, passing the slot the zone was counted in, once the zone ends.
+  inline static DxcShimTraceSink* enter(size_t& slot) {
+    State& state = getState();
+    for (;;) {
+      uint64_t epoch = state.epoch.load();
+      slot = static_cast<size_t>(epoch % 2);
+      state.activeCounts[slot].fetch_add(1);
+
+      // The epoch changed before the zone was counted, so the sink of the slot may be replaced.
+      if (state.epoch.load() != epoch) {
+        leave(slot);
+        continue;
+      }
+
+      DxcShimTraceSink* sink = state.sinks[slot].load();
+      if (sink == nullptr) {
+        leave(slot);
+      }
+      return sink;
+    }
+  }
+
+  inline static void leave(size_t slot) {
+    getState().activeCounts[slot].fetch_sub(1);
+  }
+
+  // Sets the sink of the process. NULL disables tracing.
+  //
+  // Returns once no zone is traced by the previous sink, which can then be destroyed, so it must
+  // not be called from within a sink. Zones traced by the new sink do not delay it.
+  inline static void setSink(DxcShimTraceSink* sink) {
+    State& state = getState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    // The slot of the next epoch is unused, as the previous call waited for its zones.
+    uint64_t epoch = state.epoch.load();
+    size_t previousSlot = static_cast<size_t>(epoch % 2);
+    state.sinks[1 - previousSlot].store(sink);
+    state.currentSink.store(sink);
+    state.epoch.store(epoch + 1);
+
+    while (state.activeCounts[previousSlot].load() != 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+private:
+  struct State {
+    std::atomic<DxcShimTraceSink*> currentSink {nullptr};
+    std::atomic<uint64_t> epoch {0u};
+    std::atomic<DxcShimTraceSink*> sinks[2] = {};
+    std::atomic<size_t> activeCounts[2] = {};
+
+    // Serializes replacing the sink.
+    std::mutex mutex;
+  };
+
+  inline static State& getState() {
+    static State state;
+    return state;
+  }
+};
+
+// Traces a zone for the lifetime of the scope.
+class DxcShimTraceScope {
+public:
+  inline explicit DxcShimTraceScope(DxcShimTraceLocation const& location)
+    : m_location(location) {
+    if (DxcShimTrace::isEnabled()) {
+      m_sink = DxcShimTrace::enter(m_slot);
+    }
+    if (m_sink != nullptr) {
+      m_context = m_sink->begin(m_location);
+    }
+  }
+
+  DxcShimTraceScope(DxcShimTraceScope const&) = delete;
+  DxcShimTraceScope& operator=(DxcShimTraceScope const&) = delete;
+
+  ~DxcShimTraceScope() {
+    if (m_sink != nullptr) {
+      m_sink->end(m_location, m_context);
+      DxcShimTrace::leave(m_slot);
+    }
+  }
+
+private:
+  DxcShimTraceLocation const& m_location;
+  DxcShimTraceSink* m_sink = nullptr;
+  size_t m_slot = 0;
+  uint64_t m_context = 0;
+};
+
+#define DXC_SHIM_TRACE_CONCAT_INNER(a, b) a##b
+#define DXC_SHIM_TRACE_CONCAT(a, b) DXC_SHIM_TRACE_CONCAT_INNER(a, b)
+
+// Traces a zone with the given static name until the end of the enclosing scope. Defining
+// DXC_SHIM_DISABLE_TRACING compiles tracing out entirely.
+#ifdef DXC_SHIM_DISABLE_TRACING
+#define DXC_SHIM_TRACE_SCOPE(name)
+#else
+#define DXC_SHIM_TRACE_SCOPE(name) \
+  static const DxcShimTraceLocation DXC_SHIM_TRACE_CONCAT(traceLocation, __LINE__) = { name, __func__, __FILE__, __LINE__, 0 }; \
+  DxcShimTraceScope DXC_SHIM_TRACE_CONCAT(traceScope, __LINE__)(DXC_SHIM_TRACE_CONCAT(traceLocation, __LINE__))
+#endif
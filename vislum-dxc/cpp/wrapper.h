@@ -1,109 +1,308 @@
 #pragma once
 
-#define __EMULATE_UUID
-
+#include "blob.h"
+#include "common.h"
 #include "conv.h"
+#include "dependency.h"
+#include "diagnostics.h"
+#include "cache.h"
+#include "cancellation.h"
+#include "hash.h"
+#include "include_cache.h"
+#include "loader.h"
+#include "prelude.h"
+#include "reflection.h"
+#include "scheduler.h"
+#include "remote.h"
+#include "remote_cache.h"
+#include "stats.h"
+#include "strip.h"
+#include "trace.h"
+#include <algorithm>
 #include <cstdint>
-#include <dxc/WinAdapter.h>
-#include <dxc/dxcapi.h>
 #include <exception>
-#include <dlfcn.h>
 #include <vector>
 #include <string>
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// What a compilation recorded about itself, besides its output.
+struct DxcShimCompilationInfo {
+  DxcShimCompilationStats stats = {};
+
+  // The includes resolved by the compilation, once each, in the order they were first loaded.
+  std::vector<DxcShimResolvedInclude> includes;
 
-enum class DxcShimStatus: uint8_t {
-  Ok = 0,
-  OpenLibraryError = 2,
-  GetCreateInstance2SymbolError = 2,
-  GetDxcCompilerInstanceError = 3,
-  GetDxcUtilsInstanceError = 4,
+  // The hash of the preprocessed source, set if the source was preprocessed successfully.
+  bool hasPreprocessedHash = false;
+  DxcShimHash preprocessedHash = {};
 };
 
-class DxcShimException : public std::exception {
+// The outcome of a compilation.
+//
+// A result can be reset and compiled into again. Its error message and include list keep
+// their capacity across resets, so reusing one result for many compilations avoids most of
+// the allocations of creating a fresh result every time. The messages of DXC are not copied
+// at all: the result keeps the UTF-8 blob DXC reported them in.
+class DxcShimCompilationResult {
 public:
-  DxcShimException(DxcShimStatus status) : m_status(status) {}
+  // Creates an empty result, to be compiled into.
+  inline DxcShimCompilationResult() = default;
+
+  DxcShimCompilationResult(DxcShimCompilationResult const&) = delete;
+  DxcShimCompilationResult& operator=(DxcShimCompilationResult const&) = delete;
 
-  inline DxcShimStatus getStatus() const {
-    return m_status;
+  inline bool isSuccessful() const {
+    return m_isSuccessful;
   }
 
-private:
-  DxcShimStatus m_status;
-};
+  // Returns whether the compilation was cancelled. Cancelled compilations are not successful.
+  inline bool isCancelled() const {
+    return m_isCancelled;
+  }
 
-class DxcShimLoader {
-public:
-  explicit DxcShimLoader() {
-    m_handle = dlopen("libdxcompiler.so", RTLD_NOW);
-    if (m_handle == NULL) {
-      throw DxcShimException(DxcShimStatus::OpenLibraryError);
-    }
+  // Returns the messages reported by DXC: the errors of a failed compilation, or the warnings
+  // of a successful one.
+  //
+  // The messages are NUL-terminated, and stay valid until the result is reset or freed.
+  inline const char* getMessagesPointer() const {
+    return m_messages;
+  }
+
+  // Returns the size of the messages in bytes, without the NUL terminator.
+  inline size_t getMessagesSize() const {
+    return m_messageSize;
+  }
+
+  // Returns the diagnostics parsed from the messages. A failed result has at least one error.
+  inline std::vector<DxcShimDiagnostic> const& getDiagnostics() const {
+    return m_diagnostics;
+  }
 
-    m_createInstance2 = (DxcCreateInstance2Proc)dlsym(m_handle, "DxcCreateInstance2");
-    if (m_createInstance2 == NULL) {
-      dlclose(m_handle);
-      throw DxcShimException(DxcShimStatus::GetCreateInstance2SymbolError);
+  // Returns a pointer to the bytecode.
+  //
+  // The memory is owned by the DXC blob held by this result, and stays valid
+  // until the result is reset or freed.
+  inline const void* getBytecodePointer() const {
+    return m_bytecode != nullptr ? m_bytecode->GetBufferPointer() : nullptr;
+  }
+
+  inline size_t getBytecodeSize() const {
+    return m_bytecode != nullptr ? static_cast<size_t>(m_bytecode->GetBufferSize()) : 0;
+  }
+
+  // Returns the bytecode blob, or NULL if the compilation failed.
+  inline IDxcBlob* getBytecode() const {
+    return m_bytecode;
+  }
+
+  inline DxcShimCompilationStats const& getStats() const {
+    return m_info.stats;
+  }
+
+  inline std::vector<DxcShimResolvedInclude> const& getIncludes() const {
+    return m_info.includes;
+  }
+
+  // Returns the reflection of the SPIR-V bytecode, or NULL if the compilation failed.
+  //
+  // The bytecode is reflected on the first call, so results that are never reflected do not
+  // pay for it. Safe to call from several threads at once.
+  inline const DxcShimReflection* getReflection() const {
+    std::lock_guard<std::mutex> lock(m_reflectMutex);
+    if (!m_isReflected) {
+      if (m_bytecode != nullptr) {
+        m_reflector = DxcShimReflector::reflect(m_bytecode->GetBufferPointer(), m_bytecode->GetBufferSize());
+      }
+      m_isReflected = true;
     }
+    return m_reflector != nullptr ? &m_reflector->getReflection() : nullptr;
   }
 
-  inline DxcCreateInstance2Proc getCreateInstance2Proc() const {
-    return m_createInstance2;
+  // Returns the hash of the preprocessed source, or NULL if it was not preprocessed.
+  inline const DxcShimHash* getPreprocessedHash() const {
+    return m_info.hasPreprocessedHash ? &m_info.preprocessedHash : nullptr;
   }
 
-  ~DxcShimLoader() {
-    dlclose(m_handle);
+  // Returns the info of the compilation, for the compiler to fill in.
+  inline DxcShimCompilationInfo& getInfo() {
+    return m_info;
   }
 
-private:
-  void *m_handle;
-  DxcCreateInstance2Proc m_createInstance2;
-};
+  inline void setSuccess(CComPtr<IDxcBlob> bytecode) {
+    m_isSuccessful = true;
+    m_bytecode = std::move(bytecode);
+  }
 
-class DxcShimCompilationResult {
-public:
-  inline bool isSuccessful() const {
-    return m_isSuccessful;
+  // Sets the messages reported by DXC, and parses their diagnostics.
+  inline void setMessages(const char* messages, size_t size) {
+    m_messageBlob.Release();
+    m_errorMessage.assign(messages, size);
+    parseMessages(m_errorMessage.c_str(), m_errorMessage.size());
   }
 
-  inline std::string const& getErrorMessage() const {
-    return m_errorMessage;
+  // Sets wide messages reported by DXC, converted to UTF-8 in place.
+  inline void setMessages(const wchar_t* messages, size_t size) {
+    m_messageBlob.Release();
+    m_errorMessage.clear();
+    wide_to_utf8(messages, size, m_errorMessage);
+    parseMessages(m_errorMessage.c_str(), m_errorMessage.size());
   }
 
-  inline std::vector<uint8_t> const& getBytecode() const {
-    return m_bytecode;
+  // Sets the messages reported by DXC as a UTF-8 blob, which is kept alive instead of copied.
+  inline void setMessages(CComPtr<IDxcBlobUtf8> messages) {
+    const char* data = messages->GetStringPointer();
+    size_t size = messages->GetStringLength();
+    if (data == nullptr) {
+      data = "";
+      size = 0;
+    }
+    while (size > 0 && data[size - 1] == '\0') {
+      size--;
+    }
+
+    m_messageBlob = std::move(messages);
+    m_errorMessage.clear();
+    parseMessages(data, size);
   }
 
-  inline static DxcShimCompilationResult* success(std::vector<uint8_t> bytecode) {
-    return new DxcShimCompilationResult(true, std::string(), std::move(bytecode));
+  inline void setFailure(const char* errorMessage) {
+    setFailure(errorMessage, std::strlen(errorMessage));
   }
 
-  inline static DxcShimCompilationResult* failure(std::string errorMessage) {
-    return new DxcShimCompilationResult(false, std::move(errorMessage), std::vector<uint8_t>());
+  inline void setFailure(const char* errorMessage, size_t size) {
+    setMessages(errorMessage, size);
+    setFailure();
+  }
+
+  // Fails the result with the messages already set.
+  //
+  // Failures without a diagnostic DXC reported in its usual format, like cancellations, get an
+  // error diagnostic covering the whole message.
+  inline void setFailure() {
+    m_isSuccessful = false;
+
+    for (DxcShimDiagnostic const& diagnostic : m_diagnostics) {
+      if (diagnostic.severity == DxcShimDiagnosticSeverity::Error) {
+        return;
+      }
+    }
+
+    size_t size = m_messageSize;
+    while (size > 0 && (m_messages[size - 1] == '\n' || m_messages[size - 1] == '\r')) {
+      size--;
+    }
+
+    DxcShimDiagnostic diagnostic = {};
+    diagnostic.severity = DxcShimDiagnosticSeverity::Error;
+    diagnostic.file = m_messages;
+    diagnostic.message = m_messages;
+    diagnostic.messageSize = size;
+    m_diagnostics.push_back(diagnostic);
+  }
+
+  inline void setCancelled() {
+    setFailure("compilation cancelled");
+    m_isCancelled = true;
+  }
+
+  // Returns the result to its empty state, releasing the bytecode but keeping allocations.
+  inline void reset() {
+    m_isSuccessful = false;
+    m_isCancelled = false;
+    m_messageBlob.Release();
+    m_errorMessage.clear();
+    m_messages = "";
+    m_messageSize = 0;
+    m_diagnostics.clear();
+    m_bytecode.Release();
+
+    m_info.stats = DxcShimCompilationStats {};
+    m_info.includes.clear();
+    m_info.hasPreprocessedHash = false;
+
+    m_isReflected = false;
+    m_reflector.reset();
   }
 
 private:
-  inline explicit DxcShimCompilationResult(
-    bool isSuccessful, 
-    std::string&& errorMessage, 
-    std::vector<uint8_t>&& bytecode) 
-        : m_isSuccessful(isSuccessful)
-        , m_errorMessage(std::move(errorMessage))
-        , m_bytecode(std::move(bytecode)) { }
-
-  bool m_isSuccessful;
+  inline void parseMessages(const char* messages, size_t size) {
+    m_messages = messages;
+    m_messageSize = size;
+    m_diagnostics.clear();
+    parseDiagnostics(messages, size, m_diagnostics);
+  }
+
+  bool m_isSuccessful = false;
+  bool m_isCancelled = false;
+
+  // The messages, pointing into the blob DXC reported them in, or into the error message for
+  // messages that had to be copied or converted.
+  const char* m_messages = "";
+  size_t m_messageSize = 0;
+  CComPtr<IDxcBlobUtf8> m_messageBlob;
   std::string m_errorMessage;
-  std::vector<uint8_t> m_bytecode;
+
+  // The diagnostics, pointing into the messages.
+  std::vector<DxcShimDiagnostic> m_diagnostics;
+
+  // The bytecode blob, kept alive so its buffer can be handed out without copying.
+  CComPtr<IDxcBlob> m_bytecode;
+  DxcShimCompilationInfo m_info;
+
+  mutable std::mutex m_reflectMutex;
+  mutable bool m_isReflected = false;
+  mutable std::unique_ptr<DxcShimReflector> m_reflector;
+};
+
+// The contents of an include, as returned by the user callback.
+struct DxcShimIncludeSource {
+  const char* data;
+  size_t size;
+
+  // If set, the data is borrowed rather than copied, and must stay valid until release is
+  // called with releaseContext. As includes may be cached, that can happen after the
+  // compilation has finished, and on another thread.
+  //
+  // If NULL, the data is copied and only has to stay valid until the callback returns.
+  DxcShimReleaseCallback release;
+  void* releaseContext;
 };
 
-typedef char* (*DxcShimUserCallback)(const char* filename, void* userData);
+// Loads the include with the given filename into source. Returns false if it cannot be found.
+//
+// The filename is not NUL-terminated.
+typedef bool (*DxcShimUserCallback)(const char* filename, size_t filenameSize, void* userData, DxcShimIncludeSource* source);
 
 class DxcShimIncludeHandler : public IDxcIncludeHandler {
 public:  
-  inline DxcShimIncludeHandler(CComPtr<IDxcUtils>& utils, DxcShimUserCallback userCallback, void* userData) 
+  inline DxcShimIncludeHandler(
+    CComPtr<IDxcUtils>& utils,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimIncludeCache* includeCache,
+    DxcShimCompilationInfo& info,
+    DxcShimCancellation const& cancellation,
+    DxcShimHasher* includeHasher = nullptr,
+    bool echoMacroDirectives = false)
     : m_utils(utils)
     , m_userCallback(userCallback)
-    , m_userData(userData) {}
+    , m_userData(userData)
+    , m_includeCache(includeCache)
+    , m_info(info)
+    , m_cancellation(cancellation)
+    , m_includeHasher(includeHasher)
+    , m_echoMacroDirectives(echoMacroDirectives) {}
+
+  // Sets the includes of a prelude the compilation is expanded from, which are not included
+  // again: they are served empty. While expanding a prelude, onceIncludes receives those of its
+  // includes marked with #pragma once instead. Either may be NULL.
+  inline void setPreludeIncludes(std::vector<std::string> const* skippedIncludes, std::vector<std::string>* onceIncludes) {
+    m_skippedIncludes = skippedIncludes;
+    m_onceIncludes = onceIncludes;
+  }
 
   // IUnknown methods
   HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) override {
@@ -117,11 +316,11 @@ public:
   }
 
   ULONG STDMETHODCALLTYPE AddRef() override {
-    return m_refCount++;
+    return ++m_refCount;
   }
 
   ULONG STDMETHODCALLTYPE Release() override {
-    ULONG refCount = m_refCount--;
+    ULONG refCount = --m_refCount;
     if (refCount == 0) {
       delete this;
     }
@@ -130,17 +329,86 @@ public:
 
   // IDxcIncludeHandler methods
   HRESULT STDMETHODCALLTYPE LoadSource(LPCWSTR wideFilename, IDxcBlob** ppIncludeSource) override {
-    std::string filename = utf16_to_utf8(wideFilename);
+    DXC_SHIM_TRACE_SCOPE("load source");
+
+    // Failing the include makes DXC stop early. The compiler reports the cancellation.
+    if (m_cancellation.isCancelled()) {
+      return E_ABORT;
+    }
+
+    // The filename buffer is reused across the includes of the compilation.
+    std::string& filename = m_filename;
+    filename.clear();
+    wide_to_utf8(wideFilename, std::wcslen(wideFilename), filename);
 
-    char* source = m_userCallback(filename.c_str(), m_userData);
-    if (source == nullptr) {
-      return E_FAIL;
+    std::string normalizedFilename = DxcShimIncludeCache::normalize(filename);
+    if (isSkipped(normalizedFilename)) {
+      if (m_includeHasher != nullptr) {
+        m_includeHasher->updateField(filename);
+        m_includeHasher->updateField(nullptr, 0);
+      }
+      return m_utils->CreateBlob("", 0, CP_UTF8, reinterpret_cast<IDxcBlobEncoding**>(ppIncludeSource));
     }
 
     CComPtr<IDxcBlobEncoding> sourceBlob;
-    HRESULT hr = m_utils->CreateBlob(source, strlen(source), CP_UTF8, &sourceBlob);
-    if (FAILED(hr)) {
-      return hr;
+    if (m_includeCache != nullptr) {
+      sourceBlob = m_includeCache->find(normalizedFilename);
+    }
+
+    if (sourceBlob == nullptr) {
+      DxcShimStopwatch stopwatch;
+      DxcShimIncludeSource source = {};
+      bool found;
+      {
+        DXC_SHIM_TRACE_SCOPE("include callback");
+        found = m_userCallback(filename.data(), filename.size(), m_userData, &source);
+      }
+      m_info.stats.includeTime += stopwatch.elapsed();
+      if (!found) {
+        return E_FAIL;
+      }
+
+      DXC_SHIM_TRACE_SCOPE("create include blob");
+      if (source.release != nullptr) {
+        sourceBlob = new DxcShimBorrowedBlob(source.data, source.size, source.release, source.releaseContext);
+      } else {
+        HRESULT hr = m_utils->CreateBlob(source.data, static_cast<UINT32>(source.size), CP_UTF8, &sourceBlob);
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+
+      if (m_includeCache != nullptr) {
+        m_includeCache->insert(normalizedFilename, sourceBlob);
+      }
+    }
+
+    m_info.stats.includeCount++;
+    m_info.stats.includeBytes += sourceBlob->GetBufferSize();
+    recordInclude(normalizedFilename, sourceBlob);
+
+    if (m_includeHasher != nullptr) {
+      m_includeHasher->updateField(filename);
+      m_includeHasher->updateField(sourceBlob->GetBufferPointer(), sourceBlob->GetBufferSize());
+    }
+
+    if (m_onceIncludes != nullptr && !isOnceInclude(normalizedFilename)
+      && DxcShimPrelude::hasPragmaOnce(static_cast<const char*>(sourceBlob->GetBufferPointer()), sourceBlob->GetBufferSize())) {
+      m_onceIncludes->push_back(normalizedFilename);
+    }
+
+    // The cached include is left as is, so only this compilation sees the echoes.
+    if (m_echoMacroDirectives) {
+      std::string echoed = DxcShimPrelude::echoMacroDirectives(
+        static_cast<const char*>(sourceBlob->GetBufferPointer()),
+        sourceBlob->GetBufferSize());
+
+      CComPtr<IDxcBlobEncoding> echoedBlob;
+      HRESULT hr = m_utils->CreateBlob(echoed.data(), static_cast<UINT32>(echoed.size()), CP_UTF8, &echoedBlob);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      sourceBlob = echoedBlob;
     }
 
     *ppIncludeSource = sourceBlob.Detach();
@@ -148,15 +416,306 @@ public:
   }
 
 private:
+  inline bool isSkipped(std::string const& filename) const {
+    return m_skippedIncludes != nullptr
+      && std::find(m_skippedIncludes->begin(), m_skippedIncludes->end(), filename) != m_skippedIncludes->end();
+  }
+
+  inline bool isOnceInclude(std::string const& filename) const {
+    return std::find(m_onceIncludes->begin(), m_onceIncludes->end(), filename) != m_onceIncludes->end();
+  }
+
+  // Adds an include to the resolved includes, unless it was already loaded.
+  inline void recordInclude(std::string const& filename, IDxcBlob* blob) {
+    for (DxcShimResolvedInclude const& include : m_info.includes) {
+      if (include.filename == filename) {
+        return;
+      }
+    }
+
+    DxcShimResolvedInclude include;
+    include.filename = filename;
+    include.hash = hashIncludeContents(blob->GetBufferPointer(), blob->GetBufferSize());
+    m_info.includes.push_back(std::move(include));
+  }
+
   CComPtr<IDxcUtils>& m_utils;
   DxcShimUserCallback m_userCallback;
   void* m_userData;
-  std::atomic<ULONG> m_refCount {1u};
+
+  // If set, includes are served from and added to this cache.
+  DxcShimIncludeCache* m_includeCache;
+
+  // Receives the include statistics and resolved includes of the compilation.
+  DxcShimCompilationInfo& m_info;
+  DxcShimCancellation const& m_cancellation;
+
+  // If set, receives the name and contents of every resolved include.
+  DxcShimHasher* m_includeHasher;
+
+  // If set, the macro directives of every include are echoed, to expand a prelude.
+  bool m_echoMacroDirectives;
+
+  // The includes of the prelude that are not included again, and the list receiving them
+  // while expanding the prelude.
+  std::vector<std::string> const* m_skippedIncludes = nullptr;
+  std::vector<std::string>* m_onceIncludes = nullptr;
+  std::string m_filename;
+  std::atomic<ULONG> m_refCount {0u};
+};
+
+// A preprocessor define, passed to DXC as -D name=value.
+struct DxcShimDefine {
+  const char* name;
+
+  // The value of the define. May be NULL for a define without a value.
+  const char* value;
+};
+
+// The optimization level of a compilation, passed to DXC as -O0 to -O3.
+enum class DxcShimOptimizationLevel: uint8_t {
+  O0 = 0,
+  O1 = 1,
+  O2 = 2,
+  O3 = 3,
+};
+
+class DxcShimArgumentSet;
+
+// The options of a single compilation.
+struct DxcShimCompileOptions {
+  // The name of the entry point function.
+  const char* entryPoint;
+
+  // The target profile, such as vs_6_5, ps_6_5 or cs_6_5. Selects the shader stage.
+  const char* targetProfile;
+
+  const DxcShimDefine* defines;
+  size_t defineCount;
+
+  DxcShimOptimizationLevel optimizationLevel;
+
+  // If set, the compilation is abandoned once the token is cancelled. The token must outlive
+  // the compilation.
+  const DxcShimCancellationToken* cancellationToken;
+
+  // If not 0, the compilation is abandoned once dxc_clock_now reaches the deadline.
+  uint64_t deadline;
+
+  // Additional arguments, passed to DXC verbatim after the arguments built from the options.
+  const char* const* extraArgs;
+  size_t extraArgCount;
+
+  // If set, the comma-separated SPIR-V optimizer passes DXC runs instead of those of the
+  // optimization level, passed as -Oconfig, such as "--loop-unroll,--eliminate-dead-code-aggressive".
+  const char* spirvOptimizerPasses;
+
+  // What to strip from the SPIR-V output, after DXC and before it is cached.
+  DxcShimStripOptions strip;
+
+  // If set, the arguments built once from other options, which replace those built from the
+  // entry point, target profile, optimization level, extra arguments, optimizer passes and
+  // strip options of these. The defines of these options are added to those of the set.
+  const DxcShimArgumentSet* argumentSet;
+
+  // The priority class of the compilation, among the other work of its pool.
+  DxcShimPriority priority;
+};
+
+// The wide names of the common target profiles, which are added to the arguments of a
+// compilation as they are instead of being converted. Indexed by stage and by the minor
+// version of shader model 6.
+class DxcShimProfileTable {
+public:
+  static constexpr size_t stageCount = 9;
+  static constexpr size_t minorVersionCount = 10;
+
+  // Returns the wide name of a profile, or NULL if it is not in the table.
+  inline static LPCWSTR find(const char* profile) {
+    for (size_t stage = 0; stage < stageCount; stage++) {
+      const char* version = profile;
+      const char* stageName = stages[stage];
+      while (*stageName != '\0' && *version == *stageName) {
+        version++;
+        stageName++;
+      }
+
+      if (*stageName == '\0'
+        && version[0] == '_' && version[1] == '6' && version[2] == '_'
+        && version[3] >= '0' && version[3] < static_cast<char>('0' + minorVersionCount)
+        && version[4] == '\0') {
+        return profiles[stage][version[3] - '0'];
+      }
+    }
+    return nullptr;
+  }
+
+  // Returns whether every entry of the table spells the profile of its stage and version.
+  constexpr static bool isConsistent() {
+    for (size_t stage = 0; stage < stageCount; stage++) {
+      for (size_t minorVersion = 0; minorVersion < minorVersionCount; minorVersion++) {
+        LPCWSTR profile = profiles[stage][minorVersion];
+        size_t i = 0;
+        for (; stages[stage][i] != '\0'; i++) {
+          if (profile[i] != static_cast<wchar_t>(stages[stage][i])) {
+            return false;
+          }
+        }
+
+        if (profile[i] != L'_' || profile[i + 1] != L'6' || profile[i + 2] != L'_'
+          || profile[i + 3] != static_cast<wchar_t>(L'0' + minorVersion) || profile[i + 4] != L'\0') {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+private:
+  static constexpr const char* stages[stageCount] = { "vs", "ps", "gs", "hs", "ds", "cs", "as", "ms", "lib" };
+
+#define DXC_SHIM_PROFILE_ROW(stage) { \
+    L"" stage "_6_0", L"" stage "_6_1", L"" stage "_6_2", L"" stage "_6_3", L"" stage "_6_4", \
+    L"" stage "_6_5", L"" stage "_6_6", L"" stage "_6_7", L"" stage "_6_8", L"" stage "_6_9" }
+
+  static constexpr LPCWSTR profiles[stageCount][minorVersionCount] = {
+    DXC_SHIM_PROFILE_ROW("vs"),
+    DXC_SHIM_PROFILE_ROW("ps"),
+    DXC_SHIM_PROFILE_ROW("gs"),
+    DXC_SHIM_PROFILE_ROW("hs"),
+    DXC_SHIM_PROFILE_ROW("ds"),
+    DXC_SHIM_PROFILE_ROW("cs"),
+    DXC_SHIM_PROFILE_ROW("as"),
+    DXC_SHIM_PROFILE_ROW("ms"),
+    DXC_SHIM_PROFILE_ROW("lib"),
+  };
+
+#undef DXC_SHIM_PROFILE_ROW
+};
+
+static_assert(DxcShimProfileTable::isConsistent(), "the profile table is out of order");
+
+// The argument list of a single compilation, and the processing of its output.
+//
+// Owns the wide strings backing the LPCWSTR array handed to IDxcCompiler3::Compile. A deque is
+// used so pointers to already added strings stay valid as more arguments are added.
+//
+// Clearing the arguments keeps the owned strings and their capacity, so arguments reused for
+// many compilations convert into existing buffers instead of allocating.
+class DxcShimArguments {
+public:
+  // Adds an argument with static lifetime, such as a literal.
+  inline void add(LPCWSTR arg) {
+    m_args.push_back(arg);
+  }
+
+  inline void add(std::wstring const& arg) {
+    std::wstring& owned = nextOwned();
+    owned.assign(arg);
+    m_args.push_back(owned.c_str());
+  }
+
+  // Adds a NUL-terminated UTF-8 argument.
+  inline void add(const char* arg) {
+    std::wstring& owned = nextOwned();
+    utf8_to_wide(arg, std::strlen(arg), owned);
+    m_args.push_back(owned.c_str());
+  }
+
+  // Adds a NUL-terminated UTF-8 argument following a prefix, such as the value of an option.
+  inline void add(LPCWSTR prefix, const char* arg) {
+    std::wstring& owned = nextOwned();
+    owned.assign(prefix);
+    utf8_to_wide(arg, std::strlen(arg), owned);
+    m_args.push_back(owned.c_str());
+  }
+
+  // Adds the arguments of another argument list, without copying their strings. The other
+  // list must outlive this one, or its next clear.
+  inline void add(DxcShimArguments const& args) {
+    m_args.insert(m_args.end(), args.m_args.begin(), args.m_args.end());
+    m_strip = args.m_strip;
+  }
+
+  inline void addDefine(DxcShimDefine const& define) {
+    std::wstring& owned = nextOwned();
+    utf8_to_wide(define.name, std::strlen(define.name), owned);
+    if (define.value != nullptr) {
+      owned += L'=';
+      utf8_to_wide(define.value, std::strlen(define.value), owned);
+    }
+
+    add(L"-D");
+    m_args.push_back(owned.c_str());
+  }
+
+  inline void clear() {
+    m_args.clear();
+    m_ownedCount = 0;
+    m_strip = DxcShimStripOptions {};
+  }
+
+  // Sets what to strip from the SPIR-V output of the compilation.
+  inline void setStrip(DxcShimStripOptions const& strip) {
+    m_strip = strip;
+  }
+
+  inline DxcShimStripOptions const& getStrip() const {
+    return m_strip;
+  }
+
+  inline LPCWSTR* data() {
+    return m_args.data();
+  }
+
+  inline UINT32 size() const {
+    return static_cast<UINT32>(m_args.size());
+  }
+
+private:
+  // Returns an empty owned string for the next argument, reusing one from before the last clear.
+  inline std::wstring& nextOwned() {
+    if (m_ownedCount == m_owned.size()) {
+      m_owned.emplace_back();
+    }
+
+    std::wstring& owned = m_owned[m_ownedCount++];
+    owned.clear();
+    return owned;
+  }
+
+  std::vector<LPCWSTR> m_args;
+  std::deque<std::wstring> m_owned;
+  size_t m_ownedCount = 0;
+  DxcShimStripOptions m_strip = {};
+};
+
+// Arguments built once from compile options, for the compilations that refer to them through
+// DxcShimCompileOptions::argumentSet, which then skip building and converting them. Built
+// with DxcShimCompiler::createArgumentSet.
+//
+// A set is immutable, so it can be used by many compilations at once, and must outlive them.
+class DxcShimArgumentSet {
+public:
+  inline explicit DxcShimArgumentSet(DxcShimArguments&& args)
+    : m_args(std::move(args)) {}
+
+  DxcShimArgumentSet(DxcShimArgumentSet const&) = delete;
+  DxcShimArgumentSet& operator=(DxcShimArgumentSet const&) = delete;
+
+  inline DxcShimArguments const& getArguments() const {
+    return m_args;
+  }
+
+private:
+  // Moving the arguments keeps their strings in place, so the pointers to them stay valid.
+  DxcShimArguments m_args;
 };
 
 class DxcShimCompiler {
 public:
   DxcShimCompiler(DxcShimLoader const&loader) {
+    DXC_SHIM_TRACE_SCOPE("create compiler");
     HRESULT hr;
     hr = loader.getCreateInstance2Proc()(NULL, CLSID_DxcCompiler, IID_PPV_ARGS(&m_compiler));
     if (FAILED(hr)) {
@@ -167,65 +726,766 @@ public:
     if (FAILED(hr)) {
       throw DxcShimException(DxcShimStatus::GetDxcUtilsInstanceError);
     }
+
+    CComPtr<IDxcVersionInfo> versionInfo;
+    if (SUCCEEDED(m_compiler.QueryInterface(&versionInfo))) {
+      UINT32 major = 0, minor = 0, flags = 0;
+      versionInfo->GetVersion(&major, &minor);
+      versionInfo->GetFlags(&flags);
+      m_version = std::to_string(major) + "." + std::to_string(minor) + "/" + std::to_string(flags);
+    }
+  }
+
+  // Sets the cache used by the compiler. NULL disables caching.
+  //
+  // The cache must outlive the compiler, or be replaced before it is closed.
+  inline void setCache(DxcShimCache* cache) {
+    m_cache = cache;
+  }
+
+  // Sets the include cache used by the compiler. NULL disables include caching.
+  //
+  // The include cache must outlive the compiler, or be replaced before it is destroyed.
+  inline void setIncludeCache(DxcShimIncludeCache* includeCache) {
+    m_includeCache = includeCache;
+  }
+
+  // Sets the prelude of the compiler. Sources starting with it are compiled from its expansion.
+  // NULL disables it.
+  //
+  // The prelude must outlive the compiler, or be replaced before it is destroyed.
+  inline void setPrelude(DxcShimPrelude* prelude) {
+    m_prelude = prelude;
+  }
+
+  // Sets the remote cache consulted after a miss in the cache of the compiler, and uploaded to
+  // after compiling. NULL disables it. Works with or without a local cache.
+  //
+  // The remote cache must outlive the compiler, or be replaced before it is destroyed.
+  inline void setRemoteCache(DxcShimRemoteCache* remoteCache) {
+    m_remoteCache = remoteCache;
+  }
+
+  // Sets the compile server the compilations of the compiler are forwarded to. NULL compiles
+  // in process.
+  //
+  // Only codegen is forwarded: preprocessing for the cache key, cache lookups and includes stay
+  // in process. If no server is listening, shaders are compiled in process instead. The client
+  // must outlive the compiler, or be replaced before it is destroyed.
+  inline void setCompileServer(DxcShimCompileServerClient const* compileServer) {
+    m_compileServer = compileServer;
+  }
+
+  // Sets additional counters that the statistics of every compilation are recorded into, such
+  // as the counters of the pool the compiler belongs to. NULL records into the compiler only.
+  inline void setParentStats(DxcShimStatsCounters* parentStats) {
+    m_parentStats = parentStats;
+  }
+
+  // Sets the gate that the compilations of the compiler are scheduled against by priority,
+  // such as the gate of the pool the compiler belongs to. NULL ignores priorities.
+  inline void setPriorityGate(DxcShimPriorityGate* priorityGate) {
+    m_priorityGate = priorityGate;
+  }
+
+  inline DxcShimPriorityGate* getPriorityGate() const {
+    return m_priorityGate;
+  }
+
+  // Returns the statistics accumulated over all compilations of this compiler.
+  inline DxcShimStatsCounters& getStats() {
+    return m_stats;
+  }
+
+  // Returns when a compilation with the given options is to be abandoned.
+  inline static DxcShimCancellation buildCancellation(DxcShimCompileOptions const& options) {
+    DxcShimCancellation cancellation;
+    cancellation.token = options.cancellationToken;
+    cancellation.deadline = options.deadline;
+    return cancellation;
+  }
+
+  // Builds the arguments for compiling to SPIR-V with the given options.
+  inline static void buildArguments(DxcShimCompileOptions const& options, DxcShimArguments& args) {
+    static const LPCWSTR optimizationLevels[] = { L"-O0", L"-O1", L"-O2", L"-O3" };
+
+    if (options.argumentSet != nullptr) {
+      args.add(options.argumentSet->getArguments());
+      for (size_t i = 0; i < options.defineCount; i++) {
+        args.addDefine(options.defines[i]);
+      }
+      return;
+    }
+
+    args.add(L"-spirv");
+    args.add(L"-fspv-target-env=vulkan1.3");
+    args.add(L"-E");
+    args.add(options.entryPoint);
+    args.add(L"-T");
+    LPCWSTR profile = DxcShimProfileTable::find(options.targetProfile);
+    if (profile != nullptr) {
+      args.add(profile);
+    } else {
+      args.add(options.targetProfile);
+    }
+
+    uint8_t optimizationLevel = static_cast<uint8_t>(options.optimizationLevel);
+    args.add(optimizationLevels[optimizationLevel <= 3 ? optimizationLevel : 3]);
+
+    for (size_t i = 0; i < options.defineCount; i++) {
+      args.addDefine(options.defines[i]);
+    }
+
+    if (options.spirvOptimizerPasses != nullptr) {
+      args.add(L"-Oconfig=", options.spirvOptimizerPasses);
+    }
+
+    for (size_t i = 0; i < options.extraArgCount; i++) {
+      args.add(options.extraArgs[i]);
+    }
+
+    args.setStrip(options.strip);
   }
 
-  inline DxcShimCompilationResult* compile(const char* data, DxcShimUserCallback userCallback, void* userData) {
+  // Builds the arguments of the given options into a set, for compilations to refer to. The
+  // cancellation token, deadline and argument set of the options are ignored.
+  inline static DxcShimArgumentSet* createArgumentSet(DxcShimCompileOptions const& options) {
+    DxcShimCompileOptions setOptions = options;
+    setOptions.argumentSet = nullptr;
+
+    DxcShimArguments args;
+    buildArguments(setOptions, args);
+    return new DxcShimArgumentSet(std::move(args));
+  }
+
+  inline DxcShimCompilationResult* compile(
+    const char* data,
+    size_t size,
+    DxcShimCompileOptions const& options,
+    DxcShimUserCallback userCallback,
+    void* userData) {
+    DxcShimArguments args;
+    buildArguments(options, args);
+
+    DxcShimPriorityScope priorityScope(m_priorityGate, options.priority);
+    return compile(data, size, args, buildCancellation(options), userCallback, userData);
+  }
+
+  inline void compile(
+    const char* data,
+    size_t size,
+    DxcShimCompileOptions const& options,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationResult& result) {
+    DxcShimArguments args;
+    buildArguments(options, args);
+
+    DxcShimPriorityScope priorityScope(m_priorityGate, options.priority);
+    compile(data, size, args, buildCancellation(options), userCallback, userData, result);
+  }
+
+  // Compiles a shader into a new result.
+  inline DxcShimCompilationResult* compile(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData) {
+    DxcShimCompilationResult* result = new DxcShimCompilationResult();
+    compile(data, size, args, cancellation, userCallback, userData, *result);
+    return result;
+  }
+
+  // Compiles a shader into an existing result, which is reset first. The result is cancelled
+  // if the compilation is cancelled before it completes.
+  inline void compile(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationResult& result) {
+    DXC_SHIM_TRACE_SCOPE("compile");
+    result.reset();
+    DxcShimCompilationInfo& info = result.getInfo();
+
+    // Sources starting with the prelude are compiled from its expansion instead.
+    size_t preludeSize = 0;
+    if (m_prelude != nullptr && !cancellation.isCancelled()) {
+      preludeSize = m_prelude->match(data, size);
+    }
+    if (preludeSize > 0 && expandPrelude(args, cancellation, userCallback, userData, info)) {
+      buildPreludeSource(data, size, preludeSize);
+      data = m_preludeSource.data();
+      size = m_preludeSource.size();
+    } else {
+      preludeSize = 0;
+    }
+
+    // The expansion already inlined the includes of the prelude that are only included once.
+    m_skippedIncludes = preludeSize > 0 ? &m_preludeExpansion->onceIncludes : nullptr;
+    if (cancellation.isCancelled()) {
+      result.setCancelled();
+    } else if (m_cache == nullptr && m_remoteCache == nullptr) {
+      compileUncached(data, size, args, cancellation, userCallback, userData, result);
+    } else {
+      compileCached(data, size, args, cancellation, userCallback, userData, result);
+    }
+    m_skippedIncludes = nullptr;
+
+    // The includes of the prelude are dependencies of the compilation as well.
+    if (preludeSize > 0) {
+      addPreludeIncludes(info);
+    }
+
+    info.stats.outputSize = result.getBytecodeSize();
+
+    m_stats.record(info.stats, result.isSuccessful(), result.isCancelled());
+    if (m_parentStats != nullptr) {
+      m_parentStats->record(info.stats, result.isSuccessful(), result.isCancelled());
+    }
+  }
+
+  // Preprocesses a shader without running codegen.
+  //
+  // On success, the bytecode of the result is the preprocessed source and its hash is set.
+  // Comments, whitespace and unused macros do not appear in the preprocessed source, so its
+  // hash only changes when the input to codegen does. Preprocessing is not recorded in the
+  // statistics of the compiler.
+  inline DxcShimCompilationResult* preprocess(
+    const char* data,
+    size_t size,
+    DxcShimCompileOptions const& options,
+    DxcShimUserCallback userCallback,
+    void* userData) {
+    DxcShimArguments args;
+    buildArguments(options, args);
+
+    DxcShimPriorityScope priorityScope(m_priorityGate, options.priority);
+    return preprocess(data, size, args, buildCancellation(options), userCallback, userData);
+  }
+
+  inline DxcShimCompilationResult* preprocess(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData) {
+    DxcShimCompilationResult* result = new DxcShimCompilationResult();
+    preprocess(data, size, args, cancellation, userCallback, userData, *result);
+    return result;
+  }
+
+  // Preprocesses a shader into an existing result, which is reset first.
+  inline void preprocess(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationResult& result) {
+    result.reset();
+    DxcShimCompilationInfo& info = result.getInfo();
+
+    if (cancellation.isCancelled()) {
+      result.setCancelled();
+      return;
+    }
+
+    CComPtr<IDxcResult> dxcResult;
+    HRESULT hr = preprocessSource(data, size, args, cancellation, userCallback, userData, info, nullptr, dxcResult);
+
+    if (cancellation.isCancelled()) {
+      result.setCancelled();
+    } else if (FAILED(hr)) {
+      result.setFailure("failed to invoke the DXC compiler");
+    } else if (FAILED(dxcResult->GetStatus(&hr)) || FAILED(hr)) {
+      setMessagesFromResult(dxcResult, result);
+      result.setFailure();
+    } else {
+      CComPtr<IDxcBlob> preprocessed;
+      hr = dxcResult->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(&preprocessed), nullptr);
+      if (FAILED(hr) || preprocessed == nullptr) {
+        result.setFailure("DXC did not output the preprocessed source");
+      } else {
+        info.hasPreprocessedHash = true;
+        info.preprocessedHash = hashPreprocessed(preprocessed);
+        result.setSuccess(std::move(preprocessed));
+        setMessagesFromResult(dxcResult, result);
+      }
+    }
+
+    info.stats.outputSize = result.getBytecodeSize();
+  }
+
+private:
+  inline void compileCached(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationResult& result) {
+    DxcShimCompilationInfo& info = result.getInfo();
+
+    DxcShimHash key;
+    bool hasKey = computeCacheKey(data, size, args, cancellation, userCallback, userData, key, info);
+    if (cancellation.isCancelled()) {
+      result.setCancelled();
+      return;
+    }
+
+    if (hasKey) {
+      CComPtr<IDxcBlob> cached;
+      if (m_cache != nullptr) {
+        cached = m_cache->load(key);
+      }
+      if (cached != nullptr) {
+        // Only the bytecode is cached, so cache hits report no warnings.
+        info.stats.cacheStatus = DxcShimCacheStatus::Hit;
+        result.setSuccess(std::move(cached));
+        return;
+      }
+
+      if (m_remoteCache != nullptr) {
+        cached = m_remoteCache->load(key);
+      }
+      if (cached != nullptr) {
+        // Keep a local copy, so the next compilation does not go to the remote cache.
+        if (m_cache != nullptr) {
+          m_cache->store(key, cached->GetBufferPointer(), cached->GetBufferSize());
+        }
+        info.stats.cacheStatus = DxcShimCacheStatus::RemoteHit;
+        result.setSuccess(std::move(cached));
+        return;
+      }
+    }
+
+    // The includes are resolved again by the compilation, so only record them once.
+    info.stats.cacheStatus = DxcShimCacheStatus::Miss;
+    info.stats.includeCount = 0;
+    info.stats.includeBytes = 0;
+    info.includes.clear();
+
+    // If preprocessing failed, compile anyways to report the errors.
+    compileUncached(data, size, args, cancellation, userCallback, userData, result);
+    if (hasKey && result.isSuccessful()) {
+      if (m_cache != nullptr) {
+        m_cache->store(key, result.getBytecodePointer(), result.getBytecodeSize());
+      }
+      if (m_remoteCache != nullptr && result.getBytecode() != nullptr) {
+        m_remoteCache->store(key, result.getBytecode());
+      }
+    }
+  }
+
+  // Computes the cache key of a compilation.
+  //
+  // The key covers the DXC version, the arguments, the preprocessed source and the name and
+  // contents of every resolved include. Returns false if the source fails to preprocess.
+  //
+  // Keying on the preprocessed rather than the original source means edits that do not reach
+  // codegen, such as to comments, are cache hits.
+  inline bool computeCacheKey(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimHash& key,
+    DxcShimCompilationInfo& info) {
+    DxcShimHasher hasher;
+    DxcShimHasher includeHasher;
+
+    hasher.updateField(m_version);
+    hasher.update(static_cast<uint64_t>(args.size()));
+    for (UINT32 i = 0; i < args.size(); i++) {
+      LPCWSTR arg = args.data()[i];
+      hasher.updateField(arg, wcslen(arg) * sizeof(wchar_t));
+    }
+
+    // The cached bytecode is stripped, so stripping is part of the key.
+    DxcShimStripOptions const& strip = args.getStrip();
+    hasher.update(static_cast<uint64_t>(strip.stripDebugInfo) | static_cast<uint64_t>(strip.stripNames) << 1);
+
     CComPtr<IDxcResult> dxcResult;
+    HRESULT hr = preprocessSource(data, size, args, cancellation, userCallback, userData, info, &includeHasher, dxcResult);
+    if (FAILED(hr) || FAILED(dxcResult->GetStatus(&hr)) || FAILED(hr)) {
+      return false;
+    }
+
+    CComPtr<IDxcBlob> preprocessed;
+    hr = dxcResult->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(&preprocessed), nullptr);
+    if (FAILED(hr) || preprocessed == nullptr) {
+      return false;
+    }
+
+    hasher.updateField(preprocessed->GetBufferPointer(), preprocessed->GetBufferSize());
+
+    info.hasPreprocessedHash = true;
+    info.preprocessedHash = hashPreprocessed(preprocessed);
+
+    DxcShimHash includeHash = includeHasher.finish();
+    hasher.update(includeHash.high);
+    hasher.update(includeHash.low);
+
+    key = hasher.finish();
+    return true;
+  }
+
+  // Runs the preprocessor alone, by passing -P to DXC. The output is DXC_OUT_HLSL.
+  inline HRESULT preprocessSource(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationInfo& info,
+    DxcShimHasher* includeHasher,
+    CComPtr<IDxcResult>& dxcResult,
+    std::vector<std::string>* preludeOnceIncludes = nullptr) {
+    DxcShimStopwatch stopwatch;
+
+    std::vector<LPCWSTR> preprocessArgs(args.data(), args.data() + args.size());
+    preprocessArgs.push_back(L"-P");
 
     DxcBuffer buffer = {
       .Ptr = data,
-      .Size = strlen(data),
+      .Size = size,
       .Encoding = CP_UTF8,
     };
 
-    LPCWSTR args[] = {
-      L"-spirv",
-      L"-fspv-target-env=vulkan1.3",
-      L"-E", L"main",
-      L"-T", L"vs_6_5"
-    };
+    CComPtr<IDxcIncludeHandler> includeHandler = createIncludeHandler(userCallback, userData, info, cancellation, includeHasher, preludeOnceIncludes);
 
-    UINT32 argCount = sizeof(args) / sizeof(args[0]);
+    DXC_SHIM_TRACE_SCOPE("dxc preprocess");
+    HRESULT hr = m_compiler->Compile(
+      &buffer,
+      preprocessArgs.data(),
+      static_cast<UINT32>(preprocessArgs.size()),
+      includeHandler,
+      IID_PPV_ARGS(&dxcResult));
+    info.stats.preprocessTime += stopwatch.elapsed();
+    return hr;
+  }
+
+  // Creates the include handler of a compilation, or NULL without an include callback.
+  //
+  // While compiling from the expansion of the prelude, the includes it marked as included once
+  // are skipped. If preludeOnceIncludes is set, the prelude is being expanded instead: the macro
+  // directives of the includes are echoed, and those marked with #pragma once are recorded.
+  inline CComPtr<IDxcIncludeHandler> createIncludeHandler(
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationInfo& info,
+    DxcShimCancellation const& cancellation,
+    DxcShimHasher* includeHasher = nullptr,
+    std::vector<std::string>* preludeOnceIncludes = nullptr) {
+    CComPtr<IDxcIncludeHandler> includeHandler;
+    if (userCallback == nullptr) {
+      return includeHandler;
+    }
 
-    CComPtr<IDxcIncludeHandler> includeHandler; 
-    if (userCallback != nullptr) {
-      includeHandler = new DxcShimIncludeHandler(m_utils, userCallback, userData);
+    DxcShimIncludeHandler* handler = new DxcShimIncludeHandler(m_utils, userCallback, userData, m_includeCache, info, cancellation, includeHasher, preludeOnceIncludes != nullptr);
+    handler->setPreludeIncludes(m_skippedIncludes, preludeOnceIncludes);
+    includeHandler = handler;
+    return includeHandler;
+  }
+
+  // Looks up the expansion of the prelude for the arguments, expanding it on a miss. Returns
+  // false if the prelude cannot be expanded, or the compilation was cancelled.
+  inline bool expandPrelude(
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationInfo& info) {
+    DxcShimHasher hasher;
+    hasher.updateField(m_version);
+    hasher.update(static_cast<uint64_t>(args.size()));
+    for (UINT32 i = 0; i < args.size(); i++) {
+      LPCWSTR arg = args.data()[i];
+      hasher.updateField(arg, wcslen(arg) * sizeof(wchar_t));
+    }
+    DxcShimHash argsHash = hasher.finish();
+
+    m_preludeExpansion = m_prelude->find(argsHash);
+    if (m_preludeExpansion != nullptr) {
+      return m_preludeExpansion->isUsable;
+    }
+
+    DXC_SHIM_TRACE_SCOPE("expand prelude");
+
+    // The includes of the prelude are recorded apart, as the compilation records its own.
+    DxcShimCompilationInfo preludeInfo;
+    std::vector<std::string> onceIncludes;
+    std::string source = m_prelude->buildExpansionSource();
+    CComPtr<IDxcResult> dxcResult;
+    HRESULT hr = preprocessSource(source.data(), source.size(), args, cancellation, userCallback, userData, preludeInfo, nullptr, dxcResult, &onceIncludes);
+    info.stats.preprocessTime += preludeInfo.stats.preprocessTime;
+    if (cancellation.isCancelled()) {
+      return false;
     }
 
-    m_compiler->Compile(&buffer, args, argCount, includeHandler, IID_PPV_ARGS(&dxcResult));
-    
+    // A prelude that fails to expand is remembered, and the errors are left to the compilations.
+    std::shared_ptr<DxcShimPreludeExpansion> expansion = std::make_shared<DxcShimPreludeExpansion>();
+    expansion->isUsable = false;
+
+    CComPtr<IDxcBlob> preprocessed;
+    if (SUCCEEDED(hr) && SUCCEEDED(dxcResult->GetStatus(&hr)) && SUCCEEDED(hr)
+      && SUCCEEDED(dxcResult->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(&preprocessed), nullptr))
+      && preprocessed != nullptr) {
+      const char* expanded = static_cast<const char*>(preprocessed->GetBufferPointer());
+      size_t expandedSize = preprocessed->GetBufferSize();
+      while (expandedSize > 0 && expanded[expandedSize - 1] == '\0') {
+        expandedSize--;
+      }
+
+      expansion->isUsable = DxcShimPrelude::restoreMacroDirectives(expanded, expandedSize, expansion->source);
+      expansion->includes = std::move(preludeInfo.includes);
+      expansion->onceIncludes = std::move(onceIncludes);
+    }
+
+    m_preludeExpansion = expansion;
+    m_prelude->insert(argsHash, m_preludeExpansion);
+    return m_preludeExpansion->isUsable;
+  }
+
+  // Replaces the prelude at the start of a source by its expansion. The rest of the source keeps
+  // its line numbers.
+  inline void buildPreludeSource(const char* data, size_t size, size_t preludeSize) {
+    size_t line = 1 + static_cast<size_t>(std::count(data, data + preludeSize, '\n'));
+
+    m_preludeSource.assign(m_preludeExpansion->source);
+    m_preludeSource += "#line ";
+    m_preludeSource += std::to_string(line);
+    m_preludeSource += '\n';
+    m_preludeSource.append(data + preludeSize, size - preludeSize);
+  }
+
+  // Adds the includes of the prelude to those of a compilation, unless they were already loaded.
+  inline void addPreludeIncludes(DxcShimCompilationInfo& info) const {
+    size_t compiledCount = info.includes.size();
+    for (DxcShimResolvedInclude const& include : m_preludeExpansion->includes) {
+      bool isRecorded = false;
+      for (size_t i = 0; i < compiledCount && !isRecorded; i++) {
+        isRecorded = info.includes[i].filename == include.filename;
+      }
+      if (!isRecorded) {
+        info.includes.push_back(include);
+      }
+    }
+  }
+
+  // Strips the SPIR-V output of DXC in place. Returns the bytecode unchanged if it is not valid
+  // SPIR-V.
+  inline static CComPtr<IDxcBlob> strip(CComPtr<IDxcBlob> bytecode, DxcShimStripOptions const& options) {
+    size_t size = bytecode->GetBufferSize();
+    if (size % sizeof(uint32_t) != 0) {
+      return bytecode;
+    }
+
+    // The blob is owned by this compilation alone, so its buffer can be modified.
+    uint32_t* words = static_cast<uint32_t*>(bytecode->GetBufferPointer());
+    size_t wordCount = stripSpirv(words, size / sizeof(uint32_t), options);
+    if (wordCount == 0 || wordCount * sizeof(uint32_t) == size) {
+      return bytecode;
+    }
+
+    return new DxcShimSliceBlob(bytecode, wordCount * sizeof(uint32_t));
+  }
+
+  inline static DxcShimHash hashPreprocessed(IDxcBlob* preprocessed) {
+    DxcShimHasher hasher;
+    hasher.update(preprocessed->GetBufferPointer(), preprocessed->GetBufferSize());
+    return hasher.finish();
+  }
+
+  // Sets the messages of a result to the errors or warnings of a DXC result.
+  inline static void setMessagesFromResult(IDxcResult* dxcResult, DxcShimCompilationResult& result) {
+    // DXC hands out its errors as UTF-8 directly, so the blob is kept rather than converted.
+    CComPtr<IDxcBlobUtf8> messageBlob;
+    if (dxcResult->HasOutput(DXC_OUT_ERRORS)
+      && SUCCEEDED(dxcResult->GetOutput(DXC_OUT_ERRORS, IID_PPV_ARGS(&messageBlob), nullptr))
+      && messageBlob != nullptr) {
+      result.setMessages(std::move(messageBlob));
+      return;
+    }
+
+    // Older DXC versions only report their errors through the error buffer.
+    CComPtr<IDxcBlobEncoding> errorBlob;
+    if (FAILED(dxcResult->GetErrorBuffer(&errorBlob)) || errorBlob == nullptr) {
+      return;
+    }
+
+    BOOL known;
+    UINT32 codePage;
+    errorBlob->GetEncoding(&known, &codePage);
+
+    // The size of the buffer includes the NUL terminator, if any.
+    if (codePage == CP_UTF8) {
+      const char* message = static_cast<const char*>(errorBlob->GetBufferPointer());
+      size_t size = errorBlob->GetBufferSize();
+      while (size > 0 && message[size - 1] == '\0') {
+        size--;
+      }
+
+      // If the encoding is UTF-8, copy the messages straight into the result.
+      result.setMessages(message, size);
+      return;
+    }
+
+    // Otherwise assume the encoding is wide, and convert it into the result.
+    const wchar_t* message = static_cast<const wchar_t*>(errorBlob->GetBufferPointer());
+    size_t size = errorBlob->GetBufferSize() / sizeof(wchar_t);
+    while (size > 0 && message[size - 1] == L'\0') {
+      size--;
+    }
+    result.setMessages(message, size);
+  }
+
+  // Compiles a shader on the compile server. Returns false if no server is listening, in which
+  // case nothing was done.
+  inline bool compileRemotely(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationResult& result) {
+    DXC_SHIM_TRACE_SCOPE("compile on server");
+    DxcShimCompilationInfo& info = result.getInfo();
+    DxcShimStopwatch stopwatch;
+
+    // The server asks for the includes, which are loaded as they would be in process.
+    CComPtr<IDxcIncludeHandler> includeHandler = createIncludeHandler(userCallback, userData, info, cancellation);
+
+    DxcShimCompileServerResponse response;
+    DxcShimCompileServerStatus status = m_compileServer->compile(
+      data,
+      size,
+      args.data(),
+      args.size(),
+      args.getStrip(),
+      includeHandler,
+      cancellation,
+      m_compileServerBuffer,
+      response);
+    info.stats.compileTime = stopwatch.elapsed();
+
+    switch (status) {
+    case DxcShimCompileServerStatus::Unavailable:
+      return false;
+    case DxcShimCompileServerStatus::Cancelled:
+      result.setCancelled();
+      break;
+    case DxcShimCompileServerStatus::Disconnected:
+      result.setFailure("the compile server closed the connection during the compilation");
+      break;
+    case DxcShimCompileServerStatus::Completed:
+      if (response.isSuccessful) {
+        // Successful compilations keep their warnings.
+        result.setSuccess(std::move(response.bytecode));
+        result.setMessages(response.messages, response.messageSize);
+      } else {
+        result.setMessages(response.messages, response.messageSize);
+        result.setFailure();
+      }
+      break;
+    }
+    return true;
+  }
+
+  inline void compileUncached(
+    const char* data,
+    size_t size,
+    DxcShimArguments& args,
+    DxcShimCancellation const& cancellation,
+    DxcShimUserCallback userCallback,
+    void* userData,
+    DxcShimCompilationResult& result) {
+    if (m_compileServer != nullptr && compileRemotely(data, size, args, cancellation, userCallback, userData, result)) {
+      return;
+    }
+
+    DxcShimCompilationInfo& info = result.getInfo();
+    DxcShimStopwatch stopwatch;
+    CComPtr<IDxcResult> dxcResult;
+
+    DxcBuffer buffer = {
+      .Ptr = data,
+      .Size = size,
+      .Encoding = CP_UTF8,
+    };
+
+    CComPtr<IDxcIncludeHandler> includeHandler = createIncludeHandler(userCallback, userData, info, cancellation);
+
     HRESULT hr;
-    dxcResult->GetStatus(&hr);
-    if (FAILED(hr)) {
-        CComPtr<IDxcBlobEncoding> errorBlob;
-        dxcResult->GetErrorBuffer(&errorBlob);
+    {
+      DXC_SHIM_TRACE_SCOPE("dxc compile");
+      hr = m_compiler->Compile(&buffer, args.data(), args.size(), includeHandler, IID_PPV_ARGS(&dxcResult));
+    }
+    info.stats.compileTime = stopwatch.elapsed();
+    if (cancellation.isCancelled()) {
+      result.setCancelled();
+      return;
+    }
 
-        BOOL known;
-        UINT32 codePage;
-        errorBlob->GetEncoding(&known, &codePage);
+    if (FAILED(hr)) {
+      result.setFailure("failed to invoke the DXC compiler");
+      return;
+    }
 
-        // If the encoding is UTF-8, return the error message as a UTF-8 string.
-        if (codePage == CP_UTF8) {
-          std::string message = static_cast<LPSTR>(errorBlob->GetBufferPointer());
-          return DxcShimCompilationResult::failure(message);
-        } 
-          
-        // Assume UTF-16 if the encoding.
-        std::string message = utf16_to_utf8((LPWSTR)errorBlob->GetBufferPointer());
-        return DxcShimCompilationResult::failure(std::move(message));
+    DXC_SHIM_TRACE_SCOPE("copy result");
+    dxcResult->GetStatus(&hr);
+    if (FAILED(hr)) {
+      setMessagesFromResult(dxcResult, result);
+      result.setFailure();
+      return;
     }
 
     CComPtr<IDxcBlob> bytecode;
     dxcResult->GetResult(&bytecode);
+    if (bytecode != nullptr && args.getStrip().isEnabled()) {
+      bytecode = strip(bytecode, args.getStrip());
+    }
 
-    auto ptr = static_cast<uint8_t*>(bytecode->GetBufferPointer());
-    auto size = static_cast<size_t>(bytecode->GetBufferSize());
-
-    std::vector<uint8_t> bytecodeData(ptr, ptr + size);
-    return DxcShimCompilationResult::success(std::move(bytecodeData));
+    // Successful compilations keep their warnings.
+    result.setSuccess(std::move(bytecode));
+    setMessagesFromResult(dxcResult, result);
   }
 
-private:
   CComPtr<IDxcCompiler3> m_compiler;
   CComPtr<IDxcUtils> m_utils;
+
+  // The DXC version, as reported by IDxcVersionInfo. Part of every cache key.
+  std::string m_version;
+  DxcShimCache* m_cache = nullptr;
+  DxcShimIncludeCache* m_includeCache = nullptr;
+  DxcShimRemoteCache* m_remoteCache = nullptr;
+
+  // If set, sources starting with the prelude are compiled from its expansion. The expansion is
+  // shared with the prelude, and copied into the source buffer along with the rest of the source.
+  DxcShimPrelude* m_prelude = nullptr;
+  std::shared_ptr<const DxcShimPreludeExpansion> m_preludeExpansion;
+  std::string m_preludeSource;
+
+  // The includes skipped by the compilation in progress, if it is compiled from the expansion.
+  std::vector<std::string> const* m_skippedIncludes = nullptr;
+
+  // If set, codegen is forwarded to this server. The buffer is reused for its messages.
+  DxcShimCompileServerClient const* m_compileServer = nullptr;
+  std::string m_compileServerBuffer;
+
+  DxcShimStatsCounters m_stats;
+  DxcShimStatsCounters* m_parentStats = nullptr;
+  DxcShimPriorityGate* m_priorityGate = nullptr;
 };
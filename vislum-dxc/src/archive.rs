@@ -0,0 +1,560 @@
+use std::{
+    ffi::{CStr, CString},
+    mem::MaybeUninit,
+    path::Path,
+    sync::Arc,
+};
+
+use crate::{DxcBytecode, DxcReflection, DxcResolvedInclude, sys};
+
+#[derive(thiserror::Error, Debug)]
+pub enum DxcArchiveError {
+    #[error("invalid archive path")]
+    InvalidPath,
+    #[error("failed to open archive")]
+    OpenError,
+    #[error("failed to write archive")]
+    WriteError,
+}
+
+/// Converts a path for the shim.
+fn archive_path(path: &Path) -> Result<CString, DxcArchiveError> {
+    let path = path.to_str().ok_or(DxcArchiveError::InvalidPath)?;
+    CString::new(path).map_err(|_| DxcArchiveError::InvalidPath)
+}
+
+/// Collects compiled modules to write into a [`DxcArchive`].
+///
+/// Modules are added under a caller-chosen key, such as the hash of their permutation, together
+/// with their reflection and the includes they were compiled from.
+pub struct DxcArchiveWriter {
+    inner: *mut sys::DxcShimArchiveWriter,
+}
+
+// SAFETY: The shim archive writer synchronizes all accesses internally.
+unsafe impl Send for DxcArchiveWriter {}
+unsafe impl Sync for DxcArchiveWriter {}
+
+impl DxcArchiveWriter {
+    pub fn new() -> Arc<Self> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimArchiveWriter>::uninit();
+        unsafe { sys::dxc_archive_writer_create(inner.as_mut_ptr()) };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self { inner })
+    }
+
+    /// Adds a module under the given key. The bytecode is copied.
+    ///
+    /// Returns `false` if a module with the same key was already added.
+    pub fn add(&self, key: u128, bytecode: &DxcBytecode) -> bool {
+        let key = sys::DxcShimHash::from(key);
+        unsafe { sys::dxc_archive_writer_add(self.inner, &key, bytecode.result.as_ptr()) }
+    }
+
+    /// Writes the archive, replacing any existing file atomically.
+    pub fn write(&self, path: impl AsRef<Path>) -> Result<(), DxcArchiveError> {
+        let path = archive_path(path.as_ref())?;
+
+        match unsafe { sys::dxc_archive_writer_write(self.inner, path.as_ptr()) } {
+            sys::DxcShimStatus::Ok => Ok(()),
+            sys::DxcShimStatus::ArchiveWriteError => Err(DxcArchiveError::WriteError),
+            _ => unreachable!(),
+        }
+    }
+}
+
+impl Drop for DxcArchiveWriter {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_archive_writer_destroy(self.inner) };
+    }
+}
+
+/// A shader archive, holding many compiled modules in a single memory-mapped file.
+///
+/// Opening an archive maps it and validates its index. Lookups are binary searches over the
+/// mapped index, and the bytecode is borrowed from the mapping without copying, so loading the
+/// shaders of a player costs one mapping instead of a read or compilation per shader.
+pub struct DxcArchive {
+    inner: *mut sys::DxcShimArchive,
+}
+
+// SAFETY: The shim archive is immutable once opened, and builds its reflection tables once
+// under a lock.
+unsafe impl Send for DxcArchive {}
+unsafe impl Sync for DxcArchive {}
+
+impl DxcArchive {
+    /// Maps the archive at the given path.
+    pub fn open(path: impl AsRef<Path>) -> Result<Arc<Self>, DxcArchiveError> {
+        let path = archive_path(path.as_ref())?;
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimArchive>::uninit();
+        let status = unsafe { sys::dxc_archive_open(path.as_ptr(), inner.as_mut_ptr()) };
+
+        match status {
+            sys::DxcShimStatus::Ok => {
+                let inner = unsafe { inner.assume_init() };
+                Ok(Arc::new(Self { inner }))
+            }
+            sys::DxcShimStatus::ArchiveOpenError => Err(DxcArchiveError::OpenError),
+            _ => unreachable!(),
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        unsafe { sys::dxc_archive_get_entry_count(self.inner) }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the module with the given key.
+    pub fn get(&self, key: u128) -> Option<DxcArchiveEntry<'_>> {
+        let key = sys::DxcShimHash::from(key);
+        let mut index = MaybeUninit::<usize>::uninit();
+        let found = unsafe { sys::dxc_archive_find(self.inner, &key, index.as_mut_ptr()) };
+
+        found.then(|| DxcArchiveEntry {
+            archive: self,
+            index: unsafe { index.assume_init() },
+        })
+    }
+
+    /// Returns all modules, sorted by key.
+    pub fn entries(&self) -> impl Iterator<Item = DxcArchiveEntry<'_>> {
+        (0..self.len()).map(|index| DxcArchiveEntry {
+            archive: self,
+            index,
+        })
+    }
+}
+
+impl Drop for DxcArchive {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_archive_close(self.inner) };
+    }
+}
+
+/// A module of a [`DxcArchive`].
+#[derive(Clone, Copy)]
+pub struct DxcArchiveEntry<'a> {
+    archive: &'a DxcArchive,
+    index: usize,
+}
+
+impl<'a> DxcArchiveEntry<'a> {
+    pub fn key(&self) -> u128 {
+        let mut key = MaybeUninit::<sys::DxcShimHash>::uninit();
+        unsafe { sys::dxc_archive_get_key(self.archive.inner, self.index, key.as_mut_ptr()) };
+        unsafe { key.assume_init() }.into()
+    }
+
+    /// Returns the bytecode, borrowed from the mapping of the archive. The bytecode is 8-byte
+    /// aligned.
+    pub fn bytecode(&self) -> &'a [u8] {
+        let mut bytecode = MaybeUninit::<*const std::ffi::c_void>::uninit();
+        let mut size = MaybeUninit::<usize>::uninit();
+        unsafe {
+            sys::dxc_archive_get_bytecode(
+                self.archive.inner,
+                self.index,
+                bytecode.as_mut_ptr(),
+                size.as_mut_ptr(),
+            )
+        };
+
+        let size = unsafe { size.assume_init() };
+        if size == 0 {
+            return &[];
+        }
+
+        unsafe { std::slice::from_raw_parts(bytecode.assume_init() as *const u8, size) }
+    }
+
+    /// Returns the reflection recorded when the module was archived, or `None` if its bytecode
+    /// could not be reflected.
+    pub fn reflection(&self) -> Option<DxcReflection> {
+        let mut reflection = MaybeUninit::<*const sys::DxcShimReflection>::uninit();
+        let has_reflection = unsafe {
+            sys::dxc_archive_get_reflection(self.archive.inner, self.index, reflection.as_mut_ptr())
+        };
+        if !has_reflection {
+            return None;
+        }
+
+        // SAFETY: The reflection is owned by the archive, which outlives this call.
+        Some(unsafe { DxcReflection::from_raw(&*reflection.assume_init()) })
+    }
+
+    /// Returns the includes the module was compiled from, with the hashes of their contents,
+    /// to check whether the module is stale.
+    pub fn dependencies(&self) -> Vec<DxcResolvedInclude> {
+        let count =
+            unsafe { sys::dxc_archive_get_dependency_count(self.archive.inner, self.index) };
+
+        (0..count)
+            .map(|dependency_index| {
+                let mut filename = MaybeUninit::<*const std::ffi::c_char>::uninit();
+                let mut hash = MaybeUninit::<sys::DxcShimHash>::uninit();
+                unsafe {
+                    sys::dxc_archive_get_dependency(
+                        self.archive.inner,
+                        self.index,
+                        dependency_index,
+                        filename.as_mut_ptr(),
+                        hash.as_mut_ptr(),
+                    )
+                };
+
+                let filename = unsafe { CStr::from_ptr(filename.assume_init()) };
+                DxcResolvedInclude {
+                    filename: filename.to_string_lossy().into_owned(),
+                    hash: unsafe { hash.assume_init() }.into(),
+                }
+            })
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::path::PathBuf;
+
+    use super::*;
+    use crate::{
+        DxcComponentType, DxcDescriptorType, DxcReflectionBinding, DxcReflectionInput,
+        DxcShaderStage,
+    };
+
+    // Offsets of fields of the archive layout.
+    const HEADER_VERSION: usize = 4;
+    const HEADER_ENTRY_COUNT: usize = 8;
+    const HEADER_BINDINGS_OFFSET: usize = 24;
+    const HEADER_STRINGS_OFFSET: usize = 72;
+    const HEADER_STRINGS_SIZE: usize = 80;
+    const HEADER_SIZE: usize = 88;
+    const ENTRY_SIZE: usize = 80;
+    const ENTRY_BYTECODE_OFFSET: usize = 16;
+    const ENTRY_BYTECODE_SIZE: usize = 24;
+    const ENTRY_STAGE: usize = 36;
+    const ENTRY_BINDING_COUNT: usize = 60;
+    const BINDING_NAME: usize = 16;
+
+    fn test_path(name: &str) -> PathBuf {
+        std::env::temp_dir().join(format!(
+            "vislum-dxc-archive-test-{}-{name}.vdxa",
+            std::process::id()
+        ))
+    }
+
+    fn add_bytecode(
+        writer: &DxcArchiveWriter,
+        key: u128,
+        bytecode: &[u8],
+        reflection: Option<&sys::DxcShimReflection>,
+        dependencies: &[DxcResolvedInclude],
+    ) -> bool {
+        let filenames: Vec<CString> = dependencies
+            .iter()
+            .map(|dependency| CString::new(dependency.filename.as_str()).unwrap())
+            .collect();
+        let filename_pointers: Vec<*const std::ffi::c_char> =
+            filenames.iter().map(|filename| filename.as_ptr()).collect();
+        let hashes: Vec<sys::DxcShimHash> = dependencies
+            .iter()
+            .map(|dependency| dependency.hash.into())
+            .collect();
+
+        let key = sys::DxcShimHash::from(key);
+        unsafe {
+            sys::dxc_archive_writer_add_bytecode(
+                writer.inner,
+                &key,
+                bytecode.as_ptr() as *const std::ffi::c_void,
+                bytecode.len(),
+                reflection.map_or(std::ptr::null(), |reflection| reflection),
+                filename_pointers.as_ptr(),
+                hashes.as_ptr(),
+                dependencies.len(),
+            )
+        }
+    }
+
+    /// Writes an archive with a reflected entry, and returns its contents.
+    fn reflected_archive(path: &Path) -> Vec<u8> {
+        let binding_name = CString::new("buffer").unwrap();
+        let bindings = [sys::DxcShimReflectionBinding {
+            set: 1,
+            binding: 2,
+            descriptor_type: sys::DxcShimDescriptorType::StorageBuffer,
+            count: 1,
+            name: binding_name.as_ptr(),
+        }];
+        let input_name = CString::new("position").unwrap();
+        let inputs = [sys::DxcShimReflectionInput {
+            location: 3,
+            component_type: sys::DxcShimComponentType::Float32,
+            component_count: 4,
+            name: input_name.as_ptr(),
+        }];
+        let reflection = sys::DxcShimReflection {
+            stage: sys::DxcShimShaderStage::Compute,
+            push_constant_size: 16,
+            local_size: [8, 4, 1],
+            bindings: bindings.as_ptr(),
+            binding_count: bindings.len(),
+            inputs: inputs.as_ptr(),
+            input_count: inputs.len(),
+        };
+
+        let writer = DxcArchiveWriter::new();
+        let dependencies = [DxcResolvedInclude {
+            filename: "shaders/common.hlsl".to_owned(),
+            hash: 0x1234,
+        }];
+        assert!(add_bytecode(
+            &writer,
+            7,
+            b"reflected",
+            Some(&reflection),
+            &dependencies
+        ));
+        writer.write(path).unwrap();
+        std::fs::read(path).unwrap()
+    }
+
+    /// Writes the given contents, and returns whether they open as an archive.
+    fn is_valid(path: &Path, contents: &[u8]) -> bool {
+        std::fs::write(path, contents).unwrap();
+        DxcArchive::open(path).is_ok()
+    }
+
+    fn patch_u32(contents: &[u8], offset: usize, value: u32) -> Vec<u8> {
+        let mut contents = contents.to_vec();
+        contents[offset..offset + 4].copy_from_slice(&value.to_ne_bytes());
+        contents
+    }
+
+    fn patch_u64(contents: &[u8], offset: usize, value: u64) -> Vec<u8> {
+        let mut contents = contents.to_vec();
+        contents[offset..offset + 8].copy_from_slice(&value.to_ne_bytes());
+        contents
+    }
+
+    fn read_u64(contents: &[u8], offset: usize) -> u64 {
+        u64::from_ne_bytes(contents[offset..offset + 8].try_into().unwrap())
+    }
+
+    #[test]
+    fn test_write_and_find() {
+        let path = test_path("round-trip");
+        let writer = DxcArchiveWriter::new();
+        let large_key = u128::MAX - 1;
+        assert!(add_bytecode(&writer, 30, b"third", None, &[]));
+        assert!(add_bytecode(&writer, large_key, b"large", None, &[]));
+        assert!(add_bytecode(&writer, 1 << 64, b"high", None, &[]));
+        assert!(add_bytecode(&writer, 10, b"first", None, &[]));
+        writer.write(&path).unwrap();
+
+        let archive = DxcArchive::open(&path).unwrap();
+        assert_eq!(archive.len(), 4);
+        let keys: Vec<u128> = archive.entries().map(|entry| entry.key()).collect();
+        assert_eq!(keys, [10, 30, 1 << 64, large_key]);
+
+        assert_eq!(archive.get(10).unwrap().bytecode(), b"first");
+        assert_eq!(archive.get(30).unwrap().bytecode(), b"third");
+        assert_eq!(archive.get(1 << 64).unwrap().bytecode(), b"high");
+        assert_eq!(archive.get(large_key).unwrap().bytecode(), b"large");
+        for entry in archive.entries() {
+            assert_eq!(entry.bytecode().as_ptr() as usize % 8, 0);
+            assert!(entry.reflection().is_none());
+            assert!(entry.dependencies().is_empty());
+        }
+
+        assert!(archive.get(0).is_none());
+        assert!(archive.get(20).is_none());
+        assert!(archive.get(u128::MAX).is_none());
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_duplicate_keys() {
+        let path = test_path("duplicates");
+        let writer = DxcArchiveWriter::new();
+        assert!(add_bytecode(&writer, 1, b"first", None, &[]));
+        assert!(!add_bytecode(&writer, 1, b"second", None, &[]));
+        writer.write(&path).unwrap();
+
+        let archive = DxcArchive::open(&path).unwrap();
+        assert_eq!(archive.len(), 1);
+        assert_eq!(archive.get(1).unwrap().bytecode(), b"first");
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_empty_archive() {
+        let path = test_path("empty");
+        DxcArchiveWriter::new().write(&path).unwrap();
+
+        let archive = DxcArchive::open(&path).unwrap();
+        assert!(archive.is_empty());
+        assert!(archive.get(0).is_none());
+        assert_eq!(archive.entries().count(), 0);
+
+        // An empty module is still found.
+        let writer = DxcArchiveWriter::new();
+        assert!(add_bytecode(&writer, 1, b"", None, &[]));
+        writer.write(&path).unwrap();
+        let archive = DxcArchive::open(&path).unwrap();
+        assert!(archive.get(1).unwrap().bytecode().is_empty());
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_reflection_and_dependencies() {
+        let path = test_path("reflection");
+        reflected_archive(&path);
+
+        let archive = DxcArchive::open(&path).unwrap();
+        let entry = archive.get(7).unwrap();
+        assert_eq!(entry.bytecode(), b"reflected");
+        assert_eq!(
+            entry.reflection().unwrap(),
+            DxcReflection {
+                stage: DxcShaderStage::Compute,
+                push_constant_size: 16,
+                local_size: [8, 4, 1],
+                bindings: vec![DxcReflectionBinding {
+                    set: 1,
+                    binding: 2,
+                    descriptor_type: DxcDescriptorType::StorageBuffer,
+                    count: 1,
+                    name: "buffer".to_owned(),
+                }],
+                inputs: vec![DxcReflectionInput {
+                    location: 3,
+                    component_type: DxcComponentType::Float32,
+                    component_count: 4,
+                    name: "position".to_owned(),
+                }],
+            }
+        );
+        assert_eq!(
+            entry.dependencies(),
+            [DxcResolvedInclude {
+                filename: "shaders/common.hlsl".to_owned(),
+                hash: 0x1234,
+            }]
+        );
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_validate_header() {
+        let path = test_path("header");
+        let contents = reflected_archive(&path);
+        assert!(is_valid(&path, &contents));
+
+        assert!(!is_valid(&path, b""));
+        assert!(!is_valid(&path, &contents[..HEADER_SIZE - 1]));
+        assert!(!is_valid(&path, &patch_u32(&contents, 0, 0x12345678)));
+        assert!(!is_valid(&path, &patch_u32(&contents, HEADER_VERSION, 2)));
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_validate_tables() {
+        let path = test_path("tables");
+        let contents = reflected_archive(&path);
+
+        // Truncating the file cuts off the bytecode, and then the tables.
+        let bytecode_end =
+            read_u64(&contents, HEADER_SIZE + ENTRY_BYTECODE_OFFSET) as usize + b"reflected".len();
+        assert!(is_valid(&path, &contents[..bytecode_end]));
+        assert!(!is_valid(&path, &contents[..bytecode_end - 1]));
+        assert!(!is_valid(&path, &contents[..HEADER_SIZE + ENTRY_SIZE]));
+
+        assert!(!is_valid(
+            &path,
+            &patch_u64(&contents, HEADER_ENTRY_COUNT, u64::MAX / 8)
+        ));
+        let bindings_offset = read_u64(&contents, HEADER_BINDINGS_OFFSET);
+        assert!(!is_valid(
+            &path,
+            &patch_u64(&contents, HEADER_BINDINGS_OFFSET, bindings_offset + 4)
+        ));
+        assert!(!is_valid(
+            &path,
+            &patch_u64(&contents, HEADER_BINDINGS_OFFSET, u64::MAX - 7)
+        ));
+
+        let entry = HEADER_SIZE;
+        assert!(!is_valid(
+            &path,
+            &patch_u64(
+                &contents,
+                entry + ENTRY_BYTECODE_SIZE,
+                contents.len() as u64
+            )
+        ));
+        assert!(!is_valid(
+            &path,
+            &patch_u32(&contents, entry + ENTRY_BINDING_COUNT, 2)
+        ));
+        assert!(!is_valid(
+            &path,
+            &patch_u32(&contents, entry + ENTRY_BINDING_COUNT, u32::MAX)
+        ));
+        assert!(!is_valid(
+            &path,
+            &patch_u32(&contents, entry + ENTRY_STAGE, 3)
+        ));
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_validate_strings() {
+        let path = test_path("strings");
+        let contents = reflected_archive(&path);
+        let strings_offset = read_u64(&contents, HEADER_STRINGS_OFFSET) as usize;
+        let strings_size = read_u64(&contents, HEADER_STRINGS_SIZE) as usize;
+
+        // A binding name past the string table.
+        let binding = read_u64(&contents, HEADER_BINDINGS_OFFSET) as usize;
+        assert!(!is_valid(
+            &path,
+            &patch_u32(&contents, binding + BINDING_NAME, strings_size as u32)
+        ));
+
+        // A string table without a final terminator.
+        let mut unterminated = contents.clone();
+        unterminated[strings_offset + strings_size - 1] = b'x';
+        assert!(!is_valid(&path, &unterminated));
+
+        assert!(!is_valid(
+            &path,
+            &patch_u64(&contents, HEADER_STRINGS_SIZE, contents.len() as u64)
+        ));
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn test_validate_sorted_keys() {
+        let path = test_path("sorted");
+        let writer = DxcArchiveWriter::new();
+        assert!(add_bytecode(&writer, 1, b"first", None, &[]));
+        assert!(add_bytecode(&writer, 2, b"second", None, &[]));
+        writer.write(&path).unwrap();
+        let contents = std::fs::read(&path).unwrap();
+        assert!(is_valid(&path, &contents));
+
+        // The low halves of the keys, which is all they differ in.
+        let first_key = HEADER_SIZE + 8;
+        let second_key = HEADER_SIZE + ENTRY_SIZE + 8;
+        assert!(!is_valid(&path, &patch_u64(&contents, first_key, 3)));
+        assert!(!is_valid(&path, &patch_u64(&contents, second_key, 1)));
+        std::fs::remove_file(path).unwrap();
+    }
+}
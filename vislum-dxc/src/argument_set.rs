@@ -0,0 +1,41 @@
+use std::{mem::MaybeUninit, sync::Arc};
+
+use crate::{DxcCompileOptions, DxcCompileOptionsStrings, sys};
+
+/// The arguments of a set of compile options, built once and shared by many compilations.
+///
+/// Compilations whose [`DxcCompileOptions::argument_set`] refers to it skip converting their
+/// options into DXC arguments, which is most of the per-compilation setup of a batch of shaders
+/// sharing a stage, profile and defines. Only the cancellation token, deadline and defines of
+/// their own options are still used.
+#[derive(Debug)]
+pub struct DxcArgumentSet {
+    pub(crate) inner: *mut sys::DxcShimArgumentSet,
+}
+
+// SAFETY: The shim argument set is immutable once created.
+unsafe impl Send for DxcArgumentSet {}
+unsafe impl Sync for DxcArgumentSet {}
+
+impl DxcArgumentSet {
+    /// Builds the arguments of the given options. Their cancellation token, deadline and argument
+    /// set are ignored.
+    pub fn new(options: &DxcCompileOptions<'_>) -> Arc<Self> {
+        let options = DxcCompileOptionsStrings::new(&DxcCompileOptions {
+            argument_set: None,
+            ..*options
+        });
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimArgumentSet>::uninit();
+        unsafe { sys::dxc_argument_set_create(options.raw(), inner.as_mut_ptr()) };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self { inner })
+    }
+}
+
+impl Drop for DxcArgumentSet {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_argument_set_destroy(self.inner) };
+    }
+}
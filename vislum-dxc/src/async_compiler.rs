@@ -0,0 +1,230 @@
+use std::{
+    future::Future,
+    mem::MaybeUninit,
+    pin::Pin,
+    ptr::NonNull,
+    sync::{Arc, Mutex},
+    task::{Context, Poll, Waker},
+};
+
+use crate::{
+    DxcBytecode, DxcCancellationToken, DxcCompilationError, DxcCompileOptions,
+    DxcCompileOptionsStrings, DxcCompilerCreationError, DxcCompilerPool, DxcIncludeHandler,
+    DxcIncludeHandlerUserData, compiler_creation_result, include_handler_callback, sys,
+    take_result,
+};
+
+#[derive(Default)]
+pub struct DxcAsyncCompilerCreateInfo {
+    /// The number of worker threads. 0 uses one thread per core.
+    pub thread_count: usize,
+}
+
+/// Compiles shaders in the background on worker threads owned by the shim.
+///
+/// Each worker uses its own compiler acquired from the pool, for the lifetime of the async
+/// compiler. Dropping the async compiler cancels all pending tasks and waits for the running
+/// ones to complete.
+pub struct DxcAsyncCompiler {
+    inner: *mut sys::DxcShimAsyncCompiler,
+
+    // The workers hold compilers of the pool until the async compiler is destroyed.
+    pool: Arc<DxcCompilerPool>,
+}
+
+// SAFETY: The shim async compiler synchronizes its queue internally.
+unsafe impl Send for DxcAsyncCompiler {}
+unsafe impl Sync for DxcAsyncCompiler {}
+
+impl DxcAsyncCompiler {
+    pub fn new(
+        pool: Arc<DxcCompilerPool>,
+        create_info: DxcAsyncCompilerCreateInfo,
+    ) -> Result<Arc<Self>, DxcCompilerCreationError> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimAsyncCompiler>::uninit();
+        let status = unsafe {
+            sys::dxc_async_compiler_create(pool.inner, create_info.thread_count, inner.as_mut_ptr())
+        };
+
+        compiler_creation_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        Ok(Arc::new(Self { inner, pool }))
+    }
+
+    /// Returns the pool the compilers of the workers were acquired from.
+    pub fn pool(&self) -> &Arc<DxcCompilerPool> {
+        &self.pool
+    }
+
+    /// Queues a compilation and returns its task.
+    ///
+    /// The source and options are copied by the shim. The include handler is called from a
+    /// worker thread. It and the cancellation token of the options are kept alive until the
+    /// task has completed or been cancelled.
+    pub fn compile(
+        &self,
+        data: &str,
+        options: &DxcCompileOptions<'_>,
+        include_handler: Arc<dyn DxcIncludeHandler + Send + Sync>,
+    ) -> DxcCompileTask {
+        let options_cancellation_token = options.cancellation_token.cloned();
+        let options = DxcCompileOptionsStrings::new(options);
+
+        // SAFETY: The include handler is kept alive by the state, which outlives the task.
+        let user_data = DxcIncludeHandlerUserData {
+            include_handler: unsafe { &*Arc::as_ptr(&include_handler) },
+        };
+        let state = Arc::new(DxcCompileTaskState {
+            user_data,
+            _include_handler: include_handler,
+            _cancellation_token: options_cancellation_token,
+            waker: Mutex::new(None),
+        });
+
+        // The shim holds a reference to the state until the completion callback, which is
+        // called exactly once.
+        let completion_user_data = Arc::into_raw(state.clone());
+
+        let inner = unsafe {
+            sys::dxc_compile_async(
+                self.inner,
+                data.as_ptr() as *const std::ffi::c_char,
+                data.len(),
+                options.raw(),
+                include_handler_callback(),
+                &state.user_data as *const _ as *mut std::ffi::c_void,
+                Some(dxc_compile_task_complete),
+                completion_user_data as *mut std::ffi::c_void,
+            )
+        };
+
+        DxcCompileTask {
+            inner: NonNull::new(inner).expect("the shim returned a null task"),
+            state,
+        }
+    }
+}
+
+impl Drop for DxcAsyncCompiler {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_async_compiler_destroy(self.inner) };
+    }
+}
+
+/// The status of a [`DxcCompileTask`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcTaskStatus {
+    /// Queued, waiting for a worker.
+    Pending,
+    Running,
+    Completed,
+    Cancelled,
+}
+
+impl From<sys::DxcShimTaskStatus> for DxcTaskStatus {
+    fn from(status: sys::DxcShimTaskStatus) -> Self {
+        match status {
+            sys::DxcShimTaskStatus::Pending => DxcTaskStatus::Pending,
+            sys::DxcShimTaskStatus::Running => DxcTaskStatus::Running,
+            sys::DxcShimTaskStatus::Completed => DxcTaskStatus::Completed,
+            sys::DxcShimTaskStatus::Cancelled => DxcTaskStatus::Cancelled,
+        }
+    }
+}
+
+/// The state shared between a task and its completion callback.
+struct DxcCompileTaskState {
+    user_data: DxcIncludeHandlerUserData<'static>,
+    _include_handler: Arc<dyn DxcIncludeHandler + Send + Sync>,
+    _cancellation_token: Option<Arc<DxcCancellationToken>>,
+
+    /// The waker of the last poll of the task as a future.
+    waker: Mutex<Option<Waker>>,
+}
+
+// SAFETY: The include handler is `Send + Sync`, and `user_data` only refers to it.
+unsafe impl Send for DxcCompileTaskState {}
+unsafe impl Sync for DxcCompileTaskState {}
+
+unsafe extern "C" fn dxc_compile_task_complete(
+    _task: *mut sys::DxcShimCompileTask,
+    user_data: *mut std::ffi::c_void,
+) {
+    let state = unsafe { Arc::from_raw(user_data as *const DxcCompileTaskState) };
+
+    // The status is set before the callback, so a poll holding the lock either sees it, or
+    // has stored its waker.
+    if let Some(waker) = state.waker.lock().unwrap().take() {
+        waker.wake();
+    }
+}
+
+/// A compilation queued on a [`DxcAsyncCompiler`].
+///
+/// The task can be polled, waited for, or awaited as a future. Results of cancelled tasks are
+/// `None`. Dropping a task cancels it, whether it is pending or running, as nobody can take its
+/// result anymore.
+pub struct DxcCompileTask {
+    inner: NonNull<sys::DxcShimCompileTask>,
+    state: Arc<DxcCompileTaskState>,
+}
+
+// SAFETY: The shim task synchronizes all accesses internally.
+unsafe impl Send for DxcCompileTask {}
+unsafe impl Sync for DxcCompileTask {}
+
+impl DxcCompileTask {
+    pub fn status(&self) -> DxcTaskStatus {
+        unsafe { sys::dxc_compile_task_poll(self.inner.as_ptr()) }.into()
+    }
+
+    /// Cancels the task. A pending task is cancelled immediately. A running one is stopped before
+    /// its next phase or include, and becomes [`DxcTaskStatus::Cancelled`] then, unless it
+    /// completes first.
+    ///
+    /// Returns whether the call cancelled the task, which only a pending task is right away.
+    pub fn cancel(&self) -> bool {
+        unsafe { sys::dxc_compile_task_cancel(self.inner.as_ptr()) }
+    }
+
+    /// Blocks until the task has completed or been cancelled, and returns its result.
+    pub fn wait(self) -> Option<Result<DxcBytecode, DxcCompilationError>> {
+        unsafe { sys::dxc_compile_task_wait(self.inner.as_ptr()) };
+        self.take_result()
+    }
+
+    fn take_result(&self) -> Option<Result<DxcBytecode, DxcCompilationError>> {
+        let raw_result = unsafe { sys::dxc_compile_task_take_result(self.inner.as_ptr()) };
+        if raw_result.is_null() {
+            return None;
+        }
+
+        Some(unsafe { take_result(raw_result) })
+    }
+}
+
+impl Future for DxcCompileTask {
+    type Output = Option<Result<DxcBytecode, DxcCompilationError>>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Self::Output> {
+        let mut waker = self.state.waker.lock().unwrap();
+
+        match self.status() {
+            DxcTaskStatus::Completed | DxcTaskStatus::Cancelled => Poll::Ready(self.take_result()),
+            DxcTaskStatus::Pending | DxcTaskStatus::Running => {
+                *waker = Some(cx.waker().clone());
+                Poll::Pending
+            }
+        }
+    }
+}
+
+impl Drop for DxcCompileTask {
+    fn drop(&mut self) {
+        // A task nobody is waiting for is stale, so stop it from wasting a worker, even if it is
+        // already running.
+        unsafe { sys::dxc_compile_task_cancel(self.inner.as_ptr()) };
+        unsafe { sys::dxc_compile_task_release(self.inner.as_ptr()) };
+    }
+}
@@ -0,0 +1,273 @@
+use std::ptr::NonNull;
+
+use crate::{
+    DxcBytecode, DxcCompilationError, DxcCompileOptions, DxcCompileOptionsStrings,
+    DxcCompilerCreationError, DxcCompilerPool, DxcIncludeHandler, DxcIncludeHandlerUserData,
+    borrow_result, compiler_creation_result, include_handler_callback, sys, take_result,
+};
+
+/// A single compilation of a batch.
+#[derive(Debug, Clone, Copy)]
+pub struct DxcCompileJob<'a> {
+    pub source: &'a str,
+    pub options: DxcCompileOptions<'a>,
+}
+
+impl DxcCompilerPool {
+    /// Compiles a batch of jobs in parallel, on up to `thread_count` threads.
+    ///
+    /// A `thread_count` of 0 uses one thread per core. The returned results are in the same
+    /// order as `jobs`. The include handler is called from several threads at once.
+    pub fn compile_batch(
+        &self,
+        jobs: &[DxcCompileJob<'_>],
+        thread_count: usize,
+        include_handler: &(dyn DxcIncludeHandler + Sync),
+    ) -> Result<Vec<Result<DxcBytecode, DxcCompilationError>>, DxcCompilerCreationError> {
+        // The NUL-terminated option strings of every job, kept alive for the duration of the batch.
+        let options: Vec<_> = jobs
+            .iter()
+            .map(|job| DxcCompileOptionsStrings::new(&job.options))
+            .collect();
+
+        // The include handler is shared by all jobs. The shim owns the sources it returns, so
+        // no per-job state is needed.
+        let user_data = DxcIncludeHandlerUserData { include_handler };
+
+        let raw_jobs: Vec<_> = jobs
+            .iter()
+            .zip(options.iter())
+            .map(|(job, options)| sys::DxcShimCompileJob {
+                source: job.source.as_ptr() as *const std::ffi::c_char,
+                source_size: job.source.len(),
+                options: *options.raw(),
+                user_data: &user_data as *const _ as *mut std::ffi::c_void,
+            })
+            .collect();
+
+        let mut raw_results = vec![std::ptr::null_mut(); raw_jobs.len()];
+        let status = unsafe {
+            sys::dxc_compile_batch(
+                self.inner,
+                raw_jobs.as_ptr(),
+                raw_jobs.len(),
+                thread_count,
+                include_handler_callback(),
+                raw_results.as_mut_ptr(),
+            )
+        };
+
+        compiler_creation_result(status)?;
+
+        Ok(raw_results
+            .into_iter()
+            .map(|raw_result| unsafe { take_result(raw_result) })
+            .collect())
+    }
+
+    /// Compiles a batch of jobs like [`DxcCompilerPool::compile_batch`], but hands every result
+    /// to `on_result` with the index of its job as soon as the job finishes, instead of keeping
+    /// all of them until the batch completes.
+    ///
+    /// The bytecode only lives until `on_result` returns, so a batch of thousands of shaders
+    /// holds no more than the jobs in flight. Jobs are only started while the estimated memory
+    /// of the jobs in flight fits in `memory_budget` bytes. A `memory_budget` of 0 is unlimited.
+    /// No more compilers are acquired from the pool than the budget lets run at once.
+    /// The include handler and `on_result` are called from several threads at once.
+    pub fn compile_batch_streaming(
+        &self,
+        jobs: &[DxcCompileJob<'_>],
+        thread_count: usize,
+        memory_budget: u64,
+        include_handler: &(dyn DxcIncludeHandler + Sync),
+        on_result: &(dyn Fn(usize, Result<&DxcBytecode, DxcCompilationError>) + Sync),
+    ) -> Result<(), DxcCompilerCreationError> {
+        let options: Vec<_> = jobs
+            .iter()
+            .map(|job| DxcCompileOptionsStrings::new(&job.options))
+            .collect();
+
+        let user_data = DxcIncludeHandlerUserData { include_handler };
+
+        let raw_jobs: Vec<_> = jobs
+            .iter()
+            .zip(options.iter())
+            .map(|(job, options)| sys::DxcShimCompileJob {
+                source: job.source.as_ptr() as *const std::ffi::c_char,
+                source_size: job.source.len(),
+                options: *options.raw(),
+                user_data: &user_data as *const _ as *mut std::ffi::c_void,
+            })
+            .collect();
+
+        let status = unsafe {
+            sys::dxc_compile_batch_streaming(
+                self.inner,
+                raw_jobs.as_ptr(),
+                raw_jobs.len(),
+                thread_count,
+                memory_budget,
+                include_handler_callback(),
+                Some(dxc_batch_result_trampoline),
+                &on_result as *const _ as *mut std::ffi::c_void,
+            )
+        };
+
+        compiler_creation_result(status)
+    }
+}
+
+unsafe extern "C" fn dxc_batch_result_trampoline(
+    user_data: *mut std::ffi::c_void,
+    job_index: usize,
+    result: *mut sys::DxcShimCompilationResult,
+) {
+    let on_result = unsafe {
+        &*(user_data as *const &(dyn Fn(usize, Result<&DxcBytecode, DxcCompilationError>) + Sync))
+    };
+    let result = NonNull::new(result).expect("the shim returned a null result");
+
+    // SAFETY: The shim keeps the result alive until the callback returns.
+    match unsafe { borrow_result(result) } {
+        Ok(bytecode) => on_result(job_index, Ok(&bytecode)),
+        Err(error) => on_result(job_index, Err(error)),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::{
+        sync::{
+            Arc,
+            atomic::{AtomicU64, Ordering},
+        },
+        time::Duration,
+    };
+
+    use super::*;
+
+    struct MemoryBudget(*mut sys::DxcShimMemoryBudget);
+
+    // SAFETY: The shim memory budget is synchronized.
+    unsafe impl Send for MemoryBudget {}
+    unsafe impl Sync for MemoryBudget {}
+
+    impl MemoryBudget {
+        fn new(budget: u64) -> Arc<Self> {
+            let mut memory_budget = std::ptr::null_mut();
+            unsafe { sys::dxc_memory_budget_create(budget, &mut memory_budget) };
+            Arc::new(Self(memory_budget))
+        }
+
+        fn acquire(&self, size: u64) {
+            unsafe { sys::dxc_memory_budget_acquire(self.0, size) };
+        }
+
+        fn release(&self, size: u64) {
+            unsafe { sys::dxc_memory_budget_release(self.0, size) };
+        }
+
+        fn max_in_flight(&self, sizes: &[u64]) -> usize {
+            unsafe { sys::dxc_memory_budget_get_max_in_flight(self.0, sizes.as_ptr(), sizes.len()) }
+        }
+    }
+
+    impl Drop for MemoryBudget {
+        fn drop(&mut self) {
+            unsafe { sys::dxc_memory_budget_destroy(self.0) };
+        }
+    }
+
+    #[test]
+    fn test_budget_admits_oversized_jobs_when_idle() {
+        let budget = MemoryBudget::new(100);
+        budget.acquire(500);
+
+        // Nothing else runs next to the oversized job.
+        let waiter = std::thread::spawn({
+            let budget = budget.clone();
+            move || {
+                budget.acquire(10);
+                budget.release(10);
+            }
+        });
+        std::thread::sleep(Duration::from_millis(50));
+        assert!(!waiter.is_finished());
+        budget.release(500);
+        waiter.join().unwrap();
+
+        // Nor is an oversized job started next to others.
+        budget.acquire(10);
+        let waiter = std::thread::spawn({
+            let budget = budget.clone();
+            move || {
+                budget.acquire(500);
+                budget.release(500);
+            }
+        });
+        std::thread::sleep(Duration::from_millis(50));
+        assert!(!waiter.is_finished());
+        budget.release(10);
+        waiter.join().unwrap();
+    }
+
+    #[test]
+    fn test_budget_is_never_exceeded() {
+        const BUDGET: u64 = 100;
+        let budget = MemoryBudget::new(BUDGET);
+        let used = Arc::new(AtomicU64::new(0));
+        let max_used = Arc::new(AtomicU64::new(0));
+
+        let threads: Vec<_> = (0..8u64)
+            .map(|thread_index| {
+                let budget = budget.clone();
+                let used = used.clone();
+                let max_used = max_used.clone();
+                std::thread::spawn(move || {
+                    for i in 0..200u64 {
+                        let size = 10 + (thread_index * 7 + i * 13) % 50;
+                        budget.acquire(size);
+                        let in_flight = used.fetch_add(size, Ordering::SeqCst) + size;
+                        max_used.fetch_max(in_flight, Ordering::SeqCst);
+                        std::thread::yield_now();
+                        used.fetch_sub(size, Ordering::SeqCst);
+                        budget.release(size);
+                    }
+                })
+            })
+            .collect();
+        for thread in threads {
+            thread.join().unwrap();
+        }
+
+        assert!(max_used.load(Ordering::SeqCst) <= BUDGET);
+        assert_eq!(used.load(Ordering::SeqCst), 0);
+    }
+
+    #[test]
+    fn test_zero_budget_is_unlimited() {
+        let budget = MemoryBudget::new(0);
+        for _ in 0..100 {
+            budget.acquire(u64::MAX / 2);
+        }
+        for _ in 0..100 {
+            budget.release(u64::MAX / 2);
+        }
+        assert_eq!(budget.max_in_flight(&[u64::MAX; 16]), 16);
+    }
+
+    #[test]
+    fn test_budget_max_in_flight() {
+        let budget = MemoryBudget::new(60);
+
+        // The smallest jobs are the most that can run at once.
+        assert_eq!(budget.max_in_flight(&[50, 10, 30, 20]), 3);
+        assert_eq!(budget.max_in_flight(&[20, 20, 20, 20]), 3);
+        assert_eq!(budget.max_in_flight(&[10, 10]), 2);
+
+        // An oversized job still runs, alone.
+        assert_eq!(budget.max_in_flight(&[100, 200]), 1);
+        assert_eq!(budget.max_in_flight(&[u64::MAX, u64::MAX]), 1);
+        assert_eq!(budget.max_in_flight(&[]), 1);
+    }
+}
@@ -0,0 +1,179 @@
+use std::{ffi::CString, mem::MaybeUninit, path::Path, sync::Arc};
+
+use crate::sys;
+
+#[derive(thiserror::Error, Debug)]
+pub enum DxcCacheError {
+    #[error("invalid cache directory path")]
+    InvalidPath,
+    #[error("failed to open cache directory")]
+    OpenError,
+}
+
+/// A persistent, content-addressed cache of compiled bytecode.
+///
+/// Entries are keyed by the preprocessed source, the resolved includes, the compile arguments
+/// and the DXC version, and stored as files under the cache directory. Cache hits are memory
+/// mapped, so the bytecode is never copied. The directory may be shared between processes.
+///
+/// Looking up an entry preprocesses the source, so it needs a compiler, and with it the DXC
+/// library, even when every shader is a hit. A [`crate::DxcArchive`] needs neither.
+pub struct DxcCache {
+    pub(crate) inner: *mut sys::DxcShimCache,
+}
+
+// SAFETY: The shim cache holds no mutable state besides the directory it writes to.
+unsafe impl Send for DxcCache {}
+unsafe impl Sync for DxcCache {}
+
+impl DxcCache {
+    /// Opens the cache at the given directory, creating it if needed.
+    pub fn open(directory: impl AsRef<Path>) -> Result<Arc<Self>, DxcCacheError> {
+        let directory = directory
+            .as_ref()
+            .to_str()
+            .ok_or(DxcCacheError::InvalidPath)?;
+        let directory = CString::new(directory).map_err(|_| DxcCacheError::InvalidPath)?;
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCache>::uninit();
+        let status = unsafe { sys::dxc_cache_open(directory.as_ptr(), inner.as_mut_ptr()) };
+
+        match status {
+            sys::DxcShimStatus::Ok => {
+                let inner = unsafe { inner.assume_init() };
+                Ok(Arc::new(Self { inner }))
+            }
+            sys::DxcShimStatus::CacheOpenError => Err(DxcCacheError::OpenError),
+            _ => unreachable!(),
+        }
+    }
+}
+
+impl Drop for DxcCache {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_cache_close(self.inner) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::path::PathBuf;
+
+    use super::*;
+
+    /// Returns an empty directory for a test.
+    fn test_directory(name: &str) -> PathBuf {
+        let directory = std::env::temp_dir().join(format!(
+            "vislum-dxc-cache-test-{}-{name}",
+            std::process::id()
+        ));
+        let _ = std::fs::remove_dir_all(&directory);
+        directory
+    }
+
+    fn store(cache: &DxcCache, key: sys::DxcShimHash, data: &[u8]) {
+        unsafe {
+            sys::dxc_cache_store(
+                cache.inner,
+                &key,
+                data.as_ptr() as *const std::ffi::c_void,
+                data.len(),
+            )
+        };
+    }
+
+    fn load(cache: &DxcCache, key: sys::DxcShimHash) -> Option<Vec<u8>> {
+        let mut size = 0;
+        if !unsafe { sys::dxc_cache_load(cache.inner, &key, std::ptr::null_mut(), 0, &mut size) } {
+            return None;
+        }
+
+        let mut data = vec![0u8; size];
+        let is_hit = unsafe {
+            sys::dxc_cache_load(
+                cache.inner,
+                &key,
+                data.as_mut_ptr() as *mut std::ffi::c_void,
+                size,
+                &mut size,
+            )
+        };
+        is_hit.then_some(data)
+    }
+
+    fn key(high: u64, low: u64) -> sys::DxcShimHash {
+        sys::DxcShimHash { high, low }
+    }
+
+    #[test]
+    fn test_store_and_load() {
+        let directory = test_directory("round-trip");
+        let cache = DxcCache::open(&directory).unwrap();
+        store(&cache, key(1, 2), b"first");
+        store(&cache, key(3, 4), b"second");
+        assert_eq!(load(&cache, key(1, 2)).unwrap(), b"first");
+        assert_eq!(load(&cache, key(3, 4)).unwrap(), b"second");
+
+        // Storing again replaces the entry.
+        store(&cache, key(1, 2), b"replaced");
+        assert_eq!(load(&cache, key(1, 2)).unwrap(), b"replaced");
+
+        // Other caches on the directory see the entries.
+        let other = DxcCache::open(&directory).unwrap();
+        assert_eq!(load(&other, key(3, 4)).unwrap(), b"second");
+        std::fs::remove_dir_all(directory).unwrap();
+    }
+
+    #[test]
+    fn test_sharded_layout() {
+        let directory = test_directory("layout");
+        let cache = DxcCache::open(directory.join("nested/cache/")).unwrap();
+        store(&cache, key(0xab01_2345_6789_cdef, 0x42), b"bytecode");
+
+        let entry = directory.join("nested/cache/ab/0123456789cdef0000000000000042");
+        assert_eq!(std::fs::read(entry).unwrap(), b"bytecode");
+        std::fs::remove_dir_all(directory).unwrap();
+    }
+
+    #[test]
+    fn test_missing_entries() {
+        let directory = test_directory("missing");
+        let cache = DxcCache::open(&directory).unwrap();
+        assert!(load(&cache, key(1, 2)).is_none());
+
+        // A key differing in one half only.
+        store(&cache, key(1, 2), b"bytecode");
+        assert!(load(&cache, key(1, 3)).is_none());
+        assert!(load(&cache, key(0, 2)).is_none());
+        std::fs::remove_dir_all(directory).unwrap();
+    }
+
+    #[test]
+    fn test_empty_entries_miss() {
+        let directory = test_directory("empty");
+        let cache = DxcCache::open(&directory).unwrap();
+        store(&cache, key(1, 2), b"");
+        assert!(load(&cache, key(1, 2)).is_none());
+        std::fs::remove_dir_all(directory).unwrap();
+    }
+
+    #[test]
+    fn test_open_errors() {
+        let directory = test_directory("errors");
+        std::fs::create_dir_all(&directory).unwrap();
+        std::fs::write(directory.join("file"), b"").unwrap();
+        assert!(matches!(
+            DxcCache::open(directory.join("file")),
+            Err(DxcCacheError::OpenError)
+        ));
+        assert!(matches!(
+            DxcCache::open(directory.join("file/cache")),
+            Err(DxcCacheError::OpenError)
+        ));
+        assert!(matches!(
+            DxcCache::open("a\0b"),
+            Err(DxcCacheError::InvalidPath)
+        ));
+        std::fs::remove_dir_all(directory).unwrap();
+    }
+}
@@ -0,0 +1,43 @@
+use std::{mem::MaybeUninit, sync::Arc};
+
+use crate::sys;
+
+/// Cancels the compilations it is passed to through
+/// [`DxcCompileOptions::cancellation_token`](crate::DxcCompileOptions::cancellation_token).
+///
+/// The shim checks the token between the phases of a compilation and before every include, as
+/// DXC itself cannot be interrupted. Cancelled compilations report
+/// [`DxcCompilationError::Cancelled`](crate::DxcCompilationError::Cancelled).
+#[derive(Debug)]
+pub struct DxcCancellationToken {
+    pub(crate) inner: *mut sys::DxcShimCancellationToken,
+}
+
+// SAFETY: The shim token is a single atomic flag.
+unsafe impl Send for DxcCancellationToken {}
+unsafe impl Sync for DxcCancellationToken {}
+
+impl DxcCancellationToken {
+    pub fn new() -> Arc<Self> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCancellationToken>::uninit();
+        unsafe { sys::dxc_cancellation_token_create(inner.as_mut_ptr()) };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self { inner })
+    }
+
+    /// Cancels all compilations using this token.
+    pub fn cancel(&self) {
+        unsafe { sys::dxc_cancellation_token_cancel(self.inner) };
+    }
+
+    pub fn is_cancelled(&self) -> bool {
+        unsafe { sys::dxc_cancellation_token_is_cancelled(self.inner) }
+    }
+}
+
+impl Drop for DxcCancellationToken {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_cancellation_token_destroy(self.inner) };
+    }
+}
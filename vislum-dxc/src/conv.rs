@@ -0,0 +1,160 @@
+//! Tests of the conversions between UTF-8 and the wide strings of DXC, which the shim does for
+//! arguments, filenames and messages. Both UTF-16 and UTF-32 are tested, whatever the size of
+//! `wchar_t`.
+
+use crate::sys;
+
+const REPLACEMENT: u32 = 0xfffd;
+
+fn utf8_to_utf16(s: &[u8]) -> Vec<u16> {
+    let input = s.as_ptr() as *const std::ffi::c_char;
+    let size = unsafe { sys::dxc_conv_utf8_to_utf16(input, s.len(), std::ptr::null_mut(), 0) };
+    let mut out = vec![0u16; size];
+    unsafe { sys::dxc_conv_utf8_to_utf16(input, s.len(), out.as_mut_ptr(), size) };
+    out
+}
+
+fn utf8_to_utf32(s: &[u8]) -> Vec<u32> {
+    let input = s.as_ptr() as *const std::ffi::c_char;
+    let size = unsafe { sys::dxc_conv_utf8_to_utf32(input, s.len(), std::ptr::null_mut(), 0) };
+    let mut out = vec![0u32; size];
+    unsafe { sys::dxc_conv_utf8_to_utf32(input, s.len(), out.as_mut_ptr(), size) };
+    out
+}
+
+fn utf16_to_utf8(s: &[u16]) -> Vec<u8> {
+    let size = unsafe { sys::dxc_conv_utf16_to_utf8(s.as_ptr(), s.len(), std::ptr::null_mut(), 0) };
+    let mut out = vec![0u8; size];
+    unsafe { sys::dxc_conv_utf16_to_utf8(s.as_ptr(), s.len(), out.as_mut_ptr() as *mut _, size) };
+    out
+}
+
+fn utf32_to_utf8(s: &[u32]) -> Vec<u8> {
+    let size = unsafe { sys::dxc_conv_utf32_to_utf8(s.as_ptr(), s.len(), std::ptr::null_mut(), 0) };
+    let mut out = vec![0u8; size];
+    unsafe { sys::dxc_conv_utf32_to_utf8(s.as_ptr(), s.len(), out.as_mut_ptr() as *mut _, size) };
+    out
+}
+
+/// Checks that a valid string converts to both wide encodings and back.
+fn assert_round_trip(s: &str) {
+    let utf16: Vec<u16> = s.encode_utf16().collect();
+    let utf32: Vec<u32> = s.chars().map(u32::from).collect();
+    assert_eq!(utf8_to_utf16(s.as_bytes()), utf16, "{s:?}");
+    assert_eq!(utf8_to_utf32(s.as_bytes()), utf32, "{s:?}");
+    assert_eq!(utf16_to_utf8(&utf16), s.as_bytes(), "{s:?}");
+    assert_eq!(utf32_to_utf8(&utf32), s.as_bytes(), "{s:?}");
+}
+
+/// Checks the code points invalid UTF-8 decodes to.
+fn assert_utf8_decodes(s: &[u8], code_points: &[u32]) {
+    assert_eq!(utf8_to_utf32(s), code_points, "{s:x?}");
+
+    let utf16: Vec<u16> = code_points
+        .iter()
+        .map(|&code_point| code_point as u16)
+        .collect();
+    assert_eq!(utf8_to_utf16(s), utf16, "{s:x?}");
+}
+
+#[test]
+fn test_ascii_runs() {
+    // Every length around the eight-byte and four-unit steps, with and without a non-ASCII
+    // character at every position.
+    let ascii: String = ('a'..='z').cycle().take(40).collect();
+    for length in 0..=ascii.len() {
+        let prefix = &ascii[..length];
+        assert_round_trip(prefix);
+        for position in 0..=length {
+            for character in ['\u{7f}', 'é', '€', '😀'] {
+                let mut s = prefix.to_owned();
+                s.insert(position, character);
+                assert_round_trip(&s);
+            }
+        }
+    }
+}
+
+#[test]
+fn test_multi_byte_sequences() {
+    for code_point in [
+        0x80, 0x7ff, 0x800, 0xd7ff, 0xe000, 0xfffd, 0xffff, 0x10000, 0x1f600, 0x10ffff,
+    ] {
+        let character = char::from_u32(code_point).unwrap();
+        assert_eq!(character.len_utf8(), utf32_to_utf8(&[code_point]).len());
+        assert_round_trip(&character.to_string());
+    }
+    assert_round_trip("é€😀 mixed 日本語 text 🎨");
+
+    // Characters past the basic plane are surrogate pairs in UTF-16.
+    assert_eq!(utf8_to_utf16("😀".as_bytes()), [0xd83d, 0xde00]);
+    assert_eq!(utf8_to_utf16("\u{10ffff}".as_bytes()), [0xdbff, 0xdfff]);
+    assert_eq!(utf16_to_utf8(&[0xd800, 0xdc00]), "\u{10000}".as_bytes());
+}
+
+#[test]
+fn test_invalid_utf8() {
+    // Bytes that cannot start a sequence.
+    assert_utf8_decodes(b"\x80", &[REPLACEMENT]);
+    assert_utf8_decodes(b"a\xbfb", &[0x61, REPLACEMENT, 0x62]);
+    assert_utf8_decodes(b"\xff\xfe", &[REPLACEMENT, REPLACEMENT]);
+    assert_utf8_decodes(b"\xf8\x88\x80", &[REPLACEMENT, REPLACEMENT, REPLACEMENT]);
+
+    // Overlong encodings, which decode to a single replacement.
+    assert_utf8_decodes(b"\xc0\x80", &[REPLACEMENT]);
+    assert_utf8_decodes(b"\xc1\xbf", &[REPLACEMENT]);
+    assert_utf8_decodes(b"\xe0\x80\xaf", &[REPLACEMENT]);
+    assert_utf8_decodes(b"\xf0\x80\x80\xaf", &[REPLACEMENT]);
+
+    // Encoded surrogates and code points past U+10FFFF.
+    assert_utf8_decodes(b"\xed\xa0\x80", &[REPLACEMENT]);
+    assert_utf8_decodes(b"\xed\xbf\xbf", &[REPLACEMENT]);
+    assert_utf8_decodes(b"\xf4\x90\x80\x80", &[REPLACEMENT]);
+    assert_utf8_decodes(b"\xf7\xbf\xbf\xbf", &[REPLACEMENT]);
+}
+
+#[test]
+fn test_truncated_utf8() {
+    assert_utf8_decodes(b"\xc3", &[REPLACEMENT]);
+    assert_utf8_decodes(b"a\xe2\x82", &[0x61, REPLACEMENT]);
+    assert_utf8_decodes(b"\xf0\x9f\x98", &[REPLACEMENT]);
+
+    // A sequence cut short by another character keeps that character.
+    assert_utf8_decodes(b"\xe2\x82a", &[REPLACEMENT, 0x61]);
+    assert_utf8_decodes(b"\xf0\x9f\xc3\xa9", &[REPLACEMENT, 0xe9]);
+
+    // A truncated sequence in the middle of an ASCII run.
+    let mut s = b"abcdefghijkl".to_vec();
+    s.insert(9, 0xe2);
+    let mut expected: Vec<u32> = b"abcdefghi".iter().map(|&byte| byte.into()).collect();
+    expected.push(REPLACEMENT);
+    expected.extend(b"jkl".iter().map(|&byte| u32::from(byte)));
+    assert_utf8_decodes(&s, &expected);
+}
+
+#[test]
+fn test_lone_surrogates() {
+    let replacement = "\u{fffd}".as_bytes();
+    assert_eq!(utf16_to_utf8(&[0xd800]), replacement);
+    assert_eq!(utf16_to_utf8(&[0xdfff]), replacement);
+    assert_eq!(
+        utf16_to_utf8(&[0xdc00, 0xd800]),
+        [replacement, replacement].concat()
+    );
+
+    // The unit after an unpaired high surrogate is kept.
+    assert_eq!(utf16_to_utf8(&[0xd800, 0x61]), [replacement, b"a"].concat());
+    assert_eq!(
+        utf16_to_utf8(&[0xd800, 0xd83d, 0xde00]),
+        [replacement, "😀".as_bytes()].concat()
+    );
+    assert_eq!(
+        utf16_to_utf8(&[0x61, 0x62, 0x63, 0xdc00, 0x64]),
+        [b"abc", replacement, b"d"].concat()
+    );
+
+    assert_eq!(utf32_to_utf8(&[0xd800]), replacement);
+    assert_eq!(utf32_to_utf8(&[0xdfff, 0x61]), [replacement, b"a"].concat());
+    assert_eq!(utf32_to_utf8(&[0x110000]), replacement);
+    assert_eq!(utf32_to_utf8(&[u32::MAX]), replacement);
+}
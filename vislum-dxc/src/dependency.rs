@@ -0,0 +1,292 @@
+use std::{ffi::CString, mem::MaybeUninit, sync::Arc};
+
+use crate::{DxcBytecode, sys};
+
+/// An include resolved by a compilation.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct DxcResolvedInclude {
+    /// The normalized filename. Backslashes are replaced by forward slashes, and `.` and `..`
+    /// components are resolved.
+    pub filename: String,
+
+    /// The hash of the contents of the include, as by [`hash_include_contents`].
+    pub hash: u128,
+}
+
+impl From<sys::DxcShimHash> for u128 {
+    fn from(hash: sys::DxcShimHash) -> Self {
+        ((hash.high as u128) << 64) | hash.low as u128
+    }
+}
+
+impl From<u128> for sys::DxcShimHash {
+    fn from(hash: u128) -> Self {
+        Self {
+            high: (hash >> 64) as u64,
+            low: hash as u64,
+        }
+    }
+}
+
+/// Hashes the contents of an include the same way the includes of a compilation are hashed.
+pub fn hash_include_contents(contents: &[u8]) -> u128 {
+    let mut hash = MaybeUninit::<sys::DxcShimHash>::uninit();
+    unsafe {
+        sys::dxc_hash_include_contents(
+            contents.as_ptr() as *const std::ffi::c_void,
+            contents.len(),
+            hash.as_mut_ptr(),
+        )
+    };
+    unsafe { hash.assume_init() }.into()
+}
+
+/// Maps included files to the compilations that depend on them.
+///
+/// Compilations are identified by a caller-chosen name, such as the path of the shader asset,
+/// and recorded with the includes of their bytecode. When a file changes, the index returns
+/// the names of the compilations that resolved it, directly or through other includes, so only
+/// those need to be recompiled.
+pub struct DxcDependencyIndex {
+    inner: *mut sys::DxcShimDependencyIndex,
+}
+
+// SAFETY: The shim dependency index synchronizes all accesses internally.
+unsafe impl Send for DxcDependencyIndex {}
+unsafe impl Sync for DxcDependencyIndex {}
+
+impl DxcDependencyIndex {
+    pub fn new() -> Arc<Self> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimDependencyIndex>::uninit();
+        unsafe { sys::dxc_dependency_index_create(inner.as_mut_ptr()) };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self { inner })
+    }
+
+    /// Records the includes of a compilation, replacing those previously recorded for the name.
+    pub fn record(&self, name: &str, bytecode: &DxcBytecode) {
+        let name = CString::new(name).unwrap();
+        unsafe {
+            sys::dxc_dependency_index_record(self.inner, name.as_ptr(), bytecode.result.as_ptr())
+        };
+    }
+
+    /// Removes a compilation from the index, e.g. when its shader is deleted.
+    pub fn remove(&self, name: &str) {
+        let name = CString::new(name).unwrap();
+        unsafe { sys::dxc_dependency_index_remove(self.inner, name.as_ptr()) };
+    }
+
+    /// Returns the names of the compilations that depend on a file.
+    ///
+    /// If the new contents of the file are given, compilations that resolved it with the same
+    /// contents are skipped, so touching a file without changing it does not cause
+    /// recompilations.
+    pub fn dependents(&self, filename: &str, contents: Option<&[u8]>) -> Vec<String> {
+        let filename = CString::new(filename).unwrap();
+        let hash = contents.map(|contents| sys::DxcShimHash::from(hash_include_contents(contents)));
+
+        let mut dependents = Vec::new();
+        unsafe {
+            sys::dxc_dependency_index_find_dependents(
+                self.inner,
+                filename.as_ptr(),
+                hash.as_ref().map_or(std::ptr::null(), |hash| hash),
+                Some(dxc_dependent_callback),
+                &mut dependents as *mut Vec<String> as *mut std::ffi::c_void,
+            )
+        };
+        dependents
+    }
+}
+
+impl Drop for DxcDependencyIndex {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_dependency_index_destroy(self.inner) };
+    }
+}
+
+unsafe extern "C" fn dxc_dependent_callback(
+    name: *const std::ffi::c_char,
+    user_data: *mut std::ffi::c_void,
+) {
+    let dependents = unsafe { &mut *(user_data as *mut Vec<String>) };
+    let name = unsafe { std::ffi::CStr::from_ptr(name) };
+    dependents.push(name.to_string_lossy().into_owned());
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Records a compilation with the given normalized includes and their contents.
+    fn record(index: &DxcDependencyIndex, name: &str, includes: &[(&str, &[u8])]) {
+        let name = CString::new(name).unwrap();
+        let filenames: Vec<CString> = includes
+            .iter()
+            .map(|(filename, _)| CString::new(*filename).unwrap())
+            .collect();
+        let filename_pointers: Vec<*const std::ffi::c_char> =
+            filenames.iter().map(|filename| filename.as_ptr()).collect();
+        let hashes: Vec<sys::DxcShimHash> = includes
+            .iter()
+            .map(|(_, contents)| hash_include_contents(contents).into())
+            .collect();
+
+        unsafe {
+            sys::dxc_dependency_index_record_includes(
+                index.inner,
+                name.as_ptr(),
+                filename_pointers.as_ptr(),
+                hashes.as_ptr(),
+                includes.len(),
+            )
+        };
+    }
+
+    fn sorted_dependents(
+        index: &DxcDependencyIndex,
+        filename: &str,
+        contents: Option<&[u8]>,
+    ) -> Vec<String> {
+        let mut dependents = index.dependents(filename, contents);
+        dependents.sort();
+        dependents
+    }
+
+    #[test]
+    fn test_record_and_find_dependents() {
+        let index = DxcDependencyIndex::new();
+        record(
+            &index,
+            "a.hlsl",
+            &[
+                ("shaders/common.hlsl", b"common"),
+                ("shaders/lights.hlsl", b"lights"),
+            ],
+        );
+        record(&index, "b.hlsl", &[("shaders/common.hlsl", b"common")]);
+
+        assert_eq!(
+            sorted_dependents(&index, "shaders/common.hlsl", None),
+            ["a.hlsl", "b.hlsl"]
+        );
+        assert_eq!(
+            sorted_dependents(&index, "shaders/lights.hlsl", None),
+            ["a.hlsl"]
+        );
+        assert!(index.dependents("shaders/other.hlsl", None).is_empty());
+        assert!(index.dependents("a.hlsl", None).is_empty());
+
+        // Filenames are normalized like the includes of compilations.
+        assert_eq!(
+            sorted_dependents(&index, "shaders\\lights.hlsl", None),
+            ["a.hlsl"]
+        );
+        assert_eq!(
+            sorted_dependents(&index, "shaders/./lights.hlsl", None),
+            ["a.hlsl"]
+        );
+        assert_eq!(
+            sorted_dependents(&index, "other/../shaders//lights.hlsl", None),
+            ["a.hlsl"]
+        );
+    }
+
+    #[test]
+    fn test_dependents_of_changed_contents() {
+        let index = DxcDependencyIndex::new();
+        record(&index, "a.hlsl", &[("common.hlsl", b"old")]);
+        record(&index, "b.hlsl", &[("common.hlsl", b"new")]);
+        record(&index, "c.hlsl", &[("common.hlsl", b"new")]);
+
+        // Only the compilations that resolved other contents are stale.
+        assert_eq!(
+            sorted_dependents(&index, "common.hlsl", Some(b"new")),
+            ["a.hlsl"]
+        );
+        assert_eq!(
+            sorted_dependents(&index, "common.hlsl", Some(b"old")),
+            ["b.hlsl", "c.hlsl"]
+        );
+        assert_eq!(
+            sorted_dependents(&index, "common.hlsl", Some(b"newer")),
+            ["a.hlsl", "b.hlsl", "c.hlsl"]
+        );
+        assert!(index.dependents("other.hlsl", Some(b"new")).is_empty());
+    }
+
+    #[test]
+    fn test_record_replaces_includes() {
+        let index = DxcDependencyIndex::new();
+        record(
+            &index,
+            "a.hlsl",
+            &[("common.hlsl", b"common"), ("lights.hlsl", b"lights")],
+        );
+        record(&index, "b.hlsl", &[("common.hlsl", b"common")]);
+        record(
+            &index,
+            "a.hlsl",
+            &[("common.hlsl", b"edited"), ("shadows.hlsl", b"shadows")],
+        );
+
+        assert!(index.dependents("lights.hlsl", None).is_empty());
+        assert_eq!(sorted_dependents(&index, "shadows.hlsl", None), ["a.hlsl"]);
+        assert_eq!(
+            sorted_dependents(&index, "common.hlsl", None),
+            ["a.hlsl", "b.hlsl"]
+        );
+
+        // The hashes are replaced along with the includes.
+        assert_eq!(
+            sorted_dependents(&index, "common.hlsl", Some(b"edited")),
+            ["b.hlsl"]
+        );
+
+        // A compilation without includes depends on nothing.
+        record(&index, "a.hlsl", &[]);
+        assert!(index.dependents("shadows.hlsl", None).is_empty());
+        assert_eq!(sorted_dependents(&index, "common.hlsl", None), ["b.hlsl"]);
+    }
+
+    #[test]
+    fn test_remove() {
+        let index = DxcDependencyIndex::new();
+        record(
+            &index,
+            "a.hlsl",
+            &[("common.hlsl", b"common"), ("lights.hlsl", b"lights")],
+        );
+        record(&index, "b.hlsl", &[("common.hlsl", b"common")]);
+
+        index.remove("a.hlsl");
+        assert_eq!(sorted_dependents(&index, "common.hlsl", None), ["b.hlsl"]);
+        assert!(index.dependents("lights.hlsl", None).is_empty());
+
+        // Removing unknown or removed compilations does nothing.
+        index.remove("a.hlsl");
+        index.remove("c.hlsl");
+        assert_eq!(sorted_dependents(&index, "common.hlsl", None), ["b.hlsl"]);
+
+        index.remove("b.hlsl");
+        assert!(index.dependents("common.hlsl", None).is_empty());
+
+        record(&index, "a.hlsl", &[("lights.hlsl", b"lights")]);
+        assert_eq!(sorted_dependents(&index, "lights.hlsl", None), ["a.hlsl"]);
+    }
+
+    #[test]
+    fn test_hash_include_contents() {
+        assert_eq!(
+            hash_include_contents(b"common"),
+            hash_include_contents(b"common")
+        );
+        assert_ne!(
+            hash_include_contents(b"common"),
+            hash_include_contents(b"commoN")
+        );
+        assert_ne!(hash_include_contents(b""), hash_include_contents(b"\0"));
+    }
+}
@@ -0,0 +1,246 @@
+use std::mem::MaybeUninit;
+
+use crate::sys;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcDiagnosticSeverity {
+    Error,
+    Warning,
+    /// Additional information attached to the preceding error or warning.
+    Note,
+    Remark,
+}
+
+impl From<sys::DxcShimDiagnosticSeverity> for DxcDiagnosticSeverity {
+    fn from(severity: sys::DxcShimDiagnosticSeverity) -> Self {
+        match severity {
+            sys::DxcShimDiagnosticSeverity::Error => DxcDiagnosticSeverity::Error,
+            sys::DxcShimDiagnosticSeverity::Warning => DxcDiagnosticSeverity::Warning,
+            sys::DxcShimDiagnosticSeverity::Note => DxcDiagnosticSeverity::Note,
+            sys::DxcShimDiagnosticSeverity::Remark => DxcDiagnosticSeverity::Remark,
+        }
+    }
+}
+
+/// A single message reported by DXC, such as an error or a warning.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct DxcDiagnostic {
+    pub severity: DxcDiagnosticSeverity,
+
+    /// The file the diagnostic refers to, as passed to the include handler. `None` if it has
+    /// no location, like command line errors.
+    pub file: Option<String>,
+
+    /// The 1-based line. Zero if unknown.
+    pub line: u32,
+
+    /// The 1-based column. Zero if unknown.
+    pub column: u32,
+
+    pub message: String,
+}
+
+impl DxcDiagnostic {
+    /// Copies a shim diagnostic.
+    ///
+    /// # Safety
+    ///
+    /// The strings of `diagnostic` must be valid.
+    unsafe fn from_raw(diagnostic: &sys::DxcShimDiagnostic) -> Self {
+        let file = unsafe { string_from_raw(diagnostic.file, diagnostic.file_size) };
+        Self {
+            severity: diagnostic.severity.into(),
+            file: (!file.is_empty()).then_some(file),
+            line: diagnostic.line,
+            column: diagnostic.column,
+            message: unsafe { string_from_raw(diagnostic.message, diagnostic.message_size) },
+        }
+    }
+}
+
+/// Reads the diagnostics of a shim result.
+///
+/// # Safety
+///
+/// `result` must be a valid shim result.
+pub(crate) unsafe fn read_diagnostics(
+    result: *mut sys::DxcShimCompilationResult,
+) -> Vec<DxcDiagnostic> {
+    let count = unsafe { sys::dxc_compilation_result_get_diagnostic_count(result) };
+
+    (0..count)
+        .map(|index| {
+            let mut diagnostic = MaybeUninit::<sys::DxcShimDiagnostic>::uninit();
+            unsafe {
+                sys::dxc_compilation_result_get_diagnostic(result, index, diagnostic.as_mut_ptr())
+            };
+            unsafe { DxcDiagnostic::from_raw(&diagnostic.assume_init()) }
+        })
+        .collect()
+}
+
+/// Copies a string that is not NUL-terminated out of the shim.
+unsafe fn string_from_raw(ptr: *const std::ffi::c_char, size: usize) -> String {
+    if size == 0 {
+        return String::new();
+    }
+
+    let bytes = unsafe { std::slice::from_raw_parts(ptr as *const u8, size) };
+    String::from_utf8_lossy(bytes).into_owned()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Parses messages in the format DXC reports them in.
+    fn parse(messages: &str) -> Vec<DxcDiagnostic> {
+        // A diagnostic takes a line of its own.
+        let capacity = messages.bytes().filter(|&byte| byte == b'\n').count() + 1;
+        let mut diagnostics = Vec::<sys::DxcShimDiagnostic>::with_capacity(capacity);
+
+        let count = unsafe {
+            sys::dxc_parse_diagnostics(
+                messages.as_ptr() as *const std::ffi::c_char,
+                messages.len(),
+                diagnostics.as_mut_ptr(),
+                capacity,
+            )
+        };
+
+        // SAFETY: The shim wrote `count` diagnostics, pointing into the messages.
+        unsafe { diagnostics.set_len(count.min(capacity)) };
+        diagnostics
+            .iter()
+            .map(|diagnostic| unsafe { DxcDiagnostic::from_raw(diagnostic) })
+            .collect()
+    }
+
+    fn diagnostic(
+        severity: DxcDiagnosticSeverity,
+        file: Option<&str>,
+        line: u32,
+        column: u32,
+        message: &str,
+    ) -> DxcDiagnostic {
+        DxcDiagnostic {
+            severity,
+            file: file.map(str::to_string),
+            line,
+            column,
+            message: message.to_string(),
+        }
+    }
+
+    #[test]
+    fn test_parse_located_diagnostics() {
+        let messages = "\
+shader.hlsl:12:5: error: use of undeclared identifier 'x'
+    x = 1;
+    ^
+include/common.hlsli:3:1: warning: macro redefined
+shader.hlsl:7:10: note: previous definition is here
+";
+
+        assert_eq!(
+            parse(messages),
+            [
+                diagnostic(
+                    DxcDiagnosticSeverity::Error,
+                    Some("shader.hlsl"),
+                    12,
+                    5,
+                    "use of undeclared identifier 'x'",
+                ),
+                diagnostic(
+                    DxcDiagnosticSeverity::Warning,
+                    Some("include/common.hlsli"),
+                    3,
+                    1,
+                    "macro redefined",
+                ),
+                diagnostic(
+                    DxcDiagnosticSeverity::Note,
+                    Some("shader.hlsl"),
+                    7,
+                    10,
+                    "previous definition is here",
+                ),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_parse_unlocated_diagnostics() {
+        let messages = "fatal error: unknown argument '-Zq'\nremark: cached\n";
+        assert_eq!(
+            parse(messages),
+            [
+                diagnostic(
+                    DxcDiagnosticSeverity::Error,
+                    None,
+                    0,
+                    0,
+                    "unknown argument '-Zq'",
+                ),
+                diagnostic(DxcDiagnosticSeverity::Remark, None, 0, 0, "cached"),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_parse_filenames_with_colons() {
+        let messages = "C:\\shaders\\a:b.hlsl:4: warning: no column\r\nshader.hlsl:x:5: error: e\n";
+        assert_eq!(
+            parse(messages),
+            [
+                diagnostic(
+                    DxcDiagnosticSeverity::Warning,
+                    Some("C:\\shaders\\a:b.hlsl"),
+                    4,
+                    0,
+                    "no column",
+                ),
+                // The filename ends at the first colon followed by a location.
+                diagnostic(
+                    DxcDiagnosticSeverity::Error,
+                    Some("shader.hlsl:x"),
+                    5,
+                    0,
+                    "e",
+                ),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_parse_skips_other_lines() {
+        assert!(parse("").is_empty());
+        assert!(parse("\n\n").is_empty());
+
+        // Lines that only look like diagnostics.
+        let messages = "\
+shader.hlsl:12:5 error: missing colon
+shader.hlsl:12:5: info: unknown severity
+shader.hlsl:12:5:error: missing space
+error:missing space
+";
+        assert!(parse(messages).is_empty());
+    }
+
+    #[test]
+    fn test_parse_truncated_diagnostics() {
+        // Output cut off within a location, or right after a severity.
+        assert!(parse("shader.hlsl:12:").is_empty());
+        assert_eq!(
+            parse("shader.hlsl:12:5: error: "),
+            [diagnostic(
+                DxcDiagnosticSeverity::Error,
+                Some("shader.hlsl"),
+                12,
+                5,
+                "",
+            )]
+        );
+    }
+}
@@ -0,0 +1,112 @@
+use std::{ffi::CString, mem::MaybeUninit, sync::Arc};
+
+use crate::sys;
+
+/// An in-memory cache of include blobs, shared by any number of compilers.
+///
+/// Repeated includes are served from the blobs created the first time they were loaded,
+/// without calling the [`DxcIncludeHandler`](crate::DxcIncludeHandler) again. Entries are keyed
+/// by normalized filename and stay valid until invalidated, e.g. on hot reload.
+pub struct DxcIncludeCache {
+    pub(crate) inner: *mut sys::DxcShimIncludeCache,
+}
+
+// SAFETY: The shim include cache synchronizes all accesses internally.
+unsafe impl Send for DxcIncludeCache {}
+unsafe impl Sync for DxcIncludeCache {}
+
+impl DxcIncludeCache {
+    pub fn new() -> Arc<Self> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimIncludeCache>::uninit();
+        unsafe { sys::dxc_include_cache_create(inner.as_mut_ptr()) };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self { inner })
+    }
+
+    /// Removes the cached include of the given file, so it is loaded again on its next use.
+    pub fn invalidate(&self, filename: &str) {
+        let filename = CString::new(filename).unwrap();
+        unsafe { sys::dxc_include_cache_invalidate(self.inner, filename.as_ptr()) };
+    }
+
+    /// Removes all cached includes.
+    pub fn clear(&self) {
+        unsafe { sys::dxc_include_cache_clear(self.inner) };
+    }
+}
+
+impl Drop for DxcIncludeCache {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_include_cache_destroy(self.inner) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Returns the filename an include is cached under.
+    fn normalize(filename: &str) -> String {
+        let mut normalized = vec![0u8; filename.len()];
+        let size = unsafe {
+            sys::dxc_include_cache_normalize(
+                filename.as_ptr() as *const std::ffi::c_char,
+                filename.len(),
+                normalized.as_mut_ptr() as *mut std::ffi::c_char,
+            )
+        };
+
+        // Only whole components are removed, so the rest is still valid UTF-8.
+        normalized.truncate(size);
+        String::from_utf8(normalized).unwrap()
+    }
+
+    #[test]
+    fn test_normalize_resolves_components() {
+        assert_eq!(normalize("b.hlsl"), "b.hlsl");
+        assert_eq!(normalize("./a/../b.hlsl"), "b.hlsl");
+        assert_eq!(normalize("a//b/./c.hlsl"), "a/b/c.hlsl");
+        assert_eq!(normalize("a/b/"), "a/b");
+        assert_eq!(normalize("a/b/../../c.hlsl"), "c.hlsl");
+        assert_eq!(normalize("a/.../b.hlsl"), "a/.../b.hlsl");
+    }
+
+    #[test]
+    fn test_normalize_backslashes() {
+        assert_eq!(
+            normalize(".\\shaders\\common.hlsli"),
+            "shaders/common.hlsli"
+        );
+        assert_eq!(normalize("\\shaders/a\\..\\b.hlsl"), "/shaders/b.hlsl");
+    }
+
+    #[test]
+    fn test_normalize_parent_components() {
+        // Relative paths keep the parents they cannot resolve.
+        assert_eq!(normalize("../a.hlsl"), "../a.hlsl");
+        assert_eq!(normalize("../../a/b.hlsl"), "../../a/b.hlsl");
+        assert_eq!(normalize("a/../../b.hlsl"), "../b.hlsl");
+
+        // Absolute paths have no parent above the root.
+        assert_eq!(normalize("/../a.hlsl"), "/a.hlsl");
+        assert_eq!(normalize("/a/../../b.hlsl"), "/b.hlsl");
+    }
+
+    #[test]
+    fn test_normalize_empty_paths() {
+        assert_eq!(normalize(""), "");
+        assert_eq!(normalize("."), "");
+        assert_eq!(normalize("a/.."), "");
+        assert_eq!(normalize("/"), "/");
+        assert_eq!(normalize("//./"), "/");
+    }
+
+    #[test]
+    fn test_normalize_non_ascii() {
+        assert_eq!(
+            normalize("sh\u{e4}ders/./\u{1f600}.hlsl"),
+            "sh\u{e4}ders/\u{1f600}.hlsl"
+        );
+    }
+}
@@ -1,10 +1,58 @@
 use std::{
+    borrow::Cow,
     ffi::{CStr, CString},
-    mem::MaybeUninit,
+    mem::{ManuallyDrop, MaybeUninit},
+    ops::Deref,
+    os::unix::ffi::OsStrExt,
+    path::PathBuf,
+    ptr::NonNull,
     sync::Arc,
 };
 
+mod archive;
+mod argument_set;
+mod async_compiler;
+mod batch;
+mod cache;
+mod cancellation;
+#[cfg(test)]
+mod conv;
+mod dependency;
+mod diagnostics;
+mod include_cache;
+mod options;
+mod permutation;
+mod pool;
+mod prelude;
+mod preprocess;
+mod reflection;
+mod remote_cache;
+#[cfg(test)]
+mod scheduler;
+mod server;
+mod stats;
 pub mod sys;
+mod trace;
+
+pub use archive::*;
+pub use argument_set::*;
+pub use async_compiler::*;
+pub use batch::*;
+pub use cache::*;
+pub use cancellation::*;
+pub use dependency::*;
+pub use diagnostics::*;
+pub use include_cache::*;
+pub use options::*;
+pub use permutation::*;
+pub use pool::*;
+pub use prelude::*;
+pub use preprocess::*;
+pub use reflection::*;
+pub use remote_cache::*;
+pub use server::*;
+pub use stats::*;
+pub use trace::*;
 
 #[derive(thiserror::Error, Debug)]
 pub enum DxcLoaderError {
@@ -14,10 +62,38 @@ pub enum DxcLoaderError {
     GetCreateInstance2SymbolError,
 }
 
+#[derive(Default)]
+pub struct DxcLoaderCreateInfo {
+    /// The path or soname of the DXC library. `None` uses `libdxcompiler.so`.
+    pub library_path: Option<PathBuf>,
+
+    /// Whether to open the library only when the first compiler is created. A process that
+    /// loads all its shaders from a [`DxcArchive`] then never loads DXC. Loading errors are then
+    /// returned by the compiler creation.
+    ///
+    /// A [`DxcCache`] does not avoid loading DXC, as its keys are computed from the preprocessed
+    /// source, which needs a compiler.
+    pub defer_open: bool,
+
+    /// Whether to resolve the symbols of the library when first called, instead of all of them
+    /// when it is opened.
+    pub lazy_binding: bool,
+}
+
+/// Loads the DXC library.
+///
+/// All loaders share one process-wide shim loader, so the library is opened at most once and
+/// closed when the last loader is dropped. The create info of the first loader applies until
+/// then.
 pub struct DxcLoader {
     inner: *mut sys::DxcShimLoader,
 }
 
+// SAFETY: The shim loader only holds the library handle and the resolved DxcCreateInstance2
+// entry point, which DXC allows to be called from any thread, and synchronizes opening them.
+unsafe impl Send for DxcLoader {}
+unsafe impl Sync for DxcLoader {}
+
 impl Drop for DxcLoader {
     fn drop(&mut self) {
         unsafe { sys::dxc_loader_close(self.inner) };
@@ -25,21 +101,53 @@ impl Drop for DxcLoader {
 }
 
 impl DxcLoader {
+    /// Opens a loader, loading `libdxcompiler.so` right away.
     pub fn new() -> Result<Arc<Self>, DxcLoaderError> {
+        Self::with_create_info(DxcLoaderCreateInfo::default())
+    }
+
+    pub fn with_create_info(create_info: DxcLoaderCreateInfo) -> Result<Arc<Self>, DxcLoaderError> {
+        // Paths with interior NULs cannot name a library.
+        let library_path = match &create_info.library_path {
+            Some(path) => Some(
+                CString::new(path.as_os_str().as_bytes())
+                    .map_err(|_| DxcLoaderError::OpenLibraryError)?,
+            ),
+            None => None,
+        };
+
+        let options = sys::DxcShimLoaderOptions {
+            library_path: library_path
+                .as_ref()
+                .map_or(std::ptr::null(), |path| path.as_ptr()),
+            defer_open: create_info.defer_open,
+            lazy_binding: create_info.lazy_binding,
+        };
+
         let mut inner = MaybeUninit::<*mut sys::DxcShimLoader>::uninit();
-        let status = unsafe { sys::dxc_loader_open(inner.as_mut_ptr()) };
-
-        match status {
-            sys::DxcShimStatus::Ok => {
-                let inner = unsafe { inner.assume_init() };
-                Ok(Arc::new(Self { inner }))
-            }
-            sys::DxcShimStatus::OpenLibraryError => Err(DxcLoaderError::OpenLibraryError),
-            sys::DxcShimStatus::GetCreateInstance2SymbolError => {
-                Err(DxcLoaderError::GetCreateInstance2SymbolError)
-            }
-            _ => unreachable!(),
+        let status = unsafe { sys::dxc_loader_open_with_options(&options, inner.as_mut_ptr()) };
+
+        loader_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        Ok(Arc::new(Self { inner }))
+    }
+
+    /// Returns whether the DXC library has been opened.
+    pub fn is_loaded(&self) -> bool {
+        unsafe { sys::dxc_loader_is_loaded(self.inner) }
+    }
+}
+
+/// Maps the status of loading the DXC library to a result.
+fn loader_result(status: sys::DxcShimStatus) -> Result<(), DxcLoaderError> {
+    match status {
+        sys::DxcShimStatus::Ok => Ok(()),
+        sys::DxcShimStatus::OpenLibraryError => Err(DxcLoaderError::OpenLibraryError),
+        sys::DxcShimStatus::GetCreateInstance2SymbolError => {
+            Err(DxcLoaderError::GetCreateInstance2SymbolError)
         }
+        _ => unreachable!(),
     }
 }
 
@@ -49,6 +157,11 @@ pub enum DxcCompilerCreationError {
     GetDxcCompilerInstanceError,
     #[error("failed to get DxcUtils instance")]
     GetDxcUtilsInstanceError,
+    #[error("failed to spawn a worker thread")]
+    SpawnThreadError,
+    /// The DXC library failed to load for a loader whose open was deferred.
+    #[error(transparent)]
+    LoaderError(#[from] DxcLoaderError),
 }
 
 impl Drop for DxcCompiler {
@@ -58,136 +171,631 @@ impl Drop for DxcCompiler {
 }
 
 pub trait DxcIncludeHandler {
-    fn load_source(&self, filename: &str) -> Option<String>;
+    fn load_source(&self, filename: &str) -> Option<DxcIncludeSource>;
 }
 
-/// A string interner for include handler strings.
+/// The contents of an include.
 ///
-/// This is used to prevent shared heap ownership between the C shim and the Rust code. The
-/// [`dxc_include_handler_trampoline`] function uses this to ensure that the string is not freed too early.
-struct DxcIncludeHandlerUserData<'a> {
-    /// The user-provided include handler.
-    include_handler: &'a dyn DxcIncludeHandler,
+/// The contents are handed to DXC without copying. The shim keeps them alive for as long as it
+/// needs them, which may be after the compilation has finished if includes are cached, and
+/// drops them on whichever thread releases them last.
+pub struct DxcIncludeSource(Box<dyn AsRef<[u8]> + Send + Sync>);
 
-    /// The strings that have been interned.
-    strings: Vec<CString>,
+impl DxcIncludeSource {
+    pub fn new(contents: impl AsRef<[u8]> + Send + Sync + 'static) -> Self {
+        Self(Box::new(contents))
+    }
+}
+
+impl From<String> for DxcIncludeSource {
+    fn from(contents: String) -> Self {
+        Self::new(contents)
+    }
+}
+
+impl From<&'static str> for DxcIncludeSource {
+    fn from(contents: &'static str) -> Self {
+        Self::new(contents)
+    }
+}
+
+impl From<Vec<u8>> for DxcIncludeSource {
+    fn from(contents: Vec<u8>) -> Self {
+        Self::new(contents)
+    }
+}
+
+impl From<Arc<[u8]>> for DxcIncludeSource {
+    fn from(contents: Arc<[u8]>) -> Self {
+        Self::new(contents)
+    }
+}
+
+/// The user data of the include callback, pointing to the user-provided include handler.
+pub(crate) struct DxcIncludeHandlerUserData<'a> {
+    /// The user-provided include handler.
+    pub(crate) include_handler: &'a dyn DxcIncludeHandler,
 }
 
 #[derive(thiserror::Error, Debug)]
-#[error("compilation failed: {0}")]
-pub struct DxcCompilationError(String);
+pub enum DxcCompilationError {
+    #[error("compilation failed: {message}")]
+    Failed {
+        message: String,
+        /// The diagnostics parsed from the message. There is at least one error.
+        diagnostics: Vec<DxcDiagnostic>,
+    },
+    /// The compilation was cancelled by its cancellation token or deadline.
+    #[error("compilation cancelled")]
+    Cancelled,
+}
+
+/// The bytecode produced by a successful compilation.
+///
+/// The bytes are borrowed directly from the DXC blob owned by the shim's compilation result,
+/// so no copy is made between DXC and the caller. The result is freed when this is dropped.
+pub struct DxcBytecode {
+    result: NonNull<sys::DxcShimCompilationResult>,
+    ptr: *const u8,
+    len: usize,
+}
+
+// SAFETY: The compilation result is immutable once produced and not tied to the compiler
+// that created it.
+unsafe impl Send for DxcBytecode {}
+unsafe impl Sync for DxcBytecode {}
+
+impl DxcBytecode {
+    /// Returns the bytecode as a byte slice.
+    pub fn as_bytes(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+
+        unsafe { std::slice::from_raw_parts(self.ptr, self.len) }
+    }
+
+    /// Returns the includes resolved by the compilation that produced this bytecode, each
+    /// once, in the order they were first loaded.
+    pub fn includes(&self) -> Vec<DxcResolvedInclude> {
+        let count = unsafe { sys::dxc_compilation_result_get_include_count(self.result.as_ptr()) };
+
+        (0..count)
+            .map(|index| {
+                let mut filename = MaybeUninit::<*const std::ffi::c_char>::uninit();
+                let mut hash = MaybeUninit::<sys::DxcShimHash>::uninit();
+                unsafe {
+                    sys::dxc_compilation_result_get_include(
+                        self.result.as_ptr(),
+                        index,
+                        filename.as_mut_ptr(),
+                        hash.as_mut_ptr(),
+                    )
+                };
+
+                let filename = unsafe { CStr::from_ptr(filename.assume_init()) };
+                DxcResolvedInclude {
+                    filename: filename.to_string_lossy().into_owned(),
+                    hash: unsafe { hash.assume_init() }.into(),
+                }
+            })
+            .collect()
+    }
+
+    /// Returns the bindings, push constants and inputs of the SPIR-V bytecode.
+    ///
+    /// The bytecode is reflected by the shim on the first call. Returns `None` if it is not
+    /// valid SPIR-V.
+    pub fn reflection(&self) -> Option<DxcReflection> {
+        let mut reflection = MaybeUninit::<*const sys::DxcShimReflection>::uninit();
+        let has_reflection = unsafe {
+            sys::dxc_compilation_result_get_reflection(
+                self.result.as_ptr(),
+                reflection.as_mut_ptr(),
+            )
+        };
+        if !has_reflection {
+            return None;
+        }
+
+        // SAFETY: The reflection is owned by the result, which outlives this call.
+        Some(unsafe { DxcReflection::from_raw(&*reflection.assume_init()) })
+    }
+
+    /// Returns the hash of the source after preprocessing, as by
+    /// [`DxcPreprocessedSource::hash`].
+    ///
+    /// Only compilations with a [`DxcCache`] preprocess their source, so this is `None` for
+    /// the others.
+    pub fn preprocessed_hash(&self) -> Option<u128> {
+        let mut hash = MaybeUninit::<sys::DxcShimHash>::uninit();
+        let has_hash = unsafe {
+            sys::dxc_compilation_result_get_preprocessed_hash(
+                self.result.as_ptr(),
+                hash.as_mut_ptr(),
+            )
+        };
+
+        has_hash.then(|| unsafe { hash.assume_init() }.into())
+    }
+
+    /// Returns the warnings and notes reported by the compilation that produced this bytecode.
+    ///
+    /// Only the bytecode is kept in a [`DxcCache`], so results served from it have none.
+    pub fn diagnostics(&self) -> Vec<DxcDiagnostic> {
+        unsafe { read_diagnostics(self.result.as_ptr()) }
+    }
+
+    /// Returns the raw messages DXC reported with this bytecode, such as warnings, without
+    /// copying them. Invalid UTF-8 is replaced, which is the only case that allocates.
+    pub fn messages(&self) -> Cow<'_, str> {
+        String::from_utf8_lossy(unsafe { read_messages(self.result) })
+    }
+
+    /// Returns the statistics of the compilation that produced this bytecode.
+    pub fn stats(&self) -> DxcCompilationStats {
+        let mut stats = MaybeUninit::<sys::DxcShimCompilationStats>::uninit();
+        unsafe { sys::dxc_compilation_result_get_stats(self.result.as_ptr(), stats.as_mut_ptr()) };
+        unsafe { stats.assume_init() }.into()
+    }
+}
+
+impl Deref for DxcBytecode {
+    type Target = [u8];
+
+    fn deref(&self) -> &Self::Target {
+        self.as_bytes()
+    }
+}
+
+impl AsRef<[u8]> for DxcBytecode {
+    fn as_ref(&self) -> &[u8] {
+        self.as_bytes()
+    }
+}
+
+impl Drop for DxcBytecode {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_compilation_result_free(self.result.as_ptr()) };
+    }
+}
+
+/// A compilation result that can be compiled into repeatedly, with
+/// [`DxcCompiler::compile_into`].
+///
+/// The shim keeps the allocations of the result across compilations. Only the bytecode of the
+/// last compilation is held, and it is released by the next one.
+pub struct DxcResultBuffer {
+    // Empty until the first successful compilation into the buffer.
+    bytecode: DxcBytecode,
+}
+
+impl DxcResultBuffer {
+    pub fn new() -> Self {
+        let result = unsafe { sys::dxc_compilation_result_create() };
+        Self {
+            bytecode: DxcBytecode {
+                result: NonNull::new(result).expect("the shim returned a null result"),
+                ptr: std::ptr::null(),
+                len: 0,
+            },
+        }
+    }
+
+    /// Releases the bytecode held by the buffer, keeping its allocations.
+    pub fn reset(&mut self) {
+        unsafe { sys::dxc_compilation_result_reset(self.bytecode.result.as_ptr()) };
+        self.bytecode.ptr = std::ptr::null();
+        self.bytecode.len = 0;
+    }
+}
+
+impl Default for DxcResultBuffer {
+    fn default() -> Self {
+        Self::new()
+    }
+}
 
 pub struct DxcCompiler {
     _loader: Arc<DxcLoader>,
+    cache: Option<Arc<DxcCache>>,
+    include_cache: Option<Arc<DxcIncludeCache>>,
+    prelude: Option<Arc<DxcPrelude>>,
+    compile_server: Option<Arc<DxcCompileServerClient>>,
+    remote_cache: Option<Arc<DxcRemoteCache>>,
     inner: *mut sys::DxcShimCompiler,
 }
 
-// SAFETY: DxcCompiler is thread-safe.
-// This is also a lie. Gotta fix this...
+// SAFETY: The compiler can be moved to another thread, but a single DXC compiler instance must
+// not be used by several threads at once, so it is not `Sync`. Use [`DxcCompilerPool`] to
+// compile from multiple threads.
 unsafe impl Send for DxcCompiler {}
-unsafe impl Sync for DxcCompiler {}
 
 impl DxcCompiler {
-    pub fn new(loader: Arc<DxcLoader>) -> Result<Arc<Self>, DxcCompilerCreationError> {
+    pub fn new(loader: Arc<DxcLoader>) -> Result<Self, DxcCompilerCreationError> {
         let mut inner = MaybeUninit::<*mut sys::DxcShimCompiler>::uninit();
         let status = unsafe { sys::dxc_create_compiler(loader.inner, inner.as_mut_ptr()) };
 
-        match status {
-            sys::DxcShimStatus::Ok => {
-                let inner = unsafe { inner.assume_init() };
-                Ok(Arc::new(Self {
-                    _loader: loader,
-                    inner,
-                }))
-            }
-            sys::DxcShimStatus::GetDxcCompilerInstanceError => {
-                Err(DxcCompilerCreationError::GetDxcCompilerInstanceError)
-            }
-            sys::DxcShimStatus::GetDxcUtilsInstanceError => {
-                Err(DxcCompilerCreationError::GetDxcUtilsInstanceError)
-            }
-            _ => unreachable!(),
-        }
+        compiler_creation_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        Ok(Self {
+            _loader: loader,
+            cache: None,
+            include_cache: None,
+            prelude: None,
+            compile_server: None,
+            remote_cache: None,
+            inner,
+        })
+    }
+
+    /// Sets the bytecode cache used by the compiler. `None` disables caching.
+    pub fn set_cache(&mut self, cache: Option<Arc<DxcCache>>) {
+        let raw_cache = cache
+            .as_ref()
+            .map_or(std::ptr::null_mut(), |cache| cache.inner);
+        unsafe { sys::dxc_compiler_set_cache(self.inner, raw_cache) };
+
+        // The previous cache is only dropped once the compiler no longer refers to it.
+        self.cache = cache;
+    }
+
+    /// Returns the bytecode cache used by the compiler.
+    pub fn cache(&self) -> Option<&Arc<DxcCache>> {
+        self.cache.as_ref()
+    }
+
+    /// Sets the include cache used by the compiler. `None` disables include caching.
+    pub fn set_include_cache(&mut self, include_cache: Option<Arc<DxcIncludeCache>>) {
+        let raw_include_cache = include_cache
+            .as_ref()
+            .map_or(std::ptr::null_mut(), |include_cache| include_cache.inner);
+        unsafe { sys::dxc_compiler_set_include_cache(self.inner, raw_include_cache) };
+
+        // The previous include cache is only dropped once the compiler no longer refers to it.
+        self.include_cache = include_cache;
+    }
+
+    /// Returns the include cache used by the compiler.
+    pub fn include_cache(&self) -> Option<&Arc<DxcIncludeCache>> {
+        self.include_cache.as_ref()
+    }
+
+    /// Sets the prelude of the compiler. Sources starting with it are compiled from its
+    /// expansion. `None` disables it.
+    pub fn set_prelude(&mut self, prelude: Option<Arc<DxcPrelude>>) {
+        let raw_prelude = prelude
+            .as_ref()
+            .map_or(std::ptr::null_mut(), |prelude| prelude.inner);
+        unsafe { sys::dxc_compiler_set_prelude(self.inner, raw_prelude) };
+
+        // The previous prelude is only dropped once the compiler no longer refers to it.
+        self.prelude = prelude;
+    }
+
+    /// Returns the prelude of the compiler.
+    pub fn prelude(&self) -> Option<&Arc<DxcPrelude>> {
+        self.prelude.as_ref()
+    }
+
+    /// Sets the compile server the compiler forwards codegen to. `None` compiles in process.
+    pub fn set_compile_server(&mut self, compile_server: Option<Arc<DxcCompileServerClient>>) {
+        let raw_compile_server = compile_server
+            .as_ref()
+            .map_or(std::ptr::null_mut(), |compile_server| compile_server.inner);
+        unsafe { sys::dxc_compiler_set_compile_server(self.inner, raw_compile_server) };
+
+        // The previous client is only dropped once the compiler no longer refers to it.
+        self.compile_server = compile_server;
+    }
+
+    /// Returns the compile server used by the compiler.
+    pub fn compile_server(&self) -> Option<&Arc<DxcCompileServerClient>> {
+        self.compile_server.as_ref()
     }
 
-    pub fn compile<'a>(
-        &self,
+    /// Sets the remote cache consulted after a miss in the bytecode cache. `None` disables it.
+    pub fn set_remote_cache(&mut self, remote_cache: Option<Arc<DxcRemoteCache>>) {
+        let raw_remote_cache = remote_cache
+            .as_ref()
+            .map_or(std::ptr::null_mut(), |remote_cache| remote_cache.inner);
+        unsafe { sys::dxc_compiler_set_remote_cache(self.inner, raw_remote_cache) };
+
+        // The previous remote cache is only dropped once the compiler no longer refers to it.
+        self.remote_cache = remote_cache;
+    }
+
+    /// Returns the remote cache used by the compiler.
+    pub fn remote_cache(&self) -> Option<&Arc<DxcRemoteCache>> {
+        self.remote_cache.as_ref()
+    }
+
+    /// Returns the statistics accumulated over all compilations of this compiler.
+    pub fn stats(&self) -> DxcCompilerStats {
+        let mut stats = MaybeUninit::<sys::DxcShimCompilerStats>::uninit();
+        unsafe { sys::dxc_compiler_get_stats(self.inner, stats.as_mut_ptr()) };
+        unsafe { stats.assume_init() }.into()
+    }
+
+    /// Resets the statistics of this compiler.
+    pub fn reset_stats(&mut self) {
+        unsafe { sys::dxc_compiler_reset_stats(self.inner) };
+    }
+
+    pub fn compile(
+        &mut self,
         data: &str,
-        include_handler: &'a dyn DxcIncludeHandler,
-    ) -> Result<Vec<u8>, DxcCompilationError> {
-        let data_cstr = CString::new(data).unwrap();
+        options: &DxcCompileOptions<'_>,
+        include_handler: &dyn DxcIncludeHandler,
+    ) -> Result<DxcBytecode, DxcCompilationError> {
+        // SAFETY: `&mut self` guarantees exclusive use of the compiler.
+        unsafe { compile_raw(self.inner, data, options, include_handler) }
+    }
 
-        let user_data = DxcIncludeHandlerUserData {
-            include_handler,
-            strings: Vec::new(),
-        };
+    /// Compiles a shader into a reusable result buffer, and returns the bytecode held by it.
+    ///
+    /// Compiling many shaders into one buffer saves allocating and freeing a result for each.
+    /// The bytecode is valid until the next compilation into the buffer.
+    pub fn compile_into<'b>(
+        &mut self,
+        data: &str,
+        options: &DxcCompileOptions<'_>,
+        include_handler: &dyn DxcIncludeHandler,
+        buffer: &'b mut DxcResultBuffer,
+    ) -> Result<&'b DxcBytecode, DxcCompilationError> {
+        // SAFETY: `&mut self` guarantees exclusive use of the compiler.
+        unsafe { compile_into_raw(self.inner, data, options, include_handler, buffer) }
+    }
+
+    /// Preprocesses a shader without compiling it.
+    pub fn preprocess(
+        &mut self,
+        data: &str,
+        options: &DxcCompileOptions<'_>,
+        include_handler: &dyn DxcIncludeHandler,
+    ) -> Result<DxcPreprocessedSource, DxcCompilationError> {
+        // SAFETY: `&mut self` guarantees exclusive use of the compiler.
+        unsafe { preprocess_raw(self.inner, data, options, include_handler) }
+    }
+}
 
-        let raw_result = unsafe {
-            sys::dxc_compile(
-                self.inner,
-                data_cstr.as_ptr() as *const _,
-                Some(
-                    dxc_include_handler_trampoline
-                        as unsafe extern "C" fn(
-                            *const std::ffi::c_char,
-                            *mut std::ffi::c_void,
-                        ) -> *const std::ffi::c_char,
-                ),
-                &user_data as *const _ as *mut std::ffi::c_void,
+/// Maps the status of a compiler creation to a result.
+pub(crate) fn compiler_creation_result(
+    status: sys::DxcShimStatus,
+) -> Result<(), DxcCompilerCreationError> {
+    match status {
+        sys::DxcShimStatus::Ok => Ok(()),
+        sys::DxcShimStatus::GetDxcCompilerInstanceError => {
+            Err(DxcCompilerCreationError::GetDxcCompilerInstanceError)
+        }
+        sys::DxcShimStatus::GetDxcUtilsInstanceError => {
+            Err(DxcCompilerCreationError::GetDxcUtilsInstanceError)
+        }
+        sys::DxcShimStatus::SpawnThreadError => Err(DxcCompilerCreationError::SpawnThreadError),
+        sys::DxcShimStatus::OpenLibraryError => Err(DxcLoaderError::OpenLibraryError.into()),
+        sys::DxcShimStatus::GetCreateInstance2SymbolError => {
+            Err(DxcLoaderError::GetCreateInstance2SymbolError.into())
+        }
+        _ => unreachable!(),
+    }
+}
+
+/// Compiles a shader with the given shim compiler.
+///
+/// # Safety
+///
+/// The caller must have exclusive use of `compiler` for the duration of the call.
+pub(crate) unsafe fn compile_raw(
+    compiler: *mut sys::DxcShimCompiler,
+    data: &str,
+    options: &DxcCompileOptions<'_>,
+    include_handler: &dyn DxcIncludeHandler,
+) -> Result<DxcBytecode, DxcCompilationError> {
+    let options = DxcCompileOptionsStrings::new(options);
+
+    let user_data = DxcIncludeHandlerUserData { include_handler };
+
+    let raw_result = unsafe {
+        sys::dxc_compile(
+            compiler,
+            data.as_ptr() as *const std::ffi::c_char,
+            data.len(),
+            options.raw(),
+            include_handler_callback(),
+            &user_data as *const _ as *mut std::ffi::c_void,
+        )
+    };
+
+    unsafe { take_result(raw_result) }
+}
+
+/// Compiles a shader with the given shim compiler into a result buffer.
+///
+/// # Safety
+///
+/// The caller must have exclusive use of `compiler` for the duration of the call.
+pub(crate) unsafe fn compile_into_raw<'b>(
+    compiler: *mut sys::DxcShimCompiler,
+    data: &str,
+    options: &DxcCompileOptions<'_>,
+    include_handler: &dyn DxcIncludeHandler,
+    buffer: &'b mut DxcResultBuffer,
+) -> Result<&'b DxcBytecode, DxcCompilationError> {
+    let options = DxcCompileOptionsStrings::new(options);
+
+    let user_data = DxcIncludeHandlerUserData { include_handler };
+
+    let bytecode = &mut buffer.bytecode;
+    unsafe {
+        sys::dxc_compile_into(
+            compiler,
+            data.as_ptr() as *const std::ffi::c_char,
+            data.len(),
+            options.raw(),
+            include_handler_callback(),
+            &user_data as *const _ as *mut std::ffi::c_void,
+            bytecode.result.as_ptr(),
+        )
+    };
+
+    let (ptr, len) = unsafe { read_result(bytecode.result) }?;
+    bytecode.ptr = ptr;
+    bytecode.len = len;
+    Ok(bytecode)
+}
+
+/// Takes ownership of a shim compilation result.
+///
+/// # Safety
+///
+/// `raw_result` must be a result returned by the shim that has not been freed yet.
+pub(crate) unsafe fn take_result(
+    raw_result: *mut sys::DxcShimCompilationResult,
+) -> Result<DxcBytecode, DxcCompilationError> {
+    let raw_result = NonNull::new(raw_result).expect("the shim returned a null result");
+
+    match unsafe { read_result(raw_result) } {
+        // Ownership of the result moves into the bytecode, which frees it on drop.
+        Ok((ptr, len)) => Ok(DxcBytecode {
+            result: raw_result,
+            ptr,
+            len,
+        }),
+        Err(error) => {
+            unsafe { sys::dxc_compilation_result_free(raw_result.as_ptr()) };
+            Err(error)
+        }
+    }
+}
+
+/// Reads the bytecode or error of a shim compilation result, without taking ownership of it.
+///
+/// # Safety
+///
+/// `raw_result` must be a result returned by the shim that has not been freed yet.
+unsafe fn read_result(
+    raw_result: NonNull<sys::DxcShimCompilationResult>,
+) -> Result<(*const u8, usize), DxcCompilationError> {
+    if unsafe { sys::dxc_compilation_result_is_successful(raw_result.as_ptr()) } {
+        let mut bytecode = MaybeUninit::<*mut std::ffi::c_void>::uninit();
+        let mut size = MaybeUninit::<usize>::uninit();
+
+        unsafe {
+            sys::dxc_compilation_result_get_bytecode(
+                raw_result.as_ptr(),
+                bytecode.as_mut_ptr(),
+                size.as_mut_ptr(),
             )
         };
+        let size = unsafe { size.assume_init() };
+        let bytecode = unsafe { bytecode.assume_init() };
 
-        let result = if unsafe { sys::dxc_compilation_result_is_successful(raw_result) } {
-            let mut bytecode = MaybeUninit::<*mut std::ffi::c_void>::uninit();
-            let mut size = MaybeUninit::<usize>::uninit();
+        Ok((bytecode as *const u8, size))
+    } else if unsafe { sys::dxc_compilation_result_is_cancelled(raw_result.as_ptr()) } {
+        Err(DxcCompilationError::Cancelled)
+    } else {
+        // The messages are copied once, straight out of the blob DXC reported them in.
+        let messages = unsafe { read_messages(raw_result) };
 
-            unsafe {
-                sys::dxc_compilation_result_get_bytecode(
-                    raw_result,
-                    bytecode.as_mut_ptr(),
-                    size.as_mut_ptr(),
-                )
-            };
-            let size = unsafe { size.assume_init() };
-            let bytecode = unsafe { bytecode.assume_init() };
-
-            let bytecode = unsafe { std::slice::from_raw_parts(bytecode as *const u8, size) };
-            Ok(bytecode.to_vec())
-        } else {
-            let error_message_c =
-                unsafe { sys::dxc_compilation_result_get_error_message(raw_result) };
-            let error_message = unsafe { CStr::from_ptr(error_message_c) }
-                .to_string_lossy()
-                .into_owned();
-            Err(DxcCompilationError(error_message))
-        };
+        Err(DxcCompilationError::Failed {
+            message: String::from_utf8_lossy(messages).into_owned(),
+            diagnostics: unsafe { read_diagnostics(raw_result.as_ptr()) },
+        })
+    }
+}
+
+/// Borrows a shim compilation result as bytecode, without taking ownership of it.
+///
+/// # Safety
+///
+/// `raw_result` must be a result returned by the shim that outlives the returned bytecode.
+pub(crate) unsafe fn borrow_result(
+    raw_result: NonNull<sys::DxcShimCompilationResult>,
+) -> Result<ManuallyDrop<DxcBytecode>, DxcCompilationError> {
+    let (ptr, len) = unsafe { read_result(raw_result) }?;
 
-        unsafe { sys::dxc_compilation_result_free(raw_result) };
+    // The bytecode must not be dropped, as it would free the result.
+    Ok(ManuallyDrop::new(DxcBytecode {
+        result: raw_result,
+        ptr,
+        len,
+    }))
+}
+
+/// Returns the messages of a shim compilation result, without copying them.
+///
+/// # Safety
+///
+/// `raw_result` must be a result returned by the shim that outlives the returned slice.
+unsafe fn read_messages<'a>(raw_result: NonNull<sys::DxcShimCompilationResult>) -> &'a [u8] {
+    let mut messages = MaybeUninit::<*const std::ffi::c_char>::uninit();
+    let mut size = MaybeUninit::<usize>::uninit();
+
+    unsafe {
+        sys::dxc_compilation_result_get_messages(
+            raw_result.as_ptr(),
+            messages.as_mut_ptr(),
+            size.as_mut_ptr(),
+        )
+    };
+    let size = unsafe { size.assume_init() };
+    let messages = unsafe { messages.assume_init() };
 
-        result
+    if size == 0 {
+        return &[];
     }
+    unsafe { std::slice::from_raw_parts(messages as *const u8, size) }
+}
+
+/// Returns the shim callback forwarding includes to a [`DxcIncludeHandlerUserData`].
+pub(crate) fn include_handler_callback() -> sys::DxcShimUserCallback {
+    Some(
+        dxc_include_handler_trampoline
+            as unsafe extern "C" fn(
+                *const std::ffi::c_char,
+                usize,
+                *mut std::ffi::c_void,
+                *mut sys::DxcShimIncludeSource,
+            ) -> bool,
+    )
 }
 
 unsafe extern "C" fn dxc_include_handler_trampoline(
-    filename_cptr: *const std::ffi::c_char,
+    filename_ptr: *const std::ffi::c_char,
+    filename_size: usize,
     user_data: *mut std::ffi::c_void,
-) -> *const std::ffi::c_char {
-    let filename = unsafe { CStr::from_ptr(filename_cptr) }.to_str().unwrap();
+    source: *mut sys::DxcShimIncludeSource,
+) -> bool {
+    let filename = unsafe { std::slice::from_raw_parts(filename_ptr as *const u8, filename_size) };
+    let Ok(filename) = std::str::from_utf8(filename) else {
+        return false;
+    };
 
-    let user_data = unsafe { &mut *(user_data as *mut DxcIncludeHandlerUserData<'_>) };
+    let user_data = unsafe { &*(user_data as *const DxcIncludeHandlerUserData<'_>) };
 
     match user_data.include_handler.load_source(filename) {
-        Some(source) => {
-            let source_cstr = CString::new(source).unwrap();
-            let source_cstr_ptr = source_cstr.as_ptr();
+        Some(contents) => {
+            let contents = Box::new(contents);
+            let bytes = (*contents.0).as_ref();
 
-            // Intern the string. The pointer will still be valid after that.
-            //
-            // All pointers will be dropped after [`DxcIncludeHandlerUserData`] is dropped after [`DxcCompiler::compile`] returns.
-            user_data.strings.push(source_cstr);
+            // Ownership of the contents moves to the shim, which hands them back to
+            // [`dxc_include_source_release`] once the include blob is released.
+            unsafe {
+                *source = sys::DxcShimIncludeSource {
+                    data: bytes.as_ptr() as *const std::ffi::c_char,
+                    size: bytes.len(),
+                    release: Some(dxc_include_source_release),
+                    release_context: Box::into_raw(contents) as *mut std::ffi::c_void,
+                }
+            };
 
-            source_cstr_ptr as *const std::ffi::c_char
+            true
         }
-        None => std::ptr::null(),
+        None => false,
     }
 }
+
+unsafe extern "C" fn dxc_include_source_release(context: *mut std::ffi::c_void) {
+    drop(unsafe { Box::from_raw(context as *mut DxcIncludeSource) });
+}
@@ -0,0 +1,490 @@
+use std::{ffi::CString, sync::Arc, time::Instant};
+
+use crate::{DxcArgumentSet, DxcCancellationToken, sys};
+
+/// A preprocessor define, passed to DXC as `-D name=value`.
+#[derive(Debug, Clone, Copy)]
+pub struct DxcDefine<'a> {
+    pub name: &'a str,
+    pub value: Option<&'a str>,
+}
+
+/// The optimization level of a compilation.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub enum DxcOptimizationLevel {
+    /// No optimizations, for fast iteration builds.
+    O0,
+    O1,
+    O2,
+    /// Full optimizations. This is also DXC's default.
+    #[default]
+    O3,
+}
+
+impl From<DxcOptimizationLevel> for sys::DxcShimOptimizationLevel {
+    fn from(level: DxcOptimizationLevel) -> Self {
+        match level {
+            DxcOptimizationLevel::O0 => sys::DxcShimOptimizationLevel::O0,
+            DxcOptimizationLevel::O1 => sys::DxcShimOptimizationLevel::O1,
+            DxcOptimizationLevel::O2 => sys::DxcShimOptimizationLevel::O2,
+            DxcOptimizationLevel::O3 => sys::DxcShimOptimizationLevel::O3,
+        }
+    }
+}
+
+/// The priority class of a compilation, among the other work of its pool.
+///
+/// Queued work is picked up by priority. Interactive compilations also make room for themselves
+/// at the next job boundary of running work of lower priority, such as a batch, as DXC cannot
+/// be interrupted mid-compilation.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub enum DxcPriority {
+    /// Work that is waited on but not looked at, such as the shaders of a level being loaded.
+    #[default]
+    Normal,
+    /// Work someone is looking at right now, such as the shader open in an editor.
+    Interactive,
+    /// Work nobody is waiting on, such as permutations warming the cache.
+    Background,
+}
+
+impl From<DxcPriority> for sys::DxcShimPriority {
+    fn from(priority: DxcPriority) -> Self {
+        match priority {
+            DxcPriority::Normal => sys::DxcShimPriority::Normal,
+            DxcPriority::Interactive => sys::DxcShimPriority::Interactive,
+            DxcPriority::Background => sys::DxcShimPriority::Background,
+        }
+    }
+}
+
+/// What to strip from the SPIR-V output of a compilation.
+///
+/// Debug information is most of an unstripped module. The driver ignores it, but still has to
+/// parse it when creating the shader module.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct DxcStripOptions {
+    /// Strips source text, line information and non-semantic instructions, such as the
+    /// debug info emitted by `-fspv-debug`.
+    pub debug_info: bool,
+
+    /// Strips the names of ids and members. The [`reflection`](crate::DxcBytecode::reflection)
+    /// of stripped bytecode has no names.
+    pub names: bool,
+}
+
+impl DxcStripOptions {
+    /// Strips everything that does not affect the behavior of the shader.
+    pub fn all() -> Self {
+        Self {
+            debug_info: true,
+            names: true,
+        }
+    }
+}
+
+impl From<DxcStripOptions> for sys::DxcShimStripOptions {
+    fn from(options: DxcStripOptions) -> Self {
+        Self {
+            strip_debug_info: options.debug_info,
+            strip_names: options.names,
+        }
+    }
+}
+
+/// The options of a single compilation.
+#[derive(Debug, Clone, Copy)]
+pub struct DxcCompileOptions<'a> {
+    /// The name of the entry point function.
+    pub entry_point: &'a str,
+
+    /// The target profile, such as `vs_6_5`, `ps_6_5` or `cs_6_5`. Selects the shader stage.
+    pub target_profile: &'a str,
+
+    pub defines: &'a [DxcDefine<'a>],
+
+    pub optimization_level: DxcOptimizationLevel,
+
+    /// Cancels the compilation when cancelled.
+    pub cancellation_token: Option<&'a Arc<DxcCancellationToken>>,
+
+    /// The time after which the compilation is abandoned and reports
+    /// [`DxcCompilationError::Cancelled`](crate::DxcCompilationError::Cancelled).
+    pub deadline: Option<Instant>,
+
+    /// Additional arguments, passed to DXC verbatim.
+    pub extra_args: &'a [&'a str],
+
+    /// The comma-separated SPIR-V optimizer passes to run instead of those of the optimization
+    /// level, such as `--loop-unroll,--eliminate-dead-code-aggressive`.
+    pub spirv_optimizer_passes: Option<&'a str>,
+
+    /// What to strip from the SPIR-V output. Stripped bytecode is what gets cached.
+    pub strip: DxcStripOptions,
+
+    /// The arguments built once from other options, which replace those built from the entry
+    /// point, target profile, optimization level, extra arguments, optimizer passes and strip
+    /// options of these. The defines of these options are added to those of the set.
+    pub argument_set: Option<&'a Arc<DxcArgumentSet>>,
+
+    /// The priority class of the compilation, among the other work of its pool.
+    pub priority: DxcPriority,
+}
+
+impl<'a> DxcCompileOptions<'a> {
+    /// Creates options for the given entry point and target profile.
+    pub fn new(entry_point: &'a str, target_profile: &'a str) -> Self {
+        Self {
+            entry_point,
+            target_profile,
+            defines: &[],
+            optimization_level: DxcOptimizationLevel::default(),
+            cancellation_token: None,
+            deadline: None,
+            extra_args: &[],
+            spirv_optimizer_passes: None,
+            strip: DxcStripOptions::default(),
+            argument_set: None,
+            priority: DxcPriority::default(),
+        }
+    }
+}
+
+/// The NUL-terminated strings of [`DxcCompileOptions`], in the layout expected by the shim.
+pub(crate) struct DxcCompileOptionsStrings {
+    raw: sys::DxcShimCompileOptions,
+
+    // Backing storage of `raw`. The heap allocations do not move with the struct. The strings
+    // replaced by an argument set are not converted.
+    _entry_point: Option<CString>,
+    _target_profile: Option<CString>,
+    _defines: Vec<(CString, Option<CString>)>,
+    _raw_defines: Vec<sys::DxcShimDefine>,
+    _extra_args: Vec<CString>,
+    _raw_extra_args: Vec<*const std::ffi::c_char>,
+    _spirv_optimizer_passes: Option<CString>,
+    _argument_set: Option<Arc<DxcArgumentSet>>,
+}
+
+impl DxcCompileOptionsStrings {
+    pub(crate) fn new(options: &DxcCompileOptions<'_>) -> Self {
+        let argument_set = options.argument_set.cloned();
+        let has_argument_set = argument_set.is_some();
+
+        let entry_point = (!has_argument_set).then(|| CString::new(options.entry_point).unwrap());
+        let target_profile =
+            (!has_argument_set).then(|| CString::new(options.target_profile).unwrap());
+
+        let defines: Vec<_> = options
+            .defines
+            .iter()
+            .map(|define| {
+                (
+                    CString::new(define.name).unwrap(),
+                    define.value.map(|value| CString::new(value).unwrap()),
+                )
+            })
+            .collect();
+
+        let raw_defines: Vec<_> = defines
+            .iter()
+            .map(|(name, value)| sys::DxcShimDefine {
+                name: name.as_ptr(),
+                value: value
+                    .as_ref()
+                    .map_or(std::ptr::null(), |value| value.as_ptr()),
+            })
+            .collect();
+
+        let extra_args: Vec<_> = if has_argument_set {
+            Vec::new()
+        } else {
+            options
+                .extra_args
+                .iter()
+                .map(|arg| CString::new(*arg).unwrap())
+                .collect()
+        };
+
+        let raw_extra_args: Vec<_> = extra_args.iter().map(|arg| arg.as_ptr()).collect();
+
+        let spirv_optimizer_passes = options
+            .spirv_optimizer_passes
+            .filter(|_| !has_argument_set)
+            .map(|passes| CString::new(passes).unwrap());
+
+        let raw = sys::DxcShimCompileOptions {
+            entry_point: entry_point
+                .as_ref()
+                .map_or(std::ptr::null(), |entry_point| entry_point.as_ptr()),
+            target_profile: target_profile
+                .as_ref()
+                .map_or(std::ptr::null(), |target_profile| target_profile.as_ptr()),
+            defines: raw_defines.as_ptr(),
+            define_count: raw_defines.len(),
+            optimization_level: options.optimization_level.into(),
+            cancellation_token: options
+                .cancellation_token
+                .map_or(std::ptr::null(), |token| token.inner),
+            deadline: options.deadline.map_or(0, shim_deadline),
+            extra_args: raw_extra_args.as_ptr(),
+            extra_arg_count: raw_extra_args.len(),
+            spirv_optimizer_passes: spirv_optimizer_passes
+                .as_ref()
+                .map_or(std::ptr::null(), |passes| passes.as_ptr()),
+            strip: options.strip.into(),
+            argument_set: argument_set
+                .as_ref()
+                .map_or(std::ptr::null(), |argument_set| argument_set.inner),
+            priority: options.priority.into(),
+        };
+
+        Self {
+            raw,
+            _entry_point: entry_point,
+            _target_profile: target_profile,
+            _defines: defines,
+            _raw_defines: raw_defines,
+            _extra_args: extra_args,
+            _raw_extra_args: raw_extra_args,
+            _spirv_optimizer_passes: spirv_optimizer_passes,
+            _argument_set: argument_set,
+        }
+    }
+
+    pub(crate) fn raw(&self) -> &sys::DxcShimCompileOptions {
+        &self.raw
+    }
+}
+
+/// Converts a deadline to the clock of the shim.
+fn shim_deadline(deadline: Instant) -> u64 {
+    let remaining = deadline.saturating_duration_since(Instant::now());
+    let now = unsafe { sys::dxc_clock_now() };
+
+    // 0 is no deadline.
+    now.saturating_add(remaining.as_nanos().min(u64::MAX as u128) as u64)
+        .max(1)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Strips a module as compilations do. Returns `false` if it is not valid SPIR-V.
+    fn strip(options: DxcStripOptions, words: &mut Vec<u32>) -> bool {
+        let options = sys::DxcShimStripOptions::from(options);
+        let word_count = unsafe { sys::dxc_strip_spirv(words.as_mut_ptr(), words.len(), &options) };
+        if word_count == 0 {
+            return false;
+        }
+
+        words.truncate(word_count);
+        true
+    }
+
+    const OP_SOURCE: u32 = 3;
+    const OP_NAME: u32 = 5;
+    const OP_MEMBER_NAME: u32 = 6;
+    const OP_STRING: u32 = 7;
+    const OP_LINE: u32 = 8;
+    const OP_EXTENSION: u32 = 10;
+    const OP_EXT_INST_IMPORT: u32 = 11;
+    const OP_EXT_INST: u32 = 12;
+    const OP_TYPE_VOID: u32 = 19;
+    const OP_NO_LINE: u32 = 317;
+    const OP_MODULE_PROCESSED: u32 = 330;
+
+    fn op(opcode: u32, operands: &[u32]) -> Vec<u32> {
+        let mut words = vec![((operands.len() as u32 + 1) << 16) | opcode];
+        words.extend_from_slice(operands);
+        words
+    }
+
+    fn with_string(operands: &[u32], value: &str) -> Vec<u32> {
+        let mut bytes = value.as_bytes().to_vec();
+        bytes.resize(bytes.len() / 4 * 4 + 4, 0);
+
+        let mut operands = operands.to_vec();
+        operands.extend(
+            bytes
+                .chunks(4)
+                .map(|chunk| u32::from_le_bytes(chunk.try_into().unwrap())),
+        );
+        operands
+    }
+
+    fn module(instructions: &[&[u32]]) -> Vec<u32> {
+        let mut words = vec![0x07230203, 0x00010000, 0, 16, 0];
+        for instruction in instructions {
+            words.extend_from_slice(instruction);
+        }
+        words
+    }
+
+    struct Instructions {
+        debug_extension: Vec<u32>,
+        other_extension: Vec<u32>,
+        debug_import: Vec<u32>,
+        glsl_import: Vec<u32>,
+        source: Vec<u32>,
+        string: Vec<u32>,
+        name: Vec<u32>,
+        member_name: Vec<u32>,
+        module_processed: Vec<u32>,
+        void: Vec<u32>,
+        line: Vec<u32>,
+        no_line: Vec<u32>,
+        debug_inst: Vec<u32>,
+        glsl_inst: Vec<u32>,
+    }
+
+    fn instructions() -> Instructions {
+        Instructions {
+            debug_extension: op(OP_EXTENSION, &with_string(&[], "SPV_KHR_non_semantic_info")),
+            other_extension: op(
+                OP_EXTENSION,
+                &with_string(&[], "SPV_KHR_non_semantic_info2"),
+            ),
+            debug_import: op(
+                OP_EXT_INST_IMPORT,
+                &with_string(&[1], "NonSemantic.Shader.DebugInfo.100"),
+            ),
+            glsl_import: op(OP_EXT_INST_IMPORT, &with_string(&[2], "GLSL.std.450")),
+            source: op(OP_SOURCE, &[5, 600]),
+            string: op(OP_STRING, &with_string(&[3], "shader.hlsl")),
+            name: op(OP_NAME, &with_string(&[4], "main")),
+            member_name: op(OP_MEMBER_NAME, &with_string(&[5, 0], "color")),
+            module_processed: op(OP_MODULE_PROCESSED, &with_string(&[], "dxc-commit")),
+            void: op(OP_TYPE_VOID, &[6]),
+            line: op(OP_LINE, &[3, 12, 5]),
+            no_line: op(OP_NO_LINE, &[]),
+            debug_inst: op(OP_EXT_INST, &[6, 7, 1, 1]),
+            glsl_inst: op(OP_EXT_INST, &[6, 8, 2, 1]),
+        }
+    }
+
+    fn full_module(i: &Instructions) -> Vec<u32> {
+        module(&[
+            &i.debug_extension,
+            &i.other_extension,
+            &i.debug_import,
+            &i.glsl_import,
+            &i.source,
+            &i.string,
+            &i.name,
+            &i.member_name,
+            &i.module_processed,
+            &i.void,
+            &i.line,
+            &i.debug_inst,
+            &i.glsl_inst,
+            &i.no_line,
+        ])
+    }
+
+    #[test]
+    fn test_strip_debug_info() {
+        let i = instructions();
+        let mut words = full_module(&i);
+        let options = DxcStripOptions {
+            debug_info: true,
+            names: false,
+        };
+        assert!(strip(options, &mut words));
+
+        // Extensions and instruction sets only match non-semantic ones exactly.
+        let expected = module(&[
+            &i.other_extension,
+            &i.glsl_import,
+            &i.name,
+            &i.member_name,
+            &i.void,
+            &i.glsl_inst,
+        ]);
+        assert_eq!(words, expected);
+    }
+
+    #[test]
+    fn test_strip_names() {
+        let i = instructions();
+        let mut words = full_module(&i);
+        let options = DxcStripOptions {
+            debug_info: false,
+            names: true,
+        };
+        assert!(strip(options, &mut words));
+
+        let expected = module(&[
+            &i.debug_extension,
+            &i.other_extension,
+            &i.debug_import,
+            &i.glsl_import,
+            &i.source,
+            &i.string,
+            &i.module_processed,
+            &i.void,
+            &i.line,
+            &i.debug_inst,
+            &i.glsl_inst,
+            &i.no_line,
+        ]);
+        assert_eq!(words, expected);
+    }
+
+    #[test]
+    fn test_strip_all() {
+        let i = instructions();
+        let mut words = full_module(&i);
+        assert!(strip(DxcStripOptions::all(), &mut words));
+        assert_eq!(
+            words,
+            module(&[&i.other_extension, &i.glsl_import, &i.void, &i.glsl_inst])
+        );
+
+        // Stripping again changes nothing.
+        let stripped = words.clone();
+        assert!(strip(DxcStripOptions::all(), &mut words));
+        assert_eq!(words, stripped);
+    }
+
+    #[test]
+    fn test_strip_nothing() {
+        let i = instructions();
+        let mut words = full_module(&i);
+        assert!(strip(DxcStripOptions::default(), &mut words));
+        assert_eq!(words, full_module(&i));
+
+        // A module with only a header.
+        let mut words = module(&[]);
+        assert!(strip(DxcStripOptions::all(), &mut words));
+        assert_eq!(words, module(&[]));
+    }
+
+    #[test]
+    fn test_strip_rejects_invalid_modules() {
+        let i = instructions();
+
+        let mut words = vec![0x07230203, 0x00010000, 0, 16];
+        assert!(!strip(DxcStripOptions::all(), &mut words));
+
+        let mut words = full_module(&i);
+        words[0] = 0x43425844;
+        let original = words.clone();
+        assert!(!strip(DxcStripOptions::all(), &mut words));
+        assert_eq!(words, original);
+
+        // An instruction running past the end, after ones that would be stripped.
+        let mut words = full_module(&i);
+        words.push((4 << 16) | OP_NAME);
+        let original = words.clone();
+        assert!(!strip(DxcStripOptions::all(), &mut words));
+        assert_eq!(words, original);
+
+        // An instruction of length 0.
+        let mut words = module(&[&i.name, &[OP_NAME]]);
+        let original = words.clone();
+        assert!(!strip(DxcStripOptions::all(), &mut words));
+        assert_eq!(words, original);
+    }
+}
@@ -0,0 +1,153 @@
+use std::ffi::CString;
+
+use crate::{
+    DxcBytecode, DxcCompilationError, DxcCompileOptions, DxcCompileOptionsStrings,
+    DxcCompilerCreationError, DxcCompilerPool, DxcIncludeHandler, DxcIncludeHandlerUserData,
+    compiler_creation_result, include_handler_callback, sys, take_result,
+};
+
+/// An axis of a permutation: a define and the values it takes across the variants.
+#[derive(Debug, Clone, Copy)]
+pub struct DxcPermutationAxis<'a> {
+    pub name: &'a str,
+
+    /// The values of the define. `None` leaves the define out of the variant, so a feature
+    /// toggle is `&[None, Some("1")]`.
+    pub values: &'a [Option<&'a str>],
+}
+
+/// Returns the number of variants of a permutation, the product of the value counts of its
+/// axes.
+pub fn permutation_count(axes: &[DxcPermutationAxis<'_>]) -> usize {
+    axes.iter().map(|axis| axis.values.len()).product()
+}
+
+/// The results of [`DxcCompilerPool::compile_permutations`].
+pub struct DxcPermutationResults {
+    // Only set for the variants that were compiled.
+    results: Vec<Option<Result<DxcBytecode, DxcCompilationError>>>,
+    representatives: Vec<usize>,
+}
+
+impl DxcPermutationResults {
+    /// Returns the number of variants.
+    pub fn len(&self) -> usize {
+        self.representatives.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.representatives.is_empty()
+    }
+
+    /// Returns the result of a variant, which may be shared with other variants.
+    pub fn get(&self, variant: usize) -> &Result<DxcBytecode, DxcCompilationError> {
+        self.results[self.representatives[variant]]
+            .as_ref()
+            .expect("representatives are always compiled")
+    }
+
+    /// Returns the index of the variant that was compiled for a variant. Variants with the same
+    /// representative have identical preprocessed sources, and share a result.
+    pub fn representative(&self, variant: usize) -> usize {
+        self.representatives[variant]
+    }
+
+    /// Returns the number of variants that were compiled.
+    pub fn unique_count(&self) -> usize {
+        self.results
+            .iter()
+            .filter(|result| result.is_some())
+            .count()
+    }
+}
+
+impl DxcCompilerPool {
+    /// Compiles every variant of a source over the combinations of values of the axes, on up
+    /// to `thread_count` threads.
+    ///
+    /// Variants are numbered with the last axis varying fastest, as nested loops over the
+    /// axes would, and their defines follow those of `options`. All variants are preprocessed
+    /// first, and those with identical preprocessed sources are compiled once. The include
+    /// handler is called from several threads at once.
+    pub fn compile_permutations(
+        &self,
+        source: &str,
+        options: &DxcCompileOptions<'_>,
+        axes: &[DxcPermutationAxis<'_>],
+        thread_count: usize,
+        include_handler: &(dyn DxcIncludeHandler + Sync),
+    ) -> Result<DxcPermutationResults, DxcCompilerCreationError> {
+        let options = DxcCompileOptionsStrings::new(options);
+
+        // The NUL-terminated axis strings, kept alive for the duration of the call.
+        let names: Vec<_> = axes
+            .iter()
+            .map(|axis| CString::new(axis.name).unwrap())
+            .collect();
+        let values: Vec<Vec<_>> = axes
+            .iter()
+            .map(|axis| {
+                axis.values
+                    .iter()
+                    .map(|value| value.map(|value| CString::new(value).unwrap()))
+                    .collect()
+            })
+            .collect();
+        let raw_values: Vec<Vec<_>> = values
+            .iter()
+            .map(|values| {
+                values
+                    .iter()
+                    .map(|value| {
+                        value
+                            .as_ref()
+                            .map_or(std::ptr::null(), |value| value.as_ptr())
+                    })
+                    .collect()
+            })
+            .collect();
+        let raw_axes: Vec<_> = names
+            .iter()
+            .zip(raw_values.iter())
+            .map(|(name, values)| sys::DxcShimPermutationAxis {
+                name: name.as_ptr(),
+                values: values.as_ptr(),
+                value_count: values.len(),
+            })
+            .collect();
+
+        let variant_count = permutation_count(axes);
+
+        let user_data = DxcIncludeHandlerUserData { include_handler };
+
+        let mut raw_results = vec![std::ptr::null_mut(); variant_count];
+        let mut representatives = vec![0; variant_count];
+        let status = unsafe {
+            sys::dxc_compile_permutations(
+                self.inner,
+                source.as_ptr() as *const std::ffi::c_char,
+                source.len(),
+                options.raw(),
+                raw_axes.as_ptr(),
+                raw_axes.len(),
+                thread_count,
+                include_handler_callback(),
+                &user_data as *const _ as *mut std::ffi::c_void,
+                raw_results.as_mut_ptr(),
+                representatives.as_mut_ptr(),
+            )
+        };
+
+        compiler_creation_result(status)?;
+
+        let results = raw_results
+            .into_iter()
+            .map(|raw_result| (!raw_result.is_null()).then(|| unsafe { take_result(raw_result) }))
+            .collect();
+
+        Ok(DxcPermutationResults {
+            results,
+            representatives,
+        })
+    }
+}
@@ -0,0 +1,203 @@
+use std::{mem::MaybeUninit, sync::Arc};
+
+use crate::{
+    DxcBytecode, DxcCache, DxcCompilationError, DxcCompileOptions, DxcCompileServerClient,
+    DxcCompilerCreationError, DxcCompilerStats, DxcIncludeCache, DxcIncludeHandler, DxcLoader,
+    DxcPrelude, DxcPreprocessedSource, DxcRemoteCache, DxcResultBuffer, compile_into_raw,
+    compile_raw, compiler_creation_result, preprocess_raw, sys,
+};
+
+#[derive(Default)]
+pub struct DxcCompilerPoolCreateInfo {
+    /// The number of compilers created up front.
+    pub initial_size: usize,
+
+    /// The bytecode cache used by all compilers of the pool.
+    pub cache: Option<Arc<DxcCache>>,
+
+    /// The include cache used by all compilers of the pool.
+    pub include_cache: Option<Arc<DxcIncludeCache>>,
+
+    /// The prelude of all compilers of the pool.
+    pub prelude: Option<Arc<DxcPrelude>>,
+
+    /// The compile server all compilers of the pool forward codegen to.
+    pub compile_server: Option<Arc<DxcCompileServerClient>>,
+
+    /// The remote cache all compilers of the pool consult after a miss in the bytecode cache.
+    pub remote_cache: Option<Arc<DxcRemoteCache>>,
+}
+
+/// A pool of compilers sharing a single [`DxcLoader`].
+///
+/// Each thread acquires its own compiler from the pool, so compilations can run in parallel
+/// without sharing a DXC compiler instance. Released compilers are reused.
+pub struct DxcCompilerPool {
+    loader: Arc<DxcLoader>,
+    cache: Option<Arc<DxcCache>>,
+    include_cache: Option<Arc<DxcIncludeCache>>,
+    prelude: Option<Arc<DxcPrelude>>,
+    compile_server: Option<Arc<DxcCompileServerClient>>,
+    remote_cache: Option<Arc<DxcRemoteCache>>,
+    pub(crate) inner: *mut sys::DxcShimCompilerPool,
+}
+
+// SAFETY: The shim pool synchronizes access to its idle compilers, and every acquired compiler
+// is used by a single thread at a time.
+unsafe impl Send for DxcCompilerPool {}
+unsafe impl Sync for DxcCompilerPool {}
+
+impl DxcCompilerPool {
+    pub fn new(
+        loader: Arc<DxcLoader>,
+        create_info: DxcCompilerPoolCreateInfo,
+    ) -> Result<Arc<Self>, DxcCompilerCreationError> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCompilerPool>::uninit();
+        let status = unsafe {
+            sys::dxc_compiler_pool_create(
+                loader.inner,
+                create_info.initial_size,
+                inner.as_mut_ptr(),
+            )
+        };
+
+        compiler_creation_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        if let Some(cache) = &create_info.cache {
+            unsafe { sys::dxc_compiler_pool_set_cache(inner, cache.inner) };
+        }
+        if let Some(include_cache) = &create_info.include_cache {
+            unsafe { sys::dxc_compiler_pool_set_include_cache(inner, include_cache.inner) };
+        }
+        if let Some(prelude) = &create_info.prelude {
+            unsafe { sys::dxc_compiler_pool_set_prelude(inner, prelude.inner) };
+        }
+        if let Some(compile_server) = &create_info.compile_server {
+            unsafe { sys::dxc_compiler_pool_set_compile_server(inner, compile_server.inner) };
+        }
+        if let Some(remote_cache) = &create_info.remote_cache {
+            unsafe { sys::dxc_compiler_pool_set_remote_cache(inner, remote_cache.inner) };
+        }
+
+        Ok(Arc::new(Self {
+            loader,
+            cache: create_info.cache,
+            include_cache: create_info.include_cache,
+            prelude: create_info.prelude,
+            compile_server: create_info.compile_server,
+            remote_cache: create_info.remote_cache,
+            inner,
+        }))
+    }
+
+    /// Returns the bytecode cache used by the compilers of this pool.
+    pub fn cache(&self) -> Option<&Arc<DxcCache>> {
+        self.cache.as_ref()
+    }
+
+    /// Returns the include cache used by the compilers of this pool.
+    pub fn include_cache(&self) -> Option<&Arc<DxcIncludeCache>> {
+        self.include_cache.as_ref()
+    }
+
+    /// Returns the prelude of the compilers of this pool.
+    pub fn prelude(&self) -> Option<&Arc<DxcPrelude>> {
+        self.prelude.as_ref()
+    }
+
+    /// Returns the compile server used by the compilers of this pool.
+    pub fn compile_server(&self) -> Option<&Arc<DxcCompileServerClient>> {
+        self.compile_server.as_ref()
+    }
+
+    /// Returns the remote cache used by the compilers of this pool.
+    pub fn remote_cache(&self) -> Option<&Arc<DxcRemoteCache>> {
+        self.remote_cache.as_ref()
+    }
+
+    /// Returns the loader shared by the compilers of this pool.
+    pub fn loader(&self) -> &Arc<DxcLoader> {
+        &self.loader
+    }
+
+    /// Returns the statistics accumulated over all compilations of the compilers of this pool,
+    /// including batch compilations.
+    pub fn stats(&self) -> DxcCompilerStats {
+        let mut stats = MaybeUninit::<sys::DxcShimCompilerStats>::uninit();
+        unsafe { sys::dxc_compiler_pool_get_stats(self.inner, stats.as_mut_ptr()) };
+        unsafe { stats.assume_init() }.into()
+    }
+
+    /// Resets the statistics of this pool.
+    pub fn reset_stats(&self) {
+        unsafe { sys::dxc_compiler_pool_reset_stats(self.inner) };
+    }
+
+    /// Acquires a compiler for exclusive use. The compiler is returned to the pool when dropped.
+    pub fn acquire(&self) -> Result<DxcPooledCompiler<'_>, DxcCompilerCreationError> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCompiler>::uninit();
+        let status = unsafe { sys::dxc_compiler_pool_acquire(self.inner, inner.as_mut_ptr()) };
+
+        compiler_creation_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        Ok(DxcPooledCompiler { pool: self, inner })
+    }
+}
+
+impl Drop for DxcCompilerPool {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_compiler_pool_destroy(self.inner) };
+    }
+}
+
+/// A compiler acquired from a [`DxcCompilerPool`].
+pub struct DxcPooledCompiler<'a> {
+    pool: &'a DxcCompilerPool,
+    inner: *mut sys::DxcShimCompiler,
+}
+
+// SAFETY: The compiler is exclusively owned by this handle until it is released.
+unsafe impl Send for DxcPooledCompiler<'_> {}
+
+impl DxcPooledCompiler<'_> {
+    pub fn compile(
+        &mut self,
+        data: &str,
+        options: &DxcCompileOptions<'_>,
+        include_handler: &dyn DxcIncludeHandler,
+    ) -> Result<DxcBytecode, DxcCompilationError> {
+        // SAFETY: `&mut self` guarantees exclusive use of the compiler.
+        unsafe { compile_raw(self.inner, data, options, include_handler) }
+    }
+
+    /// Compiles a shader into a reusable result buffer, as by [`DxcCompiler::compile_into`].
+    pub fn compile_into<'b>(
+        &mut self,
+        data: &str,
+        options: &DxcCompileOptions<'_>,
+        include_handler: &dyn DxcIncludeHandler,
+        buffer: &'b mut DxcResultBuffer,
+    ) -> Result<&'b DxcBytecode, DxcCompilationError> {
+        // SAFETY: `&mut self` guarantees exclusive use of the compiler.
+        unsafe { compile_into_raw(self.inner, data, options, include_handler, buffer) }
+    }
+
+    /// Preprocesses a shader without compiling it.
+    pub fn preprocess(
+        &mut self,
+        data: &str,
+        options: &DxcCompileOptions<'_>,
+        include_handler: &dyn DxcIncludeHandler,
+    ) -> Result<DxcPreprocessedSource, DxcCompilationError> {
+        // SAFETY: `&mut self` guarantees exclusive use of the compiler.
+        unsafe { preprocess_raw(self.inner, data, options, include_handler) }
+    }
+}
+
+impl Drop for DxcPooledCompiler<'_> {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_compiler_pool_release(self.pool.inner, self.inner) };
+    }
+}
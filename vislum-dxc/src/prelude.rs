@@ -0,0 +1,209 @@
+use std::{mem::MaybeUninit, sync::Arc};
+
+use crate::sys;
+
+/// A prelude shared by many shaders, such as the chain of includes every shader starts with.
+///
+/// Set on a [`crate::DxcCompiler`] or [`crate::DxcCompilerPool`], sources that start with the
+/// prelude are compiled from its expansion, which is preprocessed once per set of compile
+/// options instead of on every compilation. The macros defined by the prelude stay visible to
+/// the rest of the source. The includes of the prelude are still reported by every compilation.
+/// Include guards keep working: `#ifndef` guards through the macros, and includes marked with
+/// `#pragma once` are empty when the rest of the source includes them again.
+///
+/// DXC cannot serialize its AST, so the expansion is still parsed by every compilation.
+/// Expansions are kept until cleared, e.g. when an include of the prelude changes on disk.
+pub struct DxcPrelude {
+    pub(crate) inner: *mut sys::DxcShimPrelude,
+}
+
+// SAFETY: The shim prelude synchronizes accesses to its expansions internally.
+unsafe impl Send for DxcPrelude {}
+unsafe impl Sync for DxcPrelude {}
+
+impl DxcPrelude {
+    /// Creates a prelude from the text sources start with, such as a list of `#include`s. The
+    /// prelude must end at the end of a line of the sources.
+    pub fn new(source: &str) -> Arc<Self> {
+        let mut inner = MaybeUninit::<*mut sys::DxcShimPrelude>::uninit();
+        unsafe {
+            sys::dxc_prelude_create(
+                source.as_ptr() as *const std::ffi::c_char,
+                source.len(),
+                inner.as_mut_ptr(),
+            )
+        };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self { inner })
+    }
+
+    /// Removes all expansions, so the prelude is expanded again on its next use.
+    pub fn clear(&self) {
+        unsafe { sys::dxc_prelude_clear(self.inner) };
+    }
+}
+
+impl Drop for DxcPrelude {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_prelude_destroy(self.inner) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::ffi::c_char;
+
+    use super::*;
+
+    /// Returns the source a prelude is expanded from.
+    fn build_expansion_source(prelude: &str) -> String {
+        let size = unsafe {
+            sys::dxc_prelude_build_expansion_source(
+                prelude.as_ptr() as *const c_char,
+                prelude.len(),
+                std::ptr::null_mut(),
+                0,
+            )
+        };
+
+        let mut source = vec![0u8; size];
+        unsafe {
+            sys::dxc_prelude_build_expansion_source(
+                prelude.as_ptr() as *const c_char,
+                prelude.len(),
+                source.as_mut_ptr() as *mut c_char,
+                size,
+            )
+        };
+        String::from_utf8(source).unwrap()
+    }
+
+    /// Restores the macro directives of a preprocessed expansion, or returns `None` if it is not
+    /// usable.
+    fn restore_expansion(expanded: &str) -> Option<String> {
+        // Restoring only shortens lines, and may end the last one.
+        let mut source = vec![0u8; expanded.len() + 1];
+        let mut size = 0;
+        let is_usable = unsafe {
+            sys::dxc_prelude_restore_expansion(
+                expanded.as_ptr() as *const c_char,
+                expanded.len(),
+                source.as_mut_ptr() as *mut c_char,
+                source.len(),
+                &mut size,
+            )
+        };
+
+        source.truncate(size);
+        is_usable.then(|| String::from_utf8(source).unwrap())
+    }
+
+    fn has_pragma_once(source: &str) -> bool {
+        unsafe { sys::dxc_prelude_has_pragma_once(source.as_ptr() as *const c_char, source.len()) }
+    }
+
+    /// Preprocesses the way DXC does for the expansion: directives are dropped and pragmas
+    /// printed. Only `#if 0` conditionals are evaluated.
+    fn preprocess(source: &str) -> String {
+        let source = source.replace("\\\r\n", "").replace("\\\n", "");
+        let mut preprocessed = String::new();
+        let mut skipped_depth = 0;
+        for line in source.lines() {
+            let directive = line.trim_start();
+            if directive.starts_with("#if") {
+                skipped_depth += (skipped_depth > 0 || directive == "#if 0") as u32;
+            } else if directive.starts_with("#endif") {
+                skipped_depth = skipped_depth.saturating_sub(1);
+            } else if skipped_depth == 0
+                && (!directive.starts_with('#') || directive.starts_with("#pragma"))
+            {
+                preprocessed += line;
+                preprocessed += "\n";
+            }
+        }
+        preprocessed
+    }
+
+    /// Returns the echo of a directive as printed by the preprocessor.
+    fn echo(directive: &str) -> String {
+        let expanded = preprocess(&build_expansion_source(&format!("{directive}\n")));
+        expanded.lines().next().unwrap().to_string()
+    }
+
+    #[test]
+    fn test_round_trip_macro_directives() {
+        let prelude =
+            "#define FOO 1\nfloat x = FOO;\n  #  undef FOO\n#define BAR(a, b) ((a) * (b))\n";
+        let restored = restore_expansion(&preprocess(&build_expansion_source(prelude))).unwrap();
+        assert_eq!(
+            restored,
+            "#define FOO 1\nfloat x = FOO;\n#undef FOO\n#define BAR(a, b) ((a) * (b))\n"
+        );
+    }
+
+    #[test]
+    fn test_round_trip_line_continuations() {
+        let prelude = "#define ADD(a, b) \\\n  ((a) + \\\r\n  (b))\nfloat x;\n";
+        let restored = restore_expansion(&preprocess(&build_expansion_source(prelude))).unwrap();
+        assert_eq!(restored, "#define ADD(a, b)    ((a) +    (b))\nfloat x;\n");
+    }
+
+    #[test]
+    fn test_round_trip_comments() {
+        let prelude = "#define A 1 // one\n#define B /* two */ 2\n#define C \"//\" '\"' /* \"\n";
+        let restored = restore_expansion(&preprocess(&build_expansion_source(prelude))).unwrap();
+        assert_eq!(
+            restored,
+            "#define A 1 \n#define B   2\n#define C \"//\" '\"' \n"
+        );
+    }
+
+    #[test]
+    fn test_round_trip_conditional_definitions() {
+        let prelude = "#if 0\n#define A 1\n#endif\n#define B 2\n";
+        let restored = restore_expansion(&preprocess(&build_expansion_source(prelude))).unwrap();
+        assert_eq!(restored, "#define B 2\n");
+    }
+
+    #[test]
+    fn test_echoes_have_no_identifiers() {
+        // Expanding the operands of the pragma cannot change the names of the macros.
+        let echo = echo("#define FOO 1");
+        let (_, literal) = echo.split_once(' ').unwrap().1.split_once(' ').unwrap();
+        assert_eq!(literal, "\"define FOO 1\"");
+    }
+
+    #[test]
+    fn test_restore_rejects_changed_echoes() {
+        let echo = echo("#define FOO 1");
+        let prefix = &echo[..echo.find('"').unwrap()];
+        let end = preprocess(&build_expansion_source(""));
+        assert!(restore_expansion(&format!("{echo}\n{end}")).is_some());
+
+        // Operands that were expanded, or are not a whole string literal.
+        for operands in [
+            "define 1 1",
+            "\"define FOO 1",
+            "\"define FOO 1\" 1",
+            "\"define FOO \\n\"",
+            "\"include \\\"a.hlsl\\\"\"",
+        ] {
+            assert!(restore_expansion(&format!("{prefix}{operands}\n{end}")).is_none());
+        }
+
+        // The end of the prelude was dropped.
+        assert!(restore_expansion(&echo).is_none());
+    }
+
+    #[test]
+    fn test_has_pragma_once() {
+        assert!(has_pragma_once("#pragma once\n"));
+        assert!(has_pragma_once("// guard\n  #  pragma\tonce \r\nfloat x;"));
+        assert!(has_pragma_once("float x;\n#pragma once"));
+        assert!(!has_pragma_once("// #pragma once\n"));
+        assert!(!has_pragma_once("#pragma onceler\n#pragma pack(1)\n"));
+        assert!(!has_pragma_once("#ifndef A\n#define A\n#endif\n"));
+        assert!(!has_pragma_once(""));
+    }
+}
@@ -0,0 +1,84 @@
+use std::str::Utf8Error;
+
+use crate::{
+    DxcBytecode, DxcCompilationError, DxcCompilationStats, DxcCompileOptions,
+    DxcCompileOptionsStrings, DxcDiagnostic, DxcIncludeHandler, DxcIncludeHandlerUserData,
+    DxcResolvedInclude, include_handler_callback, sys, take_result,
+};
+
+/// The source of a shader after preprocessing.
+///
+/// Preprocessing is much cheaper than compiling, and comments, whitespace and unused macros do
+/// not reach its output. Keying a cache on [`hash`](Self::hash), together with the options that
+/// affect code generation, avoids recompiling shaders for edits that cannot change the output.
+pub struct DxcPreprocessedSource {
+    // The shim returns the preprocessed source in place of the bytecode.
+    result: DxcBytecode,
+}
+
+impl DxcPreprocessedSource {
+    pub fn as_bytes(&self) -> &[u8] {
+        // DXC includes the NUL terminator in the size of the blob.
+        let bytes = self.result.as_bytes();
+        bytes.strip_suffix(&[0]).unwrap_or(bytes)
+    }
+
+    /// Returns the preprocessed source as a string. Fails if an include was not valid UTF-8.
+    pub fn as_str(&self) -> Result<&str, Utf8Error> {
+        std::str::from_utf8(self.as_bytes())
+    }
+
+    /// Returns a hash of the preprocessed source. The hash is stable across runs and
+    /// platforms.
+    pub fn hash(&self) -> u128 {
+        self.result
+            .preprocessed_hash()
+            .expect("the shim did not hash the preprocessed source")
+    }
+
+    /// Returns the includes resolved while preprocessing.
+    pub fn includes(&self) -> Vec<DxcResolvedInclude> {
+        self.result.includes()
+    }
+
+    /// Returns the warnings reported while preprocessing, such as by `#warning`.
+    pub fn diagnostics(&self) -> Vec<DxcDiagnostic> {
+        self.result.diagnostics()
+    }
+
+    /// Returns the statistics of the preprocessing. Only the preprocess and include fields are
+    /// set.
+    pub fn stats(&self) -> DxcCompilationStats {
+        self.result.stats()
+    }
+}
+
+/// Preprocesses a shader with the given shim compiler.
+///
+/// # Safety
+///
+/// The caller must have exclusive use of `compiler` for the duration of the call.
+pub(crate) unsafe fn preprocess_raw(
+    compiler: *mut sys::DxcShimCompiler,
+    data: &str,
+    options: &DxcCompileOptions<'_>,
+    include_handler: &dyn DxcIncludeHandler,
+) -> Result<DxcPreprocessedSource, DxcCompilationError> {
+    let options = DxcCompileOptionsStrings::new(options);
+
+    let user_data = DxcIncludeHandlerUserData { include_handler };
+
+    let raw_result = unsafe {
+        sys::dxc_preprocess(
+            compiler,
+            data.as_ptr() as *const std::ffi::c_char,
+            data.len(),
+            options.raw(),
+            include_handler_callback(),
+            &user_data as *const _ as *mut std::ffi::c_void,
+        )
+    };
+
+    let result = unsafe { take_result(raw_result) }?;
+    Ok(DxcPreprocessedSource { result })
+}
@@ -0,0 +1,526 @@
+use std::ffi::{CStr, c_char};
+
+use crate::sys;
+
+/// The type of a descriptor binding. Values match `VkDescriptorType`.
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum DxcDescriptorType {
+    Sampler = 0,
+    CombinedImageSampler = 1,
+    SampledImage = 2,
+    StorageImage = 3,
+    UniformTexelBuffer = 4,
+    StorageTexelBuffer = 5,
+    UniformBuffer = 6,
+    StorageBuffer = 7,
+    InputAttachment = 10,
+    AccelerationStructure = 1000150000,
+}
+
+impl From<sys::DxcShimDescriptorType> for DxcDescriptorType {
+    fn from(descriptor_type: sys::DxcShimDescriptorType) -> Self {
+        match descriptor_type {
+            sys::DxcShimDescriptorType::Sampler => DxcDescriptorType::Sampler,
+            sys::DxcShimDescriptorType::CombinedImageSampler => {
+                DxcDescriptorType::CombinedImageSampler
+            }
+            sys::DxcShimDescriptorType::SampledImage => DxcDescriptorType::SampledImage,
+            sys::DxcShimDescriptorType::StorageImage => DxcDescriptorType::StorageImage,
+            sys::DxcShimDescriptorType::UniformTexelBuffer => DxcDescriptorType::UniformTexelBuffer,
+            sys::DxcShimDescriptorType::StorageTexelBuffer => DxcDescriptorType::StorageTexelBuffer,
+            sys::DxcShimDescriptorType::UniformBuffer => DxcDescriptorType::UniformBuffer,
+            sys::DxcShimDescriptorType::StorageBuffer => DxcDescriptorType::StorageBuffer,
+            sys::DxcShimDescriptorType::InputAttachment => DxcDescriptorType::InputAttachment,
+            sys::DxcShimDescriptorType::AccelerationStructure => {
+                DxcDescriptorType::AccelerationStructure
+            }
+        }
+    }
+}
+
+/// The stage of an entry point. Values match `VkShaderStageFlagBits`.
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum DxcShaderStage {
+    /// The execution model of the entry point is not known to the shim.
+    Unknown = 0,
+    Vertex = 0x1,
+    TessellationControl = 0x2,
+    TessellationEvaluation = 0x4,
+    Geometry = 0x8,
+    Fragment = 0x10,
+    Compute = 0x20,
+    Task = 0x40,
+    Mesh = 0x80,
+    RayGeneration = 0x100,
+    AnyHit = 0x200,
+    ClosestHit = 0x400,
+    Miss = 0x800,
+    Intersection = 0x1000,
+    Callable = 0x2000,
+}
+
+impl From<sys::DxcShimShaderStage> for DxcShaderStage {
+    fn from(stage: sys::DxcShimShaderStage) -> Self {
+        match stage {
+            sys::DxcShimShaderStage::Unknown => DxcShaderStage::Unknown,
+            sys::DxcShimShaderStage::Vertex => DxcShaderStage::Vertex,
+            sys::DxcShimShaderStage::TessellationControl => DxcShaderStage::TessellationControl,
+            sys::DxcShimShaderStage::TessellationEvaluation => {
+                DxcShaderStage::TessellationEvaluation
+            }
+            sys::DxcShimShaderStage::Geometry => DxcShaderStage::Geometry,
+            sys::DxcShimShaderStage::Fragment => DxcShaderStage::Fragment,
+            sys::DxcShimShaderStage::Compute => DxcShaderStage::Compute,
+            sys::DxcShimShaderStage::Task => DxcShaderStage::Task,
+            sys::DxcShimShaderStage::Mesh => DxcShaderStage::Mesh,
+            sys::DxcShimShaderStage::RayGeneration => DxcShaderStage::RayGeneration,
+            sys::DxcShimShaderStage::AnyHit => DxcShaderStage::AnyHit,
+            sys::DxcShimShaderStage::ClosestHit => DxcShaderStage::ClosestHit,
+            sys::DxcShimShaderStage::Miss => DxcShaderStage::Miss,
+            sys::DxcShimShaderStage::Intersection => DxcShaderStage::Intersection,
+            sys::DxcShimShaderStage::Callable => DxcShaderStage::Callable,
+        }
+    }
+}
+
+/// The scalar type of the components of a stage input.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum DxcComponentType {
+    Unknown,
+    Float16,
+    Float32,
+    Float64,
+    Sint16,
+    Sint32,
+    Sint64,
+    Uint16,
+    Uint32,
+    Uint64,
+}
+
+impl From<sys::DxcShimComponentType> for DxcComponentType {
+    fn from(component_type: sys::DxcShimComponentType) -> Self {
+        match component_type {
+            sys::DxcShimComponentType::Unknown => DxcComponentType::Unknown,
+            sys::DxcShimComponentType::Float16 => DxcComponentType::Float16,
+            sys::DxcShimComponentType::Float32 => DxcComponentType::Float32,
+            sys::DxcShimComponentType::Float64 => DxcComponentType::Float64,
+            sys::DxcShimComponentType::Sint16 => DxcComponentType::Sint16,
+            sys::DxcShimComponentType::Sint32 => DxcComponentType::Sint32,
+            sys::DxcShimComponentType::Sint64 => DxcComponentType::Sint64,
+            sys::DxcShimComponentType::Uint16 => DxcComponentType::Uint16,
+            sys::DxcShimComponentType::Uint32 => DxcComponentType::Uint32,
+            sys::DxcShimComponentType::Uint64 => DxcComponentType::Uint64,
+        }
+    }
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct DxcReflectionBinding {
+    pub set: u32,
+    pub binding: u32,
+    pub descriptor_type: DxcDescriptorType,
+
+    /// The number of descriptors. 0 for runtime arrays, whose size is set by the pipeline
+    /// layout.
+    pub count: u32,
+
+    /// The name of the resource, empty if DXC emitted none.
+    pub name: String,
+}
+
+/// An input of the entry point, such as a vertex attribute. Built-ins are not included.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct DxcReflectionInput {
+    pub location: u32,
+    pub component_type: DxcComponentType,
+    pub component_count: u32,
+
+    /// The name of the input, empty if DXC emitted none.
+    pub name: String,
+}
+
+/// The interface of a SPIR-V shader, as needed to build its pipeline layout.
+///
+/// Read by the shim from the decorations of the bytecode, so the SPIR-V does not need to be
+/// parsed again on the Rust side.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct DxcReflection {
+    pub stage: DxcShaderStage,
+
+    /// The size in bytes of the push constant block. 0 if there is none.
+    pub push_constant_size: u32,
+
+    /// The workgroup size of compute, task and mesh shaders. 0 for other stages.
+    pub local_size: [u32; 3],
+
+    pub bindings: Vec<DxcReflectionBinding>,
+    pub inputs: Vec<DxcReflectionInput>,
+}
+
+impl DxcReflection {
+    /// Copies a shim reflection.
+    ///
+    /// # Safety
+    ///
+    /// The tables and names of `reflection` must be valid.
+    pub(crate) unsafe fn from_raw(reflection: &sys::DxcShimReflection) -> Self {
+        let bindings = unsafe { raw_slice(reflection.bindings, reflection.binding_count) }
+            .iter()
+            .map(|binding| DxcReflectionBinding {
+                set: binding.set,
+                binding: binding.binding,
+                descriptor_type: binding.descriptor_type.into(),
+                count: binding.count,
+                name: unsafe { raw_string(binding.name) },
+            })
+            .collect();
+
+        let inputs = unsafe { raw_slice(reflection.inputs, reflection.input_count) }
+            .iter()
+            .map(|input| DxcReflectionInput {
+                location: input.location,
+                component_type: input.component_type.into(),
+                component_count: input.component_count,
+                name: unsafe { raw_string(input.name) },
+            })
+            .collect();
+
+        Self {
+            stage: reflection.stage.into(),
+            push_constant_size: reflection.push_constant_size,
+            local_size: reflection.local_size,
+            bindings,
+            inputs,
+        }
+    }
+}
+
+unsafe fn raw_slice<'a, T>(data: *const T, len: usize) -> &'a [T] {
+    if len == 0 {
+        return &[];
+    }
+
+    unsafe { std::slice::from_raw_parts(data, len) }
+}
+
+unsafe fn raw_string(name: *const c_char) -> String {
+    unsafe { CStr::from_ptr(name) }
+        .to_string_lossy()
+        .into_owned()
+}
+
+#[cfg(test)]
+mod tests {
+    use std::mem::MaybeUninit;
+
+    use super::*;
+
+    const OP_NAME: u32 = 5;
+    const OP_ENTRY_POINT: u32 = 15;
+    const OP_EXECUTION_MODE: u32 = 16;
+    const OP_TYPE_INT: u32 = 21;
+    const OP_TYPE_FLOAT: u32 = 22;
+    const OP_TYPE_VECTOR: u32 = 23;
+    const OP_TYPE_IMAGE: u32 = 25;
+    const OP_TYPE_SAMPLER: u32 = 26;
+    const OP_TYPE_ARRAY: u32 = 28;
+    const OP_TYPE_RUNTIME_ARRAY: u32 = 29;
+    const OP_TYPE_STRUCT: u32 = 30;
+    const OP_TYPE_POINTER: u32 = 32;
+    const OP_CONSTANT: u32 = 43;
+    const OP_VARIABLE: u32 = 59;
+    const OP_DECORATE: u32 = 71;
+    const OP_MEMBER_DECORATE: u32 = 72;
+
+    const DECORATION_BUFFER_BLOCK: u32 = 3;
+    const DECORATION_BUILT_IN: u32 = 11;
+    const DECORATION_LOCATION: u32 = 30;
+    const DECORATION_BINDING: u32 = 33;
+    const DECORATION_DESCRIPTOR_SET: u32 = 34;
+    const DECORATION_OFFSET: u32 = 35;
+
+    const STORAGE_CLASS_UNIFORM_CONSTANT: u32 = 0;
+    const STORAGE_CLASS_INPUT: u32 = 1;
+    const STORAGE_CLASS_UNIFORM: u32 = 2;
+    const STORAGE_CLASS_PUSH_CONSTANT: u32 = 9;
+
+    /// Reflects a module on its own, without a compilation result.
+    fn reflect(words: &[u32]) -> Option<DxcReflection> {
+        let mut reflector = MaybeUninit::<*mut sys::DxcShimReflector>::uninit();
+        let is_valid = unsafe {
+            sys::dxc_reflector_create(words.as_ptr(), words.len(), reflector.as_mut_ptr())
+        };
+        if !is_valid {
+            return None;
+        }
+
+        let reflector = unsafe { reflector.assume_init() };
+
+        // SAFETY: The reflection is owned by the reflector, which is destroyed after the copy.
+        let reflection =
+            unsafe { DxcReflection::from_raw(&*sys::dxc_reflector_get_reflection(reflector)) };
+        unsafe { sys::dxc_reflector_destroy(reflector) };
+        Some(reflection)
+    }
+
+    /// Declares a push constant block of the given type after the types.
+    fn push_constant_module(bound: u32, types: &[Vec<u32>], type_id: u32) -> Vec<u32> {
+        let mut instructions = types.to_vec();
+        instructions.push(op(
+            OP_TYPE_POINTER,
+            &[bound - 2, STORAGE_CLASS_PUSH_CONSTANT, type_id],
+        ));
+        instructions.push(op(
+            OP_VARIABLE,
+            &[bound - 2, bound - 1, STORAGE_CLASS_PUSH_CONSTANT],
+        ));
+        module(bound, &instructions)
+    }
+
+    /// Encodes an instruction.
+    fn op(opcode: u32, operands: &[u32]) -> Vec<u32> {
+        let mut words = vec![((operands.len() as u32 + 1) << 16) | opcode];
+        words.extend_from_slice(operands);
+        words
+    }
+
+    /// Encodes a literal string, NUL-terminated and padded to whole words.
+    fn string(value: &str) -> Vec<u32> {
+        let mut bytes = value.as_bytes().to_vec();
+        bytes.resize(bytes.len() / 4 * 4 + 4, 0);
+        bytes
+            .chunks(4)
+            .map(|chunk| u32::from_le_bytes(chunk.try_into().unwrap()))
+            .collect()
+    }
+
+    fn with_string(operands: &[u32], value: &str) -> Vec<u32> {
+        let mut operands = operands.to_vec();
+        operands.extend(string(value));
+        operands
+    }
+
+    fn module(bound: u32, instructions: &[Vec<u32>]) -> Vec<u32> {
+        let mut words = vec![0x07230203, 0x00010000, 0, bound, 0];
+        for instruction in instructions {
+            words.extend_from_slice(instruction);
+        }
+        words
+    }
+
+    /// A compute shader with a uniform buffer, push constants and an input.
+    fn compute_module() -> Vec<u32> {
+        module(
+            16,
+            &[
+                op(OP_ENTRY_POINT, &with_string(&[5, 1], "main")),
+                op(OP_EXECUTION_MODE, &[1, 17, 8, 4, 1]),
+                op(OP_NAME, &with_string(&[5], "ubo")),
+                op(OP_NAME, &with_string(&[10], "in_position")),
+                op(OP_DECORATE, &[5, DECORATION_DESCRIPTOR_SET, 2]),
+                op(OP_DECORATE, &[5, DECORATION_BINDING, 3]),
+                op(OP_DECORATE, &[10, DECORATION_LOCATION, 1]),
+                op(OP_DECORATE, &[11, DECORATION_BUILT_IN, 0]),
+                op(OP_MEMBER_DECORATE, &[3, 0, DECORATION_OFFSET, 0]),
+                op(OP_MEMBER_DECORATE, &[3, 1, DECORATION_OFFSET, 16]),
+                op(OP_TYPE_FLOAT, &[2, 32]),
+                op(OP_TYPE_STRUCT, &[3, 2, 2]),
+                op(OP_TYPE_POINTER, &[4, STORAGE_CLASS_UNIFORM, 3]),
+                op(OP_VARIABLE, &[4, 5, STORAGE_CLASS_UNIFORM]),
+                op(OP_TYPE_POINTER, &[6, STORAGE_CLASS_PUSH_CONSTANT, 3]),
+                op(OP_VARIABLE, &[6, 7, STORAGE_CLASS_PUSH_CONSTANT]),
+                op(OP_TYPE_VECTOR, &[8, 2, 4]),
+                op(OP_TYPE_POINTER, &[9, STORAGE_CLASS_INPUT, 8]),
+                op(OP_VARIABLE, &[9, 10, STORAGE_CLASS_INPUT]),
+                op(OP_VARIABLE, &[9, 11, STORAGE_CLASS_INPUT]),
+            ],
+        )
+    }
+
+    #[test]
+    fn test_reflect_compute() {
+        let reflection = reflect(&compute_module()).unwrap();
+        assert_eq!(reflection.stage, DxcShaderStage::Compute);
+        assert_eq!(reflection.local_size, [8, 4, 1]);
+        assert_eq!(reflection.push_constant_size, 20);
+        assert_eq!(
+            reflection.bindings,
+            [DxcReflectionBinding {
+                set: 2,
+                binding: 3,
+                descriptor_type: DxcDescriptorType::UniformBuffer,
+                count: 1,
+                name: "ubo".to_string(),
+            }]
+        );
+
+        // The built-in input is left out.
+        assert_eq!(
+            reflection.inputs,
+            [DxcReflectionInput {
+                location: 1,
+                component_type: DxcComponentType::Float32,
+                component_count: 4,
+                name: "in_position".to_string(),
+            }]
+        );
+    }
+
+    #[test]
+    fn test_reflect_descriptor_arrays() {
+        let words = module(
+            16,
+            &[
+                op(OP_ENTRY_POINT, &with_string(&[4, 1], "main")),
+                op(OP_DECORATE, &[6, DECORATION_BINDING, 0]),
+                op(OP_DECORATE, &[9, DECORATION_BINDING, 1]),
+                op(OP_DECORATE, &[11, DECORATION_BUFFER_BLOCK, 0]),
+                op(OP_DECORATE, &[13, DECORATION_BINDING, 2]),
+                op(OP_TYPE_INT, &[2, 32, 0]),
+                op(OP_CONSTANT, &[2, 3, 4]),
+                op(OP_TYPE_SAMPLER, &[4]),
+                op(OP_TYPE_ARRAY, &[5, 4, 3]),
+                op(OP_TYPE_POINTER, &[7, STORAGE_CLASS_UNIFORM_CONSTANT, 5]),
+                op(OP_VARIABLE, &[7, 6, STORAGE_CLASS_UNIFORM_CONSTANT]),
+                op(OP_TYPE_FLOAT, &[14, 32]),
+                op(OP_TYPE_IMAGE, &[8, 14, 1, 0, 0, 0, 2, 0]),
+                op(OP_TYPE_RUNTIME_ARRAY, &[15, 8]),
+                op(OP_TYPE_POINTER, &[10, STORAGE_CLASS_UNIFORM_CONSTANT, 15]),
+                op(OP_VARIABLE, &[10, 9, STORAGE_CLASS_UNIFORM_CONSTANT]),
+                op(OP_TYPE_STRUCT, &[11, 2]),
+                op(OP_TYPE_POINTER, &[12, STORAGE_CLASS_UNIFORM, 11]),
+                op(OP_VARIABLE, &[12, 13, STORAGE_CLASS_UNIFORM]),
+            ],
+        );
+
+        let reflection = reflect(&words).unwrap();
+        assert_eq!(reflection.stage, DxcShaderStage::Fragment);
+        let bindings: Vec<_> = reflection
+            .bindings
+            .iter()
+            .map(|binding| (binding.binding, binding.descriptor_type, binding.count))
+            .collect();
+        assert_eq!(
+            bindings,
+            [
+                (0, DxcDescriptorType::Sampler, 4),
+                (1, DxcDescriptorType::StorageImage, 0),
+                (2, DxcDescriptorType::StorageBuffer, 1),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_reflect_unknown_execution_model() {
+        let words = module(2, &[op(OP_ENTRY_POINT, &with_string(&[42, 1], "main"))]);
+        let reflection = reflect(&words).unwrap();
+        assert_eq!(reflection.stage, DxcShaderStage::Unknown);
+        assert!(reflection.bindings.is_empty());
+        assert!(reflection.inputs.is_empty());
+    }
+
+    #[test]
+    fn test_reflect_ignores_out_of_bound_ids() {
+        let words = module(
+            4,
+            &[
+                op(OP_NAME, &with_string(&[100], "stray")),
+                op(OP_DECORATE, &[100, DECORATION_BINDING, 0]),
+                op(OP_VARIABLE, &[3, 100, STORAGE_CLASS_UNIFORM]),
+            ],
+        );
+        let reflection = reflect(&words).unwrap();
+        assert!(reflection.bindings.is_empty());
+    }
+
+    #[test]
+    fn test_reflect_rejects_malformed_modules() {
+        assert!(reflect(&[]).is_none());
+        assert!(reflect(&[0x07230203, 0x00010000, 0, 1]).is_none());
+
+        let mut words = compute_module();
+        words[0] = 0x03022307;
+        assert!(reflect(&words).is_none());
+
+        // An instruction of length 0, and one running past the end of the module.
+        assert!(reflect(&module(2, &[vec![OP_NAME]])).is_none());
+        let mut words = compute_module();
+        words.truncate(words.len() - 1);
+        assert!(reflect(&words).is_none());
+    }
+
+    #[test]
+    fn test_reflect_rejects_implausible_sizes() {
+        // A bound far past the size of the module, which would still fit in memory.
+        let mut words = compute_module();
+        words[3] = 1 << 20;
+        assert!(reflect(&words).is_none());
+
+        // A member index past the limit of the specification.
+        let words = module(
+            4,
+            &[op(
+                OP_MEMBER_DECORATE,
+                &[3, 0xffff_fff0, DECORATION_OFFSET, 0],
+            )],
+        );
+        assert!(reflect(&words).is_none());
+
+        // The largest member index allowed.
+        let words = module(
+            4,
+            &[op(OP_MEMBER_DECORATE, &[3, 16382, DECORATION_OFFSET, 0])],
+        );
+        assert!(reflect(&words).is_some());
+    }
+
+    #[test]
+    fn test_reflect_shared_member_types() {
+        // Every struct holds 16 members of the struct before it.
+        let mut types = vec![op(OP_TYPE_FLOAT, &[1, 32])];
+        for id in 2..=3 {
+            types.push(op(OP_TYPE_STRUCT, &[&[id][..], &[id - 1; 16]].concat()));
+        }
+        let reflection = reflect(&push_constant_module(6, &types, 3)).unwrap();
+        assert_eq!(reflection.push_constant_size, 4 * 16 * 16);
+
+        // Each struct is sized once instead of once per path to it, and the size saturates.
+        for id in 4..=32 {
+            types.push(op(OP_TYPE_STRUCT, &[&[id][..], &[id - 1; 16]].concat()));
+        }
+        let reflection = reflect(&push_constant_module(35, &types, 32)).unwrap();
+        assert_eq!(reflection.push_constant_size, u32::MAX);
+    }
+
+    #[test]
+    fn test_reflect_self_containing_struct() {
+        let types = [op(OP_TYPE_STRUCT, &[1, 1, 1])];
+        let reflection = reflect(&push_constant_module(4, &types, 1)).unwrap();
+        assert_eq!(reflection.push_constant_size, 0);
+    }
+
+    #[test]
+    fn test_reflect_saturates_sizes() {
+        // An array of 2^31 floats.
+        let types = [
+            op(OP_TYPE_FLOAT, &[1, 32]),
+            op(OP_TYPE_INT, &[2, 32, 0]),
+            op(OP_CONSTANT, &[2, 3, 0x8000_0000]),
+            op(OP_TYPE_ARRAY, &[4, 1, 3]),
+        ];
+        let reflection = reflect(&push_constant_module(7, &types, 4)).unwrap();
+        assert_eq!(reflection.push_constant_size, u32::MAX);
+
+        // A member ending past 4 GiB.
+        let types = [
+            op(OP_MEMBER_DECORATE, &[2, 0, DECORATION_OFFSET, 0xffff_fffe]),
+            op(OP_TYPE_FLOAT, &[1, 32]),
+            op(OP_TYPE_STRUCT, &[2, 1]),
+        ];
+        let reflection = reflect(&push_constant_module(5, &types, 2)).unwrap();
+        assert_eq!(reflection.push_constant_size, u32::MAX);
+    }
+}
@@ -0,0 +1,624 @@
+use std::{
+    ffi::CString,
+    mem::MaybeUninit,
+    sync::{Arc, Mutex},
+    time::Duration,
+};
+
+use crate::{DxcCache, sys};
+
+#[derive(thiserror::Error, Debug)]
+pub enum DxcRemoteCacheError {
+    #[error("invalid host")]
+    InvalidHost,
+    #[error("failed to spawn upload thread")]
+    SpawnThreadError,
+    #[error("failed to listen on address")]
+    ListenError,
+}
+
+/// A backend of a [`DxcRemoteCache`], such as a client of an HTTP cache shared by a build farm.
+pub trait DxcRemoteCacheBackend: Send + Sync {
+    /// Looks up many keys at once. Returns the bytecode of every key, in the same order, or
+    /// `None` for the keys that are not cached.
+    ///
+    /// Called from the compiling threads, but never for two batches at once.
+    fn lookup(&self, keys: &[u128]) -> Vec<Option<Vec<u8>>>;
+
+    /// Stores the bytecode of a key. Called from the upload thread of the cache.
+    fn store(&self, key: u128, bytecode: &[u8]);
+}
+
+/// A cache of compiled bytecode shared between machines, so a shader compiled once anywhere in
+/// a build farm is a download everywhere else.
+///
+/// Set on a [`crate::DxcCompiler`] or [`crate::DxcCompilerPool`], it is consulted after a miss in
+/// the local [`DxcCache`], which then keeps a copy of the download, and receives every shader
+/// compiled after a miss. Lookups of concurrent compilations are batched into a single request.
+/// Uploads are queued and run on a thread of the cache, so compilations never wait on them.
+pub struct DxcRemoteCache {
+    pub(crate) inner: *mut sys::DxcShimRemoteCache,
+}
+
+// SAFETY: The shim remote cache synchronizes its lookups and upload queue, and the backend is
+// `Send + Sync`.
+unsafe impl Send for DxcRemoteCache {}
+unsafe impl Sync for DxcRemoteCache {}
+
+impl DxcRemoteCache {
+    /// Creates a remote cache in front of the given backend.
+    pub fn new(
+        backend: impl DxcRemoteCacheBackend + 'static,
+    ) -> Result<Arc<Self>, DxcRemoteCacheError> {
+        let backend: Box<Box<dyn DxcRemoteCacheBackend>> = Box::new(Box::new(backend));
+
+        // Ownership of the backend moves to the shim, which hands it back to
+        // [`dxc_remote_cache_backend_release`] once the cache is destroyed.
+        let backend = sys::DxcShimRemoteCacheBackend {
+            lookup: Some(dxc_remote_cache_backend_lookup),
+            store: Some(dxc_remote_cache_backend_store),
+            release: Some(dxc_remote_cache_backend_release),
+            user_data: Box::into_raw(backend) as *mut std::ffi::c_void,
+        };
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimRemoteCache>::uninit();
+        let status = unsafe { sys::dxc_remote_cache_create(&backend, inner.as_mut_ptr()) };
+
+        match status {
+            sys::DxcShimStatus::Ok => {
+                let inner = unsafe { inner.assume_init() };
+                Ok(Arc::new(Self { inner }))
+            }
+            sys::DxcShimStatus::SpawnThreadError => {
+                unsafe { dxc_remote_cache_backend_release(backend.user_data) };
+                Err(DxcRemoteCacheError::SpawnThreadError)
+            }
+            _ => unreachable!(),
+        }
+    }
+
+    /// Creates a remote cache talking to a [`DxcCacheServer`] at the given host and port.
+    ///
+    /// Does not connect until the first lookup or upload. Connections and requests time out
+    /// after the given timeout, after which the server is skipped for a few seconds, so an
+    /// unreachable server does not slow down every compilation.
+    pub fn connect(
+        host: &str,
+        port: u16,
+        timeout: Duration,
+    ) -> Result<Arc<Self>, DxcRemoteCacheError> {
+        let host = CString::new(host).map_err(|_| DxcRemoteCacheError::InvalidHost)?;
+        let timeout = timeout.as_millis().clamp(1, u32::MAX as u128) as u32;
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimRemoteCache>::uninit();
+        let status = unsafe {
+            sys::dxc_remote_cache_connect(host.as_ptr(), port, timeout, inner.as_mut_ptr())
+        };
+
+        match status {
+            sys::DxcShimStatus::Ok => {
+                let inner = unsafe { inner.assume_init() };
+                Ok(Arc::new(Self { inner }))
+            }
+            sys::DxcShimStatus::SpawnThreadError => Err(DxcRemoteCacheError::SpawnThreadError),
+            _ => unreachable!(),
+        }
+    }
+
+    /// Waits until every queued upload has been handed to the backend.
+    pub fn flush(&self) {
+        unsafe { sys::dxc_remote_cache_flush(self.inner) };
+    }
+}
+
+impl Drop for DxcRemoteCache {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_remote_cache_destroy(self.inner) };
+    }
+}
+
+unsafe extern "C" fn dxc_remote_cache_backend_lookup(
+    user_data: *mut std::ffi::c_void,
+    keys: *const sys::DxcShimHash,
+    count: usize,
+    entries: *mut sys::DxcShimRemoteCacheEntry,
+) {
+    let backend = unsafe { &*(user_data as *const Box<dyn DxcRemoteCacheBackend>) };
+    let keys = unsafe { std::slice::from_raw_parts(keys, count) };
+    let entries = unsafe { std::slice::from_raw_parts_mut(entries, count) };
+
+    let keys: Vec<u128> = keys.iter().map(|&key| key.into()).collect();
+    let bytecodes = backend.lookup(&keys);
+
+    for (entry, bytecode) in entries.iter_mut().zip(bytecodes) {
+        let Some(bytecode) = bytecode else {
+            continue;
+        };
+
+        // Ownership of the bytecode moves to the shim, which hands it back to
+        // [`dxc_remote_cache_entry_release`] once the bytecode blob is released.
+        let bytecode = Box::new(bytecode);
+        *entry = sys::DxcShimRemoteCacheEntry {
+            data: bytecode.as_ptr() as *const std::ffi::c_void,
+            size: bytecode.len(),
+            release: Some(dxc_remote_cache_entry_release),
+            release_context: Box::into_raw(bytecode) as *mut std::ffi::c_void,
+        };
+    }
+}
+
+unsafe extern "C" fn dxc_remote_cache_backend_store(
+    user_data: *mut std::ffi::c_void,
+    key: *const sys::DxcShimHash,
+    data: *const std::ffi::c_void,
+    size: usize,
+) {
+    let backend = unsafe { &*(user_data as *const Box<dyn DxcRemoteCacheBackend>) };
+    let bytecode = unsafe { std::slice::from_raw_parts(data as *const u8, size) };
+    backend.store(unsafe { *key }.into(), bytecode);
+}
+
+unsafe extern "C" fn dxc_remote_cache_backend_release(user_data: *mut std::ffi::c_void) {
+    drop(unsafe { Box::from_raw(user_data as *mut Box<dyn DxcRemoteCacheBackend>) });
+}
+
+unsafe extern "C" fn dxc_remote_cache_entry_release(context: *mut std::ffi::c_void) {
+    drop(unsafe { Box::from_raw(context as *mut Vec<u8>) });
+}
+
+/// Shares a [`DxcCache`] over TCP with the [`DxcRemoteCache`]s of other machines.
+///
+/// Every connection is served by a thread of its own. The protocol has no authentication, so
+/// the server should only be reachable from trusted machines.
+pub struct DxcCacheServer {
+    _cache: Arc<DxcCache>,
+    inner: *mut sys::DxcShimCacheServer,
+    run_lock: Mutex<()>,
+}
+
+// SAFETY: Stopping the shim server only writes to a pipe, and runs are serialized by the lock.
+unsafe impl Send for DxcCacheServer {}
+unsafe impl Sync for DxcCacheServer {}
+
+impl DxcCacheServer {
+    /// Listens on the given host and port. `None` listens on all addresses, and a port of 0
+    /// picks a free port.
+    pub fn bind(
+        cache: Arc<DxcCache>,
+        host: Option<&str>,
+        port: u16,
+    ) -> Result<Arc<Self>, DxcRemoteCacheError> {
+        let host = match host {
+            Some(host) => Some(CString::new(host).map_err(|_| DxcRemoteCacheError::InvalidHost)?),
+            None => None,
+        };
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCacheServer>::uninit();
+        let status = unsafe {
+            sys::dxc_cache_server_create(
+                cache.inner,
+                host.as_ref().map_or(std::ptr::null(), |host| host.as_ptr()),
+                port,
+                inner.as_mut_ptr(),
+            )
+        };
+
+        match status {
+            sys::DxcShimStatus::Ok => {
+                let inner = unsafe { inner.assume_init() };
+                Ok(Arc::new(Self {
+                    _cache: cache,
+                    inner,
+                    run_lock: Mutex::new(()),
+                }))
+            }
+            sys::DxcShimStatus::ServerListenError => Err(DxcRemoteCacheError::ListenError),
+            _ => unreachable!(),
+        }
+    }
+
+    /// Returns the port the server listens on.
+    pub fn port(&self) -> u16 {
+        unsafe { sys::dxc_cache_server_get_port(self.inner) }
+    }
+
+    /// Serves connections until [`DxcCacheServer::stop`] is called.
+    pub fn run(&self) {
+        let _guard = self
+            .run_lock
+            .lock()
+            .unwrap_or_else(|error| error.into_inner());
+        unsafe { sys::dxc_cache_server_run(self.inner) };
+    }
+
+    /// Makes [`DxcCacheServer::run`] return, once its connections are closed.
+    pub fn stop(&self) {
+        unsafe { sys::dxc_cache_server_stop(self.inner) };
+    }
+}
+
+impl Drop for DxcCacheServer {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_cache_server_destroy(self.inner) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::{
+        io::{Read, Write},
+        net::{TcpListener, TcpStream},
+        path::PathBuf,
+        thread::JoinHandle,
+        time::Instant,
+    };
+
+    use super::*;
+
+    const CACHE_LOOKUP: u32 = 5;
+    const CACHE_LOOKUP_RESULT: u32 = 6;
+    const CACHE_STORE: u32 = 7;
+
+    const TIMEOUT_MILLISECONDS: u32 = 5000;
+
+    /// A cache server running on a thread, on a cache of its own.
+    struct TestServer {
+        directory: PathBuf,
+        cache: Arc<DxcCache>,
+        server: Arc<DxcCacheServer>,
+        thread: Option<JoinHandle<()>>,
+    }
+
+    impl TestServer {
+        fn start(name: &str, port: u16) -> Self {
+            let directory = std::env::temp_dir().join(format!(
+                "vislum-dxc-remote-cache-test-{}-{name}",
+                std::process::id()
+            ));
+            let _ = std::fs::remove_dir_all(&directory);
+
+            let cache = DxcCache::open(&directory).unwrap();
+            let server = DxcCacheServer::bind(cache.clone(), Some("127.0.0.1"), port).unwrap();
+            let thread = std::thread::spawn({
+                let server = server.clone();
+                move || server.run()
+            });
+            Self {
+                directory,
+                cache,
+                server,
+                thread: Some(thread),
+            }
+        }
+
+        fn port(&self) -> u16 {
+            self.server.port()
+        }
+
+        fn store(&self, key: u128, data: &[u8]) {
+            let key = sys::DxcShimHash::from(key);
+            unsafe {
+                sys::dxc_cache_store(
+                    self.cache.inner,
+                    &key,
+                    data.as_ptr() as *const std::ffi::c_void,
+                    data.len(),
+                )
+            };
+        }
+
+        fn contains(&self, key: u128) -> bool {
+            let key = sys::DxcShimHash::from(key);
+            let mut size = 0;
+            unsafe {
+                sys::dxc_cache_load(self.cache.inner, &key, std::ptr::null_mut(), 0, &mut size)
+            }
+        }
+    }
+
+    impl Drop for TestServer {
+        fn drop(&mut self) {
+            self.server.stop();
+            self.thread.take().unwrap().join().unwrap();
+            let _ = std::fs::remove_dir_all(&self.directory);
+        }
+    }
+
+    /// The TCP backend of [`DxcRemoteCache::connect`], called directly.
+    struct TcpBackend {
+        inner: *mut sys::DxcShimTcpCacheBackend,
+    }
+
+    impl TcpBackend {
+        fn new(port: u16, retry_delay: Duration) -> Self {
+            let host = CString::new("127.0.0.1").unwrap();
+            let mut inner = std::ptr::null_mut();
+            unsafe {
+                sys::dxc_tcp_cache_backend_create(
+                    host.as_ptr(),
+                    port,
+                    TIMEOUT_MILLISECONDS,
+                    retry_delay.as_millis() as u32,
+                    &mut inner,
+                )
+            };
+            Self { inner }
+        }
+
+        fn lookup(&self, keys: &[u128]) -> Vec<Option<Vec<u8>>> {
+            let keys: Vec<sys::DxcShimHash> = keys.iter().map(|&key| key.into()).collect();
+            let mut entries = vec![
+                sys::DxcShimRemoteCacheEntry {
+                    data: std::ptr::null(),
+                    size: 0,
+                    release: None,
+                    release_context: std::ptr::null_mut(),
+                };
+                keys.len()
+            ];
+            unsafe {
+                sys::dxc_tcp_cache_backend_lookup(
+                    self.inner,
+                    keys.as_ptr(),
+                    keys.len(),
+                    entries.as_mut_ptr(),
+                )
+            };
+
+            entries
+                .iter()
+                .map(|entry| {
+                    (!entry.data.is_null()).then(|| {
+                        unsafe { std::slice::from_raw_parts(entry.data as *const u8, entry.size) }
+                            .to_vec()
+                    })
+                })
+                .collect()
+        }
+
+        fn store(&self, key: u128, bytecode: &[u8]) {
+            let key = sys::DxcShimHash::from(key);
+            unsafe {
+                sys::dxc_tcp_cache_backend_store(
+                    self.inner,
+                    &key,
+                    bytecode.as_ptr() as *const std::ffi::c_void,
+                    bytecode.len(),
+                )
+            };
+        }
+    }
+
+    impl Drop for TcpBackend {
+        fn drop(&mut self) {
+            unsafe { sys::dxc_tcp_cache_backend_destroy(self.inner) };
+        }
+    }
+
+    /// Encodes a message of the cache protocol, announcing the given payload size.
+    fn message_with_size(message_type: u32, size: u32, payload: &[u8]) -> Vec<u8> {
+        let mut message = Vec::new();
+        message.extend_from_slice(&message_type.to_ne_bytes());
+        message.extend_from_slice(&size.to_ne_bytes());
+        message.extend_from_slice(payload);
+        message
+    }
+
+    fn message(message_type: u32, payload: &[u8]) -> Vec<u8> {
+        message_with_size(message_type, payload.len() as u32, payload)
+    }
+
+    fn append_key(payload: &mut Vec<u8>, key: u128) {
+        let key = sys::DxcShimHash::from(key);
+        payload.extend_from_slice(&key.high.to_ne_bytes());
+        payload.extend_from_slice(&key.low.to_ne_bytes());
+    }
+
+    fn append_string(payload: &mut Vec<u8>, data: &[u8]) {
+        payload.extend_from_slice(&(data.len() as u32).to_ne_bytes());
+        payload.extend_from_slice(data);
+        payload.push(0);
+    }
+
+    fn connect(port: u16) -> TcpStream {
+        let stream = TcpStream::connect(("127.0.0.1", port)).unwrap();
+        stream
+            .set_read_timeout(Some(Duration::from_secs(10)))
+            .unwrap();
+        stream
+    }
+
+    /// Sends the bytes on a new connection, and asserts the server closes it without replying.
+    fn assert_dropped(port: u16, bytes: &[u8]) {
+        let mut stream = connect(port);
+        stream.write_all(bytes).unwrap();
+
+        let mut reply = [0u8; 1];
+        match stream.read(&mut reply) {
+            Ok(count) => assert_eq!(count, 0, "the server replied"),
+            Err(error) => assert_eq!(error.kind(), std::io::ErrorKind::ConnectionReset),
+        }
+    }
+
+    /// Answers the first message of a single connection with the given bytes, then waits for the
+    /// client to close it.
+    fn reply_once(reply: Vec<u8>) -> (u16, JoinHandle<()>) {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let port = listener.local_addr().unwrap().port();
+        let thread = std::thread::spawn(move || {
+            let (mut stream, _) = listener.accept().unwrap();
+            let mut header = [0u8; 8];
+            stream.read_exact(&mut header).unwrap();
+            let size = u32::from_ne_bytes(header[4..].try_into().unwrap());
+            std::io::copy(&mut (&mut stream).take(size as u64), &mut std::io::sink()).unwrap();
+
+            stream.write_all(&reply).unwrap();
+            let _ = stream.read_to_end(&mut Vec::new());
+        });
+        (port, thread)
+    }
+
+    #[test]
+    fn test_batch_lookup() {
+        let server = TestServer::start("batch", 0);
+        server.store(1, b"first");
+        server.store(3, b"third");
+
+        let backend = TcpBackend::new(server.port(), Duration::from_secs(5));
+        assert_eq!(
+            backend.lookup(&[1, 2, 3, 4, 1]),
+            [
+                Some(b"first".to_vec()),
+                None,
+                Some(b"third".to_vec()),
+                None,
+                Some(b"first".to_vec()),
+            ]
+        );
+
+        // The connection and its buffers are reused by later batches.
+        assert_eq!(backend.lookup(&[]), []);
+        assert_eq!(backend.lookup(&[4, 3]), [None, Some(b"third".to_vec())]);
+    }
+
+    #[test]
+    fn test_store_then_lookup() {
+        let server = TestServer::start("store", 0);
+        let backend = TcpBackend::new(server.port(), Duration::from_secs(5));
+
+        // Larger than a chunk of the server's receive buffer.
+        let large: Vec<u8> = (0..3 << 20).map(|i| (i % 251) as u8).collect();
+        backend.store(1, b"uploaded");
+        backend.store(2, &large);
+
+        // Stores are not answered, so they are only visible once the server has written them.
+        let deadline = Instant::now() + Duration::from_secs(10);
+        let mut entries = backend.lookup(&[1, 2]);
+        while entries.iter().any(Option::is_none) && Instant::now() < deadline {
+            std::thread::sleep(Duration::from_millis(10));
+            entries = backend.lookup(&[1, 2]);
+        }
+        assert_eq!(entries, [Some(b"uploaded".to_vec()), Some(large)]);
+    }
+
+    #[test]
+    fn test_backoff_after_failed_connection() {
+        let retry_delay = Duration::from_millis(500);
+
+        // A port nothing listens on, until the server is started on it.
+        let port = TcpListener::bind("127.0.0.1:0")
+            .unwrap()
+            .local_addr()
+            .unwrap()
+            .port();
+        let retrying = TcpBackend::new(port, retry_delay);
+        let waiting = TcpBackend::new(port, Duration::from_secs(5));
+
+        let failure = Instant::now();
+        assert_eq!(retrying.lookup(&[1]), [None]);
+        assert_eq!(waiting.lookup(&[1]), [None]);
+        waiting.store(2, b"refused");
+
+        let server = TestServer::start("backoff", port);
+        server.store(1, b"bytecode");
+
+        // Until the retry delay of a connection has passed, lookups miss and stores are dropped
+        // without connecting.
+        if failure.elapsed() < retry_delay * 4 / 5 {
+            assert_eq!(retrying.lookup(&[1]), [None]);
+        }
+        assert_eq!(waiting.lookup(&[1]), [None]);
+        waiting.store(2, b"dropped");
+
+        std::thread::sleep(retry_delay.saturating_sub(failure.elapsed()) + retry_delay / 10);
+        assert_eq!(retrying.lookup(&[1]), [Some(b"bytecode".to_vec())]);
+        assert_eq!(waiting.lookup(&[1]), [None]);
+        assert!(!server.contains(2));
+    }
+
+    #[test]
+    fn test_server_drops_invalid_messages() {
+        let server = TestServer::start("invalid", 0);
+        server.store(1, b"bytecode");
+        let port = server.port();
+
+        // A valid lookup on a raw connection is answered.
+        let mut lookup = 1u32.to_ne_bytes().to_vec();
+        append_key(&mut lookup, 1);
+        let mut stream = connect(port);
+        stream.write_all(&message(CACHE_LOOKUP, &lookup)).unwrap();
+        let mut header = [0u8; 8];
+        stream.read_exact(&mut header).unwrap();
+        assert_eq!(
+            u32::from_ne_bytes(header[..4].try_into().unwrap()),
+            CACHE_LOOKUP_RESULT
+        );
+        drop(stream);
+
+        // An unknown message type.
+        assert_dropped(port, &message(99, &[]));
+        assert_dropped(port, &message(CACHE_LOOKUP_RESULT, &[0; 4]));
+
+        // A payload larger than any request, dropped before it is sent.
+        assert_dropped(port, &message_with_size(CACHE_STORE, (64 << 20) + 1, &[]));
+
+        // A lookup of more keys than its payload holds.
+        let mut lookup = 2u32.to_ne_bytes().to_vec();
+        append_key(&mut lookup, 1);
+        assert_dropped(port, &message(CACHE_LOOKUP, &lookup));
+        assert_dropped(port, &message(CACHE_LOOKUP, &[]));
+
+        // A store whose bytecode overruns its payload, or misses its NUL.
+        let mut store = Vec::new();
+        append_key(&mut store, 2);
+        append_string(&mut store, b"bytecode");
+        store.pop();
+        assert_dropped(port, &message(CACHE_STORE, &store));
+        store.push(1);
+        assert_dropped(port, &message(CACHE_STORE, &store));
+
+        // Closing a connection mid-message does not bother the server either.
+        let mut stream = connect(port);
+        stream
+            .write_all(&message(CACHE_LOOKUP, &lookup)[..6])
+            .unwrap();
+        drop(stream);
+
+        assert!(!server.contains(2));
+        let backend = TcpBackend::new(port, Duration::from_secs(5));
+        assert_eq!(backend.lookup(&[1, 2]), [Some(b"bytecode".to_vec()), None]);
+    }
+
+    #[test]
+    fn test_backend_drops_invalid_replies() {
+        // A reply of the wrong type.
+        let (port, thread) = reply_once(message(CACHE_STORE, &[0; 4]));
+        let backend = TcpBackend::new(port, Duration::from_secs(5));
+        assert_eq!(backend.lookup(&[1]), [None]);
+        drop(backend);
+        thread.join().unwrap();
+
+        // A reply larger than any message.
+        let (port, thread) = reply_once(message_with_size(CACHE_LOOKUP_RESULT, u32::MAX, &[]));
+        let backend = TcpBackend::new(port, Duration::from_secs(5));
+        assert_eq!(backend.lookup(&[1]), [None]);
+        drop(backend);
+        thread.join().unwrap();
+
+        // A reply whose second entry overruns it keeps the first one.
+        let mut reply = Vec::new();
+        reply.extend_from_slice(&1u32.to_ne_bytes());
+        append_string(&mut reply, b"first");
+        reply.extend_from_slice(&1u32.to_ne_bytes());
+        reply.extend_from_slice(&100u32.to_ne_bytes());
+        reply.extend_from_slice(b"second");
+        let (port, thread) = reply_once(message(CACHE_LOOKUP_RESULT, &reply));
+        let backend = TcpBackend::new(port, Duration::from_secs(5));
+        assert_eq!(
+            backend.lookup(&[1, 2, 3]),
+            [Some(b"first".to_vec()), None, None]
+        );
+        drop(backend);
+        thread.join().unwrap();
+    }
+}
@@ -0,0 +1,234 @@
+//! Tests of the work queue and the priority gate the shim schedules the jobs of batches and
+//! pools with.
+
+use std::{
+    sync::{
+        Arc,
+        atomic::{AtomicUsize, Ordering},
+    },
+    time::{Duration, Instant},
+};
+
+use crate::sys::{self, DxcShimPriority};
+
+/// How long a thread is given to get past a point it should not.
+const BLOCKED_DELAY: Duration = Duration::from_millis(50);
+
+struct WorkQueue(*mut sys::DxcShimIntegerWorkQueue);
+
+// SAFETY: The shim work queue is synchronized.
+unsafe impl Send for WorkQueue {}
+unsafe impl Sync for WorkQueue {}
+
+impl WorkQueue {
+    fn new(worker_count: usize) -> Arc<Self> {
+        let mut queue = std::ptr::null_mut();
+        unsafe { sys::dxc_work_queue_create(worker_count, &mut queue) };
+        Arc::new(Self(queue))
+    }
+
+    fn push(&self, item: u64, priority: DxcShimPriority) {
+        unsafe { sys::dxc_work_queue_push(self.0, item, priority) };
+    }
+
+    fn pop(&self, worker_index: usize) -> Option<u64> {
+        let mut item = 0;
+        unsafe { sys::dxc_work_queue_pop(self.0, worker_index, &mut item) }.then_some(item)
+    }
+
+    fn stop(&self) -> Vec<u64> {
+        let mut items = vec![0; 64];
+        let count = unsafe { sys::dxc_work_queue_stop(self.0, items.as_mut_ptr(), items.len()) };
+        assert!(count <= items.len());
+        items.truncate(count);
+        items
+    }
+}
+
+impl Drop for WorkQueue {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_work_queue_destroy(self.0) };
+    }
+}
+
+struct PriorityGate(*mut sys::DxcShimPriorityGate);
+
+// SAFETY: The shim priority gate is synchronized.
+unsafe impl Send for PriorityGate {}
+unsafe impl Sync for PriorityGate {}
+
+impl PriorityGate {
+    fn new() -> Arc<Self> {
+        let mut gate = std::ptr::null_mut();
+        unsafe { sys::dxc_priority_gate_create(&mut gate) };
+        Arc::new(Self(gate))
+    }
+
+    fn enter(&self, priority: DxcShimPriority) -> PriorityScope<'_> {
+        let mut scope = std::ptr::null_mut();
+        unsafe { sys::dxc_priority_scope_enter(self.0, priority, &mut scope) };
+        PriorityScope(scope, std::marker::PhantomData)
+    }
+}
+
+impl Drop for PriorityGate {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_priority_gate_destroy(self.0) };
+    }
+}
+
+struct PriorityScope<'a>(
+    *mut sys::DxcShimPriorityScope,
+    std::marker::PhantomData<&'a PriorityGate>,
+);
+
+impl Drop for PriorityScope<'_> {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_priority_scope_leave(self.0) };
+    }
+}
+
+/// Waits until a count reaches a value, failing after a while.
+fn wait_for_count(count: &AtomicUsize, value: usize) {
+    let start = Instant::now();
+    while count.load(Ordering::SeqCst) < value {
+        assert!(
+            start.elapsed() < Duration::from_secs(10),
+            "timed out waiting for {value}"
+        );
+        std::thread::sleep(Duration::from_millis(1));
+    }
+}
+
+#[test]
+fn test_queue_priority_order() {
+    let queue = WorkQueue::new(1);
+    queue.push(1, DxcShimPriority::Background);
+    queue.push(2, DxcShimPriority::Normal);
+    queue.push(3, DxcShimPriority::Interactive);
+    queue.push(4, DxcShimPriority::Normal);
+    queue.push(5, DxcShimPriority::Background);
+    queue.push(6, DxcShimPriority::Interactive);
+
+    let items: Vec<u64> = (0..6).map(|_| queue.pop(0).unwrap()).collect();
+    assert_eq!(items, [3, 6, 2, 4, 1, 5]);
+    assert!(queue.stop().is_empty());
+    assert_eq!(queue.pop(0), None);
+}
+
+#[test]
+fn test_queue_stealing() {
+    // Items are pushed onto the workers in turn, so worker 0 owns the even ones.
+    let queue = WorkQueue::new(2);
+    for item in 0..6 {
+        queue.push(item, DxcShimPriority::Normal);
+    }
+
+    // Own items are taken from the front, then stolen ones from the back.
+    let items: Vec<u64> = (0..6).map(|_| queue.pop(0).unwrap()).collect();
+    assert_eq!(items, [0, 2, 4, 5, 3, 1]);
+
+    // More urgent items of other workers are stolen before own ones.
+    queue.push(10, DxcShimPriority::Normal);
+    queue.push(11, DxcShimPriority::Interactive);
+    queue.push(12, DxcShimPriority::Background);
+    queue.push(13, DxcShimPriority::Normal);
+    assert_eq!(queue.pop(0), Some(11));
+    assert_eq!(queue.pop(0), Some(10));
+    assert_eq!(queue.pop(0), Some(13));
+    assert_eq!(queue.pop(1), Some(12));
+}
+
+#[test]
+fn test_queue_stop() {
+    let queue = WorkQueue::new(2);
+    queue.push(1, DxcShimPriority::Normal);
+    queue.push(2, DxcShimPriority::Background);
+    queue.push(3, DxcShimPriority::Interactive);
+
+    let mut items = queue.stop();
+    items.sort();
+    assert_eq!(items, [1, 2, 3]);
+    assert_eq!(queue.pop(0), None);
+    assert_eq!(queue.pop(1), None);
+}
+
+#[test]
+fn test_queue_stop_wakes_poppers() {
+    let queue = WorkQueue::new(4);
+    let popped = Arc::new(AtomicUsize::new(0));
+
+    let workers: Vec<_> = (0..4)
+        .map(|worker_index| {
+            let queue = queue.clone();
+            let popped = popped.clone();
+            std::thread::spawn(move || {
+                let mut items = Vec::new();
+                while let Some(item) = queue.pop(worker_index) {
+                    items.push(item);
+                    popped.fetch_add(1, Ordering::SeqCst);
+                }
+                items
+            })
+        })
+        .collect();
+
+    // Items pushed while the workers wait are each taken once.
+    for item in 0..16 {
+        queue.push(item, DxcShimPriority::Normal);
+    }
+    wait_for_count(&popped, 16);
+
+    // The workers are now all blocked on an empty queue.
+    std::thread::sleep(BLOCKED_DELAY);
+    assert!(queue.stop().is_empty());
+
+    let mut items: Vec<u64> = workers
+        .into_iter()
+        .flat_map(|worker| worker.join().unwrap())
+        .collect();
+    items.sort();
+    assert_eq!(items, (0..16).collect::<Vec<u64>>());
+}
+
+#[test]
+fn test_gate_yields_to_interactive() {
+    let gate = PriorityGate::new();
+    let entered = Arc::new(AtomicUsize::new(0));
+
+    // Every interactive scope claims one worker running lower priority work.
+    let first_interactive = gate.enter(DxcShimPriority::Interactive);
+    let second_interactive = gate.enter(DxcShimPriority::Interactive);
+
+    std::thread::scope(|scope| {
+        for priority in [DxcShimPriority::Normal, DxcShimPriority::Background] {
+            let gate = &gate;
+            let entered = &entered;
+            scope.spawn(move || {
+                let _scope = gate.enter(priority);
+                entered.fetch_add(1, Ordering::SeqCst);
+            });
+        }
+
+        std::thread::sleep(BLOCKED_DELAY);
+        assert_eq!(entered.load(Ordering::SeqCst), 0);
+
+        // Both interactive scopes have claimed a worker, so further work runs.
+        drop(gate.enter(DxcShimPriority::Normal));
+
+        // Other interactive work is never held.
+        drop(gate.enter(DxcShimPriority::Interactive));
+
+        // Ending an interactive scope releases one of the waiting workers.
+        drop(first_interactive);
+        wait_for_count(&entered, 1);
+        std::thread::sleep(BLOCKED_DELAY);
+        assert_eq!(entered.load(Ordering::SeqCst), 1);
+
+        drop(second_interactive);
+        wait_for_count(&entered, 2);
+    });
+
+    // Without interactive work, nothing waits.
+    drop(gate.enter(DxcShimPriority::Background));
+}
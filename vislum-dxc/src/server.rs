@@ -0,0 +1,167 @@
+use std::{
+    ffi::CString,
+    mem::MaybeUninit,
+    os::unix::ffi::OsStrExt,
+    path::{Path, PathBuf},
+    sync::{Arc, Mutex},
+};
+
+use crate::{
+    DxcCompilerCreationError, DxcLoaderCreateInfo, DxcLoaderError, compiler_creation_result, sys,
+};
+
+#[derive(thiserror::Error, Debug)]
+pub enum DxcCompileServerError {
+    #[error("invalid socket path")]
+    InvalidPath,
+    #[error("socket path is too long")]
+    AddressError,
+    #[error("failed to listen on socket")]
+    ListenError,
+    #[error("failed to fork worker process")]
+    SpawnError,
+    #[error("worker failed to start")]
+    WorkerStartError(#[from] DxcCompilerCreationError),
+}
+
+/// Converts a socket path for the shim.
+fn socket_path(path: &Path) -> Result<CString, DxcCompileServerError> {
+    CString::new(path.as_os_str().as_bytes()).map_err(|_| DxcCompileServerError::InvalidPath)
+}
+
+pub struct DxcCompileServerCreateInfo {
+    /// The path of the socket to listen on. An existing socket at the path is replaced.
+    pub socket_path: PathBuf,
+
+    /// The number of worker processes, and so of compilations run at once.
+    pub worker_count: usize,
+
+    /// How each worker loads DXC. The open is never deferred.
+    pub loader: DxcLoaderCreateInfo,
+}
+
+/// Runs compilations sent by [`DxcCompileServerClient`]s in a pool of worker processes.
+///
+/// Every worker loads DXC on its own and runs one compilation at a time, so compilations from
+/// many threads run in parallel without sharing DXC's global state, and a crash in DXC only takes
+/// down the worker, which is replaced. The workers are killed with the server.
+///
+/// The workers are forked, so the server should be run from a process of its own, such as the
+/// editor executable started with a dedicated flag, before it starts other threads.
+pub struct DxcCompileServer {
+    inner: *mut sys::DxcShimCompileServer,
+    run_lock: Mutex<()>,
+}
+
+// SAFETY: Stopping the shim server only writes to a pipe, and runs are serialized by the lock.
+unsafe impl Send for DxcCompileServer {}
+unsafe impl Sync for DxcCompileServer {}
+
+impl DxcCompileServer {
+    pub fn new(
+        create_info: DxcCompileServerCreateInfo,
+    ) -> Result<Arc<Self>, DxcCompileServerError> {
+        let socket_path = socket_path(&create_info.socket_path)?;
+
+        // Paths with interior NULs cannot name a library.
+        let library_path = match &create_info.loader.library_path {
+            Some(path) => Some(CString::new(path.as_os_str().as_bytes()).map_err(|_| {
+                DxcCompileServerError::WorkerStartError(DxcLoaderError::OpenLibraryError.into())
+            })?),
+            None => None,
+        };
+
+        let options = sys::DxcShimCompileServerOptions {
+            socket_path: socket_path.as_ptr(),
+            worker_count: create_info.worker_count,
+            loader_options: sys::DxcShimLoaderOptions {
+                library_path: library_path
+                    .as_ref()
+                    .map_or(std::ptr::null(), |path| path.as_ptr()),
+                defer_open: false,
+                lazy_binding: create_info.loader.lazy_binding,
+            },
+        };
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCompileServer>::uninit();
+        let status = unsafe { sys::dxc_compile_server_create(&options, inner.as_mut_ptr()) };
+
+        server_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        Ok(Arc::new(Self {
+            inner,
+            run_lock: Mutex::new(()),
+        }))
+    }
+
+    /// Forks the workers and serves compilations until [`DxcCompileServer::stop`] is called.
+    pub fn run(&self) -> Result<(), DxcCompileServerError> {
+        let _guard = self
+            .run_lock
+            .lock()
+            .unwrap_or_else(|error| error.into_inner());
+        server_result(unsafe { sys::dxc_compile_server_run(self.inner) })
+    }
+
+    /// Makes [`DxcCompileServer::run`] return, once the workers have been stopped.
+    pub fn stop(&self) {
+        unsafe { sys::dxc_compile_server_stop(self.inner) };
+    }
+}
+
+impl Drop for DxcCompileServer {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_compile_server_destroy(self.inner) };
+    }
+}
+
+/// Maps the status of a compile server to a result.
+fn server_result(status: sys::DxcShimStatus) -> Result<(), DxcCompileServerError> {
+    match status {
+        sys::DxcShimStatus::Ok => Ok(()),
+        sys::DxcShimStatus::ServerAddressError => Err(DxcCompileServerError::AddressError),
+        sys::DxcShimStatus::ServerListenError => Err(DxcCompileServerError::ListenError),
+        sys::DxcShimStatus::ServerSpawnError => Err(DxcCompileServerError::SpawnError),
+        status => Err(compiler_creation_result(status).unwrap_err().into()),
+    }
+}
+
+/// Forwards the compilations of compilers to a [`DxcCompileServer`].
+///
+/// Set it on a [`crate::DxcCompiler`] or [`crate::DxcCompilerPool`] to compile out of process
+/// without further changes. Only codegen is forwarded: cache lookups and includes stay in
+/// process, and the include handler is called as usual whenever the server needs an include.
+/// If no server is listening, shaders are compiled in process instead. If a worker crashes,
+/// the compilation it was running fails.
+pub struct DxcCompileServerClient {
+    pub(crate) inner: *mut sys::DxcShimCompileServerClient,
+}
+
+// SAFETY: The shim client only holds the socket address, and every compilation opens its own
+// connection.
+unsafe impl Send for DxcCompileServerClient {}
+unsafe impl Sync for DxcCompileServerClient {}
+
+impl DxcCompileServerClient {
+    /// Creates a client of the server listening on the given socket path. Does not connect.
+    pub fn new(socket_path: impl AsRef<Path>) -> Result<Arc<Self>, DxcCompileServerError> {
+        let socket_path = self::socket_path(socket_path.as_ref())?;
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimCompileServerClient>::uninit();
+        let status = unsafe {
+            sys::dxc_compile_server_client_create(socket_path.as_ptr(), inner.as_mut_ptr())
+        };
+
+        server_result(status)?;
+
+        let inner = unsafe { inner.assume_init() };
+        Ok(Arc::new(Self { inner }))
+    }
+}
+
+impl Drop for DxcCompileServerClient {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_compile_server_client_destroy(self.inner) };
+    }
+}
@@ -0,0 +1,105 @@
+use std::time::Duration;
+
+use crate::sys;
+
+/// Whether the result of a compilation was served from the bytecode cache.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcCacheStatus {
+    /// The compiler has no bytecode cache.
+    Disabled,
+    Hit,
+    Miss,
+    /// Missed in the local cache, and served from the [`DxcRemoteCache`](crate::DxcRemoteCache).
+    RemoteHit,
+}
+
+impl From<sys::DxcShimCacheStatus> for DxcCacheStatus {
+    fn from(status: sys::DxcShimCacheStatus) -> Self {
+        match status {
+            sys::DxcShimCacheStatus::Disabled => DxcCacheStatus::Disabled,
+            sys::DxcShimCacheStatus::Hit => DxcCacheStatus::Hit,
+            sys::DxcShimCacheStatus::Miss => DxcCacheStatus::Miss,
+            sys::DxcShimCacheStatus::RemoteHit => DxcCacheStatus::RemoteHit,
+        }
+    }
+}
+
+/// The statistics of a single compilation.
+#[derive(Debug, Clone, Copy)]
+pub struct DxcCompilationStats {
+    /// The time spent preprocessing the source to compute its cache key.
+    pub preprocess_time: Duration,
+
+    /// The time spent compiling the source. Zero if the result was served from the cache.
+    pub compile_time: Duration,
+
+    /// The time spent in the [`DxcIncludeHandler`](crate::DxcIncludeHandler). Part of the
+    /// preprocess and compile times.
+    pub include_time: Duration,
+
+    /// The number of includes resolved.
+    pub include_count: u64,
+
+    /// The total size of the resolved includes in bytes.
+    pub include_bytes: u64,
+
+    /// The size of the bytecode in bytes.
+    pub output_size: u64,
+
+    pub cache_status: DxcCacheStatus,
+}
+
+impl From<sys::DxcShimCompilationStats> for DxcCompilationStats {
+    fn from(stats: sys::DxcShimCompilationStats) -> Self {
+        Self {
+            preprocess_time: Duration::from_nanos(stats.preprocess_time),
+            compile_time: Duration::from_nanos(stats.compile_time),
+            include_time: Duration::from_nanos(stats.include_time),
+            include_count: stats.include_count,
+            include_bytes: stats.include_bytes,
+            output_size: stats.output_size,
+            cache_status: stats.cache_status.into(),
+        }
+    }
+}
+
+/// The statistics accumulated over all compilations of a compiler or pool.
+///
+/// The counters are read individually while compilations may be running, so they are not
+/// guaranteed to be consistent with each other.
+#[derive(Debug, Clone, Copy)]
+pub struct DxcCompilerStats {
+    pub compilation_count: u64,
+    /// The number of failed compilations, not counting cancelled ones.
+    pub failure_count: u64,
+    pub cancellation_count: u64,
+    pub cache_hit_count: u64,
+    pub cache_miss_count: u64,
+    pub preprocess_time: Duration,
+    pub compile_time: Duration,
+    pub include_time: Duration,
+    pub include_count: u64,
+    pub include_bytes: u64,
+    pub output_bytes: u64,
+    /// The number of cache hits served from the remote cache. Part of the cache hits.
+    pub remote_cache_hit_count: u64,
+}
+
+impl From<sys::DxcShimCompilerStats> for DxcCompilerStats {
+    fn from(stats: sys::DxcShimCompilerStats) -> Self {
+        Self {
+            compilation_count: stats.compilation_count,
+            failure_count: stats.failure_count,
+            cancellation_count: stats.cancellation_count,
+            cache_hit_count: stats.cache_hit_count,
+            cache_miss_count: stats.cache_miss_count,
+            preprocess_time: Duration::from_nanos(stats.preprocess_time),
+            compile_time: Duration::from_nanos(stats.compile_time),
+            include_time: Duration::from_nanos(stats.include_time),
+            include_count: stats.include_count,
+            include_bytes: stats.include_bytes,
+            output_bytes: stats.output_bytes,
+            remote_cache_hit_count: stats.remote_cache_hit_count,
+        }
+    }
+}
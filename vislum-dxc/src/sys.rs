@@ -12,6 +12,14 @@ pub enum DxcShimStatus {
     GetCreateInstance2SymbolError = 2,
     GetDxcCompilerInstanceError = 3,
     GetDxcUtilsInstanceError = 4,
+    CacheOpenError = 5,
+    SpawnThreadError = 6,
+    ArchiveOpenError = 7,
+    ArchiveWriteError = 8,
+    ServerAddressError = 9,
+    ServerListenError = 10,
+    ServerSpawnError = 11,
+    TraceOpenError = 12,
 }
 
 #[repr(C)]
@@ -26,43 +34,1029 @@ pub struct DxcShimCompiler {
     _marker: PhantomData<(*mut u8, PhantomPinned)>,
 }
 
+#[repr(C)]
+pub struct DxcShimCache {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimIncludeCache {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimPrelude {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+#[cfg(test)]
+pub struct DxcShimReflector {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+#[cfg(test)]
+pub struct DxcShimIntegerWorkQueue {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+#[cfg(test)]
+pub struct DxcShimPriorityGate {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+#[cfg(test)]
+pub struct DxcShimPriorityScope {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+#[cfg(test)]
+pub struct DxcShimMemoryBudget {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+#[cfg(test)]
+pub struct DxcShimTcpCacheBackend {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimArgumentSet {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimCompilerPool {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimCancellationToken {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimDependencyIndex {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimArchiveWriter {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimArchive {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimRemoteCache {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimCacheServer {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimTraceSink {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimCompileServerClient {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimCompileServer {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimAsyncCompiler {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
+#[repr(C)]
+pub struct DxcShimCompileTask {
+    _data: (),
+    _marker: PhantomData<(*mut u8, PhantomPinned)>,
+}
+
 #[repr(C)]
 pub struct DxcShimCompilationResult {
     _data: (),
     _marker: PhantomData<(*mut u8, PhantomPinned)>,
 }
 
+#[repr(C)]
+pub struct DxcShimDefine {
+    pub name: *const std::ffi::c_char,
+    pub value: *const std::ffi::c_char,
+}
+
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimOptimizationLevel {
+    O0 = 0,
+    O1 = 1,
+    O2 = 2,
+    O3 = 3,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct DxcShimCompileOptions {
+    pub entry_point: *const std::ffi::c_char,
+    pub target_profile: *const std::ffi::c_char,
+    pub defines: *const DxcShimDefine,
+    pub define_count: usize,
+    pub optimization_level: DxcShimOptimizationLevel,
+    pub cancellation_token: *const DxcShimCancellationToken,
+    pub deadline: u64,
+    pub extra_args: *const *const std::ffi::c_char,
+    pub extra_arg_count: usize,
+    pub spirv_optimizer_passes: *const std::ffi::c_char,
+    pub strip: DxcShimStripOptions,
+    pub argument_set: *const DxcShimArgumentSet,
+    pub priority: DxcShimPriority,
+}
+
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimPriority {
+    Normal = 0,
+    Interactive = 1,
+    Background = 2,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct DxcShimStripOptions {
+    pub strip_debug_info: bool,
+    pub strip_names: bool,
+}
+
+#[repr(C)]
+pub struct DxcShimCompileJob {
+    pub source: *const std::ffi::c_char,
+    pub source_size: usize,
+    pub options: DxcShimCompileOptions,
+    pub user_data: *mut std::ffi::c_void,
+}
+
+#[repr(C)]
+pub struct DxcShimPermutationAxis {
+    pub name: *const std::ffi::c_char,
+    pub values: *const *const std::ffi::c_char,
+    pub value_count: usize,
+}
+
+pub type DxcShimReleaseCallback = Option<unsafe extern "C" fn(context: *mut std::ffi::c_void)>;
+
+#[repr(C)]
+pub struct DxcShimIncludeSource {
+    pub data: *const std::ffi::c_char,
+    pub size: usize,
+    pub release: DxcShimReleaseCallback,
+    pub release_context: *mut std::ffi::c_void,
+}
+
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct DxcShimHash {
+    pub high: u64,
+    pub low: u64,
+}
+
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimCacheStatus {
+    Disabled = 0,
+    Hit = 1,
+    Miss = 2,
+    RemoteHit = 3,
+}
+
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimDescriptorType {
+    Sampler = 0,
+    CombinedImageSampler = 1,
+    SampledImage = 2,
+    StorageImage = 3,
+    UniformTexelBuffer = 4,
+    StorageTexelBuffer = 5,
+    UniformBuffer = 6,
+    StorageBuffer = 7,
+    InputAttachment = 10,
+    AccelerationStructure = 1000150000,
+}
+
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimShaderStage {
+    Unknown = 0,
+    Vertex = 0x1,
+    TessellationControl = 0x2,
+    TessellationEvaluation = 0x4,
+    Geometry = 0x8,
+    Fragment = 0x10,
+    Compute = 0x20,
+    Task = 0x40,
+    Mesh = 0x80,
+    RayGeneration = 0x100,
+    AnyHit = 0x200,
+    ClosestHit = 0x400,
+    Miss = 0x800,
+    Intersection = 0x1000,
+    Callable = 0x2000,
+}
+
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimComponentType {
+    Unknown = 0,
+    Float16 = 1,
+    Float32 = 2,
+    Float64 = 3,
+    Sint16 = 4,
+    Sint32 = 5,
+    Sint64 = 6,
+    Uint16 = 7,
+    Uint32 = 8,
+    Uint64 = 9,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimReflectionBinding {
+    pub set: u32,
+    pub binding: u32,
+    pub descriptor_type: DxcShimDescriptorType,
+    pub count: u32,
+    pub name: *const std::ffi::c_char,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimReflectionInput {
+    pub location: u32,
+    pub component_type: DxcShimComponentType,
+    pub component_count: u32,
+    pub name: *const std::ffi::c_char,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimReflection {
+    pub stage: DxcShimShaderStage,
+    pub push_constant_size: u32,
+    pub local_size: [u32; 3],
+    pub bindings: *const DxcShimReflectionBinding,
+    pub binding_count: usize,
+    pub inputs: *const DxcShimReflectionInput,
+    pub input_count: usize,
+}
+
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimDiagnosticSeverity {
+    Error = 0,
+    Warning = 1,
+    Note = 2,
+    Remark = 3,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimDiagnostic {
+    pub severity: DxcShimDiagnosticSeverity,
+    pub file: *const std::ffi::c_char,
+    pub file_size: usize,
+    pub line: u32,
+    pub column: u32,
+    pub message: *const std::ffi::c_char,
+    pub message_size: usize,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimLoaderOptions {
+    pub library_path: *const std::ffi::c_char,
+    pub defer_open: bool,
+    pub lazy_binding: bool,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimRemoteCacheEntry {
+    pub data: *const std::ffi::c_void,
+    pub size: usize,
+    pub release: DxcShimReleaseCallback,
+    pub release_context: *mut std::ffi::c_void,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimTraceLocation {
+    pub name: *const std::ffi::c_char,
+    pub function: *const std::ffi::c_char,
+    pub file: *const std::ffi::c_char,
+    pub line: u32,
+    pub color: u32,
+}
+
+pub type DxcShimTraceBeginCallback = Option<
+    unsafe extern "C" fn(
+        user_data: *mut std::ffi::c_void,
+        location: *const DxcShimTraceLocation,
+    ) -> u64,
+>;
+
+pub type DxcShimTraceEndCallback = Option<
+    unsafe extern "C" fn(
+        user_data: *mut std::ffi::c_void,
+        location: *const DxcShimTraceLocation,
+        context: u64,
+    ),
+>;
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimTraceCallbacks {
+    pub begin: DxcShimTraceBeginCallback,
+    pub end: DxcShimTraceEndCallback,
+    pub user_data: *mut std::ffi::c_void,
+}
+
+pub type DxcShimRemoteCacheLookupCallback = Option<
+    unsafe extern "C" fn(
+        user_data: *mut std::ffi::c_void,
+        keys: *const DxcShimHash,
+        count: usize,
+        entries: *mut DxcShimRemoteCacheEntry,
+    ),
+>;
+
+pub type DxcShimRemoteCacheStoreCallback = Option<
+    unsafe extern "C" fn(
+        user_data: *mut std::ffi::c_void,
+        key: *const DxcShimHash,
+        data: *const std::ffi::c_void,
+        size: usize,
+    ),
+>;
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimRemoteCacheBackend {
+    pub lookup: DxcShimRemoteCacheLookupCallback,
+    pub store: DxcShimRemoteCacheStoreCallback,
+    pub release: DxcShimReleaseCallback,
+    pub user_data: *mut std::ffi::c_void,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimCompileServerOptions {
+    pub socket_path: *const std::ffi::c_char,
+    pub worker_count: usize,
+    pub loader_options: DxcShimLoaderOptions,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimCompilationStats {
+    pub preprocess_time: u64,
+    pub compile_time: u64,
+    pub include_time: u64,
+    pub include_count: u64,
+    pub include_bytes: u64,
+    pub output_size: u64,
+    pub cache_status: DxcShimCacheStatus,
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct DxcShimCompilerStats {
+    pub compilation_count: u64,
+    pub failure_count: u64,
+    pub cancellation_count: u64,
+    pub cache_hit_count: u64,
+    pub cache_miss_count: u64,
+    pub preprocess_time: u64,
+    pub compile_time: u64,
+    pub include_time: u64,
+    pub include_count: u64,
+    pub include_bytes: u64,
+    pub output_bytes: u64,
+    pub remote_cache_hit_count: u64,
+}
+
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DxcShimTaskStatus {
+    Pending = 0,
+    Running = 1,
+    Completed = 2,
+    Cancelled = 3,
+}
+
+pub type DxcShimCompletionCallback =
+    Option<unsafe extern "C" fn(task: *mut DxcShimCompileTask, user_data: *mut std::ffi::c_void)>;
+
+pub type DxcShimBatchResultCallback = Option<
+    unsafe extern "C" fn(
+        user_data: *mut std::ffi::c_void,
+        job_index: usize,
+        result: *mut DxcShimCompilationResult,
+    ),
+>;
+
+pub type DxcShimDependentCallback =
+    Option<unsafe extern "C" fn(name: *const std::ffi::c_char, user_data: *mut std::ffi::c_void)>;
+
 pub type DxcShimUserCallback = Option<
     unsafe extern "C" fn(
         filename: *const std::ffi::c_char,
+        filename_size: usize,
         user_data: *mut std::ffi::c_void,
-    ) -> *const std::ffi::c_char,
+        source: *mut DxcShimIncludeSource,
+    ) -> bool,
 >;
 
 unsafe extern "C" {
     pub unsafe fn dxc_loader_open(loader: *mut *mut DxcShimLoader) -> DxcShimStatus;
+    pub unsafe fn dxc_loader_open_with_options(
+        options: *const DxcShimLoaderOptions,
+        loader: *mut *mut DxcShimLoader,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_loader_is_loaded(loader: *mut DxcShimLoader) -> bool;
     pub unsafe fn dxc_loader_close(loader: *mut DxcShimLoader);
     pub unsafe fn dxc_create_compiler(
         loader: *mut DxcShimLoader,
         compiler: *mut *mut DxcShimCompiler,
     ) -> DxcShimStatus;
     pub unsafe fn dxc_compiler_release(compiler: *mut DxcShimCompiler);
+    pub unsafe fn dxc_cache_open(
+        directory: *const std::ffi::c_char,
+        cache: *mut *mut DxcShimCache,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_cache_close(cache: *mut DxcShimCache);
+    #[cfg(test)]
+    pub unsafe fn dxc_cache_store(
+        cache: *mut DxcShimCache,
+        key: *const DxcShimHash,
+        data: *const std::ffi::c_void,
+        size: usize,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_cache_load(
+        cache: *mut DxcShimCache,
+        key: *const DxcShimHash,
+        data: *mut std::ffi::c_void,
+        capacity: usize,
+        size: *mut usize,
+    ) -> bool;
+    pub unsafe fn dxc_compiler_set_cache(compiler: *mut DxcShimCompiler, cache: *mut DxcShimCache);
+    pub unsafe fn dxc_include_cache_create(include_cache: *mut *mut DxcShimIncludeCache);
+    pub unsafe fn dxc_include_cache_destroy(include_cache: *mut DxcShimIncludeCache);
+    pub unsafe fn dxc_include_cache_invalidate(
+        include_cache: *mut DxcShimIncludeCache,
+        filename: *const std::ffi::c_char,
+    );
+    pub unsafe fn dxc_include_cache_clear(include_cache: *mut DxcShimIncludeCache);
+    #[cfg(test)]
+    pub unsafe fn dxc_include_cache_normalize(
+        filename: *const std::ffi::c_char,
+        size: usize,
+        normalized: *mut std::ffi::c_char,
+    ) -> usize;
+    pub unsafe fn dxc_compiler_set_include_cache(
+        compiler: *mut DxcShimCompiler,
+        include_cache: *mut DxcShimIncludeCache,
+    );
+    pub unsafe fn dxc_prelude_create(
+        data: *const std::ffi::c_char,
+        size: usize,
+        prelude: *mut *mut DxcShimPrelude,
+    );
+    pub unsafe fn dxc_prelude_destroy(prelude: *mut DxcShimPrelude);
+    pub unsafe fn dxc_prelude_clear(prelude: *mut DxcShimPrelude);
+    #[cfg(test)]
+    pub unsafe fn dxc_prelude_build_expansion_source(
+        data: *const std::ffi::c_char,
+        size: usize,
+        source: *mut std::ffi::c_char,
+        capacity: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_prelude_restore_expansion(
+        data: *const std::ffi::c_char,
+        size: usize,
+        source: *mut std::ffi::c_char,
+        capacity: usize,
+        source_size: *mut usize,
+    ) -> bool;
+    #[cfg(test)]
+    pub unsafe fn dxc_prelude_has_pragma_once(data: *const std::ffi::c_char, size: usize) -> bool;
+    pub unsafe fn dxc_compiler_set_prelude(
+        compiler: *mut DxcShimCompiler,
+        prelude: *mut DxcShimPrelude,
+    );
+    pub unsafe fn dxc_compiler_pool_create(
+        loader: *mut DxcShimLoader,
+        initial_size: usize,
+        pool: *mut *mut DxcShimCompilerPool,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_compiler_pool_destroy(pool: *mut DxcShimCompilerPool);
+    pub unsafe fn dxc_compiler_pool_acquire(
+        pool: *mut DxcShimCompilerPool,
+        compiler: *mut *mut DxcShimCompiler,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_compiler_pool_release(
+        pool: *mut DxcShimCompilerPool,
+        compiler: *mut DxcShimCompiler,
+    );
+    pub unsafe fn dxc_compiler_pool_set_cache(
+        pool: *mut DxcShimCompilerPool,
+        cache: *mut DxcShimCache,
+    );
+    pub unsafe fn dxc_compiler_pool_set_include_cache(
+        pool: *mut DxcShimCompilerPool,
+        include_cache: *mut DxcShimIncludeCache,
+    );
+    pub unsafe fn dxc_compiler_pool_set_prelude(
+        pool: *mut DxcShimCompilerPool,
+        prelude: *mut DxcShimPrelude,
+    );
+    pub unsafe fn dxc_compiler_get_stats(
+        compiler: *mut DxcShimCompiler,
+        stats: *mut DxcShimCompilerStats,
+    );
+    pub unsafe fn dxc_compiler_reset_stats(compiler: *mut DxcShimCompiler);
+    pub unsafe fn dxc_compiler_pool_get_stats(
+        pool: *mut DxcShimCompilerPool,
+        stats: *mut DxcShimCompilerStats,
+    );
+    pub unsafe fn dxc_compiler_pool_reset_stats(pool: *mut DxcShimCompilerPool);
+    pub unsafe fn dxc_argument_set_create(
+        options: *const DxcShimCompileOptions,
+        argument_set: *mut *mut DxcShimArgumentSet,
+    );
+    pub unsafe fn dxc_argument_set_destroy(argument_set: *mut DxcShimArgumentSet);
     pub unsafe fn dxc_compile(
         compiler: *mut DxcShimCompiler,
         data: *const std::ffi::c_char,
+        size: usize,
+        options: *const DxcShimCompileOptions,
+        user_callback: DxcShimUserCallback,
+        user_data: *mut std::ffi::c_void,
+    ) -> *mut DxcShimCompilationResult;
+    pub unsafe fn dxc_compile_into(
+        compiler: *mut DxcShimCompiler,
+        data: *const std::ffi::c_char,
+        size: usize,
+        options: *const DxcShimCompileOptions,
+        user_callback: DxcShimUserCallback,
+        user_data: *mut std::ffi::c_void,
+        result: *mut DxcShimCompilationResult,
+    );
+    pub unsafe fn dxc_preprocess(
+        compiler: *mut DxcShimCompiler,
+        data: *const std::ffi::c_char,
+        size: usize,
+        options: *const DxcShimCompileOptions,
+        user_callback: DxcShimUserCallback,
+        user_data: *mut std::ffi::c_void,
+    ) -> *mut DxcShimCompilationResult;
+    pub unsafe fn dxc_compile_batch(
+        pool: *mut DxcShimCompilerPool,
+        jobs: *const DxcShimCompileJob,
+        job_count: usize,
+        thread_count: usize,
+        user_callback: DxcShimUserCallback,
+        results: *mut *mut DxcShimCompilationResult,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_compile_batch_streaming(
+        pool: *mut DxcShimCompilerPool,
+        jobs: *const DxcShimCompileJob,
+        job_count: usize,
+        thread_count: usize,
+        memory_budget: u64,
+        user_callback: DxcShimUserCallback,
+        on_result: DxcShimBatchResultCallback,
+        result_user_data: *mut std::ffi::c_void,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_permutation_count(
+        axes: *const DxcShimPermutationAxis,
+        axis_count: usize,
+    ) -> usize;
+    pub unsafe fn dxc_compile_permutations(
+        pool: *mut DxcShimCompilerPool,
+        source: *const std::ffi::c_char,
+        source_size: usize,
+        options: *const DxcShimCompileOptions,
+        axes: *const DxcShimPermutationAxis,
+        axis_count: usize,
+        thread_count: usize,
+        user_callback: DxcShimUserCallback,
+        user_data: *mut std::ffi::c_void,
+        results: *mut *mut DxcShimCompilationResult,
+        representatives: *mut usize,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_async_compiler_create(
+        pool: *mut DxcShimCompilerPool,
+        thread_count: usize,
+        async_compiler: *mut *mut DxcShimAsyncCompiler,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_async_compiler_destroy(async_compiler: *mut DxcShimAsyncCompiler);
+    pub unsafe fn dxc_compile_async(
+        async_compiler: *mut DxcShimAsyncCompiler,
+        data: *const std::ffi::c_char,
+        size: usize,
+        options: *const DxcShimCompileOptions,
         user_callback: DxcShimUserCallback,
         user_data: *mut std::ffi::c_void,
+        on_complete: DxcShimCompletionCallback,
+        completion_user_data: *mut std::ffi::c_void,
+    ) -> *mut DxcShimCompileTask;
+    pub unsafe fn dxc_compile_task_poll(task: *mut DxcShimCompileTask) -> DxcShimTaskStatus;
+    pub unsafe fn dxc_compile_task_cancel(task: *mut DxcShimCompileTask) -> bool;
+    pub unsafe fn dxc_compile_task_wait(task: *mut DxcShimCompileTask);
+    pub unsafe fn dxc_compile_task_take_result(
+        task: *mut DxcShimCompileTask,
     ) -> *mut DxcShimCompilationResult;
+    pub unsafe fn dxc_compile_task_release(task: *mut DxcShimCompileTask);
+    pub unsafe fn dxc_cancellation_token_create(token: *mut *mut DxcShimCancellationToken);
+    pub unsafe fn dxc_cancellation_token_destroy(token: *mut DxcShimCancellationToken);
+    pub unsafe fn dxc_cancellation_token_cancel(token: *mut DxcShimCancellationToken);
+    pub unsafe fn dxc_cancellation_token_is_cancelled(token: *mut DxcShimCancellationToken)
+    -> bool;
+    pub unsafe fn dxc_hash_include_contents(
+        data: *const std::ffi::c_void,
+        size: usize,
+        hash: *mut DxcShimHash,
+    );
+    pub unsafe fn dxc_dependency_index_create(index: *mut *mut DxcShimDependencyIndex);
+    pub unsafe fn dxc_dependency_index_destroy(index: *mut DxcShimDependencyIndex);
+    pub unsafe fn dxc_dependency_index_record(
+        index: *mut DxcShimDependencyIndex,
+        name: *const std::ffi::c_char,
+        result: *mut DxcShimCompilationResult,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_dependency_index_record_includes(
+        index: *mut DxcShimDependencyIndex,
+        name: *const std::ffi::c_char,
+        filenames: *const *const std::ffi::c_char,
+        hashes: *const DxcShimHash,
+        count: usize,
+    );
+    pub unsafe fn dxc_dependency_index_remove(
+        index: *mut DxcShimDependencyIndex,
+        name: *const std::ffi::c_char,
+    );
+    pub unsafe fn dxc_dependency_index_find_dependents(
+        index: *mut DxcShimDependencyIndex,
+        filename: *const std::ffi::c_char,
+        hash: *const DxcShimHash,
+        callback: DxcShimDependentCallback,
+        user_data: *mut std::ffi::c_void,
+    );
+    pub unsafe fn dxc_clock_now() -> u64;
     pub unsafe fn dxc_compilation_result_is_successful(
         result: *mut DxcShimCompilationResult,
     ) -> bool;
+    pub unsafe fn dxc_compilation_result_is_cancelled(
+        result: *mut DxcShimCompilationResult,
+    ) -> bool;
     pub unsafe fn dxc_compilation_result_get_error_message(
         result: *mut DxcShimCompilationResult,
     ) -> *const std::ffi::c_char;
+    pub unsafe fn dxc_compilation_result_get_messages(
+        result: *mut DxcShimCompilationResult,
+        messages: *mut *const std::ffi::c_char,
+        size: *mut usize,
+    );
     pub unsafe fn dxc_compilation_result_get_bytecode(
         result: *mut DxcShimCompilationResult,
         bytecode: *mut *mut std::ffi::c_void,
         size: *mut usize,
     );
+    pub unsafe fn dxc_compilation_result_get_stats(
+        result: *mut DxcShimCompilationResult,
+        stats: *mut DxcShimCompilationStats,
+    );
+    pub unsafe fn dxc_compilation_result_get_include_count(
+        result: *mut DxcShimCompilationResult,
+    ) -> usize;
+    pub unsafe fn dxc_compilation_result_get_include(
+        result: *mut DxcShimCompilationResult,
+        index: usize,
+        filename: *mut *const std::ffi::c_char,
+        hash: *mut DxcShimHash,
+    );
+    pub unsafe fn dxc_compilation_result_get_diagnostic_count(
+        result: *mut DxcShimCompilationResult,
+    ) -> usize;
+    pub unsafe fn dxc_compilation_result_get_diagnostic(
+        result: *mut DxcShimCompilationResult,
+        index: usize,
+        diagnostic: *mut DxcShimDiagnostic,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_parse_diagnostics(
+        text: *const std::ffi::c_char,
+        size: usize,
+        diagnostics: *mut DxcShimDiagnostic,
+        capacity: usize,
+    ) -> usize;
+    pub unsafe fn dxc_compilation_result_get_reflection(
+        result: *mut DxcShimCompilationResult,
+        reflection: *mut *const DxcShimReflection,
+    ) -> bool;
+    #[cfg(test)]
+    pub unsafe fn dxc_reflector_create(
+        words: *const u32,
+        word_count: usize,
+        reflector: *mut *mut DxcShimReflector,
+    ) -> bool;
+    #[cfg(test)]
+    pub unsafe fn dxc_reflector_get_reflection(
+        reflector: *mut DxcShimReflector,
+    ) -> *const DxcShimReflection;
+    #[cfg(test)]
+    pub unsafe fn dxc_reflector_destroy(reflector: *mut DxcShimReflector);
+    #[cfg(test)]
+    pub unsafe fn dxc_strip_spirv(
+        words: *mut u32,
+        word_count: usize,
+        options: *const DxcShimStripOptions,
+    ) -> usize;
+    pub unsafe fn dxc_compilation_result_get_preprocessed_hash(
+        result: *mut DxcShimCompilationResult,
+        hash: *mut DxcShimHash,
+    ) -> bool;
+    pub unsafe fn dxc_compilation_result_create() -> *mut DxcShimCompilationResult;
+    pub unsafe fn dxc_compilation_result_reset(result: *mut DxcShimCompilationResult);
     pub unsafe fn dxc_compilation_result_free(result: *mut DxcShimCompilationResult);
+
+    pub unsafe fn dxc_archive_writer_create(writer: *mut *mut DxcShimArchiveWriter);
+    pub unsafe fn dxc_archive_writer_destroy(writer: *mut DxcShimArchiveWriter);
+    pub unsafe fn dxc_archive_writer_add(
+        writer: *mut DxcShimArchiveWriter,
+        key: *const DxcShimHash,
+        result: *mut DxcShimCompilationResult,
+    ) -> bool;
+    #[cfg(test)]
+    pub unsafe fn dxc_archive_writer_add_bytecode(
+        writer: *mut DxcShimArchiveWriter,
+        key: *const DxcShimHash,
+        bytecode: *const std::ffi::c_void,
+        bytecode_size: usize,
+        reflection: *const DxcShimReflection,
+        dependency_filenames: *const *const std::ffi::c_char,
+        dependency_hashes: *const DxcShimHash,
+        dependency_count: usize,
+    ) -> bool;
+    pub unsafe fn dxc_archive_writer_write(
+        writer: *mut DxcShimArchiveWriter,
+        path: *const std::ffi::c_char,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_archive_open(
+        path: *const std::ffi::c_char,
+        archive: *mut *mut DxcShimArchive,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_archive_close(archive: *mut DxcShimArchive);
+    pub unsafe fn dxc_archive_get_entry_count(archive: *mut DxcShimArchive) -> usize;
+    pub unsafe fn dxc_archive_find(
+        archive: *mut DxcShimArchive,
+        key: *const DxcShimHash,
+        index: *mut usize,
+    ) -> bool;
+    pub unsafe fn dxc_archive_get_key(
+        archive: *mut DxcShimArchive,
+        index: usize,
+        key: *mut DxcShimHash,
+    );
+    pub unsafe fn dxc_archive_get_bytecode(
+        archive: *mut DxcShimArchive,
+        index: usize,
+        bytecode: *mut *const std::ffi::c_void,
+        size: *mut usize,
+    );
+    pub unsafe fn dxc_archive_get_reflection(
+        archive: *mut DxcShimArchive,
+        index: usize,
+        reflection: *mut *const DxcShimReflection,
+    ) -> bool;
+    pub unsafe fn dxc_archive_get_dependency_count(
+        archive: *mut DxcShimArchive,
+        index: usize,
+    ) -> usize;
+    pub unsafe fn dxc_archive_get_dependency(
+        archive: *mut DxcShimArchive,
+        index: usize,
+        dependency_index: usize,
+        filename: *mut *const std::ffi::c_char,
+        hash: *mut DxcShimHash,
+    );
+    pub unsafe fn dxc_compile_server_client_create(
+        socket_path: *const std::ffi::c_char,
+        client: *mut *mut DxcShimCompileServerClient,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_compile_server_client_destroy(client: *mut DxcShimCompileServerClient);
+    pub unsafe fn dxc_compiler_set_compile_server(
+        compiler: *mut DxcShimCompiler,
+        client: *mut DxcShimCompileServerClient,
+    );
+    pub unsafe fn dxc_compiler_pool_set_compile_server(
+        pool: *mut DxcShimCompilerPool,
+        client: *mut DxcShimCompileServerClient,
+    );
+    pub unsafe fn dxc_compile_server_create(
+        options: *const DxcShimCompileServerOptions,
+        server: *mut *mut DxcShimCompileServer,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_compile_server_destroy(server: *mut DxcShimCompileServer);
+    pub unsafe fn dxc_compile_server_run(server: *mut DxcShimCompileServer) -> DxcShimStatus;
+    pub unsafe fn dxc_compile_server_stop(server: *mut DxcShimCompileServer);
+    pub unsafe fn dxc_remote_cache_create(
+        backend: *const DxcShimRemoteCacheBackend,
+        remote_cache: *mut *mut DxcShimRemoteCache,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_remote_cache_connect(
+        host: *const std::ffi::c_char,
+        port: u16,
+        timeout_milliseconds: u32,
+        remote_cache: *mut *mut DxcShimRemoteCache,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_remote_cache_destroy(remote_cache: *mut DxcShimRemoteCache);
+    pub unsafe fn dxc_remote_cache_flush(remote_cache: *mut DxcShimRemoteCache);
+    pub unsafe fn dxc_compiler_set_remote_cache(
+        compiler: *mut DxcShimCompiler,
+        remote_cache: *mut DxcShimRemoteCache,
+    );
+    pub unsafe fn dxc_compiler_pool_set_remote_cache(
+        pool: *mut DxcShimCompilerPool,
+        remote_cache: *mut DxcShimRemoteCache,
+    );
+    pub unsafe fn dxc_cache_server_create(
+        cache: *mut DxcShimCache,
+        host: *const std::ffi::c_char,
+        port: u16,
+        server: *mut *mut DxcShimCacheServer,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_cache_server_destroy(server: *mut DxcShimCacheServer);
+    pub unsafe fn dxc_cache_server_get_port(server: *mut DxcShimCacheServer) -> u16;
+    pub unsafe fn dxc_cache_server_run(server: *mut DxcShimCacheServer);
+    pub unsafe fn dxc_cache_server_stop(server: *mut DxcShimCacheServer);
+    pub unsafe fn dxc_trace_chrome_sink_create(
+        path: *const std::ffi::c_char,
+        sink: *mut *mut DxcShimTraceSink,
+    ) -> DxcShimStatus;
+    pub unsafe fn dxc_trace_callback_sink_create(
+        callbacks: *const DxcShimTraceCallbacks,
+        sink: *mut *mut DxcShimTraceSink,
+    );
+    pub unsafe fn dxc_trace_sink_destroy(sink: *mut DxcShimTraceSink);
+    pub unsafe fn dxc_trace_sink_flush(sink: *mut DxcShimTraceSink);
+    pub unsafe fn dxc_trace_set_sink(sink: *mut DxcShimTraceSink);
+    #[cfg(test)]
+    pub unsafe fn dxc_conv_utf8_to_utf16(
+        s: *const std::ffi::c_char,
+        size: usize,
+        out: *mut u16,
+        capacity: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_conv_utf8_to_utf32(
+        s: *const std::ffi::c_char,
+        size: usize,
+        out: *mut u32,
+        capacity: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_conv_utf16_to_utf8(
+        s: *const u16,
+        size: usize,
+        out: *mut std::ffi::c_char,
+        capacity: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_conv_utf32_to_utf8(
+        s: *const u32,
+        size: usize,
+        out: *mut std::ffi::c_char,
+        capacity: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_work_queue_create(
+        worker_count: usize,
+        queue: *mut *mut DxcShimIntegerWorkQueue,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_work_queue_destroy(queue: *mut DxcShimIntegerWorkQueue);
+    #[cfg(test)]
+    pub unsafe fn dxc_work_queue_push(
+        queue: *mut DxcShimIntegerWorkQueue,
+        item: u64,
+        priority: DxcShimPriority,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_work_queue_pop(
+        queue: *mut DxcShimIntegerWorkQueue,
+        worker_index: usize,
+        item: *mut u64,
+    ) -> bool;
+    #[cfg(test)]
+    pub unsafe fn dxc_work_queue_stop(
+        queue: *mut DxcShimIntegerWorkQueue,
+        items: *mut u64,
+        capacity: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_priority_gate_create(gate: *mut *mut DxcShimPriorityGate);
+    #[cfg(test)]
+    pub unsafe fn dxc_priority_gate_destroy(gate: *mut DxcShimPriorityGate);
+    #[cfg(test)]
+    pub unsafe fn dxc_priority_scope_enter(
+        gate: *mut DxcShimPriorityGate,
+        priority: DxcShimPriority,
+        scope: *mut *mut DxcShimPriorityScope,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_priority_scope_leave(scope: *mut DxcShimPriorityScope);
+    #[cfg(test)]
+    pub unsafe fn dxc_memory_budget_create(
+        budget: u64,
+        memory_budget: *mut *mut DxcShimMemoryBudget,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_memory_budget_destroy(memory_budget: *mut DxcShimMemoryBudget);
+    #[cfg(test)]
+    pub unsafe fn dxc_memory_budget_acquire(memory_budget: *mut DxcShimMemoryBudget, size: u64);
+    #[cfg(test)]
+    pub unsafe fn dxc_memory_budget_release(memory_budget: *mut DxcShimMemoryBudget, size: u64);
+    #[cfg(test)]
+    pub unsafe fn dxc_memory_budget_get_max_in_flight(
+        memory_budget: *mut DxcShimMemoryBudget,
+        sizes: *const u64,
+        count: usize,
+    ) -> usize;
+    #[cfg(test)]
+    pub unsafe fn dxc_tcp_cache_backend_create(
+        host: *const std::ffi::c_char,
+        port: u16,
+        timeout_milliseconds: u32,
+        retry_delay_milliseconds: u32,
+        backend: *mut *mut DxcShimTcpCacheBackend,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_tcp_cache_backend_destroy(backend: *mut DxcShimTcpCacheBackend);
+    #[cfg(test)]
+    pub unsafe fn dxc_tcp_cache_backend_lookup(
+        backend: *mut DxcShimTcpCacheBackend,
+        keys: *const DxcShimHash,
+        count: usize,
+        entries: *mut DxcShimRemoteCacheEntry,
+    );
+    #[cfg(test)]
+    pub unsafe fn dxc_tcp_cache_backend_store(
+        backend: *mut DxcShimTcpCacheBackend,
+        key: *const DxcShimHash,
+        data: *const std::ffi::c_void,
+        size: usize,
+    );
 }
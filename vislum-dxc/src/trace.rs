@@ -0,0 +1,313 @@
+use std::{
+    ffi::{CStr, CString},
+    mem::MaybeUninit,
+    os::unix::ffi::OsStrExt,
+    path::Path,
+    sync::{Arc, Mutex},
+};
+
+use crate::sys;
+
+#[derive(thiserror::Error, Debug)]
+pub enum DxcTraceError {
+    #[error("invalid trace path")]
+    InvalidPath,
+    #[error("failed to create trace file")]
+    OpenError,
+}
+
+/// The static description of a zone traced by the shim, one per place it is traced from.
+#[derive(Clone, Copy)]
+pub struct DxcTraceLocation(&'static sys::DxcShimTraceLocation);
+
+// SAFETY: Locations are immutable and live as long as the process.
+unsafe impl Send for DxcTraceLocation {}
+unsafe impl Sync for DxcTraceLocation {}
+
+impl DxcTraceLocation {
+    /// Returns the name of the zone, such as `"dxc compile"`.
+    pub fn name(&self) -> &'static str {
+        unsafe { static_str(self.0.name) }
+    }
+
+    /// Returns the name of the shim function the zone is traced in.
+    pub fn function(&self) -> &'static str {
+        unsafe { static_str(self.0.function) }
+    }
+
+    /// Returns the shim source file the zone is traced in.
+    pub fn file(&self) -> &'static str {
+        unsafe { static_str(self.0.file) }
+    }
+
+    pub fn line(&self) -> u32 {
+        self.0.line
+    }
+
+    /// Returns the location as a `___tracy_source_location_data`, which it is laid out as, to
+    /// begin a Tracy zone with `___tracy_emit_zone_begin`.
+    pub fn as_tracy_source_location(&self) -> *const std::ffi::c_void {
+        self.0 as *const sys::DxcShimTraceLocation as *const std::ffi::c_void
+    }
+}
+
+/// Converts a string of a location, which are static and ASCII.
+unsafe fn static_str(ptr: *const std::ffi::c_char) -> &'static str {
+    unsafe { CStr::from_ptr(ptr) }.to_str().unwrap_or("")
+}
+
+/// Receives the zones traced by a [`DxcTraceSink`], such as to forward them to a profiler.
+pub trait DxcTraceCallbacks: Send + Sync {
+    /// Called when a zone begins. Returns a context passed to [`DxcTraceCallbacks::end`], such
+    /// as the bits of a `TracyCZoneCtx`.
+    fn begin(&self, location: DxcTraceLocation) -> u64;
+
+    /// Called when a zone ends, on the thread it began on.
+    fn end(&self, location: DxcTraceLocation, context: u64);
+}
+
+/// A sink for the zones the shim traces around loading DXC, creating compilers, compiling,
+/// resolving includes, cache accesses and copying results out, to see where compilations spend
+/// their time on a timeline.
+///
+/// Tracing is enabled by setting a sink with [`set_trace_sink`]. While no sink is set, tracing
+/// costs a single load per zone.
+pub struct DxcTraceSink {
+    inner: *mut sys::DxcShimTraceSink,
+    _callbacks: Option<Box<Box<dyn DxcTraceCallbacks>>>,
+}
+
+// SAFETY: The shim sinks synchronize their output, and callbacks are `Send + Sync`.
+unsafe impl Send for DxcTraceSink {}
+unsafe impl Sync for DxcTraceSink {}
+
+impl DxcTraceSink {
+    /// Creates a sink writing zones to a file in the Chrome trace event format, as read by
+    /// `chrome://tracing` and Perfetto. The file is completed once the sink is dropped.
+    pub fn chrome(path: impl AsRef<Path>) -> Result<Arc<Self>, DxcTraceError> {
+        let path = CString::new(path.as_ref().as_os_str().as_bytes())
+            .map_err(|_| DxcTraceError::InvalidPath)?;
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimTraceSink>::uninit();
+        let status =
+            unsafe { sys::dxc_trace_chrome_sink_create(path.as_ptr(), inner.as_mut_ptr()) };
+
+        match status {
+            sys::DxcShimStatus::Ok => {
+                let inner = unsafe { inner.assume_init() };
+                Ok(Arc::new(Self {
+                    inner,
+                    _callbacks: None,
+                }))
+            }
+            sys::DxcShimStatus::TraceOpenError => Err(DxcTraceError::OpenError),
+            _ => unreachable!(),
+        }
+    }
+
+    /// Creates a sink forwarding zones to the given callbacks.
+    pub fn new(callbacks: impl DxcTraceCallbacks + 'static) -> Arc<Self> {
+        let callbacks: Box<Box<dyn DxcTraceCallbacks>> = Box::new(Box::new(callbacks));
+
+        let raw_callbacks = sys::DxcShimTraceCallbacks {
+            begin: Some(dxc_trace_begin_trampoline),
+            end: Some(dxc_trace_end_trampoline),
+            user_data: &*callbacks as *const Box<dyn DxcTraceCallbacks> as *mut std::ffi::c_void,
+        };
+
+        let mut inner = MaybeUninit::<*mut sys::DxcShimTraceSink>::uninit();
+        unsafe { sys::dxc_trace_callback_sink_create(&raw_callbacks, inner.as_mut_ptr()) };
+
+        let inner = unsafe { inner.assume_init() };
+        Arc::new(Self {
+            inner,
+            _callbacks: Some(callbacks),
+        })
+    }
+
+    /// Writes out the zones buffered by the sink.
+    pub fn flush(&self) {
+        unsafe { sys::dxc_trace_sink_flush(self.inner) };
+    }
+}
+
+impl Drop for DxcTraceSink {
+    fn drop(&mut self) {
+        unsafe { sys::dxc_trace_sink_destroy(self.inner) };
+    }
+}
+
+unsafe extern "C" fn dxc_trace_begin_trampoline(
+    user_data: *mut std::ffi::c_void,
+    location: *const sys::DxcShimTraceLocation,
+) -> u64 {
+    let callbacks = unsafe { &*(user_data as *const Box<dyn DxcTraceCallbacks>) };
+    callbacks.begin(DxcTraceLocation(unsafe { &*location }))
+}
+
+unsafe extern "C" fn dxc_trace_end_trampoline(
+    user_data: *mut std::ffi::c_void,
+    location: *const sys::DxcShimTraceLocation,
+    context: u64,
+) {
+    let callbacks = unsafe { &*(user_data as *const Box<dyn DxcTraceCallbacks>) };
+    callbacks.end(DxcTraceLocation(unsafe { &*location }), context);
+}
+
+/// The sink set for the process, kept alive while the shim refers to it.
+static TRACE_SINK: Mutex<Option<Arc<DxcTraceSink>>> = Mutex::new(None);
+
+/// Sets the sink the zones of the process are traced to. `None` disables tracing.
+///
+/// Returns once no zone is traced by the previous sink anymore, so it must not be called from
+/// [`DxcTraceCallbacks`]. Zones traced by the new sink do not delay it.
+pub fn set_trace_sink(sink: Option<Arc<DxcTraceSink>>) {
+    let mut current = TRACE_SINK.lock().unwrap_or_else(|error| error.into_inner());
+
+    let raw_sink = sink
+        .as_ref()
+        .map_or(std::ptr::null_mut(), |sink| sink.inner);
+    unsafe { sys::dxc_trace_set_sink(raw_sink) };
+
+    // The previous sink is only dropped once the shim no longer refers to it.
+    *current = sink;
+}
+
+/// Returns the sink the zones of the process are traced to.
+pub fn trace_sink() -> Option<Arc<DxcTraceSink>> {
+    TRACE_SINK
+        .lock()
+        .unwrap_or_else(|error| error.into_inner())
+        .clone()
+}
+
+#[cfg(test)]
+mod tests {
+    use std::{
+        cell::Cell,
+        sync::{
+            Condvar,
+            atomic::{AtomicBool, Ordering},
+            mpsc,
+        },
+        time::Duration,
+    };
+
+    use super::*;
+    use crate::DxcCache;
+
+    thread_local! {
+        /// Which gate the zones of the thread are held at, so zones of other tests pass.
+        static ROLE: Cell<u32> = const { Cell::new(0) };
+    }
+
+    /// Holds the first zone a thread of a role begins until released.
+    struct Gate {
+        role: u32,
+        is_entered: AtomicBool,
+        is_released: Mutex<bool>,
+        condvar: Condvar,
+    }
+
+    impl Gate {
+        fn new(role: u32) -> Arc<Self> {
+            Arc::new(Self {
+                role,
+                is_entered: AtomicBool::new(false),
+                is_released: Mutex::new(false),
+                condvar: Condvar::new(),
+            })
+        }
+
+        fn wait_entered(&self) {
+            while !self.is_entered.load(Ordering::SeqCst) {
+                std::thread::sleep(Duration::from_millis(1));
+            }
+        }
+
+        fn release(&self) {
+            *self.is_released.lock().unwrap() = true;
+            self.condvar.notify_all();
+        }
+    }
+
+    struct GateCallbacks(Arc<Gate>);
+
+    impl DxcTraceCallbacks for GateCallbacks {
+        fn begin(&self, _location: DxcTraceLocation) -> u64 {
+            let gate = &self.0;
+            if ROLE.get() == gate.role && !gate.is_entered.swap(true, Ordering::SeqCst) {
+                let mut is_released = gate.is_released.lock().unwrap();
+                while !*is_released {
+                    is_released = gate.condvar.wait(is_released).unwrap();
+                }
+            }
+            0
+        }
+
+        fn end(&self, _location: DxcTraceLocation, _context: u64) {}
+    }
+
+    /// Traces a zone by storing to a cache.
+    fn trace_zone(cache: &DxcCache) {
+        let key = sys::DxcShimHash { high: 1, low: 2 };
+        unsafe { sys::dxc_cache_store(cache.inner, &key, b"zone".as_ptr() as *const _, 4) };
+    }
+
+    #[test]
+    fn test_set_sink_ignores_zones_of_new_sink() {
+        let directory =
+            std::env::temp_dir().join(format!("vislum-dxc-trace-test-{}", std::process::id()));
+        let cache = DxcCache::open(&directory).unwrap();
+
+        let previous_gate = Gate::new(1);
+        let next_gate = Gate::new(2);
+        set_trace_sink(Some(DxcTraceSink::new(GateCallbacks(
+            previous_gate.clone(),
+        ))));
+
+        // A zone of the previous sink, which replacing it waits for.
+        let previous_zone = std::thread::spawn({
+            let cache = cache.clone();
+            move || {
+                ROLE.set(1);
+                trace_zone(&cache);
+            }
+        });
+        previous_gate.wait_entered();
+
+        let (done_sender, done_receiver) = mpsc::channel();
+        let setter = std::thread::spawn({
+            let sink = DxcTraceSink::new(GateCallbacks(next_gate.clone()));
+            move || {
+                set_trace_sink(Some(sink));
+                done_sender.send(()).unwrap();
+            }
+        });
+
+        // A zone of the next sink, held while the sink is replaced.
+        let next_zone = std::thread::spawn({
+            let cache = cache.clone();
+            let next_gate = next_gate.clone();
+            move || {
+                ROLE.set(2);
+                while !next_gate.is_entered.load(Ordering::SeqCst) {
+                    trace_zone(&cache);
+                }
+            }
+        });
+        next_gate.wait_entered();
+        assert!(done_receiver.try_recv().is_err());
+
+        previous_gate.release();
+        assert!(done_receiver.recv_timeout(Duration::from_secs(10)).is_ok());
+
+        next_gate.release();
+        previous_zone.join().unwrap();
+        setter.join().unwrap();
+        next_zone.join().unwrap();
+
+        set_trace_sink(None);
+        let _ = std::fs::remove_dir_all(directory);
+    }
+}